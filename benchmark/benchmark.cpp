@@ -0,0 +1,388 @@
+/* Copyright (c) 2014-2018, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+//--------------------------------------------------------------------------------------------------
+// Benchmark suite: runs the samples in headless mode on fixed workloads, and compares their
+// reports to a baseline
+//
+// Usage: vk_benchmark_KHR [-baseline file.json] [-update] [-frames n] [-config name]
+// - Each configuration is a run of a sample with `-headless -report <file>`, see
+//   ray_tracing__advance/headless.hpp for the content of the report. The other samples render in
+//   a hidden window, see common/benchmark_run.hpp.
+// - A metric fails when it is worse than the baseline by more than its tolerance
+// - With -update, the baseline is replaced by the results, keeping its tolerances
+// - The exit code is 1 when a configuration failed, 0 otherwise
+//
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+//--------------------------------------------------------------------------------------------------
+// Workloads
+//
+
+// Sample executables, set by CMakeLists.txt
+struct Sample
+{
+  const char* name;
+  const char* exe;
+};
+static const Sample kSamples[] = {
+    {"advance", RAY_TRACING__ADVANCE_EXE},
+    {"simple", RAY_TRACING__SIMPLE_EXE},
+    {"animation", RAY_TRACING_ANIMATION_EXE},
+    {"anyhit", RAY_TRACING_ANYHIT_EXE},
+    {"callable", RAY_TRACING_CALLABLE_EXE},
+    {"instances", RAY_TRACING_INSTANCES_EXE},
+    {"intersection", RAY_TRACING_INTERSECTION_EXE},
+    {"jitter_cam", RAY_TRACING_JITTER_CAM_EXE},
+    {"manyhits", RAY_TRACING_MANYHITS_EXE},
+    {"rayquery", RAY_TRACING_RAYQUERY_EXE},
+    {"reflections", RAY_TRACING_REFLECTIONS_EXE},
+};
+
+// The advance sample combines the features of the tutorials: reflections, implicit spheres and
+// cubes through an intersection shader, transparency through any-hit shaders, lights in
+// callable shaders, and accumulation with a jittered camera. The tutorials run with their default
+// settings, they do not have the AS cache nor the workload options of the advance sample.
+struct Config
+{
+  const char* name;
+  const char* sample;
+  const char* args;
+};
+static const Config kConfigs[] = {
+    {"advance", "advance", ""},
+    {"advance_spp8", "advance", "-samples 8"},
+    {"advance_orbit", "advance", "-camera \"" PROJECT_ABSDIRECTORY "orbit.txt\""},
+    {"advance_packed", "advance", "-packedVertices"},
+    {"advance_rgba16f", "advance", "-color rgba16f"},
+    {"advance_pool", "advance", "-geometryPool"},
+    {"simple", "simple", ""},
+    {"animation", "animation", ""},
+    {"anyhit", "anyhit", ""},
+    {"callable", "callable", ""},
+    {"instances", "instances", ""},
+    {"intersection", "intersection", ""},
+    {"jitter_cam", "jitter_cam", ""},
+    {"manyhits", "manyhits", ""},
+    {"rayquery", "rayquery", ""},
+    {"reflections", "reflections", ""},
+};
+
+// Metrics of the reports which are compared to the baseline
+struct Metric
+{
+  const char* key;
+  bool        higherIsBetter;
+  double      tolerance;  // Relative, unless set in the baseline
+};
+static const Metric kMetrics[] = {
+    {"raysPerSec", true, 0.05},   {"gpuFrameMs", false, 0.05}, {"frameMs", false, 0.15},
+    {"asBuildMs", false, 0.25},   {"asMemoryMB", false, 0.01},
+};
+
+//--------------------------------------------------------------------------------------------------
+// JSON subset used by the reports and the baseline: objects, strings and numbers
+//
+struct Json
+{
+  double                                    number{0};
+  std::string                               string;
+  std::vector<std::pair<std::string, Json>> members;
+
+  const Json* find(const std::string& key) const
+  {
+    for(const auto& m : members)
+      if(m.first == key)
+        return &m.second;
+    return nullptr;
+  }
+  double get(const std::string& key, double fallback) const
+  {
+    const Json* value = find(key);
+    return value ? value->number : fallback;
+  }
+};
+
+class JsonParser
+{
+public:
+  explicit JsonParser(const std::string& text)
+      : m_text(text)
+  {
+  }
+
+  bool parse(Json& value)
+  {
+    return parseValue(value) && (skipSpaces(), m_pos == m_text.size());
+  }
+
+private:
+  void skipSpaces()
+  {
+    while(m_pos < m_text.size() && isspace(static_cast<unsigned char>(m_text[m_pos])))
+      m_pos++;
+  }
+  bool accept(char c)
+  {
+    skipSpaces();
+    if(m_pos < m_text.size() && m_text[m_pos] == c)
+    {
+      m_pos++;
+      return true;
+    }
+    return false;
+  }
+
+  bool parseString(std::string& str)
+  {
+    if(!accept('"'))
+      return false;
+    while(m_pos < m_text.size() && m_text[m_pos] != '"')
+    {
+      if(m_text[m_pos] == '\\' && m_pos + 1 < m_text.size())
+        m_pos++;
+      str += m_text[m_pos++];
+    }
+    return accept('"');
+  }
+
+  bool parseValue(Json& value)
+  {
+    skipSpaces();
+    if(m_pos >= m_text.size())
+      return false;
+    if(m_text[m_pos] == '"')
+      return parseString(value.string);
+    if(accept('{'))
+    {
+      if(accept('}'))
+        return true;
+      do
+      {
+        std::pair<std::string, Json> member;
+        if(!parseString(member.first) || !accept(':') || !parseValue(member.second))
+          return false;
+        value.members.push_back(member);
+      } while(accept(','));
+      return accept('}');
+    }
+    const char* begin = m_text.c_str() + m_pos;
+    char*       end   = nullptr;
+    value.number      = strtod(begin, &end);
+    m_pos += end - begin;
+    return end != begin;
+  }
+
+  const std::string& m_text;
+  size_t             m_pos{0};
+};
+
+static bool loadJson(const std::string& filename, Json& json)
+{
+  std::ifstream file(filename);
+  if(!file)
+    return false;
+  std::stringstream text;
+  text << file.rdbuf();
+  return JsonParser(text.str()).parse(json);
+}
+
+//--------------------------------------------------------------------------------------------------
+// Results of a configuration, the metrics being in the order of kMetrics
+//
+struct Result
+{
+  std::string         name;
+  bool                ran{false};
+  std::vector<double> metrics;
+};
+
+static Result runConfig(const Config& config, int nbFrames)
+{
+  Result result;
+  result.name = config.name;
+
+  const char* exe = nullptr;
+  for(const auto& s : kSamples)
+    if(strcmp(s.name, config.sample) == 0)
+      exe = s.exe;
+
+  std::string reportFile = std::string("benchmark_") + config.name + ".json";
+  std::remove(reportFile.c_str());
+  std::stringstream cmd;
+  // The BLAS are always built, asBuildMs would otherwise measure the loading of the BLAS cache
+  cmd << "\"" << exe << "\" -headless -noAsCache -width 1280 -height 720 -frames " << nbFrames
+      << " " << config.args << " -report " << reportFile;
+  printf("Running %s: %s\n", config.name, cmd.str().c_str());
+  fflush(stdout);
+#ifdef WIN32
+  // cmd.exe removes the first and the last quotes of the command
+  int exitCode = std::system(("\"" + cmd.str() + "\"").c_str());
+#else
+  int exitCode = std::system(cmd.str().c_str());
+#endif
+
+  Json report;
+  if(exitCode != 0 || !loadJson(reportFile, report))
+  {
+    printf("  %s did not complete (exit code %d)\n", config.name, exitCode);
+    return result;
+  }
+  result.ran = true;
+  for(const auto& m : kMetrics)
+    result.metrics.push_back(report.get(m.key, 0.0));
+  if(const Json* device = report.find("device"))
+    printf("  on %s\n", device->string.c_str());
+  return result;
+}
+
+// Counts the metrics worse than the baseline by more than their tolerance
+static int compare(const Result& result, const Json* baseline, const Json& tolerances)
+{
+  int failures = 0;
+  for(size_t i = 0; i < result.metrics.size(); i++)
+  {
+    const Metric& metric = kMetrics[i];
+    double        value  = result.metrics[i];
+    const Json*   ref    = baseline ? baseline->find(metric.key) : nullptr;
+    if(!ref)
+    {
+      printf("  %-12s %14.4g  (no baseline)\n", metric.key, value);
+      continue;
+    }
+    double tolerance = tolerances.get(metric.key, metric.tolerance);
+    double change    = ref->number != 0 ? (value - ref->number) / std::fabs(ref->number) : 0.0;
+    bool   failed    = metric.higherIsBetter ? change < -tolerance : change > tolerance;
+    printf("  %-12s %14.4g  baseline %14.4g  %+7.2f%%  %s\n", metric.key, value, ref->number,
+           change * 100.0, failed ? "FAIL" : "ok");
+    failures += failed ? 1 : 0;
+  }
+  return failures;
+}
+
+// The configurations which did not run keep their previous baseline
+static bool writeBaseline(const std::string&         filename,
+                          const std::vector<Result>& results,
+                          const Json&                baseline)
+{
+  const Json  none;
+  const Json* tolerances = baseline.find("tolerances");
+  const Json* configs    = baseline.find("configs");
+
+  std::map<std::string, std::vector<double>> values;
+  for(const auto& c : configs ? configs->members : none.members)
+    for(const auto& m : kMetrics)
+      values[c.first].push_back(c.second.get(m.key, 0.0));
+  for(const auto& r : results)
+    if(r.ran)
+      values[r.name] = r.metrics;
+
+  std::ofstream file(filename);
+  if(!file)
+    return false;
+  file << "{\n  \"tolerances\": {";
+  for(size_t i = 0; i < sizeof(kMetrics) / sizeof(kMetrics[0]); i++)
+    file << (i ? ", " : "") << "\"" << kMetrics[i].key
+         << "\": " << (tolerances ? *tolerances : none).get(kMetrics[i].key, kMetrics[i].tolerance);
+  file << "},\n  \"configs\": {\n";
+  bool first = true;
+  for(const auto& v : values)
+  {
+    file << (first ? "" : ",\n") << "    \"" << v.first << "\": {";
+    for(size_t i = 0; i < v.second.size(); i++)
+      file << (i ? ", " : "") << "\"" << kMetrics[i].key << "\": " << v.second[i];
+    file << "}";
+    first = false;
+  }
+  file << "\n  }\n}\n";
+  return file.good();
+}
+
+//--------------------------------------------------------------------------------------------------
+// Application Entry
+//
+int main(int argc, char** argv)
+{
+  std::string baselineFile = PROJECT_ABSDIRECTORY "baseline.json";
+  std::string only;
+  bool        update   = false;
+  int         nbFrames = 64;
+  for(int i = 1; i < argc; i++)
+  {
+    if(strcmp(argv[i], "-baseline") == 0 && i + 1 < argc)
+      baselineFile = argv[++i];
+    else if(strcmp(argv[i], "-update") == 0)
+      update = true;
+    else if(strcmp(argv[i], "-frames") == 0 && i + 1 < argc)
+      nbFrames = std::max(atoi(argv[++i]), 1);
+    else if(strcmp(argv[i], "-config") == 0 && i + 1 < argc)
+      only = argv[++i];
+  }
+
+  Json baseline;
+  if(!loadJson(baselineFile, baseline))
+    printf("No baseline in %s, the results are not compared\n", baselineFile.c_str());
+  Json        noTolerances;
+  const Json* tolerances = baseline.find("tolerances");
+  const Json* configs    = baseline.find("configs");
+
+  std::vector<Result> results;
+  int                 nbFailed = 0;
+  for(const auto& config : kConfigs)
+  {
+    if(!only.empty() && only != config.name)
+      continue;
+    Result result = runConfig(config, nbFrames);
+    int    failed = result.ran ? 0 : 1;
+    if(result.ran)
+      failed = compare(result, configs ? configs->find(config.name) : nullptr,
+                       tolerances ? *tolerances : noTolerances);
+    nbFailed += failed > 0 ? 1 : 0;
+    results.push_back(result);
+  }
+
+  printf("%d of %d configurations failed\n", nbFailed, int(results.size()));
+  if(update)
+  {
+    if(writeBaseline(baselineFile, results, baseline))
+      printf("Baseline written to %s\n", baselineFile.c_str());
+    else
+      printf("Cannot write the baseline %s\n", baselineFile.c_str());
+  }
+  return nbFailed ? 1 : 0;
+}
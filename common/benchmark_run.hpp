@@ -0,0 +1,138 @@
+/******************************************************************************
+ * Copyright 1998-2018 NVIDIA Corp. All Rights Reserved.
+ *****************************************************************************/
+
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "gpu_profiler.hpp"
+#include "memory_stats.hpp"
+#include "nvh/nvprint.hpp"
+
+//--------------------------------------------------------------------------------------------------
+// Benchmark runs of the samples rendering in a window, for the suite of benchmark/
+//
+// - With -headless, the window is hidden and the application exits after -frames frames
+// - -width and -height set the size of the window
+// - -report writes the summary read by the suite, with the keys of the report of
+//   ray_tracing__advance (see its headless.hpp). The metrics a sample does not measure, such as
+//   asBuildMs, are left out: the suite reads them as 0.
+// The other arguments of the suite, meant for ray_tracing__advance, are ignored.
+//
+// Usage:
+//   BenchmarkRun bench(argc, argv, SAMPLE_WIDTH, SAMPLE_HEIGHT);
+//   if(bench.headless())
+//     glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+//   ...
+//   while(!glfwWindowShouldClose(window) && !bench.done())
+//   {
+//     profiler.beginFrame();
+//     ...  // The ray tracing pass in a "Ray trace" section
+//     bench.endFrame();
+//   }
+//   device.waitIdle();
+//   int exitCode = bench.finish(physicalDevice, profiler);
+//
+class BenchmarkRun
+{
+public:
+  BenchmarkRun(int argc, char** argv, int width, int height)
+      : m_width(width)
+      , m_height(height)
+  {
+    for(int i = 1; i < argc; i++)
+    {
+      if(strcmp(argv[i], "-headless") == 0)
+        m_headless = true;
+      else if(strcmp(argv[i], "-width") == 0 && i + 1 < argc)
+        m_width = std::max(atoi(argv[++i]), 1);
+      else if(strcmp(argv[i], "-height") == 0 && i + 1 < argc)
+        m_height = std::max(atoi(argv[++i]), 1);
+      else if(strcmp(argv[i], "-frames") == 0 && i + 1 < argc)
+        m_nbFrames = std::max(atoi(argv[++i]), 1);
+      else if(strcmp(argv[i], "-report") == 0 && i + 1 < argc)
+        m_reportFile = argv[++i];
+    }
+  }
+
+  bool headless() const { return m_headless; }
+  int  width() const { return m_width; }
+  int  height() const { return m_height; }
+
+  // Headless runs stop after their frames, the others when the window is closed
+  bool done() const { return m_headless && m_frame >= m_nbFrames; }
+
+  // After the submission of a frame. The wall time is measured from the end of the first frame,
+  // which includes the creation of the pipelines by the driver.
+  void endFrame()
+  {
+    if(m_frame++ == 0)
+      m_start = std::chrono::steady_clock::now();
+  }
+
+  // Writing the report once the GPU is idle, returns the exit code of the application
+  int finish(const vk::PhysicalDevice& physicalDevice, GpuProfiler& profiler)
+  {
+    if(m_reportFile.empty())
+      return 0;
+    profiler.flush();
+
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - m_start;
+    double frameMs    = m_frame > 1 ? elapsed.count() / double(m_frame - 1) : 0.0;
+    double gpuFrameMs = 0.0;
+    double raysPerSec = 0.0;
+    for(const auto& s : profiler.stats())
+    {
+      gpuFrameMs += s.avgMs;
+      if(s.name == "Ray trace" && s.avgMs > 0)
+        raysPerSec = double(m_width) * double(m_height) / (s.avgMs * 1e-3);
+    }
+    double asMemoryMB = double(MemoryStats::shared().current(MemoryCategory::eBlas)
+                               + MemoryStats::shared().current(MemoryCategory::eTlas))
+                        / (1024.0 * 1024.0);
+
+    std::ofstream file(m_reportFile);
+    file << "{\n";
+    file << "  \"device\": \"" << physicalDevice.getProperties().deviceName << "\",\n";
+    file << "  \"width\": " << m_width << ",\n";
+    file << "  \"height\": " << m_height << ",\n";
+    file << "  \"frames\": " << m_frame << ",\n";
+    file << "  \"frameMs\": " << frameMs << ",\n";
+    file << "  \"gpuFrameMs\": " << gpuFrameMs << ",\n";
+    file << "  \"raysPerSec\": " << raysPerSec << ",\n";
+    file << "  \"asMemoryMB\": " << asMemoryMB << ",\n";
+    file << "  \"passes\": {";
+    const std::vector<GpuProfiler::Stats>& passes = profiler.stats();
+    for(size_t i = 0; i < passes.size(); i++)
+      file << (i ? ", " : "") << "\"" << passes[i].name << "\": " << passes[i].avgMs;
+    file << "}\n";
+    file << "}\n";
+    if(!file.good())
+    {
+      LOGE("Benchmark: cannot write %s\n", m_reportFile.c_str());
+      return 1;
+    }
+    LOGI("Benchmark: %d frames of %dx%d, %.3f ms per frame, GPU time %.3f ms per frame\n", m_frame,
+         m_width, m_height, frameMs, gpuFrameMs);
+    return 0;
+  }
+
+private:
+  bool        m_headless{false};
+  int         m_width{0};
+  int         m_height{0};
+  int         m_nbFrames{100};
+  int         m_frame{0};
+  std::string m_reportFile;
+
+  std::chrono::steady_clock::time_point m_start;
+};
@@ -0,0 +1,286 @@
+/******************************************************************************
+ * Copyright 1998-2018 NVIDIA Corp. All Rights Reserved.
+ *****************************************************************************/
+
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+
+#include <algorithm>
+#include <deque>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "nvh/nvprint.hpp"
+
+//--------------------------------------------------------------------------------------------------
+// GPU time of the passes of each frame, measured with timestamp queries
+//
+// Each frame uses its own range of the query pool. The ranges are reset from the host, so the
+// sections can be recorded in any command buffer of the frame, on any queue, and in any order.
+// This requires the hostQueryReset feature of Vulkan 1.2, enabled by the context when supported:
+// without it, profiling is disabled.
+// A range is read back when it is reused, framesInFlight + 1 frames later: the GPU is then done
+// with it and the results never stall.
+//
+// Usage, once per frame after the previous frame was submitted:
+//   profiler.beginFrame();
+//   {
+//     GpuProfiler::Section section(profiler, cmdBuf, "Ray trace");
+//     ...
+//   }
+//
+// stats() gives the last, minimum, average and maximum time of each section over the last
+// kHistory frames, which exportCsv() and exportChromeTrace() write to a file.
+//
+class GpuProfiler
+{
+public:
+  static const uint32_t kHistory = 256;  // Frames kept for the statistics and the exports
+
+  struct Stats
+  {
+    std::string name;
+    double      lastMs{0};
+    double      minMs{0};
+    double      avgMs{0};
+    double      maxMs{0};
+  };
+
+  // Scoped section: its time is from construction to destruction in the command buffer
+  class Section
+  {
+  public:
+    Section(GpuProfiler& profiler, const vk::CommandBuffer& cmdBuf, const std::string& name)
+        : m_profiler(profiler)
+        , m_cmdBuf(cmdBuf)
+        , m_section(profiler.cmdBegin(cmdBuf, name))
+    {
+    }
+    ~Section() { m_profiler.cmdEnd(m_cmdBuf, m_section); }
+
+  private:
+    GpuProfiler&      m_profiler;
+    vk::CommandBuffer m_cmdBuf;
+    uint32_t          m_section;
+  };
+
+  void setup(const vk::Device&         device,
+             const vk::PhysicalDevice& physicalDevice,
+             uint32_t                  framesInFlight)
+  {
+    auto limits = physicalDevice.getProperties().limits;
+    m_device    = device;
+    m_msPerTick = limits.timestampPeriod * 1e-6;
+    if(!limits.timestampComputeAndGraphics)
+    {
+      LOGW("GpuProfiler: timestamps are not supported on all queues, profiling is disabled\n");
+      return;
+    }
+    auto features = physicalDevice.getFeatures2<vk::PhysicalDeviceFeatures2,
+                                                vk::PhysicalDeviceVulkan12Features>();
+    if(!features.get<vk::PhysicalDeviceVulkan12Features>().hostQueryReset)
+    {
+      LOGW("GpuProfiler: host query reset is not supported, profiling is disabled\n");
+      return;
+    }
+
+    m_slots.resize(framesInFlight + 1);
+    uint32_t nbQueries = kMaxSections * 2 * static_cast<uint32_t>(m_slots.size());
+    m_queryPool = m_device.createQueryPool({{}, vk::QueryType::eTimestamp, nbQueries});
+    m_device.resetQueryPool(m_queryPool, 0, nbQueries);
+  }
+
+  void destroy()
+  {
+    m_device.destroy(m_queryPool);
+    m_queryPool = vk::QueryPool();
+    m_slots.clear();
+    m_series.clear();
+    m_events.clear();
+    m_stats.clear();
+  }
+
+  // Collecting the results of the frame that used the next range, and resetting it
+  void beginFrame()
+  {
+    if(!m_queryPool)
+      return;
+    m_frame++;
+    m_current = m_frame % m_slots.size();
+
+    readSlot(m_current, {});
+    m_slots[m_current].frame = m_frame;
+  }
+
+  // Collecting the frames not read yet, oldest first, once the GPU is done with them
+  void flush()
+  {
+    if(!m_queryPool)
+      return;
+    for(size_t i = 1; i <= m_slots.size(); i++)
+      readSlot((m_current + i) % m_slots.size(), vk::QueryResultFlagBits::eWait);
+  }
+
+  // Returns the section to pass to cmdEnd()
+  uint32_t cmdBegin(const vk::CommandBuffer& cmdBuf, const std::string& name)
+  {
+    if(!m_queryPool || m_slots[m_current].names.size() >= kMaxSections)
+      return kInvalid;
+    Slot&    slot    = m_slots[m_current];
+    uint32_t section = static_cast<uint32_t>(slot.names.size());
+    slot.names.push_back(name);
+    cmdBuf.writeTimestamp(vk::PipelineStageFlagBits::eTopOfPipe, m_queryPool,
+                          firstQuery(m_current) + 2 * section);
+    return section;
+  }
+
+  void cmdEnd(const vk::CommandBuffer& cmdBuf, uint32_t section)
+  {
+    if(section == kInvalid)
+      return;
+    cmdBuf.writeTimestamp(vk::PipelineStageFlagBits::eBottomOfPipe, m_queryPool,
+                          firstQuery(m_current) + 2 * section + 1);
+  }
+
+  const std::vector<Stats>& stats() const { return m_stats; }
+
+  // One line per section and frame: frame, section, start and duration in milliseconds
+  bool exportCsv(const std::string& filename) const
+  {
+    std::ofstream file(filename);
+    if(!file)
+      return false;
+    file << "frame,section,start_ms,duration_ms\n";
+    for(const auto& e : m_events)
+      file << e.frame << "," << e.name << "," << e.startMs << "," << e.durationMs << "\n";
+    LOGI("GpuProfiler: %d timings written to %s\n", int(m_events.size()), filename.c_str());
+    return true;
+  }
+
+  // Trace Event Format, for chrome://tracing or Perfetto
+  bool exportChromeTrace(const std::string& filename) const
+  {
+    std::ofstream file(filename);
+    if(!file)
+      return false;
+    file << "{\"traceEvents\":[\n";
+    for(size_t i = 0; i < m_events.size(); i++)
+    {
+      const auto& e = m_events[i];
+      file << "{\"name\":\"" << e.name << "\",\"cat\":\"gpu\",\"ph\":\"X\",\"pid\":0,\"tid\":0"
+           << ",\"ts\":" << e.startMs * 1000.0 << ",\"dur\":" << e.durationMs * 1000.0
+           << ",\"args\":{\"frame\":" << e.frame << "}}"
+           << (i + 1 < m_events.size() ? ",\n" : "\n");
+    }
+    file << "],\"displayTimeUnit\":\"ms\"}\n";
+    LOGI("GpuProfiler: %d timings written to %s\n", int(m_events.size()), filename.c_str());
+    return true;
+  }
+
+private:
+  static const uint32_t kMaxSections = 32;  // Per frame
+  static const uint32_t kInvalid     = ~0u;
+
+  // Sections recorded by a frame in its range of queries
+  struct Slot
+  {
+    uint64_t                 frame{0};
+    std::vector<std::string> names;
+  };
+
+  // Durations of a section over the last frames
+  struct Series
+  {
+    std::string        name;
+    std::deque<double> durations;
+    uint64_t           lastFrame{0};
+  };
+
+  struct Event
+  {
+    uint64_t    frame;
+    std::string name;
+    double      startMs;  // From the first timestamp read
+    double      durationMs;
+  };
+
+  uint32_t firstQuery(size_t slot) const { return static_cast<uint32_t>(slot) * kMaxSections * 2; }
+
+  void readSlot(size_t index, vk::QueryResultFlags flags)
+  {
+    Slot& slot = m_slots[index];
+    if(slot.names.empty())
+      return;
+    uint32_t              nbQueries = static_cast<uint32_t>(slot.names.size()) * 2;
+    std::vector<uint64_t> ticks(nbQueries);
+    if(m_device.getQueryPoolResults<uint64_t>(m_queryPool, firstQuery(index), nbQueries, ticks,
+                                              sizeof(uint64_t),
+                                              vk::QueryResultFlagBits::e64 | flags)
+       == vk::Result::eSuccess)
+      collect(slot, ticks);
+    m_device.resetQueryPool(m_queryPool, firstQuery(index), nbQueries);
+    slot.names.clear();
+  }
+
+  void collect(const Slot& slot, const std::vector<uint64_t>& ticks)
+  {
+    if(m_originTicks == 0)
+      m_originTicks = *std::min_element(ticks.begin(), ticks.end());
+
+    for(size_t i = 0; i < slot.names.size(); i++)
+    {
+      uint64_t begin    = ticks[2 * i];
+      uint64_t end      = std::max(ticks[2 * i + 1], begin);
+      double   duration = (end - begin) * m_msPerTick;
+
+      auto it = std::find_if(m_series.begin(), m_series.end(),
+                             [&](const Series& s) { return s.name == slot.names[i]; });
+      if(it == m_series.end())
+        it = m_series.insert(m_series.end(), Series{slot.names[i], {}, 0});
+      // Sections recorded several times in a frame are added together
+      if(it->lastFrame == slot.frame && !it->durations.empty())
+        it->durations.back() += duration;
+      else
+        it->durations.push_back(duration);
+      it->lastFrame = slot.frame;
+      if(it->durations.size() > kHistory)
+        it->durations.pop_front();
+
+      double start = begin >= m_originTicks ? (begin - m_originTicks) * m_msPerTick : 0.0;
+      m_events.push_back({slot.frame, slot.names[i], start, duration});
+    }
+    while(!m_events.empty() && m_events.front().frame + kHistory <= slot.frame)
+      m_events.pop_front();
+
+    // Sections not recorded for a while are dropped
+    auto stale = [&](const Series& s) { return s.lastFrame + kHistory <= slot.frame; };
+    m_series.erase(std::remove_if(m_series.begin(), m_series.end(), stale), m_series.end());
+
+    m_stats.clear();
+    for(const auto& s : m_series)
+    {
+      Stats stats;
+      stats.name   = s.name;
+      stats.lastMs = s.durations.back();
+      stats.minMs  = *std::min_element(s.durations.begin(), s.durations.end());
+      stats.maxMs  = *std::max_element(s.durations.begin(), s.durations.end());
+      for(double d : s.durations)
+        stats.avgMs += d;
+      stats.avgMs /= double(s.durations.size());
+      m_stats.push_back(stats);
+    }
+  }
+
+  vk::Device          m_device;
+  vk::QueryPool       m_queryPool;
+  double              m_msPerTick{0};
+  uint64_t            m_frame{0};
+  size_t              m_current{0};
+  uint64_t            m_originTicks{0};
+  std::vector<Slot>   m_slots;
+  std::vector<Series> m_series;
+  std::deque<Event>   m_events;
+  std::vector<Stats>  m_stats;
+};
@@ -0,0 +1,47 @@
+/******************************************************************************
+ * Copyright 1998-2018 NVIDIA Corp. All Rights Reserved.
+ *****************************************************************************/
+
+#pragma once
+
+#include "gpu_profiler.hpp"
+#include "imgui.h"
+
+//--------------------------------------------------------------------------------------------------
+// ImGui panel of the GPU profiler: times of the last frame, and over the last kHistory frames
+//
+inline void renderGpuProfilerUI(const GpuProfiler& profiler)
+{
+  if(!ImGui::CollapsingHeader("GPU timings"))
+    return;
+
+  ImGui::Columns(5, "gpuTimings", false);
+  for(const char* title : {"Pass", "Last ms", "Avg", "Min", "Max"})
+  {
+    ImGui::Text("%s", title);
+    ImGui::NextColumn();
+  }
+  double total = 0;
+  for(const auto& s : profiler.stats())
+  {
+    ImGui::Text("%s", s.name.c_str());
+    ImGui::NextColumn();
+    ImGui::Text("%.3f", s.lastMs);
+    ImGui::NextColumn();
+    ImGui::Text("%.3f", s.avgMs);
+    ImGui::NextColumn();
+    ImGui::Text("%.3f", s.minMs);
+    ImGui::NextColumn();
+    ImGui::Text("%.3f", s.maxMs);
+    ImGui::NextColumn();
+    total += s.avgMs;
+  }
+  ImGui::Columns(1);
+  ImGui::Text("Sum of the averages: %.3f ms", total);
+
+  if(ImGui::Button("Export CSV"))
+    profiler.exportCsv("gpu_timings.csv");
+  ImGui::SameLine();
+  if(ImGui::Button("Export trace"))
+    profiler.exportChromeTrace("gpu_timings.json");
+}
@@ -0,0 +1,158 @@
+/******************************************************************************
+ * Copyright 1998-2018 NVIDIA Corp. All Rights Reserved.
+ *****************************************************************************/
+
+#pragma once
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+
+#include "nvmath/nvmath.h"
+#include "threadpool.hpp"
+
+//--------------------------------------------------------------------------------------------------
+// World and normal matrices of many instances, computed in blocks on the shared thread pool
+// - The matrices are affine: only their first 3 rows are kept, one array per element, so that the
+//   loops over the instances of a block are vectorized by the compiler
+// - The normal matrix is the inverse transpose of the 3x3 part, the cofactors divided by the
+//   determinant, instead of a 4x4 inversion. It has no translation, which the shaders ignore as
+//   they transform the normals with w = 0.
+// - The results of a block are written by the same job, directly in the mapped buffers: the
+//   matrices of the scene description and the row-major 3x4 transforms of the TLAS records
+//
+
+// Inverse transpose of the row-major 3x3 matrix `a`, in `n`
+inline void inverseTranspose3x3(const float a[9], float n[9])
+{
+  n[0]      = a[4] * a[8] - a[5] * a[7];
+  n[1]      = a[5] * a[6] - a[3] * a[8];
+  n[2]      = a[3] * a[7] - a[4] * a[6];
+  n[3]      = a[2] * a[7] - a[1] * a[8];
+  n[4]      = a[0] * a[8] - a[2] * a[6];
+  n[5]      = a[1] * a[6] - a[0] * a[7];
+  n[6]      = a[1] * a[5] - a[2] * a[4];
+  n[7]      = a[2] * a[3] - a[0] * a[5];
+  n[8]      = a[0] * a[4] - a[1] * a[3];
+  float det = a[0] * n[0] + a[1] * n[1] + a[2] * n[2];
+  float inv = det != 0.f ? 1.f / det : 0.f;
+  for(int k = 0; k < 9; k++)
+    n[k] *= inv;
+}
+
+// Normal matrix of a single affine transform, replacing transpose(invert(m))
+inline nvmath::mat4f instanceNormalMatrix(const nvmath::mat4f& m)
+{
+  float a[9], n[9];
+  for(int r = 0; r < 3; r++)
+    for(int c = 0; c < 3; c++)
+      a[r * 3 + c] = m(r, c);
+  inverseTranspose3x3(a, n);
+
+  nvmath::mat4f res(1);
+  for(int r = 0; r < 3; r++)
+    for(int c = 0; c < 3; c++)
+      res(r, c) = n[r * 3 + c];
+  return res;
+}
+
+class InstanceTransforms
+{
+public:
+  static const size_t kBlockSize = 256;  // Instances per job
+
+  void resize(size_t count)
+  {
+    m_count = count;
+    for(auto& e : m_world)
+      e.resize(count);
+    for(auto& e : m_normal)
+      e.resize(count);
+  }
+  size_t size() const { return m_count; }
+
+  // World matrix of instance i, to call from the `fill` function of compute()
+  void setWorld(size_t i, const nvmath::mat4f& world)
+  {
+    for(int r = 0; r < 3; r++)
+      for(int c = 0; c < 4; c++)
+        m_world[r * 4 + c][i] = world(r, c);
+  }
+
+  // All instances, in blocks of kBlockSize spread over ThreadPool::shared(). For each block,
+  // `fill(i)` sets the world matrix of each of its instances, then their normal matrices are
+  // computed and `write(begin, end)` stores the block with the write functions below.
+  template <typename Fill, typename Write>
+  void compute(Fill&& fill, Write&& write)
+  {
+    size_t nbBlocks = (m_count + kBlockSize - 1) / kBlockSize;
+    ThreadPool::shared().parallelFor(nbBlocks, [&](size_t block) {
+      size_t begin = block * kBlockSize;
+      size_t end   = std::min(begin + kBlockSize, m_count);
+      for(size_t i = begin; i < end; i++)
+        fill(i);
+      computeNormals(begin, end);
+      write(begin, end);
+    });
+  }
+
+  // World matrices of [begin, end) in the member `world` of dst[begin, end)
+  template <typename T>
+  void writeWorld(size_t begin, size_t end, T* dst, nvmath::mat4f T::*world) const
+  {
+    for(size_t i = begin; i < end; i++)
+    {
+      nvmath::mat4f& m = dst[i].*world;
+      for(int r = 0; r < 3; r++)
+        for(int c = 0; c < 4; c++)
+          m(r, c) = m_world[r * 4 + c][i];
+      m(3, 0) = m(3, 1) = m(3, 2) = 0.f;
+      m(3, 3) = 1.f;
+    }
+  }
+
+  // Normal matrices of [begin, end) in the member `normal` of dst[begin, end)
+  template <typename T>
+  void writeNormal(size_t begin, size_t end, T* dst, nvmath::mat4f T::*normal) const
+  {
+    for(size_t i = begin; i < end; i++)
+    {
+      nvmath::mat4f& m = dst[i].*normal;
+      m                = nvmath::mat4f(1);
+      for(int r = 0; r < 3; r++)
+        for(int c = 0; c < 3; c++)
+          m(r, c) = m_normal[r * 3 + c][i];
+    }
+  }
+
+  // Transforms of the TLAS records [begin, end), their other members are left as they are
+  void writeTlasTransforms(size_t                                begin,
+                           size_t                                end,
+                           vk::AccelerationStructureInstanceKHR* dst) const
+  {
+    for(size_t i = begin; i < end; i++)
+      for(int r = 0; r < 3; r++)
+        for(int c = 0; c < 4; c++)
+          dst[i].transform.matrix[r][c] = m_world[r * 4 + c][i];
+  }
+
+private:
+  void computeNormals(size_t begin, size_t end)
+  {
+    for(size_t i = begin; i < end; i++)
+    {
+      float a[9], n[9];
+      for(int r = 0; r < 3; r++)
+        for(int c = 0; c < 3; c++)
+          a[r * 3 + c] = m_world[r * 4 + c][i];
+      inverseTranspose3x3(a, n);
+      for(int k = 0; k < 9; k++)
+        m_normal[k][i] = n[k];
+    }
+  }
+
+  size_t                             m_count{0};
+  std::array<std::vector<float>, 12> m_world;   // Rows 0..2 of the world matrices
+  std::array<std::vector<float>, 9>  m_normal;  // 3x3 normal matrices, row-major
+};
@@ -0,0 +1,156 @@
+/******************************************************************************
+ * Copyright 1998-2018 NVIDIA Corp. All Rights Reserved.
+ *****************************************************************************/
+
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <vector>
+
+#include "nvh/nvprint.hpp"
+
+// What the memory is used for
+enum class MemoryCategory : uint32_t
+{
+  eVertex,
+  eIndex,
+  eBlas,
+  eTlas,
+  eScratch,
+  eTexture,
+  eSbt,
+  eStaging,
+  eCount
+};
+
+//--------------------------------------------------------------------------------------------------
+// Device memory used by the sample, per category
+//
+// The owners of the resources call add() when creating them and remove() with the same size when
+// destroying them, possibly from several threads. The peak of each category is kept, which is
+// what matters for transient memory such as scratch and staging buffers.
+//
+// After setup(), queryHeaps() returns the heaps and, with VK_EXT_memory_budget, their usage and
+// budget as seen by the driver: the difference with the tracked total is memory not attributed
+// to a category (render targets, uniform buffers, allocator blocks not fully used, ...).
+//
+class MemoryStats
+{
+public:
+  struct Heap
+  {
+    vk::DeviceSize size{0};
+    vk::DeviceSize budget{0};  // Size of the heap without VK_EXT_memory_budget
+    vk::DeviceSize usage{0};   // 0 without VK_EXT_memory_budget
+    bool           deviceLocal{false};
+  };
+
+  static MemoryStats& shared()
+  {
+    static MemoryStats stats;
+    return stats;
+  }
+
+  void add(MemoryCategory category, vk::DeviceSize size)
+  {
+    auto&          current = m_current[uint32_t(category)];
+    auto&          peak    = m_peak[uint32_t(category)];
+    vk::DeviceSize value   = current.fetch_add(size) + size;
+    vk::DeviceSize prev    = peak.load();
+    while(prev < value && !peak.compare_exchange_weak(prev, value))
+      ;
+  }
+  void remove(MemoryCategory category, vk::DeviceSize size)
+  {
+    m_current[uint32_t(category)].fetch_sub(size);
+  }
+
+  vk::DeviceSize current(MemoryCategory category) const
+  {
+    return m_current[uint32_t(category)].load();
+  }
+  vk::DeviceSize peak(MemoryCategory category) const { return m_peak[uint32_t(category)].load(); }
+  vk::DeviceSize total() const
+  {
+    vk::DeviceSize sum = 0;
+    for(const auto& c : m_current)
+      sum += c.load();
+    return sum;
+  }
+
+  static const char* name(MemoryCategory category)
+  {
+    static const char* names[] = {"Vertex", "Index",    "BLAS", "TLAS",
+                                  "Scratch", "Textures", "SBT",  "Staging"};
+    return names[uint32_t(category)];
+  }
+
+  // Memory backing the resources, as the allocators see it
+  static vk::DeviceSize sizeOf(const vk::Device& device, vk::Buffer buffer)
+  {
+    return buffer ? device.getBufferMemoryRequirements(buffer).size : 0;
+  }
+  static vk::DeviceSize sizeOf(const vk::Device& device, vk::Image image)
+  {
+    return image ? device.getImageMemoryRequirements(image).size : 0;
+  }
+
+  // Physical device of the heaps, the budget is only available with VK_EXT_memory_budget
+  void setup(const vk::PhysicalDevice& physicalDevice)
+  {
+    m_physicalDevice = physicalDevice;
+    m_hasBudget      = false;
+    for(const auto& e : physicalDevice.enumerateDeviceExtensionProperties())
+      if(strcmp(e.extensionName, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME) == 0)
+        m_hasBudget = true;
+  }
+  bool hasBudget() const { return m_hasBudget; }
+
+  std::vector<Heap> queryHeaps() const
+  {
+    if(!m_physicalDevice)
+      return {};
+    vk::PhysicalDeviceMemoryProperties2         props;
+    vk::PhysicalDeviceMemoryBudgetPropertiesEXT budgetProps;
+    if(m_hasBudget)
+      props.setPNext(&budgetProps);
+    m_physicalDevice.getMemoryProperties2(&props);
+
+    std::vector<Heap> heaps(props.memoryProperties.memoryHeapCount);
+    for(uint32_t i = 0; i < props.memoryProperties.memoryHeapCount; i++)
+    {
+      const auto& heap     = props.memoryProperties.memoryHeaps[i];
+      heaps[i].size        = heap.size;
+      heaps[i].deviceLocal = (heap.flags & vk::MemoryHeapFlagBits::eDeviceLocal) ? true : false;
+      heaps[i].budget      = m_hasBudget ? budgetProps.heapBudget[i] : heap.size;
+      heaps[i].usage       = m_hasBudget ? budgetProps.heapUsage[i] : 0;
+    }
+    return heaps;
+  }
+
+  void log() const
+  {
+    const double mb = 1.0 / (1024.0 * 1024.0);
+    LOGI("Memory per category (current / peak MB):\n");
+    for(uint32_t i = 0; i < uint32_t(MemoryCategory::eCount); i++)
+      LOGI("  %-8s %8.2f / %8.2f\n", name(MemoryCategory(i)), m_current[i].load() * mb,
+           m_peak[i].load() * mb);
+    auto heaps = queryHeaps();
+    for(size_t i = 0; i < heaps.size(); i++)
+      LOGI("  Heap %d%s: %.2f MB used, budget %.2f MB of %.2f MB\n", int(i),
+           heaps[i].deviceLocal ? " (device local)" : "", heaps[i].usage * mb,
+           heaps[i].budget * mb, heaps[i].size * mb);
+  }
+
+private:
+  static const uint32_t kCount = uint32_t(MemoryCategory::eCount);
+
+  vk::PhysicalDevice          m_physicalDevice;
+  bool                        m_hasBudget{false};
+  std::atomic<vk::DeviceSize> m_current[kCount]{};
+  std::atomic<vk::DeviceSize> m_peak[kCount]{};
+};
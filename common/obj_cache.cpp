@@ -0,0 +1,400 @@
+/******************************************************************************
+ * Copyright 1998-2018 NVIDIA Corp. All Rights Reserved.
+ *****************************************************************************/
+
+#include "obj_cache.h"
+#include "nvh/nvprint.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+const uint32_t kCacheMagic   = 0x424a424f;  // "OBJB"
+const uint32_t kCacheVersion = 2;
+const size_t   kAlignment    = 16;
+
+const uint32_t kFlagDeduplicated = 1;  // Vertices merged by ObjLoader::m_deduplicate
+const uint32_t kKnownFlags       = kFlagDeduplicated;
+
+// Header at the beginning of the cache file. All sections start at an offset
+// relative to the beginning of the file and are aligned to kAlignment.
+struct CacheHeader
+{
+  uint32_t magic;
+  uint32_t version;
+  uint32_t sizeofVertex;
+  uint32_t sizeofMaterial;
+  uint64_t objFileSize;
+  uint64_t objFileTime;
+  uint32_t flags;       // kFlagDeduplicated
+  uint32_t nbMtlFiles;  // After the texture names, see MtlStamp
+  uint32_t nbVertices;
+  uint32_t nbIndices;
+  uint32_t nbMaterials;
+  uint32_t nbMatIndx;
+  uint32_t nbTextures;
+  uint32_t pad;
+  uint64_t verticesOffset;
+  uint64_t indicesOffset;
+  uint64_t materialsOffset;
+  uint64_t matIndxOffset;
+  uint64_t texturesOffset;
+};
+
+inline uint64_t alignUp(uint64_t v)
+{
+  return (v + kAlignment - 1) & ~uint64_t(kAlignment - 1);
+}
+
+// Size and modification time of the OBJ, used to invalidate the cache
+bool objFileStamp(const std::string& filename, uint64_t& size, uint64_t& time)
+{
+#ifdef _WIN32
+  struct _stat64 st;
+  if(_stat64(filename.c_str(), &st) != 0)
+    return false;
+#else
+  struct stat st;
+  if(stat(filename.c_str(), &st) != 0)
+    return false;
+#endif
+  size = static_cast<uint64_t>(st.st_size);
+  time = static_cast<uint64_t>(st.st_mtime);
+  return true;
+}
+
+// Material library referenced by the OBJ, followed by its name
+struct MtlStamp
+{
+  uint64_t size;
+  uint64_t time;
+  uint32_t nameLength;
+};
+
+// Files of the `mtllib` statements, in the directory of the OBJ as tinyobj loads them
+std::vector<std::string> materialLibraries(const std::string& objFilename)
+{
+  std::vector<std::string> files;
+  std::ifstream            stream(objFilename);
+  size_t                   sep = objFilename.find_last_of("\\/");
+  std::string              dir = sep == std::string::npos ? "" : objFilename.substr(0, sep + 1);
+  std::string              line;
+  while(std::getline(stream, line))
+  {
+    std::istringstream words(line);
+    std::string        word;
+    if(!(words >> word) || word != "mtllib")
+      continue;
+    while(words >> word)
+      files.push_back(dir + word);
+  }
+  return files;
+}
+
+}  // namespace
+
+//--------------------------------------------------------------------------------------------------
+// `path/scene.obj` -> `path/scene.objbin`
+//
+std::string ObjCache::cacheFilename(const std::string& objFilename)
+{
+  size_t dot = objFilename.find_last_of('.');
+  size_t sep = objFilename.find_last_of("\\/");
+  if(dot == std::string::npos || (sep != std::string::npos && dot < sep))
+    return objFilename + ".objbin";
+  return objFilename.substr(0, dot) + ".objbin";
+}
+
+bool ObjCache::fileStamp(const std::string& filename, uint64_t& size, uint64_t& time)
+{
+  return objFileStamp(filename, size, time);
+}
+
+//--------------------------------------------------------------------------------------------------
+// Serializing the content of the loader
+//
+bool ObjCache::save(const std::string& objFilename, const ObjLoader& loader)
+{
+  CacheHeader header{};
+  if(!objFileStamp(objFilename, header.objFileSize, header.objFileTime))
+    return false;
+
+  header.magic          = kCacheMagic;
+  header.version        = kCacheVersion;
+  header.sizeofVertex   = sizeof(VertexObj);
+  header.sizeofMaterial = sizeof(MaterialObj);
+  header.flags          = loader.m_deduplicate ? kFlagDeduplicated : 0;
+  header.nbVertices     = static_cast<uint32_t>(loader.m_vertices.size());
+  header.nbIndices      = static_cast<uint32_t>(loader.m_indices.size());
+  header.nbMaterials    = static_cast<uint32_t>(loader.m_materials.size());
+  header.nbMatIndx      = static_cast<uint32_t>(loader.m_matIndx.size());
+  header.nbTextures     = static_cast<uint32_t>(loader.m_textures.size());
+
+  // Editing a material library invalidates the cache as well as editing the OBJ
+  std::vector<std::string> mtlFiles = materialLibraries(objFilename);
+  std::vector<MtlStamp>    mtlStamps(mtlFiles.size());
+  for(size_t i = 0; i < mtlFiles.size(); i++)
+  {
+    if(!objFileStamp(mtlFiles[i], mtlStamps[i].size, mtlStamps[i].time))
+      mtlStamps[i].size = mtlStamps[i].time = 0;  // Missing, until it is created
+    mtlStamps[i].nameLength = static_cast<uint32_t>(mtlFiles[i].size());
+  }
+  header.nbMtlFiles = static_cast<uint32_t>(mtlFiles.size());
+
+  header.verticesOffset  = alignUp(sizeof(CacheHeader));
+  header.indicesOffset   = alignUp(header.verticesOffset + header.nbVertices * sizeof(VertexObj));
+  header.materialsOffset = alignUp(header.indicesOffset + header.nbIndices * sizeof(uint32_t));
+  header.matIndxOffset = alignUp(header.materialsOffset + header.nbMaterials * sizeof(MaterialObj));
+  header.texturesOffset = alignUp(header.matIndxOffset + header.nbMatIndx * sizeof(uint32_t));
+
+  // Writing to a temporary file first, so an interrupted write never leaves a valid header
+  std::string filename = cacheFilename(objFilename);
+  std::string tmpName  = filename + ".tmp";
+  FILE*       fp       = fopen(tmpName.c_str(), "wb");
+  if(fp == nullptr)
+    return false;
+
+  bool       ok  = true;
+  uint64_t   pos = 0;
+  const char zero[kAlignment]{};
+  auto       put = [&](const void* data, size_t size) {
+    ok = ok && (size == 0 || fwrite(data, 1, size, fp) == size);
+    pos += size;
+  };
+  // Padding up to the next section
+  auto seek = [&](uint64_t offset) { put(zero, static_cast<size_t>(offset - pos)); };
+
+  put(&header, sizeof(header));
+  seek(header.verticesOffset);
+  put(loader.m_vertices.data(), loader.m_vertices.size() * sizeof(VertexObj));
+  seek(header.indicesOffset);
+  put(loader.m_indices.data(), loader.m_indices.size() * sizeof(uint32_t));
+  seek(header.materialsOffset);
+  put(loader.m_materials.data(), loader.m_materials.size() * sizeof(MaterialObj));
+  seek(header.matIndxOffset);
+  put(loader.m_matIndx.data(), loader.m_matIndx.size() * sizeof(uint32_t));
+  seek(header.texturesOffset);
+  for(const auto& t : loader.m_textures)
+  {
+    uint32_t len = static_cast<uint32_t>(t.size());
+    put(&len, sizeof(len));
+    put(t.data(), len);
+  }
+  for(size_t i = 0; i < mtlFiles.size(); i++)
+  {
+    put(&mtlStamps[i], sizeof(MtlStamp));
+    put(mtlFiles[i].data(), mtlFiles[i].size());
+  }
+  ok = (fclose(fp) == 0) && ok;
+
+  if(ok)
+  {
+    remove(filename.c_str());
+    ok = rename(tmpName.c_str(), filename.c_str()) == 0;
+  }
+  if(!ok)
+  {
+    remove(tmpName.c_str());
+    LOGW("Could not write the OBJ cache: %s\n", filename.c_str());
+  }
+  return ok;
+}
+
+//--------------------------------------------------------------------------------------------------
+// Mapping the cache and pointing to the arrays, if the cache is valid
+//
+bool ObjCache::load(const std::string& objFilename, bool deduplicate)
+{
+  close();
+
+  uint64_t objSize, objTime;
+  if(!objFileStamp(objFilename, objSize, objTime))
+    return false;
+
+  std::string filename = cacheFilename(objFilename);
+
+#ifdef _WIN32
+  HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                            FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+  if(file == INVALID_HANDLE_VALUE)
+    return false;
+  LARGE_INTEGER fileSize;
+  if(!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart < (LONGLONG)sizeof(CacheHeader))
+  {
+    CloseHandle(file);
+    return false;
+  }
+  // Copy-on-write mapping: the arrays can be modified without touching the file
+  HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_WRITECOPY, 0, 0, nullptr);
+  void*  mapped  = mapping ? MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0) : nullptr;
+  if(mapped == nullptr)
+  {
+    if(mapping)
+      CloseHandle(mapping);
+    CloseHandle(file);
+    return false;
+  }
+  m_fileHandle    = file;
+  m_mappingHandle = mapping;
+  m_mappedSize    = static_cast<size_t>(fileSize.QuadPart);
+#else
+  int fd = open(filename.c_str(), O_RDONLY);
+  if(fd < 0)
+    return false;
+  struct stat st;
+  if(fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(CacheHeader))
+  {
+    ::close(fd);
+    return false;
+  }
+  // Copy-on-write mapping: the arrays can be modified without touching the file
+  void* mapped = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  ::close(fd);
+  if(mapped == MAP_FAILED)
+    return false;
+  madvise(mapped, st.st_size, MADV_WILLNEED);
+  m_mappedSize = static_cast<size_t>(st.st_size);
+#endif
+  m_mapped = mapped;
+
+  // Validating the header against the OBJ and the current structures
+  const CacheHeader& h = *reinterpret_cast<const CacheHeader*>(m_mapped);
+  bool valid = h.magic == kCacheMagic && h.version == kCacheVersion
+               && h.sizeofVertex == sizeof(VertexObj) && h.sizeofMaterial == sizeof(MaterialObj)
+               && (h.flags & ~kKnownFlags) == 0
+               && h.flags == (deduplicate ? kFlagDeduplicated : 0)
+               && h.objFileSize == objSize && h.objFileTime == objTime
+               && h.verticesOffset + uint64_t(h.nbVertices) * sizeof(VertexObj) <= m_mappedSize
+               && h.indicesOffset + uint64_t(h.nbIndices) * sizeof(uint32_t) <= m_mappedSize
+               && h.materialsOffset + uint64_t(h.nbMaterials) * sizeof(MaterialObj) <= m_mappedSize
+               && h.matIndxOffset + uint64_t(h.nbMatIndx) * sizeof(uint32_t) <= m_mappedSize
+               && h.texturesOffset <= m_mappedSize;
+
+  // Texture names, then the material libraries which must not have changed
+  const char* ptr = reinterpret_cast<const char*>(m_mapped) + h.texturesOffset;
+  const char* end = reinterpret_cast<const char*>(m_mapped) + m_mappedSize;
+  if(valid)
+  {
+    for(uint32_t i = 0; i < h.nbTextures && valid; i++)
+    {
+      uint32_t len = 0;
+      valid        = ptr + sizeof(len) <= end;
+      if(!valid)
+        break;
+      memcpy(&len, ptr, sizeof(len));
+      ptr += sizeof(len);
+      valid = ptr + len <= end;
+      if(valid)
+        m_textures.emplace_back(ptr, len);
+      ptr += len;
+    }
+  }
+  for(uint32_t i = 0; i < h.nbMtlFiles && valid; i++)
+  {
+    MtlStamp stamp;
+    valid = ptr + sizeof(stamp) <= end;
+    if(!valid)
+      break;
+    memcpy(&stamp, ptr, sizeof(stamp));
+    ptr += sizeof(stamp);
+    valid = ptr + stamp.nameLength <= end;
+    if(!valid)
+      break;
+    uint64_t size = 0, time = 0;
+    objFileStamp(std::string(ptr, stamp.nameLength), size, time);
+    valid = size == stamp.size && time == stamp.time;
+    ptr += stamp.nameLength;
+  }
+
+  // Indices of a stale or damaged cache, the BLAS builds and the hit shaders would read past the
+  // vertices
+  if(valid)
+  {
+    const char*     base    = reinterpret_cast<const char*>(m_mapped);
+    const uint32_t* indices = reinterpret_cast<const uint32_t*>(base + h.indicesOffset);
+    for(uint32_t i = 0; i < h.nbIndices && valid; i++)
+      valid = indices[i] < h.nbVertices;
+  }
+
+  if(!valid)
+  {
+    close();
+    return false;
+  }
+
+  char* base    = reinterpret_cast<char*>(m_mapped);
+  m_vertices    = reinterpret_cast<VertexObj*>(base + h.verticesOffset);
+  m_indices     = reinterpret_cast<uint32_t*>(base + h.indicesOffset);
+  m_materials   = reinterpret_cast<MaterialObj*>(base + h.materialsOffset);
+  m_matIndx     = reinterpret_cast<uint32_t*>(base + h.matIndxOffset);
+  m_nbVertices  = h.nbVertices;
+  m_nbIndices   = h.nbIndices;
+  m_nbMaterials = h.nbMaterials;
+  m_nbMatIndx   = h.nbMatIndx;
+  return true;
+}
+
+//--------------------------------------------------------------------------------------------------
+// Taking ownership of parsed data, exposed through the same accessors as a mapped cache
+//
+void ObjCache::assign(ObjLoader&& loader)
+{
+  close();
+  m_loader      = std::move(loader);
+  m_vertices    = m_loader.m_vertices.data();
+  m_indices     = m_loader.m_indices.data();
+  m_materials   = m_loader.m_materials.data();
+  m_matIndx     = m_loader.m_matIndx.data();
+  m_nbVertices  = static_cast<uint32_t>(m_loader.m_vertices.size());
+  m_nbIndices   = static_cast<uint32_t>(m_loader.m_indices.size());
+  m_nbMaterials = static_cast<uint32_t>(m_loader.m_materials.size());
+  m_nbMatIndx   = static_cast<uint32_t>(m_loader.m_matIndx.size());
+  m_textures    = m_loader.m_textures;
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+//
+void ObjCache::close()
+{
+  if(m_mapped)
+  {
+#ifdef _WIN32
+    UnmapViewOfFile(m_mapped);
+    CloseHandle(static_cast<HANDLE>(m_mappingHandle));
+    CloseHandle(static_cast<HANDLE>(m_fileHandle));
+    m_mappingHandle = nullptr;
+    m_fileHandle    = nullptr;
+#else
+    munmap(m_mapped, m_mappedSize);
+#endif
+    m_mapped     = nullptr;
+    m_mappedSize = 0;
+  }
+
+  m_loader      = ObjLoader();
+  m_textures.clear();
+  m_vertices    = nullptr;
+  m_indices     = nullptr;
+  m_materials   = nullptr;
+  m_matIndx     = nullptr;
+  m_nbVertices  = 0;
+  m_nbIndices   = 0;
+  m_nbMaterials = 0;
+  m_nbMatIndx   = 0;
+}
@@ -0,0 +1,96 @@
+/******************************************************************************
+ * Copyright 1998-2018 NVIDIA Corp. All Rights Reserved.
+ *****************************************************************************/
+
+#pragma once
+#include "obj_loader.h"
+#include <string>
+#include <vector>
+
+//--------------------------------------------------------------------------------------------------
+// Binary cache of a parsed OBJ file
+//
+// The cache is stored next to the OBJ (`scene.obj` -> `scene.objbin`) and is made of a versioned
+// header followed by the vertex, index, material and material index arrays, laid out exactly as
+// `VertexObj`, `uint32_t` and `MaterialObj` in memory. Texture names come last, followed by the
+// material libraries of the OBJ.
+//
+// On load, the file is memory mapped (copy-on-write) and the arrays are used directly from the
+// mapped pages, so they can be handed to the staging buffers without parsing or copying.
+// The cache is invalidated when the size or modification time of the OBJ or of one of its material
+// libraries change, when the layout of the structures differs, when it was written with other
+// loader options, or when an index is past the vertices.
+//
+// Usage:
+//   ObjCache cache;
+//   if(!cache.load(filename))
+//   {
+//     ObjLoader loader;
+//     loader.loadModel(filename);
+//     ObjCache::save(filename, loader);
+//     cache.assign(std::move(loader));
+//   }
+//   m_alloc.createBuffer(cmdBuf, cache.verticesSize(), cache.vertices(), ...);
+//
+class ObjCache
+{
+public:
+  ObjCache() = default;
+  ~ObjCache() { close(); }
+  ObjCache(const ObjCache&) = delete;
+  ObjCache& operator=(const ObjCache&) = delete;
+
+  // Maps the cache of `objFilename`, returns false if it is missing, outdated, or written with
+  // another ObjLoader::m_deduplicate
+  bool load(const std::string& objFilename, bool deduplicate = true);
+  // Writes the cache of the loader's content, returns false on failure
+  static bool save(const std::string& objFilename, const ObjLoader& loader);
+  // Uses the content of a loader instead of a mapped file
+  void assign(ObjLoader&& loader);
+  // Unmaps the file and releases the data
+  void close();
+
+  static std::string cacheFilename(const std::string& objFilename);
+  // Size and modification time of a file, which invalidate the caches built from it
+  static bool fileStamp(const std::string& filename, uint64_t& size, uint64_t& time);
+
+  VertexObj*   vertices() { return m_vertices; }
+  uint32_t*    indices() { return m_indices; }
+  MaterialObj* materials() { return m_materials; }
+  uint32_t*    matIndx() { return m_matIndx; }
+
+  uint32_t nbVertices() const { return m_nbVertices; }
+  uint32_t nbIndices() const { return m_nbIndices; }
+  uint32_t nbMaterials() const { return m_nbMaterials; }
+  uint32_t nbMatIndx() const { return m_nbMatIndx; }
+
+  size_t verticesSize() const { return m_nbVertices * sizeof(VertexObj); }
+  size_t indicesSize() const { return m_nbIndices * sizeof(uint32_t); }
+  size_t materialsSize() const { return m_nbMaterials * sizeof(MaterialObj); }
+  size_t matIndxSize() const { return m_nbMatIndx * sizeof(uint32_t); }
+
+  const std::vector<std::string>& textures() const { return m_textures; }
+
+private:
+  VertexObj*   m_vertices{nullptr};
+  uint32_t*    m_indices{nullptr};
+  MaterialObj* m_materials{nullptr};
+  uint32_t*    m_matIndx{nullptr};
+  uint32_t     m_nbVertices{0};
+  uint32_t     m_nbIndices{0};
+  uint32_t     m_nbMaterials{0};
+  uint32_t     m_nbMatIndx{0};
+
+  std::vector<std::string> m_textures;
+
+  // Mapped file
+  void*  m_mapped{nullptr};
+  size_t m_mappedSize{0};
+#ifdef _WIN32
+  void* m_fileHandle{nullptr};
+  void* m_mappingHandle{nullptr};
+#endif
+
+  // Owned data when not mapped (see assign)
+  ObjLoader m_loader;
+};
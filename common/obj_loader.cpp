@@ -6,6 +6,7 @@
 #define TINYOBJLOADER_IMPLEMENTATION
 #include "obj_loader.h"
 #include "nvh/nvprint.hpp"
+#include "threadpool.hpp"
 
 //-----------------------------------------------------------------------------
 // Extract the directory component from a complete path.
@@ -31,6 +32,39 @@ static inline std::string get_path(const std::string& file)
   return dir;
 }
 
+//-----------------------------------------------------------------------------
+// Key used to merge identical face corners: the OBJ index triple, and the smoothing of the face
+// when the normals are computed
+//
+struct ObjIndexKey
+{
+  int v, n, t;
+  int s;  // 0 with the normals of the file, else the smoothing group or -1 - face when flat
+  bool operator==(const ObjIndexKey& o) const
+  {
+    return v == o.v && n == o.n && t == o.t && s == o.s;
+  }
+};
+
+struct ObjIndexKeyHash
+{
+  size_t operator()(const ObjIndexKey& k) const
+  {
+    size_t h = std::hash<int>()(k.v);
+    h ^= std::hash<int>()(k.n) + 0x9e3779b9 + (h << 6) + (h >> 2);
+    h ^= std::hash<int>()(k.t) + 0x9e3779b9 + (h << 6) + (h >> 2);
+    h ^= std::hash<int>()(k.s) + 0x9e3779b9 + (h << 6) + (h >> 2);
+    return h;
+  }
+};
+
+// Normalized n, or `fallback` for the null normal of degenerate faces
+static inline nvmath::vec3f normalizeOr(const nvmath::vec3f& n, const nvmath::vec3f& fallback)
+{
+  float len = nvmath::length(n);
+  return len > 1e-20f ? n * (1.f / len) : fallback;
+}
+
 void ObjLoader::loadModel(const std::string& filename)
 {
   tinyobj::ObjReader reader;
@@ -69,42 +103,123 @@ void ObjLoader::loadModel(const std::string& filename)
   if(m_materials.empty())
     m_materials.emplace_back(MaterialObj());
 
-  const tinyobj::attrib_t& attrib = reader.GetAttrib();
+  const tinyobj::attrib_t&            attrib = reader.GetAttrib();
+  const std::vector<tinyobj::shape_t>& shapes = reader.GetShapes();
 
-  for(const auto& shape : reader.GetShapes())
-  {
-    m_vertices.reserve(shape.mesh.indices.size() + m_vertices.size());
-    m_indices.reserve(shape.mesh.indices.size() + m_indices.size());
+  // Creates the vertex of a face corner
+  auto makeVertex = [&attrib](const tinyobj::index_t& index) {
+    VertexObj    vertex = {};
+    const float* vp     = &attrib.vertices[3 * index.vertex_index];
+    vertex.pos          = {*(vp + 0), *(vp + 1), *(vp + 2)};
+
+    if(!attrib.normals.empty() && index.normal_index >= 0)
+    {
+      const float* np = &attrib.normals[3 * index.normal_index];
+      vertex.nrm      = {*(np + 0), *(np + 1), *(np + 2)};
+    }
+
+    if(!attrib.texcoords.empty() && index.texcoord_index >= 0)
+    {
+      const float* tp = &attrib.texcoords[2 * index.texcoord_index + 0];
+      vertex.texCoord = {*tp, 1.0f - *(tp + 1)};
+    }
+
+    if(!attrib.colors.empty())
+    {
+      const float* vc = &attrib.colors[3 * index.vertex_index];
+      vertex.color    = {*(vc + 0), *(vc + 1), *(vc + 2)};
+    }
+    return vertex;
+  };
+
+  // Prefix sum over the number of face corners: each shape writes its indices in
+  // [indexOffset[s], indexOffset[s+1]), which allows the shapes to be assembled in parallel.
+  std::vector<size_t> indexOffset(shapes.size() + 1, 0);
+  for(size_t s = 0; s < shapes.size(); s++)
+    indexOffset[s + 1] = indexOffset[s] + shapes[s].mesh.indices.size();
+
+  for(const auto& shape : shapes)
     m_matIndx.insert(m_matIndx.end(), shape.mesh.material_ids.begin(),
                      shape.mesh.material_ids.end());
 
-    for(const auto& index : shape.mesh.indices)
-    {
-      VertexObj    vertex = {};
-      const float* vp     = &attrib.vertices[3 * index.vertex_index];
-      vertex.pos          = {*(vp + 0), *(vp + 1), *(vp + 2)};
+  // Without normals in the file, the faces are flat as with one vertex per corner, unless they are
+  // in a smoothing group (`s 1`): the corners of a flat face are never merged with other faces
+  const bool computeNormals = attrib.normals.empty();
+  auto       smoothing      = [&](size_t s, size_t face) {
+    const auto& groups = shapes[s].mesh.smoothing_group_ids;
+    if(!computeNormals)
+      return 0;
+    if(face < groups.size() && groups[face] != 0)
+      return static_cast<int>(groups[face]);
+    return -1 - static_cast<int>(indexOffset[s] / 3 + face);
+  };
 
-      if(!attrib.normals.empty() && index.normal_index >= 0)
-      {
-        const float* np = &attrib.normals[3 * index.normal_index];
-        vertex.nrm      = {*(np + 0), *(np + 1), *(np + 2)};
-      }
+  // Small models are not worth dispatching to the pool
+  const bool parallel = shapes.size() > 1 && indexOffset.back() >= m_parallelThreshold;
+  auto forEachShape   = [&](const std::function<void(size_t)>& fn) {
+    if(parallel)
+      ThreadPool::shared().parallelFor(shapes.size(), fn);
+    else
+      for(size_t s = 0; s < shapes.size(); s++)
+        fn(s);
+  };
 
-      if(!attrib.texcoords.empty() && index.texcoord_index >= 0)
+  // Vertices of shape `s` are in [vertexOffset[s], vertexOffset[s+1])
+  std::vector<size_t> vertexOffset;
+  m_indices.resize(indexOffset.back());
+
+  if(m_deduplicate)
+  {
+    // Each shape de-duplicates its own corners, then all shapes are concatenated
+    std::vector<std::vector<VertexObj>> shapeVertices(shapes.size());
+    forEachShape([&](size_t s) {
+      const auto& indices = shapes[s].mesh.indices;
+      auto&       verts   = shapeVertices[s];
+      uint32_t*   dst     = m_indices.data() + indexOffset[s];
+
+      // Map from OBJ index triple to the vertex emitted for it
+      std::unordered_map<ObjIndexKey, uint32_t, ObjIndexKeyHash> vertexMap;
+      vertexMap.reserve(indices.size() / 2);
+      verts.reserve(indices.size() / 2);
+
+      for(size_t i = 0; i < indices.size(); i++)
       {
-        const float* tp = &attrib.texcoords[2 * index.texcoord_index + 0];
-        vertex.texCoord = {*tp, 1.0f - *(tp + 1)};
+        ObjIndexKey key{indices[i].vertex_index, indices[i].normal_index,
+                        indices[i].texcoord_index, smoothing(s, i / 3)};
+        auto        res = vertexMap.emplace(key, static_cast<uint32_t>(verts.size()));
+        if(res.second)
+          verts.push_back(makeVertex(indices[i]));
+        dst[i] = res.first->second;
       }
+    });
+
+    vertexOffset.resize(shapes.size() + 1, 0);
+    for(size_t s = 0; s < shapes.size(); s++)
+      vertexOffset[s + 1] = vertexOffset[s] + shapeVertices[s].size();
+    m_vertices.resize(vertexOffset.back());
 
-      if(!attrib.colors.empty())
+    forEachShape([&](size_t s) {
+      std::copy(shapeVertices[s].begin(), shapeVertices[s].end(),
+                m_vertices.begin() + vertexOffset[s]);
+      uint32_t base = static_cast<uint32_t>(vertexOffset[s]);
+      for(size_t i = indexOffset[s]; i < indexOffset[s + 1]; i++)
+        m_indices[i] += base;
+    });
+  }
+  else
+  {
+    // One vertex per face corner
+    vertexOffset = indexOffset;
+    m_vertices.resize(indexOffset.back());
+    forEachShape([&](size_t s) {
+      const auto& indices = shapes[s].mesh.indices;
+      for(size_t i = 0; i < indices.size(); i++)
       {
-        const float* vc = &attrib.colors[3 * index.vertex_index];
-        vertex.color    = {*(vc + 0), *(vc + 1), *(vc + 2)};
+        size_t dst      = indexOffset[s] + i;
+        m_vertices[dst] = makeVertex(indices[i]);
+        m_indices[dst]  = static_cast<uint32_t>(dst);
       }
-
-      m_vertices.push_back(vertex);
-      m_indices.push_back(static_cast<int>(m_indices.size()));
-    }
+    });
   }
 
   // Fixing material indices
@@ -116,18 +231,59 @@ void ObjLoader::loadModel(const std::string& filename)
 
 
   // Compute normal when no normal were provided.
-  if(attrib.normals.empty())
-  {
-    for(size_t i = 0; i < m_indices.size(); i += 3)
+  // The flat faces do not share their vertices, so each shape can be processed independently.
+  if(!computeNormals)
+    return;
+  const nvmath::vec3f up(0.f, 1.f, 0.f);
+  forEachShape([&](size_t s) {
+    for(size_t i = indexOffset[s]; i < indexOffset[s + 1]; i += 3)
     {
+      if(m_deduplicate && smoothing(s, (i - indexOffset[s]) / 3) > 0)
+        continue;
       VertexObj& v0 = m_vertices[m_indices[i + 0]];
       VertexObj& v1 = m_vertices[m_indices[i + 1]];
       VertexObj& v2 = m_vertices[m_indices[i + 2]];
 
-      nvmath::vec3f n = nvmath::normalize(nvmath::cross((v1.pos - v0.pos), (v2.pos - v0.pos)));
+      nvmath::vec3f n = normalizeOr(nvmath::cross((v1.pos - v0.pos), (v2.pos - v0.pos)), up);
       v0.nrm          = n;
       v1.nrm          = n;
       v2.nrm          = n;
     }
+  });
+
+  // The faces of a smoothing group average their area weighted normals at each position, once the
+  // shapes are merged: the vertices of several shapes, or with several texture coordinates, get the
+  // same normal and show no seam.
+  auto positionKey = [&](size_t s, size_t corner) {
+    uint32_t position = static_cast<uint32_t>(shapes[s].mesh.indices[corner].vertex_index);
+    uint32_t group    = static_cast<uint32_t>(smoothing(s, corner / 3));
+    return (uint64_t(position) << 32) | group;
+  };
+  std::unordered_map<uint64_t, nvmath::vec3f> smoothNormals;
+  for(size_t s = 0; m_deduplicate && s < shapes.size(); s++)
+  {
+    for(size_t i = indexOffset[s]; i < indexOffset[s + 1]; i += 3)
+    {
+      size_t corner = i - indexOffset[s];
+      if(smoothing(s, corner / 3) <= 0)
+        continue;
+      const nvmath::vec3f& p0 = m_vertices[m_indices[i + 0]].pos;
+      const nvmath::vec3f& p1 = m_vertices[m_indices[i + 1]].pos;
+      const nvmath::vec3f& p2 = m_vertices[m_indices[i + 2]].pos;
+      nvmath::vec3f        n  = nvmath::cross((p1 - p0), (p2 - p0));
+      for(size_t k = 0; k < 3; k++)
+        smoothNormals[positionKey(s, corner + k)] += n;
+    }
   }
+  if(smoothNormals.empty())
+    return;
+  forEachShape([&](size_t s) {
+    for(size_t i = indexOffset[s]; i < indexOffset[s + 1]; i++)
+    {
+      size_t corner = i - indexOffset[s];
+      if(smoothing(s, corner / 3) > 0)
+        m_vertices[m_indices[i]].nrm =
+            normalizeOr(smoothNormals.find(positionKey(s, corner))->second, up);
+    }
+  });
 }
@@ -6,6 +6,7 @@
 #include "fileformats/tiny_obj_loader.h"
 #include "nvmath/nvmath.h"
 #include <array>
+#include <functional>
 #include <iostream>
 #include <unordered_map>
 #include <vector>
@@ -47,6 +48,14 @@ class ObjLoader
 public:
   void loadModel(const std::string& filename);
 
+  // When true, face corners sharing the same (vertex, normal, texcoord) indices are merged
+  // into a single vertex, and m_indices references them. When false, one vertex is emitted
+  // per face corner and m_indices is the sequence 0..N-1.
+  bool m_deduplicate{true};
+  // Models with more face corners than this, and more than one shape, have their shapes
+  // assembled in parallel on ThreadPool::shared()
+  size_t m_parallelThreshold{1 << 16};
+
   std::vector<VertexObj>   m_vertices;
   std::vector<uint32_t>    m_indices;
   std::vector<MaterialObj> m_materials;
@@ -0,0 +1,184 @@
+/******************************************************************************
+ * Copyright 1998-2018 NVIDIA Corp. All Rights Reserved.
+ *****************************************************************************/
+
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "nvh/nvprint.hpp"
+
+//--------------------------------------------------------------------------------------------------
+// Pipeline cache persisted on disk
+//
+// The file starts with a header holding the vendor, device, driver version and pipeline cache
+// UUID of the device which wrote it. If any of them differ, or the file is missing or truncated,
+// the cache starts empty. save() writes the cache back, typically before destroying it.
+//
+// Usage:
+//   m_pipelineCache.init(device, physicalDevice, "sample.pipelinecache");
+//   {
+//     PipelineCache::Timer timer(m_pipelineCache, "Graphics");
+//     m_pipeline = generator.createPipeline(m_pipelineCache.get());
+//   }
+//   ...
+//   m_pipelineCache.save();
+//   m_pipelineCache.destroy();
+//
+class PipelineCache
+{
+public:
+  void init(const vk::Device&         device,
+            const vk::PhysicalDevice& physicalDevice,
+            const std::string&        filename)
+  {
+    m_device   = device;
+    m_filename = filename;
+    m_header   = makeHeader(physicalDevice.getProperties());
+
+    auto                 start = std::chrono::high_resolution_clock::now();
+    std::vector<uint8_t> data  = readFile();
+    m_warm                     = !data.empty();
+
+    vk::PipelineCacheCreateInfo createInfo;
+    createInfo.setInitialDataSize(data.size());
+    createInfo.setPInitialData(data.empty() ? nullptr : data.data());
+    m_cache = m_device.createPipelineCache(createInfo);
+
+    LOGI("Pipeline cache %s: %s (%d KB, %.2f ms)\n", m_filename.c_str(),
+         m_warm ? "loaded" : "empty", int(data.size() / 1024), elapsedMs(start));
+  }
+
+  // Writing the content of the cache, to a temporary file first so a failure never leaves a
+  // partial file behind
+  bool save()
+  {
+    if(!m_cache)
+      return false;
+
+    std::vector<uint8_t> data = m_device.getPipelineCacheData(m_cache);
+    m_header.dataSize         = data.size();
+
+    std::string tmpName = m_filename + ".tmp";
+    FILE*       fp      = fopen(tmpName.c_str(), "wb");
+    if(fp == nullptr)
+      return false;
+    bool ok = fwrite(&m_header, sizeof(m_header), 1, fp) == 1
+              && (data.empty() || fwrite(data.data(), data.size(), 1, fp) == 1);
+    ok      = (fclose(fp) == 0) && ok;
+    if(ok)
+    {
+      remove(m_filename.c_str());
+      ok = rename(tmpName.c_str(), m_filename.c_str()) == 0;
+    }
+    if(!ok)
+    {
+      remove(tmpName.c_str());
+      LOGW("Could not write the pipeline cache: %s\n", m_filename.c_str());
+    }
+    return ok;
+  }
+
+  void destroy()
+  {
+    m_device.destroy(m_cache);
+    m_cache = vk::PipelineCache();
+  }
+
+  vk::PipelineCache get() const { return m_cache; }
+  // True if the cache was loaded from a valid file
+  bool warm() const { return m_warm; }
+
+  // Reporting the time spent in the scope, and whether the cache was warm
+  class Timer
+  {
+  public:
+    Timer(const PipelineCache& cache, const char* name)
+        : m_name(name)
+        , m_warm(cache.warm())
+        , m_start(std::chrono::high_resolution_clock::now())
+    {
+    }
+    ~Timer()
+    {
+      LOGI("Pipeline %s: %.2f ms (%s cache)\n", m_name, elapsedMs(m_start),
+           m_warm ? "warm" : "cold");
+    }
+
+  private:
+    const char*                                    m_name;
+    bool                                           m_warm;
+    std::chrono::high_resolution_clock::time_point m_start;
+  };
+
+private:
+  struct Header
+  {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t vendorID;
+    uint32_t deviceID;
+    uint32_t driverVersion;
+    uint8_t  uuid[VK_UUID_SIZE];
+    uint64_t dataSize;
+  };
+
+  static const uint32_t kMagic   = 0x43504b56;  // "VKPC"
+  static const uint32_t kVersion = 1;
+
+  static Header makeHeader(const vk::PhysicalDeviceProperties& props)
+  {
+    Header header{};
+    header.magic         = kMagic;
+    header.version       = kVersion;
+    header.vendorID      = props.vendorID;
+    header.deviceID      = props.deviceID;
+    header.driverVersion = props.driverVersion;
+    memcpy(header.uuid, props.pipelineCacheUUID, VK_UUID_SIZE);
+    return header;
+  }
+
+  static double elapsedMs(std::chrono::high_resolution_clock::time_point start)
+  {
+    return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now()
+                                                     - start)
+        .count();
+  }
+
+  // Content of the file after the header, empty if the file does not match the device
+  std::vector<uint8_t> readFile() const
+  {
+    std::vector<uint8_t> data;
+    FILE*                fp = fopen(m_filename.c_str(), "rb");
+    if(fp == nullptr)
+      return data;
+
+    Header header{};
+    bool   valid = fread(&header, sizeof(header), 1, fp) == 1 && header.magic == m_header.magic
+                 && header.version == m_header.version && header.vendorID == m_header.vendorID
+                 && header.deviceID == m_header.deviceID
+                 && header.driverVersion == m_header.driverVersion
+                 && memcmp(header.uuid, m_header.uuid, VK_UUID_SIZE) == 0
+                 && header.dataSize < (1ull << 32);
+    if(valid)
+    {
+      data.resize(static_cast<size_t>(header.dataSize));
+      if(!data.empty() && fread(data.data(), data.size(), 1, fp) != 1)
+        data.clear();
+    }
+    fclose(fp);
+    return data;
+  }
+
+  vk::Device        m_device;
+  vk::PipelineCache m_cache;
+  std::string       m_filename;
+  Header            m_header{};
+  bool              m_warm{false};
+};
@@ -0,0 +1,1166 @@
+/******************************************************************************
+ * Copyright 1998-2018 NVIDIA Corp. All Rights Reserved.
+ *****************************************************************************/
+
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "memory_stats.hpp"
+#include "nvh/nvprint.hpp"
+#include "nvvk/allocator_vk.hpp"
+#include "nvvk/commands_vk.hpp"
+#include "nvvk/debug_util_vk.hpp"
+#include "nvvk/raytraceKHR_vk.hpp"
+
+//--------------------------------------------------------------------------------------------------
+// Acceleration structure builder, with the same interface as nvvk::RaytracingBuilderKHR, and:
+// - BLAS are built in batches: all BLAS of a batch are built in parallel, each using its own
+//   region of a shared scratch buffer. A batch is closed when its scratch memory would exceed
+//   the budget (setScratchBudget), and each batch is submitted on its own.
+// - Compaction is opt-in (setCompaction) and applies to the BLAS with eAllowCompaction and without
+//   eAllowUpdate, in their flags or in the ones of buildBlas. The compacted sizes are queried at
+//   the end of each batch, then the BLAS are copied into their compacted version before the next
+//   batch starts, which keeps the peak memory to one batch of uncompacted BLAS.
+// - All builds and updates share one scratch buffer, only reallocated when a larger one is needed,
+//   and the instance buffer and its staging buffer are kept: once they reached their size, the
+//   updates of an animated scene do not allocate device memory. releaseScratch() frees the
+//   scratch buffer, for example after the initial builds.
+// - With setBlasCache, the BLAS are serialized to a file once built, and deserialized instead of
+//   built by the next launches. The file is ignored and written again when the key or the layout
+//   of the BLAS changed, or when the driver cannot read it.
+//
+// With setQueueFamilies, the buffers created by the builder are shared by several queue families,
+// for example when the updates are recorded on a compute queue. The acceleration structures are
+// not buffers in this version of the extension, and have no queue family ownership.
+//
+// The allocator is nvvk::Allocator, selected by NVVK_ALLOC_* before including this file.
+// The memory of the acceleration structures, scratch and staging buffers is reported to
+// MemoryStats::shared().
+//
+class RaytracingBuilder
+{
+public:
+  using Blas     = nvvk::RaytracingBuilderKHR::Blas;
+  using Instance = nvvk::RaytracingBuilderKHR::Instance;
+  using vkASMR   = vk::AccelerationStructureMemoryRequirementsTypeKHR;
+  using vkBU     = vk::BufferUsageFlagBits;
+  using vkMP     = vk::MemoryPropertyFlagBits;
+
+  // Range of modified instances, see updateTlas
+  struct InstanceRange
+  {
+    uint32_t first{0};
+    uint32_t count{0};
+  };
+
+  RaytracingBuilder()                         = default;
+  RaytracingBuilder(RaytracingBuilder const&) = delete;
+  RaytracingBuilder& operator=(RaytracingBuilder const&) = delete;
+
+  void setup(const vk::Device& device, nvvk::Allocator* allocator, uint32_t queueIndex)
+  {
+    m_device     = device;
+    m_queueIndex = queueIndex;
+    m_alloc      = allocator;
+    m_debug.setup(device);
+  }
+
+  // Maximum amount of scratch memory used at once when building BLAS. A single BLAS
+  // requiring more than the budget is still built, alone in its batch.
+  void setScratchBudget(vk::DeviceSize budget) { m_scratchBudget = budget; }
+  // Compacting BLAS built with eAllowCompaction
+  void setCompaction(bool compact) { m_compact = compact; }
+  // When updateTlas rebuilds instead of refitting: more than `dirtyFraction` of the instances
+  // changed, the bounds of the instance origins grew by more than `boundsGrowth` (diagonal ratio)
+  // since the last build, or `maxRefits` refits were done since the last build.
+  void setTlasRebuildHeuristics(float dirtyFraction, float boundsGrowth, uint32_t maxRefits)
+  {
+    m_rebuildDirtyFraction = dirtyFraction;
+    m_rebuildBoundsGrowth  = boundsGrowth;
+    m_rebuildMaxRefits     = maxRefits;
+  }
+
+  // Concurrent sharing of the instance, staging and scratch buffers by `families`, when there are
+  // several of them. Must be called before the first build.
+  void setQueueFamilies(const std::vector<uint32_t>& families) { m_queueFamilies = families; }
+
+  // File of the serialized BLAS, none if empty. `key` identifies the content of the geometry
+  // (source files, vertex format, ...), the number and layout of the geometries are checked by the
+  // builder.
+  void setBlasCache(const std::string& filename, uint64_t key)
+  {
+    m_cacheFile = filename;
+    m_cacheKey  = key;
+  }
+
+  vk::AccelerationStructureKHR getAccelerationStructure() const { return m_tlas.as.accel; }
+
+  void destroy()
+  {
+    for(auto& b : m_blas)
+      destroyTracked(b.as, MemoryCategory::eBlas);
+    destroyTracked(m_tlas.as, MemoryCategory::eTlas);
+    destroyTracked(m_instBuffer, MemoryCategory::eTlas);
+    if(m_instStagingMapped)
+      m_alloc->unmap(m_instStaging);
+    destroyTracked(m_instStaging, MemoryCategory::eStaging);
+    for(auto& ring : m_instRing)
+    {
+      m_alloc->unmap(ring.buffer);
+      destroyTracked(ring.buffer, MemoryCategory::eStaging);
+    }
+    destroyTracked(m_ringScratch, MemoryCategory::eScratch);
+    releaseScratch();
+    m_instStagingMapped = nullptr;
+    m_instRing.clear();
+    m_ringScratchAddress = 0;
+    m_blas.clear();
+    m_tlas = {};
+  }
+
+  //------------------------------------------------------------------------------------------------
+  // Creating and building all BLAS, in batches bounded by the scratch budget.
+  // The flags of each BLAS are added to `flags`, for example eAllowUpdate on the animated ones.
+  //
+  void buildBlas(const std::vector<Blas>&               blas_,
+                 vk::BuildAccelerationStructureFlagsKHR flags =
+                     vk::BuildAccelerationStructureFlagBitsKHR::ePreferFastTrace)
+  {
+    m_blas = blas_;  // Keeping a copy
+    for(auto& blas : m_blas)
+      blas.flags = flags | blas.flags;
+
+    // Serialized by a previous launch
+    uint64_t cacheKey = blasCacheKey();
+    if(!m_cacheFile.empty() && loadBlasCache(cacheKey))
+      return;
+
+    // Compacting the BLAS which allow it, but not the ones refit in place (eAllowUpdate): their
+    // handle is kept as built
+    using vkBF = vk::BuildAccelerationStructureFlagBitsKHR;
+    std::vector<char> compactable(m_blas.size(), 0);
+    bool              doCompaction{false};
+    for(size_t idx = 0; idx < m_blas.size(); idx++)
+    {
+      const auto& blasFlags = m_blas[idx].flags;
+      compactable[idx] = m_compact && (blasFlags & vkBF::eAllowCompaction)
+                         && !(blasFlags & vkBF::eAllowUpdate);
+      doCompaction     = doCompaction || compactable[idx] != 0;
+    }
+
+    // Creating all acceleration structures and getting the scratch size of each of them
+    std::vector<vk::DeviceSize> scratchSizes(m_blas.size());
+    std::vector<vk::DeviceSize> originalSizes(m_blas.size());
+    for(size_t idx = 0; idx < m_blas.size(); idx++)
+    {
+      auto& blas = m_blas[idx];
+
+      vk::AccelerationStructureCreateInfoKHR asCreateInfo{
+          {}, vk::AccelerationStructureTypeKHR::eBottomLevel};
+      asCreateInfo.setFlags(blas.flags);
+      asCreateInfo.setMaxGeometryCount((uint32_t)blas.asCreateGeometryInfo.size());
+      asCreateInfo.setPGeometryInfos(blas.asCreateGeometryInfo.data());
+      blas.as = track(m_alloc->createAcceleration(asCreateInfo), MemoryCategory::eBlas);
+      m_debug.setObjectName(blas.as.accel, (std::string("Blas" + std::to_string(idx)).c_str()));
+
+      scratchSizes[idx]  = alignScratch(memoryRequirement(blas.as.accel, vkASMR::eBuildScratch));
+      originalSizes[idx] = memoryRequirement(blas.as.accel, vkASMR::eObject);
+    }
+    if(m_blas.empty())
+      return;
+
+    // Splitting in batches: [batchStart[i], batchStart[i+1])
+    std::vector<size_t> batchStart{0};
+    vk::DeviceSize      batchScratch{0};
+    vk::DeviceSize      maxBatchScratch{0};
+    for(size_t idx = 0; idx < m_blas.size(); idx++)
+    {
+      if(batchScratch > 0 && batchScratch + scratchSizes[idx] > m_scratchBudget)
+      {
+        batchStart.push_back(idx);
+        batchScratch = 0;
+      }
+      batchScratch += scratchSizes[idx];
+      maxBatchScratch = std::max(maxBatchScratch, batchScratch);
+    }
+    batchStart.push_back(m_blas.size());
+
+    // Scratch memory for the biggest batch
+    vk::DeviceAddress scratchAddress = getScratch(maxBatchScratch);
+
+    // Query of the compacted size, one per compactable BLAS of a batch
+    vk::QueryPool queryPool;
+    if(doCompaction)
+    {
+      size_t maxBatchCount{0};
+      for(size_t b = 0; b + 1 < batchStart.size(); b++)
+        maxBatchCount = std::max(maxBatchCount, batchStart[b + 1] - batchStart[b]);
+      vk::QueryPoolCreateInfo qpci;
+      qpci.setQueryCount((uint32_t)maxBatchCount);
+      qpci.setQueryType(vk::QueryType::eAccelerationStructureCompactedSizeKHR);
+      queryPool = m_device.createQueryPool(qpci);
+    }
+
+    nvvk::CommandPool genCmdBuf(m_device, m_queueIndex);
+    vk::DeviceSize    totOriginalSize{0}, totCompactSize{0};
+    for(size_t b = 0; b + 1 < batchStart.size(); b++)
+    {
+      size_t first = batchStart[b];
+      size_t count = batchStart[b + 1] - first;
+
+      std::vector<size_t> compacted;  // BLAS of the batch with a query
+      for(size_t idx = first; idx < first + count; idx++)
+        if(compactable[idx])
+          compacted.push_back(idx);
+
+      vk::CommandBuffer cmdBuf = genCmdBuf.createCommandBuffer();
+      if(!compacted.empty())
+        cmdBuf.resetQueryPool(queryPool, 0, (uint32_t)compacted.size());
+
+      // All builds of the batch are independent: they use distinct scratch regions
+      vk::DeviceSize scratchOffset{0};
+      for(size_t idx = first; idx < first + count; idx++)
+      {
+        cmdBuildBlas(cmdBuf, m_blas[idx], false, scratchAddress + scratchOffset);
+        scratchOffset += scratchSizes[idx];
+      }
+
+      // Builds must be finished before querying the compacted size
+      if(!compacted.empty())
+      {
+        vk::MemoryBarrier barrier(vk::AccessFlagBits::eAccelerationStructureWriteKHR,
+                                  vk::AccessFlagBits::eAccelerationStructureReadKHR);
+        cmdBuf.pipelineBarrier(vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR,
+                               vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR, {},
+                               {barrier}, {}, {});
+        std::vector<vk::AccelerationStructureKHR> accels(compacted.size());
+        for(size_t i = 0; i < compacted.size(); i++)
+          accels[i] = m_blas[compacted[i]].as.accel;
+        cmdBuf.writeAccelerationStructuresPropertiesKHR(
+            accels, vk::QueryType::eAccelerationStructureCompactedSizeKHR, queryPool, 0);
+      }
+      genCmdBuf.submitAndWait(cmdBuf);
+
+      if(compacted.empty())
+        continue;
+
+      // Copying the compactable BLAS of the batch to their compacted version
+      std::vector<vk::DeviceSize> compactSizes(compacted.size());
+      m_device.getQueryPoolResults<vk::DeviceSize>(queryPool, 0, (uint32_t)compacted.size(),
+                                                   compactSizes, sizeof(vk::DeviceSize),
+                                                   vk::QueryResultFlagBits::eWait);
+
+      cmdBuf = genCmdBuf.createCommandBuffer();
+      std::vector<nvvk::AccelKHR> cleanupAS(compacted.size());
+      for(size_t i = 0; i < compacted.size(); i++)
+      {
+        Blas& blas = m_blas[compacted[i]];
+        totOriginalSize += originalSizes[compacted[i]];
+        totCompactSize += compactSizes[i];
+
+        vk::AccelerationStructureCreateInfoKHR asCreateInfo{
+            {}, vk::AccelerationStructureTypeKHR::eBottomLevel};
+        asCreateInfo.setCompactedSize(compactSizes[i]);
+        asCreateInfo.setFlags(blas.flags);
+        auto as = track(m_alloc->createAcceleration(asCreateInfo), MemoryCategory::eBlas);
+        m_debug.setObjectName(as.accel,
+                              (std::string("Blas" + std::to_string(compacted[i])).c_str()));
+
+        vk::CopyAccelerationStructureInfoKHR copyInfo{
+            blas.as.accel, as.accel, vk::CopyAccelerationStructureModeKHR::eCompact};
+        cmdBuf.copyAccelerationStructureKHR(&copyInfo);
+        cleanupAS[i] = blas.as;
+        blas.as      = as;
+      }
+      genCmdBuf.submitAndWait(cmdBuf);
+
+      // Destroying the uncompacted versions
+      for(auto& as : cleanupAS)
+        destroyTracked(as, MemoryCategory::eBlas);
+    }
+
+    LOGI("BLAS: %d built in %d batch(es), scratch %d KB\n", (int)m_blas.size(),
+         (int)batchStart.size() - 1, (int)(maxBatchScratch / 1024));
+    if(doCompaction && totOriginalSize > 0)
+    {
+      LOGI("BLAS compaction: %d KB -> %d KB (%2.2f%% smaller)\n", (int)(totOriginalSize / 1024),
+           (int)(totCompactSize / 1024),
+           (totOriginalSize - totCompactSize) / float(totOriginalSize) * 100.f);
+    }
+
+    if(queryPool)
+      m_device.destroyQueryPool(queryPool);
+    m_alloc->finalizeAndReleaseStaging();
+
+    if(!m_cacheFile.empty())
+      saveBlasCache(cacheKey);
+  }
+
+  //------------------------------------------------------------------------------------------------
+  // Refit of a BLAS, after its geometry was modified
+  //
+  void updateBlas(uint32_t blasIdx)
+  {
+    Blas& blas = m_blas[blasIdx];
+
+    vk::DeviceAddress scratchAddress =
+        getScratch(memoryRequirement(blas.as.accel, vkASMR::eUpdateScratch));
+
+    nvvk::CommandPool genCmdBuf(m_device, m_queueIndex);
+    vk::CommandBuffer cmdBuf = genCmdBuf.createCommandBuffer();
+    cmdBuildBlas(cmdBuf, blas, true, scratchAddress);
+    genCmdBuf.submitAndWait(cmdBuf);
+  }
+
+  //------------------------------------------------------------------------------------------------
+  // Converting an instance to the Vulkan structure. The BLAS must be built.
+  //
+  vk::AccelerationStructureInstanceKHR instanceToVkGeometryInstanceKHR(const Instance& instance)
+  {
+    Blas&             blas = m_blas[instance.blasId];
+    vk::DeviceAddress blasAddress =
+        m_device.getAccelerationStructureAddressKHR({blas.as.accel});
+
+    vk::AccelerationStructureInstanceKHR gInst{};
+    // The matrices for the instance transforms are row-major, instead of column-major in the
+    // rest of the application. The transform only holds the first 3 rows.
+    nvmath::mat4f transp = nvmath::transpose(instance.transform);
+    memcpy(&gInst.transform, &transp, sizeof(gInst.transform));
+    gInst.setInstanceCustomIndex(instance.instanceId);
+    gInst.setMask(instance.mask);
+    gInst.setInstanceShaderBindingTableRecordOffset(instance.hitGroupId);
+    gInst.setFlags(instance.flags);
+    gInst.setAccelerationStructureReference(blasAddress);
+    return gInst;
+  }
+
+  //------------------------------------------------------------------------------------------------
+  // Creating and building the TLAS
+  //
+  void buildTlas(const std::vector<Instance>&           instances,
+                 vk::BuildAccelerationStructureFlagsKHR flags =
+                     vk::BuildAccelerationStructureFlagBitsKHR::ePreferFastTrace)
+  {
+    // Cannot call buildTlas twice
+    assert(m_tlas.as.accel == VK_NULL_HANDLE);
+
+    m_tlas.flags = flags;
+
+    vk::AccelerationStructureCreateGeometryTypeInfoKHR geometryCreate{
+        vk::GeometryTypeKHR::eInstances};
+    geometryCreate.setMaxPrimitiveCount(static_cast<uint32_t>(instances.size()));
+    geometryCreate.setAllowsTransforms(VK_TRUE);
+
+    vk::AccelerationStructureCreateInfoKHR asCreateInfo{
+        {}, vk::AccelerationStructureTypeKHR::eTopLevel};
+    asCreateInfo.setFlags(flags);
+    asCreateInfo.setMaxGeometryCount(1);
+    asCreateInfo.setPGeometryInfos(&geometryCreate);
+    m_tlas.as = track(m_alloc->createAcceleration(asCreateInfo), MemoryCategory::eTlas);
+    m_debug.setObjectName(m_tlas.as.accel, "Tlas");
+
+    vk::DeviceAddress scratchAddress =
+        getScratch(memoryRequirement(m_tlas.as.accel, vkASMR::eBuildScratch));
+
+    std::vector<vk::AccelerationStructureInstanceKHR> geometryInstances;
+    geometryInstances.reserve(instances.size());
+    for(const auto& inst : instances)
+      geometryInstances.push_back(instanceToVkGeometryInstanceKHR(inst));
+
+    nvvk::CommandPool genCmdBuf(m_device, m_queueIndex);
+    vk::CommandBuffer cmdBuf = genCmdBuf.createCommandBuffer();
+
+    // Uploaded through the persistent staging buffer of the updates
+    vk::DeviceSize size = geometryInstances.size() * sizeof(vk::AccelerationStructureInstanceKHR);
+    vk::BufferUsageFlags usage =
+        vkBU::eRayTracingKHR | vkBU::eShaderDeviceAddress | vkBU::eTransferDst;
+    m_instBuffer = track(createBuffer(size, usage), MemoryCategory::eTlas);
+    m_debug.setObjectName(m_instBuffer.buffer, "TLASInstances");
+    m_tlas.nbInstances = static_cast<uint32_t>(instances.size());
+    mapInstanceStaging();
+    memcpy(m_instStagingMapped, geometryInstances.data(), size);
+    cmdBuf.copyBuffer(m_instStaging.buffer, m_instBuffer.buffer, vk::BufferCopy{0, 0, size});
+
+    // Make sure the instance buffer is copied before triggering the build
+    vk::MemoryBarrier barrier(vk::AccessFlagBits::eTransferWrite,
+                              vk::AccessFlagBits::eAccelerationStructureWriteKHR);
+    cmdBuf.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer,
+                           vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR, {}, {barrier},
+                           {}, {});
+
+    cmdBuildTlas(cmdBuf, static_cast<uint32_t>(instances.size()), false, scratchAddress);
+
+    genCmdBuf.submitAndWait(cmdBuf);
+
+    resetTlasBounds(instances);
+  }
+
+  //------------------------------------------------------------------------------------------------
+  // Updating the TLAS after the instances in `dirty` were modified. Only the records of these
+  // ranges are written and copied to the instance buffer. The TLAS is then refit, or rebuilt if
+  // it was not built with eAllowUpdate or if refitting would degrade it too much (see
+  // setTlasRebuildHeuristics). The number of instances must not change.
+  // Returns true if the TLAS was rebuilt.
+  //
+  bool updateTlas(const std::vector<Instance>& instances, std::vector<InstanceRange> dirty)
+  {
+    assert(instances.size() == m_tlas.nbInstances);
+    uint32_t nbInstances = static_cast<uint32_t>(instances.size());
+
+    std::vector<InstanceRange> ranges = mergeRanges(std::move(dirty), nbInstances);
+    if(ranges.empty())
+      return false;
+
+    mapInstanceStaging();
+    uint32_t                    nbDirty{0};
+    std::vector<vk::BufferCopy> regions =
+        writeRanges(instances, ranges, m_instStagingMapped, nbDirty);
+
+    bool rebuild = needsTlasRebuild(nbDirty, nbInstances);
+
+    // Large enough for both, so alternating refits and rebuilds does not grow the scratch twice
+    vk::DeviceAddress scratchAddress =
+        getScratch(std::max(memoryRequirement(m_tlas.as.accel, vkASMR::eBuildScratch),
+                            memoryRequirement(m_tlas.as.accel, vkASMR::eUpdateScratch)));
+
+    nvvk::CommandPool genCmdBuf(m_device, m_queueIndex);
+    vk::CommandBuffer cmdBuf = genCmdBuf.createCommandBuffer();
+
+    cmdCopyAndBuildTlas(cmdBuf, m_instStaging.buffer, regions, !rebuild, scratchAddress);
+    genCmdBuf.submitAndWait(cmdBuf);
+
+    if(rebuild)
+      resetTlasBounds(instances);
+    else
+      m_tlas.nbRefits++;
+    return rebuild;
+  }
+
+  //------------------------------------------------------------------------------------------------
+  // Refit of the TLAS with new instance transformations
+  //
+  void updateTlasMatrices(const std::vector<Instance>& instances)
+  {
+    assert(instances.size() == m_tlas.nbInstances);
+    assert(m_tlas.flags & vk::BuildAccelerationStructureFlagBitsKHR::eAllowUpdate);
+    vk::DeviceSize bufferSize = instances.size() * sizeof(vk::AccelerationStructureInstanceKHR);
+
+    mapInstanceStaging();
+    for(size_t i = 0; i < instances.size(); i++)
+      m_instStagingMapped[i] = instanceToVkGeometryInstanceKHR(instances[i]);
+
+    vk::DeviceAddress scratchAddress =
+        getScratch(memoryRequirement(m_tlas.as.accel, vkASMR::eUpdateScratch));
+
+    nvvk::CommandPool genCmdBuf(m_device, m_queueIndex);
+    vk::CommandBuffer cmdBuf = genCmdBuf.createCommandBuffer();
+
+    vk::BufferCopy region{0, 0, bufferSize};
+    cmdBuf.copyBuffer(m_instStaging.buffer, m_instBuffer.buffer, region);
+
+    vk::MemoryBarrier barrier(vk::AccessFlagBits::eTransferWrite,
+                              vk::AccessFlagBits::eAccelerationStructureWriteKHR);
+    cmdBuf.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer,
+                           vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR, {}, {barrier},
+                           {}, {});
+
+    cmdBuildTlas(cmdBuf, static_cast<uint32_t>(instances.size()), true, scratchAddress);
+    genCmdBuf.submitAndWait(cmdBuf);
+  }
+
+  // Freeing the shared scratch buffer, allocated again by the next build or update
+  void releaseScratch()
+  {
+    destroyTracked(m_scratch, MemoryCategory::eScratch);
+    m_scratchSize    = 0;
+    m_scratchAddress = 0;
+  }
+
+  //------------------------------------------------------------------------------------------------
+  // Recording the updates in a user command buffer, without waiting: used when the updates are
+  // submitted with the frame, or on another queue. The caller provides the scratch memory (see
+  // get*UpdateScratchSize) and the synchronization around the commands.
+  //
+  vk::DeviceSize getBlasUpdateScratchSize(uint32_t blasIdx)
+  {
+    return alignScratch(memoryRequirement(m_blas[blasIdx].as.accel, vkASMR::eUpdateScratch));
+  }
+  // Large enough for cmdUpdateTlas, which may also rebuild the TLAS
+  vk::DeviceSize getTlasUpdateScratchSize()
+  {
+    return alignScratch(std::max(memoryRequirement(m_tlas.as.accel, vkASMR::eBuildScratch),
+                                 memoryRequirement(m_tlas.as.accel, vkASMR::eUpdateScratch)));
+  }
+
+  void cmdUpdateBlas(const vk::CommandBuffer& cmdBuf,
+                     uint32_t                 blasIdx,
+                     vk::DeviceAddress        scratchAddress)
+  {
+    assert(m_blas[blasIdx].flags & vk::BuildAccelerationStructureFlagBitsKHR::eAllowUpdate);
+    cmdBuildBlas(cmdBuf, m_blas[blasIdx], true, scratchAddress);
+  }
+
+  // Writing the Vulkan instances, for example in mapped memory used by cmdUpdateTlas
+  void writeInstances(const std::vector<Instance>&          instances,
+                      vk::AccelerationStructureInstanceKHR* dst)
+  {
+    for(size_t i = 0; i < instances.size(); i++)
+      dst[i] = instanceToVkGeometryInstanceKHR(instances[i]);
+  }
+
+  // Updating the TLAS from the records written by the caller in `srcBuffer`, laid out as the
+  // instance buffer from `srcOffset`, for example in memory shared with another queue. Only the
+  // records of `dirty` are copied: the others must not have changed since the previous update by
+  // this builder. The TLAS is refit or rebuilt as in updateTlas, the scratch memory is provided by
+  // the caller (see getTlasUpdateScratchSize).
+  // Returns true if the TLAS was rebuilt.
+  //
+  bool cmdUpdateTlas(const vk::CommandBuffer&     cmdBuf,
+                     vk::Buffer                   srcBuffer,
+                     vk::DeviceSize               srcOffset,
+                     const std::vector<Instance>& instances,
+                     std::vector<InstanceRange>   dirty,
+                     vk::DeviceAddress            scratchAddress)
+  {
+    assert(instances.size() == m_tlas.nbInstances);
+    uint32_t                   nbInstances = static_cast<uint32_t>(instances.size());
+    std::vector<InstanceRange> ranges      = mergeRanges(std::move(dirty), nbInstances);
+    if(ranges.empty())
+      return false;
+
+    vk::DeviceSize              instSize = sizeof(vk::AccelerationStructureInstanceKHR);
+    std::vector<vk::BufferCopy> regions;
+    uint32_t                    nbDirty{0};
+    for(const auto& r : ranges)
+    {
+      for(uint32_t i = r.first; i < r.first + r.count; i++)
+        growTlasBounds(instances[i]);
+      regions.emplace_back(srcOffset + r.first * instSize, r.first * instSize, r.count * instSize);
+      nbDirty += r.count;
+    }
+    bool rebuild = needsTlasRebuild(nbDirty, nbInstances);
+    cmdCopyAndBuildTlas(cmdBuf, srcBuffer, regions, !rebuild, scratchAddress);
+
+    if(rebuild)
+      resetTlasBounds(instances);
+    else
+      m_tlas.nbRefits++;
+    return rebuild;
+  }
+
+  //------------------------------------------------------------------------------------------------
+  // Same as updateTlas, but recorded in the command buffer of a frame instead of waiting for the
+  // GPU. The records are written in the staging buffer of `frameSlot`, one per frame in flight:
+  // the caller only reuses a slot once the fence of the frame which last used it was signaled.
+  // The commands wait for the previous traces and builds, and are followed by a barrier to the
+  // ray tracing and compute shaders.
+  // Returns true if the TLAS was rebuilt.
+  //
+  bool cmdUpdateTlas(const vk::CommandBuffer&     cmdBuf,
+                     uint32_t                     frameSlot,
+                     const std::vector<Instance>& instances,
+                     std::vector<InstanceRange>   dirty)
+  {
+    assert(instances.size() == m_tlas.nbInstances);
+    uint32_t                   nbInstances = static_cast<uint32_t>(instances.size());
+    std::vector<InstanceRange> ranges      = mergeRanges(std::move(dirty), nbInstances);
+    if(ranges.empty())
+      return false;
+
+    InstanceRing&               ring = mapInstanceRing(frameSlot);
+    uint32_t                    nbDirty{0};
+    std::vector<vk::BufferCopy> regions = writeRanges(instances, ranges, ring.mapped, nbDirty);
+    bool                        rebuild = needsTlasRebuild(nbDirty, nbInstances);
+
+    // Own scratch, the synchronous builds may release the shared one while a frame is in flight.
+    // The builds of consecutive frames are serialized by the barrier of cmdCopyAndBuildTlas.
+    if(!m_ringScratch.buffer)
+    {
+      vk::DeviceSize size = std::max(memoryRequirement(m_tlas.as.accel, vkASMR::eBuildScratch),
+                                     memoryRequirement(m_tlas.as.accel, vkASMR::eUpdateScratch));
+      m_ringScratch = track(createBuffer(size, vkBU::eRayTracingKHR | vkBU::eShaderDeviceAddress),
+                            MemoryCategory::eScratch);
+      m_debug.setObjectName(m_ringScratch.buffer, "TLASRingScratch");
+      m_ringScratchAddress = m_device.getBufferAddress({m_ringScratch.buffer});
+    }
+    cmdCopyAndBuildTlas(cmdBuf, ring.buffer.buffer, regions, !rebuild, m_ringScratchAddress);
+
+    vk::MemoryBarrier barrier(vk::AccessFlagBits::eAccelerationStructureWriteKHR,
+                              vk::AccessFlagBits::eAccelerationStructureReadKHR);
+    cmdBuf.pipelineBarrier(vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR,
+                           vk::PipelineStageFlagBits::eRayTracingShaderKHR
+                               | vk::PipelineStageFlagBits::eComputeShader,
+                           {}, {barrier}, {}, {});
+
+    if(rebuild)
+      resetTlasBounds(instances);
+    else
+      m_tlas.nbRefits++;
+    return rebuild;
+  }
+
+protected:
+  // Scratch addresses are kept aligned when sub-allocated
+  static vk::DeviceSize alignScratch(vk::DeviceSize size)
+  {
+    const vk::DeviceSize alignment = 256;
+    return (size + alignment - 1) & ~(alignment - 1);
+  }
+
+  vk::DeviceSize memoryRequirement(vk::AccelerationStructureKHR                        accel,
+                                   vk::AccelerationStructureMemoryRequirementsTypeKHR type)
+  {
+    vk::AccelerationStructureMemoryRequirementsInfoKHR memoryRequirementsInfo{
+        type, vk::AccelerationStructureBuildTypeKHR::eDevice, accel};
+    return m_device.getAccelerationStructureMemoryRequirementsKHR(memoryRequirementsInfo)
+        .memoryRequirements.size;
+  }
+
+  // Address of the shared scratch buffer, reallocated if smaller than `size`. All builds wait for
+  // their completion, so the previous content is never in use.
+  vk::DeviceAddress getScratch(vk::DeviceSize size)
+  {
+    if(size > m_scratchSize)
+    {
+      releaseScratch();
+      m_scratch = track(createBuffer(size, vkBU::eRayTracingKHR | vkBU::eShaderDeviceAddress),
+                        MemoryCategory::eScratch);
+      m_debug.setObjectName(m_scratch.buffer, "ASScratch");
+      m_scratchSize    = size;
+      m_scratchAddress = m_device.getBufferAddress({m_scratch.buffer});
+    }
+    return m_scratchAddress;
+  }
+
+  // Sorting and merging the overlapping or contiguous ranges, clamped to the instances
+  static std::vector<InstanceRange> mergeRanges(std::vector<InstanceRange> dirty,
+                                                uint32_t                   nbInstances)
+  {
+    std::sort(dirty.begin(), dirty.end(), [](const InstanceRange& a, const InstanceRange& b) {
+      return a.first < b.first;
+    });
+    std::vector<InstanceRange> ranges;
+    for(auto r : dirty)
+    {
+      r.count = std::min(r.first + r.count, nbInstances) - std::min(r.first, nbInstances);
+      if(r.count == 0)
+        continue;
+      if(!ranges.empty() && r.first <= ranges.back().first + ranges.back().count)
+      {
+        InstanceRange& last = ranges.back();
+        last.count          = std::max(last.first + last.count, r.first + r.count) - last.first;
+      }
+      else
+        ranges.push_back(r);
+    }
+    return ranges;
+  }
+
+  // Writing the records of `ranges` in `dst`, laid out as the instance buffer, and returning the
+  // regions to copy. The bounds of the TLAS grow with the written instances.
+  std::vector<vk::BufferCopy> writeRanges(const std::vector<Instance>&          instances,
+                                          const std::vector<InstanceRange>&     ranges,
+                                          vk::AccelerationStructureInstanceKHR* dst,
+                                          uint32_t&                             nbDirty)
+  {
+    vk::DeviceSize              instSize = sizeof(vk::AccelerationStructureInstanceKHR);
+    std::vector<vk::BufferCopy> regions;
+    for(const auto& r : ranges)
+    {
+      for(uint32_t i = r.first; i < r.first + r.count; i++)
+      {
+        dst[i] = instanceToVkGeometryInstanceKHR(instances[i]);
+        growTlasBounds(instances[i]);
+      }
+      regions.emplace_back(r.first * instSize, r.first * instSize, r.count * instSize);
+      nbDirty += r.count;
+    }
+    return regions;
+  }
+
+  // Refit or rebuild, see setTlasRebuildHeuristics
+  bool needsTlasRebuild(uint32_t nbDirty, uint32_t nbInstances) const
+  {
+    return !(m_tlas.flags & vk::BuildAccelerationStructureFlagBitsKHR::eAllowUpdate)
+           || nbDirty > m_rebuildDirtyFraction * nbInstances
+           || m_tlas.nbRefits >= m_rebuildMaxRefits
+           || (m_tlas.builtDiagonal > 0.f
+               && nvmath::length(m_tlas.boundsMax - m_tlas.boundsMin)
+                      > m_rebuildBoundsGrowth * m_tlas.builtDiagonal);
+  }
+
+  // Copying `regions` of `srcBuffer` to the instance buffer and building the TLAS
+  void cmdCopyAndBuildTlas(const vk::CommandBuffer&           cmdBuf,
+                           vk::Buffer                         srcBuffer,
+                           const std::vector<vk::BufferCopy>& regions,
+                           bool                               update,
+                           vk::DeviceAddress                  scratchAddress)
+  {
+    // The frames submitted before may still trace the TLAS, for example between two updates of
+    // the levels of detail while the camera moves
+    vk::MemoryBarrier traceBarrier(vk::AccessFlagBits::eAccelerationStructureReadKHR
+                                       | vk::AccessFlagBits::eAccelerationStructureWriteKHR,
+                                   vk::AccessFlagBits::eTransferWrite
+                                       | vk::AccessFlagBits::eAccelerationStructureWriteKHR);
+    cmdBuf.pipelineBarrier(vk::PipelineStageFlagBits::eRayTracingShaderKHR
+                               | vk::PipelineStageFlagBits::eComputeShader
+                               | vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR,
+                           vk::PipelineStageFlagBits::eTransfer
+                               | vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR,
+                           {}, {traceBarrier}, {}, {});
+    cmdBuf.copyBuffer(srcBuffer, m_instBuffer.buffer, regions);
+
+    vk::MemoryBarrier barrier(vk::AccessFlagBits::eTransferWrite,
+                              vk::AccessFlagBits::eAccelerationStructureWriteKHR);
+    cmdBuf.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer,
+                           vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR, {}, {barrier},
+                           {}, {});
+
+    cmdBuildTlas(cmdBuf, m_tlas.nbInstances, update, scratchAddress);
+  }
+
+  // Staging buffer of a frame in flight, created and mapped on first use
+  struct InstanceRing
+  {
+    nvvk::Buffer                          buffer;
+    vk::AccelerationStructureInstanceKHR* mapped{nullptr};
+  };
+  InstanceRing& mapInstanceRing(uint32_t frameSlot)
+  {
+    if(frameSlot >= m_instRing.size())
+      m_instRing.resize(frameSlot + 1);
+    InstanceRing& ring = m_instRing[frameSlot];
+    if(ring.mapped != nullptr)
+      return ring;
+    vk::DeviceSize size = m_tlas.nbInstances * sizeof(vk::AccelerationStructureInstanceKHR);
+    ring.buffer         = track(
+        createBuffer(size, vkBU::eTransferSrc, vkMP::eHostVisible | vkMP::eHostCoherent),
+        MemoryCategory::eStaging);
+    ring.mapped =
+        reinterpret_cast<vk::AccelerationStructureInstanceKHR*>(m_alloc->map(ring.buffer));
+    m_debug.setObjectName(ring.buffer.buffer, "TLASInstancesRing");
+    return ring;
+  }
+
+  // Persistent staging buffer of the instances, matching the layout of the instance buffer
+  void mapInstanceStaging()
+  {
+    if(m_instStagingMapped != nullptr)
+      return;
+    vk::DeviceSize size = m_tlas.nbInstances * sizeof(vk::AccelerationStructureInstanceKHR);
+    m_instStaging       = track(
+        createBuffer(size, vkBU::eTransferSrc, vkMP::eHostVisible | vkMP::eHostCoherent),
+        MemoryCategory::eStaging);
+    m_instStagingMapped =
+        reinterpret_cast<vk::AccelerationStructureInstanceKHR*>(m_alloc->map(m_instStaging));
+    m_debug.setObjectName(m_instStaging.buffer, "TLASInstancesStaging");
+  }
+
+  // Buffer shared by the queue families of setQueueFamilies, if several
+  nvvk::Buffer createBuffer(vk::DeviceSize          size,
+                            vk::BufferUsageFlags    usage,
+                            vk::MemoryPropertyFlags memProps = vkMP::eDeviceLocal)
+  {
+    vk::BufferCreateInfo info{{}, size, usage};
+    if(m_queueFamilies.size() > 1)
+    {
+      info.setSharingMode(vk::SharingMode::eConcurrent);
+      info.setQueueFamilyIndexCount(static_cast<uint32_t>(m_queueFamilies.size()));
+      info.setPQueueFamilyIndices(m_queueFamilies.data());
+    }
+    return m_alloc->createBuffer(info, memProps);
+  }
+
+  // Reporting the memory of the resources to MemoryStats
+  nvvk::Buffer track(nvvk::Buffer buffer, MemoryCategory category)
+  {
+    MemoryStats::shared().add(category, MemoryStats::sizeOf(m_device, buffer.buffer));
+    return buffer;
+  }
+  nvvk::AccelKHR track(nvvk::AccelKHR as, MemoryCategory category)
+  {
+    MemoryStats::shared().add(category, memoryRequirement(as.accel, vkASMR::eObject));
+    return as;
+  }
+  void destroyTracked(nvvk::Buffer& buffer, MemoryCategory category)
+  {
+    MemoryStats::shared().remove(category, MemoryStats::sizeOf(m_device, buffer.buffer));
+    m_alloc->destroy(buffer);
+  }
+  void destroyTracked(nvvk::AccelKHR& as, MemoryCategory category)
+  {
+    if(as.accel)
+      MemoryStats::shared().remove(category, memoryRequirement(as.accel, vkASMR::eObject));
+    m_alloc->destroy(as);
+  }
+
+  //------------------------------------------------------------------------------------------------
+  // BLAS cache: a header, the size of each serialized BLAS, then the serialized BLAS. Each one
+  // starts with the driver and compatibility UUIDs checked by the driver, then its serialized and
+  // deserialized sizes.
+  //
+  struct BlasCacheHeader
+  {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t key;
+    uint64_t nbBlas;
+  };
+  static const uint32_t kBlasCacheMagic   = 0x53414c42;  // "BLAS"
+  static const uint32_t kBlasCacheVersion = 1;
+
+  // Key of the user, combined with everything the builder knows of the BLAS
+  uint64_t blasCacheKey() const
+  {
+    uint64_t hash = 14695981039346656037ull;  // FNV-1a, on 64-bit values
+    auto     mix  = [&hash](uint64_t v) { hash = (hash ^ v) * 1099511628211ull; };
+    mix(m_cacheKey);
+    mix(m_compact ? 1 : 0);
+    mix(m_blas.size());
+    for(const auto& b : m_blas)
+    {
+      mix(static_cast<VkBuildAccelerationStructureFlagsKHR>(b.flags));
+      for(const auto& g : b.asGeometry)
+        mix(static_cast<VkGeometryFlagsKHR>(g.flags));
+      for(const auto& g : b.asCreateGeometryInfo)
+      {
+        mix(static_cast<uint64_t>(g.geometryType));
+        mix(g.maxPrimitiveCount);
+        mix(static_cast<uint64_t>(g.indexType));
+        mix(g.maxVertexCount);
+        mix(static_cast<uint64_t>(g.vertexFormat));
+        mix(g.allowsTransforms);
+      }
+      for(const auto& o : b.asBuildOffsetInfo)
+      {
+        mix(o.primitiveCount);
+        mix(o.primitiveOffset);
+        mix(o.firstVertex);
+      }
+    }
+    return hash;
+  }
+
+  // Host visible memory for the serialization copies
+  nvvk::Buffer createSerializationBuffer(vk::DeviceSize size)
+  {
+    return track(m_alloc->createBuffer(size, vkBU::eRayTracingKHR | vkBU::eShaderDeviceAddress,
+                                       vk::MemoryPropertyFlagBits::eHostVisible
+                                           | vk::MemoryPropertyFlagBits::eHostCoherent),
+                 MemoryCategory::eStaging);
+  }
+
+  void saveBlasCache(uint64_t key)
+  {
+    const uint32_t                            count = static_cast<uint32_t>(m_blas.size());
+    std::vector<vk::AccelerationStructureKHR> accels;
+    for(const auto& b : m_blas)
+      accels.push_back(b.as.accel);
+
+    // Serialized sizes
+    nvvk::CommandPool genCmdBuf(m_device, m_queueIndex);
+    vk::QueryPool     queryPool = m_device.createQueryPool(
+        {{}, vk::QueryType::eAccelerationStructureSerializationSizeKHR, count});
+    vk::CommandBuffer cmdBuf = genCmdBuf.createCommandBuffer();
+    cmdBuf.resetQueryPool(queryPool, 0, count);
+    cmdBuf.writeAccelerationStructuresPropertiesKHR(
+        accels, vk::QueryType::eAccelerationStructureSerializationSizeKHR, queryPool, 0);
+    genCmdBuf.submitAndWait(cmdBuf);
+    std::vector<uint64_t> sizes(count);
+    m_device.getQueryPoolResults<uint64_t>(queryPool, 0, count, sizes, sizeof(uint64_t),
+                                           vk::QueryResultFlagBits::e64
+                                               | vk::QueryResultFlagBits::eWait);
+    m_device.destroyQueryPool(queryPool);
+
+    std::vector<vk::DeviceSize> offsets(count);
+    vk::DeviceSize              total{0};
+    for(uint32_t i = 0; i < count; i++)
+    {
+      offsets[i] = total;
+      total += alignScratch(sizes[i]);
+    }
+
+    // Serializing all BLAS to host memory
+    nvvk::Buffer      readback = createSerializationBuffer(total);
+    vk::DeviceAddress address  = m_device.getBufferAddress({readback.buffer});
+    cmdBuf                     = genCmdBuf.createCommandBuffer();
+    for(uint32_t i = 0; i < count; i++)
+    {
+      vk::CopyAccelerationStructureToMemoryInfoKHR copyInfo;
+      copyInfo.setSrc(accels[i]);
+      copyInfo.dst.setDeviceAddress(address + offsets[i]);
+      copyInfo.setMode(vk::CopyAccelerationStructureModeKHR::eSerialize);
+      cmdBuf.copyAccelerationStructureToMemoryKHR(&copyInfo);
+    }
+    vk::MemoryBarrier barrier(vk::AccessFlagBits::eTransferWrite, vk::AccessFlagBits::eHostRead);
+    cmdBuf.pipelineBarrier(vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR,
+                           vk::PipelineStageFlagBits::eHost, {}, {barrier}, {}, {});
+    genCmdBuf.submitAndWait(cmdBuf);
+
+    // Writing to a temporary file first, so an interrupted write never leaves a valid header
+    BlasCacheHeader header{kBlasCacheMagic, kBlasCacheVersion, key, count};
+    std::string     tmpName = m_cacheFile + ".tmp";
+    FILE*           fp      = fopen(tmpName.c_str(), "wb");
+    bool            written = fp != nullptr;
+    if(fp)
+    {
+      const uint8_t* data = reinterpret_cast<const uint8_t*>(m_alloc->map(readback));
+      written             = fwrite(&header, sizeof(header), 1, fp) == 1
+                && fwrite(sizes.data(), sizeof(uint64_t), count, fp) == count;
+      for(uint32_t i = 0; i < count && written; i++)
+        written = fwrite(data + offsets[i], 1, sizes[i], fp) == sizes[i];
+      m_alloc->unmap(readback);
+      written = fclose(fp) == 0 && written;
+    }
+    destroyTracked(readback, MemoryCategory::eStaging);
+
+    std::remove(m_cacheFile.c_str());
+    if(written && std::rename(tmpName.c_str(), m_cacheFile.c_str()) == 0)
+      LOGI("BLAS cache: %d BLAS (%d KB) written to %s\n", int(count), int(total / 1024),
+           m_cacheFile.c_str());
+    else
+    {
+      std::remove(tmpName.c_str());
+      LOGW("BLAS cache: cannot write %s\n", m_cacheFile.c_str());
+    }
+  }
+
+  // Creating m_blas from the cache, false if it is missing, outdated or incompatible
+  bool loadBlasCache(uint64_t key)
+  {
+    const size_t kBlobHeader = 2 * VK_UUID_SIZE + 3 * sizeof(uint64_t);
+
+    BlasCacheHeader       header{};
+    std::vector<uint64_t> sizes;
+    std::vector<uint8_t>  data;
+    FILE*                 fp = fopen(m_cacheFile.c_str(), "rb");
+    long                  fileSize{0};
+    if(fp != nullptr && fseek(fp, 0, SEEK_END) == 0)
+    {
+      fileSize = ftell(fp);
+      rewind(fp);
+    }
+    bool valid = fp != nullptr && fread(&header, sizeof(header), 1, fp) == 1
+                 && header.magic == kBlasCacheMagic && header.version == kBlasCacheVersion
+                 && header.key == key && header.nbBlas == m_blas.size();
+    if(valid)
+    {
+      sizes.resize(m_blas.size());
+      valid = fread(sizes.data(), sizeof(uint64_t), sizes.size(), fp) == sizes.size();
+    }
+    // The sizes are bounded by the rest of the file before allocating anything: a truncated or
+    // corrupted file must not trigger a huge allocation
+    uint64_t remaining = static_cast<uint64_t>(std::max(fileSize, 0L));
+    remaining -= std::min(remaining, uint64_t(sizeof(header) + sizes.size() * sizeof(uint64_t)));
+    std::vector<vk::DeviceSize> offsets(sizes.size());
+    vk::DeviceSize              total{0};
+    for(size_t i = 0; i < sizes.size() && valid; i++)
+    {
+      valid = sizes[i] >= kBlobHeader && sizes[i] <= remaining;
+      if(valid)
+      {
+        offsets[i] = total;
+        total += alignScratch(sizes[i]);
+        remaining -= sizes[i];
+      }
+    }
+    if(valid)
+    {
+      data.resize(total);
+      for(size_t i = 0; i < sizes.size() && valid; i++)
+        valid = fread(data.data() + offsets[i], 1, sizes[i], fp) == sizes[i];
+    }
+    if(fp)
+      fclose(fp);
+    if(!valid)
+    {
+      LOGI("BLAS cache: %s is missing or outdated\n", m_cacheFile.c_str());
+      return false;
+    }
+
+    // Each blob starts with the version data of the driver which serialized it
+    try
+    {
+      for(size_t i = 0; i < sizes.size(); i++)
+      {
+        vk::AccelerationStructureVersionKHR version;
+        version.setVersionData(data.data() + offsets[i]);
+        m_device.getAccelerationStructureCompatibilityKHR(version);
+      }
+    }
+    catch(const vk::SystemError&)
+    {
+      LOGI("BLAS cache: %s was written by an incompatible driver\n", m_cacheFile.c_str());
+      return false;
+    }
+
+    nvvk::Buffer staging = createSerializationBuffer(total);
+    memcpy(m_alloc->map(staging), data.data(), total);
+    m_alloc->unmap(staging);
+    vk::DeviceAddress address = m_device.getBufferAddress({staging.buffer});
+
+    nvvk::CommandPool genCmdBuf(m_device, m_queueIndex);
+    vk::CommandBuffer cmdBuf = genCmdBuf.createCommandBuffer();
+    for(size_t i = 0; i < m_blas.size(); i++)
+    {
+      uint64_t deserializedSize;
+      memcpy(&deserializedSize, data.data() + offsets[i] + 2 * VK_UUID_SIZE + sizeof(uint64_t),
+             sizeof(uint64_t));
+
+      Blas&                                  blas = m_blas[i];
+      vk::AccelerationStructureCreateInfoKHR asCreateInfo{
+          {}, vk::AccelerationStructureTypeKHR::eBottomLevel};
+      asCreateInfo.setCompactedSize(deserializedSize);
+      asCreateInfo.setFlags(blas.flags);
+      blas.as = track(m_alloc->createAcceleration(asCreateInfo), MemoryCategory::eBlas);
+      m_debug.setObjectName(blas.as.accel, (std::string("Blas" + std::to_string(i)).c_str()));
+
+      vk::CopyMemoryToAccelerationStructureInfoKHR copyInfo;
+      copyInfo.src.setDeviceAddress(address + offsets[i]);
+      copyInfo.setDst(blas.as.accel);
+      copyInfo.setMode(vk::CopyAccelerationStructureModeKHR::eDeserialize);
+      cmdBuf.copyMemoryToAccelerationStructureKHR(&copyInfo);
+    }
+    genCmdBuf.submitAndWait(cmdBuf);
+    destroyTracked(staging, MemoryCategory::eStaging);
+
+    LOGI("BLAS: %d loaded from %s (%d KB)\n", int(m_blas.size()), m_cacheFile.c_str(),
+         int(total / 1024));
+    return true;
+  }
+
+  // Recording the build, or the update, of a BLAS
+  void cmdBuildBlas(const vk::CommandBuffer& cmdBuf,
+                    const Blas&              blas,
+                    bool                     update,
+                    vk::DeviceAddress        scratchAddress)
+  {
+    const vk::AccelerationStructureGeometryKHR*   pGeometry = blas.asGeometry.data();
+    vk::AccelerationStructureBuildGeometryInfoKHR asInfo{
+        vk::AccelerationStructureTypeKHR::eBottomLevel};
+    asInfo.setFlags(blas.flags);
+    asInfo.setUpdate(update);
+    asInfo.setSrcAccelerationStructure(update ? blas.as.accel : vk::AccelerationStructureKHR());
+    asInfo.setDstAccelerationStructure(blas.as.accel);
+    asInfo.setGeometryArrayOfPointers(VK_FALSE);
+    asInfo.setGeometryCount((uint32_t)blas.asGeometry.size());
+    asInfo.setPpGeometries(&pGeometry);
+    asInfo.scratchData.setDeviceAddress(scratchAddress);
+
+    std::vector<const vk::AccelerationStructureBuildOffsetInfoKHR*> pBuildOffset(
+        blas.asBuildOffsetInfo.size());
+    for(size_t i = 0; i < blas.asBuildOffsetInfo.size(); i++)
+      pBuildOffset[i] = &blas.asBuildOffsetInfo[i];
+
+    cmdBuf.buildAccelerationStructureKHR(asInfo, pBuildOffset);
+  }
+
+  // Recording the build, or the update, of the TLAS from the instance buffer
+  void cmdBuildTlas(const vk::CommandBuffer& cmdBuf,
+                    uint32_t                 nbInstances,
+                    bool                     update,
+                    vk::DeviceAddress        scratchAddress)
+  {
+    vk::AccelerationStructureGeometryKHR topASGeometry{vk::GeometryTypeKHR::eInstances};
+    topASGeometry.geometry.instances.setArrayOfPointers(VK_FALSE);
+    topASGeometry.geometry.instances.setData(m_device.getBufferAddress({m_instBuffer.buffer}));
+    const vk::AccelerationStructureGeometryKHR* pGeometry = &topASGeometry;
+
+    vk::AccelerationStructureBuildGeometryInfoKHR topASInfo;
+    topASInfo.setFlags(m_tlas.flags);
+    topASInfo.setUpdate(update);
+    topASInfo.setSrcAccelerationStructure(update ? m_tlas.as.accel
+                                                 : vk::AccelerationStructureKHR());
+    topASInfo.setDstAccelerationStructure(m_tlas.as.accel);
+    topASInfo.setGeometryArrayOfPointers(VK_FALSE);
+    topASInfo.setGeometryCount(1);
+    topASInfo.setPpGeometries(&pGeometry);
+    topASInfo.scratchData.setDeviceAddress(scratchAddress);
+
+    vk::AccelerationStructureBuildOffsetInfoKHR        buildOffsetInfo{nbInstances, 0, 0, 0};
+    const vk::AccelerationStructureBuildOffsetInfoKHR* pBuildOffsetInfo = &buildOffsetInfo;
+    cmdBuf.buildAccelerationStructureKHR(1, &topASInfo, &pBuildOffsetInfo);
+  }
+
+  // Bounds of the instance origins, tracked to detect when a refit degrades the TLAS
+  static nvmath::vec3f instanceOrigin(const Instance& instance)
+  {
+    nvmath::vec4f origin = instance.transform * nvmath::vec4f(0.f, 0.f, 0.f, 1.f);
+    return nvmath::vec3f(origin.x, origin.y, origin.z);
+  }
+
+  void resetTlasBounds(const std::vector<Instance>& instances)
+  {
+    const float fmax   = std::numeric_limits<float>::max();
+    m_tlas.nbInstances = static_cast<uint32_t>(instances.size());
+    m_tlas.nbRefits    = 0;
+    m_tlas.boundsMin   = nvmath::vec3f(fmax, fmax, fmax);
+    m_tlas.boundsMax   = nvmath::vec3f(-fmax, -fmax, -fmax);
+    for(const auto& inst : instances)
+      growTlasBounds(inst);
+    m_tlas.builtDiagonal =
+        instances.empty() ? 0.f : nvmath::length(m_tlas.boundsMax - m_tlas.boundsMin);
+  }
+
+  void growTlasBounds(const Instance& instance)
+  {
+    nvmath::vec3f p = instanceOrigin(instance);
+    for(int i = 0; i < 3; i++)
+    {
+      m_tlas.boundsMin[i] = std::min(m_tlas.boundsMin[i], p[i]);
+      m_tlas.boundsMax[i] = std::max(m_tlas.boundsMax[i], p[i]);
+    }
+  }
+
+  struct Tlas
+  {
+    nvvk::AccelKHR                         as;
+    vk::BuildAccelerationStructureFlagsKHR flags;
+    uint32_t                               nbInstances{0};
+    uint32_t                               nbRefits{0};  // Since the last build
+    nvmath::vec3f                          boundsMin;
+    nvmath::vec3f                          boundsMax;
+    float                                  builtDiagonal{0.f};  // At the last build
+  };
+
+  std::vector<Blas> m_blas;
+  Tlas              m_tlas;
+  nvvk::Buffer      m_instBuffer;
+
+  // updateTlas and updateTlasMatrices
+  nvvk::Buffer                          m_instStaging;
+  vk::AccelerationStructureInstanceKHR* m_instStagingMapped{nullptr};
+  float                                 m_rebuildDirtyFraction{0.5f};
+  float                                 m_rebuildBoundsGrowth{1.5f};
+  uint32_t                              m_rebuildMaxRefits{256};
+
+  // cmdUpdateTlas of the frames in flight
+  std::vector<InstanceRing> m_instRing;
+  nvvk::Buffer              m_ringScratch;
+  vk::DeviceAddress         m_ringScratchAddress{0};
+
+  vk::Device            m_device;
+  uint32_t              m_queueIndex{0};
+  std::vector<uint32_t> m_queueFamilies;  // See setQueueFamilies
+  nvvk::Allocator*      m_alloc{nullptr};
+  nvvk::DebugUtil       m_debug;
+
+  // Shared by all builds and updates
+  nvvk::Buffer      m_scratch;
+  vk::DeviceSize    m_scratchSize{0};
+  vk::DeviceAddress m_scratchAddress{0};
+
+  vk::DeviceSize m_scratchBudget{256ull * 1024 * 1024};
+  bool           m_compact{false};
+  std::string    m_cacheFile;
+  uint64_t       m_cacheKey{0};
+};
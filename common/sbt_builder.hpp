@@ -0,0 +1,187 @@
+/******************************************************************************
+ * Copyright 1998-2018 NVIDIA Corp. All Rights Reserved.
+ *****************************************************************************/
+
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <vector>
+
+#include "memory_stats.hpp"
+#include "nvvk/allocator_vk.hpp"
+#include "nvvk/commands_vk.hpp"
+
+//--------------------------------------------------------------------------------------------------
+// Shader binding table of a ray tracing pipeline, with optional data after each handle
+// - addGroup() is called for each group of the pipeline, in the order of the pipeline, with its
+//   kind and the data of its record (the shaders read it as shaderRecordEXT)
+// - create() writes the handles of a pipeline and the data in a new buffer. The records of a kind
+//   are contiguous, with the stride of the largest record of the kind, and each kind starts at
+//   shaderGroupBaseAlignment.
+// - Without waiting for the queue: createBuffer() allocates the table, filled by cmdUpload() in a
+//   command buffer of the caller with the bytes of table()
+// - region() gives the regions of a table passed to traceRaysKHR
+//
+// Hit groups are selected by the instances (hitGroupId) in the order they were added, the table
+// layout only depends on the groups: several pipelines with the same groups, for example with
+// other specialization constants, share the regions.
+//
+// The allocator is nvvk::Allocator, selected by NVVK_ALLOC_* before including this file.
+//
+class SbtBuilder
+{
+public:
+  enum Kind
+  {
+    eRaygen,
+    eMiss,
+    eHit,
+    eCallable,
+    eNbKinds
+  };
+
+  void setup(const vk::Device&                                device,
+             nvvk::Allocator*                                 allocator,
+             uint32_t                                         queueIndex,
+             const vk::PhysicalDeviceRayTracingPropertiesKHR& properties)
+  {
+    m_device     = device;
+    m_alloc      = allocator;
+    m_queueIndex = queueIndex;
+    m_properties = properties;
+  }
+
+  void clear()
+  {
+    m_groups.clear();
+    updateLayout();
+  }
+
+  // `groupIndex` is the index of the group in the pipeline
+  void addGroup(Kind kind, uint32_t groupIndex, const void* data = nullptr, size_t dataSize = 0)
+  {
+    Group group{kind, groupIndex, {}};
+    if(data != nullptr)
+      group.data.assign(static_cast<const uint8_t*>(data),
+                        static_cast<const uint8_t*>(data) + dataSize);
+    m_groups.push_back(group);
+    updateLayout();
+  }
+
+  // Table of `pipeline`, which has `groupCount` groups. The caller destroys the buffer and
+  // removes it from MemoryStats (category eSbt).
+  nvvk::Buffer create(const vk::Pipeline& pipeline, uint32_t groupCount)
+  {
+    nvvk::CommandPool genCmdBuf(m_device, m_queueIndex);
+    vk::CommandBuffer cmdBuf = genCmdBuf.createCommandBuffer();
+    nvvk::Buffer      buffer = m_alloc->createBuffer(cmdBuf, table(pipeline, groupCount),
+                                                vk::BufferUsageFlagBits::eRayTracingKHR);
+    genCmdBuf.submitAndWait(cmdBuf);
+    m_alloc->finalizeAndReleaseStaging();
+    MemoryStats::shared().add(MemoryCategory::eSbt, MemoryStats::sizeOf(m_device, buffer.buffer));
+    return buffer;
+  }
+
+  // Content of the table of `pipeline`
+  std::vector<uint8_t> table(const vk::Pipeline& pipeline, uint32_t groupCount) const
+  {
+    uint32_t             handleSize = m_properties.shaderGroupHandleSize;
+    std::vector<uint8_t> handles(groupCount * handleSize);
+    m_device.getRayTracingShaderGroupHandlesKHR(pipeline, 0, groupCount,
+                                                static_cast<uint32_t>(handles.size()),
+                                                handles.data());
+
+    std::vector<uint8_t>           data(m_tableSize, 0);
+    std::array<uint32_t, eNbKinds> written{};
+    for(const auto& g : m_groups)
+    {
+      uint8_t* record = data.data() + m_offsets[g.kind] + written[g.kind]++ * m_strides[g.kind];
+      memcpy(record, handles.data() + g.groupIndex * handleSize, handleSize);
+      if(!g.data.empty())
+        memcpy(record + handleSize, g.data.data(), g.data.size());
+    }
+    return data;
+  }
+
+  // Empty table, same ownership as create()
+  nvvk::Buffer createBuffer()
+  {
+    using vkBU = vk::BufferUsageFlagBits;
+    nvvk::Buffer buffer =
+        m_alloc->createBuffer(m_tableSize, vkBU::eRayTracingKHR | vkBU::eTransferDst);
+    MemoryStats::shared().add(MemoryCategory::eSbt, MemoryStats::sizeOf(m_device, buffer.buffer));
+    return buffer;
+  }
+
+  // Writing `table` in a buffer of createBuffer(), outside of a render pass. The table is small,
+  // it is copied in the command buffer, followed by a barrier to the ray tracing stages.
+  void cmdUpload(const vk::CommandBuffer&    cmdBuf,
+                 const nvvk::Buffer&         buffer,
+                 const std::vector<uint8_t>& table) const
+  {
+    const vk::DeviceSize kMaxUpdateSize = 65536;  // Limit of vkCmdUpdateBuffer
+    for(vk::DeviceSize offset = 0; offset < table.size(); offset += kMaxUpdateSize)
+    {
+      vk::DeviceSize size = std::min<vk::DeviceSize>(kMaxUpdateSize, table.size() - offset);
+      cmdBuf.updateBuffer(buffer.buffer, offset, size, table.data() + offset);
+    }
+    vk::MemoryBarrier barrier(vk::AccessFlagBits::eTransferWrite, vk::AccessFlagBits::eShaderRead);
+    cmdBuf.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer,
+                           vk::PipelineStageFlagBits::eRayTracingShaderKHR, {}, {barrier}, {}, {});
+  }
+
+  vk::StridedBufferRegionKHR region(Kind kind, const nvvk::Buffer& table) const
+  {
+    if(m_counts[kind] == 0)
+      return {};
+    return {table.buffer, m_offsets[kind], m_strides[kind], m_counts[kind] * m_strides[kind]};
+  }
+
+private:
+  struct Group
+  {
+    Kind                 kind;
+    uint32_t             groupIndex;
+    std::vector<uint8_t> data;
+  };
+
+  static vk::DeviceSize alignUp(vk::DeviceSize v, vk::DeviceSize a)
+  {
+    return a > 0 ? (v + a - 1) / a * a : v;
+  }
+
+  void updateLayout()
+  {
+    vk::DeviceSize handleSize = m_properties.shaderGroupHandleSize;
+    m_counts.fill(0);
+    m_strides.fill(handleSize);
+    for(const auto& g : m_groups)
+    {
+      m_counts[g.kind]++;
+      vk::DeviceSize size = alignUp(handleSize + g.data.size(), handleSize);
+      m_strides[g.kind]   = std::max(m_strides[g.kind], size);
+    }
+    m_tableSize = 0;
+    for(int k = 0; k < eNbKinds; k++)
+    {
+      m_offsets[k] = m_tableSize;
+      m_tableSize  = alignUp(m_tableSize + m_counts[k] * m_strides[k],
+                            m_properties.shaderGroupBaseAlignment);
+    }
+  }
+
+  vk::Device                                m_device;
+  nvvk::Allocator*                          m_alloc{nullptr};
+  uint32_t                                  m_queueIndex{0};
+  vk::PhysicalDeviceRayTracingPropertiesKHR m_properties;
+  std::vector<Group>                        m_groups;
+
+  std::array<vk::DeviceSize, eNbKinds> m_offsets{};
+  std::array<vk::DeviceSize, eNbKinds> m_strides{};
+  std::array<uint32_t, eNbKinds>       m_counts{};
+  vk::DeviceSize                       m_tableSize{0};
+};
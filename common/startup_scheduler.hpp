@@ -0,0 +1,219 @@
+/******************************************************************************
+ * Copyright 1998-2018 NVIDIA Corp. All Rights Reserved.
+ *****************************************************************************/
+
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "nvh/nvprint.hpp"
+#include "threadpool.hpp"
+
+//--------------------------------------------------------------------------------------------------
+// Runs the startup work of a sample concurrently on the shared thread pool
+//
+// Each task starts as soon as all the tasks it depends on are done, so the time spent in run() is
+// the longest chain of dependent tasks instead of the sum of all of them. Tasks running at the
+// same time must not use the same queue or externally synchronized objects.
+//
+// Usage:
+//   StartupScheduler scheduler;
+//   auto shaders = scheduler.add("shaders", [&] { loadShaders(); });
+//   scheduler.add("pipeline", [&] { createPipeline(); }, {shaders});
+//   scheduler.add("acceleration structures", [&] { createBlasAndTlas(); });
+//   scheduler.run();
+//
+class StartupScheduler
+{
+public:
+  using TaskId = uint32_t;
+
+  TaskId add(const std::string& name, std::function<void()> fn, std::vector<TaskId> deps = {})
+  {
+    Task task;
+    task.name = name;
+    task.fn   = std::move(fn);
+    task.deps = std::move(deps);
+    m_tasks.emplace_back(std::move(task));
+    return static_cast<TaskId>(m_tasks.size() - 1);
+  }
+
+  // Runs all tasks and blocks until they are done. If a task throws, no further task is started
+  // and the exception is rethrown once the running ones are done.
+  void run()
+  {
+    auto   start     = std::chrono::high_resolution_clock::now();
+    size_t nbStarted = 0;
+    size_t nbDone    = 0;
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while(nbDone < nbStarted || (nbStarted < m_tasks.size() && !m_error))
+    {
+      // Starting all tasks having their dependencies satisfied
+      for(size_t i = 0; i < m_tasks.size() && !m_error; i++)
+      {
+        if(m_tasks[i].state == State::eWaiting && ready(m_tasks[i]))
+        {
+          m_tasks[i].state = State::eRunning;
+          nbStarted++;
+          ThreadPool::shared().push([this, i] { execute(m_tasks[i]); });
+        }
+      }
+      // Remaining tasks depending on each other
+      if(nbDone == nbStarted)
+      {
+        assert(!"StartupScheduler: cyclic dependencies");
+        break;
+      }
+      m_doneCond.wait(lock, [&] { return countDone() > nbDone; });
+      nbDone = countDone();
+    }
+
+    double total = elapsedMs(start);
+    double sum   = 0;
+    for(const auto& t : m_tasks)
+      sum += t.timeMs;
+    LOGI("Startup: %.2f ms for %d tasks (%.2f ms if serial)\n", total, int(m_tasks.size()), sum);
+
+    std::exception_ptr error = m_error;
+    m_tasks.clear();
+    m_error = nullptr;
+    if(error)
+      std::rethrow_exception(error);
+  }
+
+private:
+  enum class State
+  {
+    eWaiting,
+    eRunning,
+    eDone
+  };
+
+  struct Task
+  {
+    std::string           name;
+    std::function<void()> fn;
+    std::vector<TaskId>   deps;
+    State                 state{State::eWaiting};
+    double                timeMs{0};
+  };
+
+  bool ready(const Task& task) const
+  {
+    for(auto d : task.deps)
+      if(m_tasks[d].state != State::eDone)
+        return false;
+    return true;
+  }
+
+  size_t countDone() const
+  {
+    size_t count = 0;
+    for(const auto& t : m_tasks)
+      count += t.state == State::eDone ? 1 : 0;
+    return count;
+  }
+
+  void execute(Task& task)
+  {
+    auto               start = std::chrono::high_resolution_clock::now();
+    std::exception_ptr error;
+    try
+    {
+      task.fn();
+    }
+    catch(...)
+    {
+      error = std::current_exception();
+    }
+    double timeMs = elapsedMs(start);
+    LOGI("Startup task %s: %.2f ms\n", task.name.c_str(), timeMs);
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      task.timeMs = timeMs;
+      task.state  = State::eDone;
+      if(error && !m_error)
+        m_error = error;
+    }
+    m_doneCond.notify_all();
+  }
+
+  static double elapsedMs(std::chrono::high_resolution_clock::time_point start)
+  {
+    return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now()
+                                                     - start)
+        .count();
+  }
+
+  std::vector<Task>       m_tasks;
+  std::mutex              m_mutex;
+  std::condition_variable m_doneCond;
+  std::exception_ptr      m_error;
+};
+
+//--------------------------------------------------------------------------------------------------
+// Creating a ray tracing pipeline through a deferred host operation
+//
+// The calling thread and idle workers of the shared pool all join the operation, so the driver can
+// spread the compilation over several threads. When the driver does not defer the creation, this
+// is the same as createRayTracingPipelinesKHR. The create info must stay valid until it returns.
+//
+inline vk::Result createRayTracingPipelineDeferred(
+    const vk::Device&                          device,
+    vk::PipelineCache                          cache,
+    const vk::RayTracingPipelineCreateInfoKHR& info,
+    vk::Pipeline&                              pipeline)
+{
+  // Destroyed by the last thread leaving the operation, the helpers can start after it is complete
+  auto deleter = [device](vk::DeferredOperationKHR* op) {
+    device.destroyDeferredOperationKHR(*op);
+    delete op;
+  };
+  std::shared_ptr<vk::DeferredOperationKHR> op(
+      new vk::DeferredOperationKHR(device.createDeferredOperationKHR()), deleter);
+
+  vk::DeferredOperationInfoKHR        deferredInfo{*op};
+  vk::RayTracingPipelineCreateInfoKHR deferredCreateInfo = info;
+  deferredInfo.setPNext(info.pNext);
+  deferredCreateInfo.setPNext(&deferredInfo);
+
+  // The handle is written when the operation completes, so it must not be a temporary
+  vk::Result result =
+      device.createRayTracingPipelinesKHR(cache, 1, &deferredCreateInfo, nullptr, &pipeline);
+  if(result != vk::Result::eOperationDeferredKHR)
+    return result;
+
+  uint32_t concurrency = device.getDeferredOperationMaxConcurrencyKHR(*op);
+  uint32_t nbHelpers   = std::min(std::max(concurrency, 1u) - 1, ThreadPool::shared().size());
+  for(uint32_t i = 0; i < nbHelpers; i++)
+  {
+    ThreadPool::shared().push([device, op] {
+      while(device.deferredOperationJoinKHR(*op) == vk::Result::eThreadIdleKHR)
+        std::this_thread::yield();
+    });
+  }
+
+  vk::Result join;
+  while((join = device.deferredOperationJoinKHR(*op)) == vk::Result::eThreadIdleKHR)
+    std::this_thread::yield();
+  // Other threads are finishing the remaining work
+  if(join == vk::Result::eThreadDoneKHR)
+  {
+    while(device.getDeferredOperationResultKHR(*op) == vk::Result::eNotReady)
+      std::this_thread::yield();
+  }
+  return device.getDeferredOperationResultKHR(*op);
+}
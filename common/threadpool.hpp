@@ -0,0 +1,152 @@
+/******************************************************************************
+ * Copyright 1998-2018 NVIDIA Corp. All Rights Reserved.
+ *****************************************************************************/
+
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+//--------------------------------------------------------------------------------------------------
+// Minimal pool of worker threads
+// - push() queues a job and returns a future on its result
+// - wait() blocks until all queued jobs are done
+// - parallelFor() splits [0, count) in chunks and blocks until all of them are done
+//
+// Jobs must not wait on other jobs of the same pool, as all workers could end up waiting.
+// parallelFor() can be called from a job: the calling thread runs the chunks that no worker has
+// started, and only waits for the ones in progress.
+//
+class ThreadPool
+{
+public:
+  explicit ThreadPool(uint32_t nbThreads = 0)
+  {
+    if(nbThreads == 0)
+      nbThreads = std::max(1u, std::thread::hardware_concurrency());
+    for(uint32_t i = 0; i < nbThreads; i++)
+      m_workers.emplace_back([this] { workerLoop(); });
+  }
+
+  ~ThreadPool()
+  {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_stop = true;
+    }
+    m_jobCond.notify_all();
+    for(auto& w : m_workers)
+      w.join();
+  }
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  // Pool shared by the whole application, created on first use
+  static ThreadPool& shared()
+  {
+    static ThreadPool pool;
+    return pool;
+  }
+
+  uint32_t size() const { return static_cast<uint32_t>(m_workers.size()); }
+
+  template <typename F>
+  auto push(F&& job) -> std::future<decltype(job())>
+  {
+    using R   = decltype(job());
+    auto task = std::make_shared<std::packaged_task<R()>>(std::forward<F>(job));
+    auto res  = task->get_future();
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_jobs.emplace([task] { (*task)(); });
+      m_pending++;
+    }
+    m_jobCond.notify_one();
+    return res;
+  }
+
+  // Waits for all jobs pushed so far
+  void wait()
+  {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_doneCond.wait(lock, [this] { return m_pending == 0; });
+  }
+
+  // Calls fn(i) for all i in [0, count). The chunks are taken in turn by the calling thread and by
+  // the workers, a worker starting after the last one was taken returns without calling fn.
+  template <typename F>
+  void parallelFor(size_t count, F&& fn, size_t minChunk = 1)
+  {
+    if(count == 0)
+      return;
+    size_t nbChunks  = std::min(count / std::max<size_t>(minChunk, 1) + 1, size_t(size()) + 1);
+    size_t chunkSize = (count + nbChunks - 1) / nbChunks;
+    nbChunks         = (count + chunkSize - 1) / chunkSize;
+
+    struct State
+    {
+      std::atomic<size_t>     next{0};
+      size_t                  done{0};
+      std::mutex              mutex;
+      std::condition_variable cond;
+    };
+    auto state = std::make_shared<State>();
+    auto body  = &fn;
+    auto run   = [state, body, count, chunkSize, nbChunks] {
+      for(size_t chunk = state->next++; chunk < nbChunks; chunk = state->next++)
+      {
+        size_t end = std::min((chunk + 1) * chunkSize, count);
+        for(size_t i = chunk * chunkSize; i < end; i++)
+          (*body)(i);
+        std::lock_guard<std::mutex> lock(state->mutex);
+        if(++state->done == nbChunks)
+          state->cond.notify_all();
+      }
+    };
+    for(size_t i = 1; i < nbChunks; i++)
+      push(run);
+    run();
+
+    std::unique_lock<std::mutex> lock(state->mutex);
+    state->cond.wait(lock, [&] { return state->done == nbChunks; });
+  }
+
+private:
+  void workerLoop()
+  {
+    for(;;)
+    {
+      std::function<void()> job;
+      {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_jobCond.wait(lock, [this] { return m_stop || !m_jobs.empty(); });
+        if(m_jobs.empty())
+          return;  // Stopping
+        job = std::move(m_jobs.front());
+        m_jobs.pop();
+      }
+      job();
+      {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_pending--;
+      }
+      m_doneCond.notify_all();
+    }
+  }
+
+  std::vector<std::thread>          m_workers;
+  std::queue<std::function<void()>> m_jobs;
+  std::mutex                        m_mutex;
+  std::condition_variable           m_jobCond;
+  std::condition_variable           m_doneCond;
+  size_t                            m_pending{0};
+  bool                              m_stop{false};
+};
@@ -0,0 +1,242 @@
+/* Copyright (c) 2014-2018, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "adaptive.hpp"
+#include "nvh/fileoperations.hpp"
+#include "nvvk/commands_vk.hpp"
+#include "nvvk/images_vk.hpp"
+#include "nvvk/shaders_vk.hpp"
+
+extern std::vector<std::string> defaultSearchPaths;
+
+//////////////////////////////////////////////////////////////////////////
+// Adaptive sampling
+//////////////////////////////////////////////////////////////////////////
+
+void AdaptiveSampler::setup(const vk::Device& device,
+                            nvvk::Allocator*  allocator,
+                            uint32_t          queueFamily,
+                            PipelineCache*    pipelineCache,
+                            RetiredResources* retired)
+{
+  m_device             = device;
+  m_alloc              = allocator;
+  m_graphicsQueueIndex = queueFamily;
+  m_pipelineCache      = pipelineCache;
+  m_retired            = retired;
+  m_debug.setup(m_device);
+}
+
+void AdaptiveSampler::destroy()
+{
+  m_device.destroy(m_pipeline);
+  m_device.destroy(m_pipelineLayout);
+  m_device.destroy(m_descPool);
+  m_device.destroy(m_dsetLayout);
+  m_alloc->destroy(m_statsTexture);
+  m_alloc->destroy(m_pixelBuffer);
+  if(!m_readbackFrame.empty())
+    m_alloc->unmap(m_readback);
+  m_alloc->destroy(m_readback);
+  m_readbackFrame.clear();
+}
+
+//--------------------------------------------------------------------------------------------------
+// Statistics image and pixel list of the size of the rendering, and one read back slot for each
+// frame in flight
+//
+void AdaptiveSampler::createResources(const vk::Extent2D&      size,
+                                      uint32_t                 nbFrames,
+                                      const vk::CommandBuffer& cmdBuf)
+{
+  using vkBU = vk::BufferUsageFlagBits;
+
+  m_retired->destroy(m_alloc, m_statsTexture);
+  m_retired->destroy(m_alloc, m_pixelBuffer);
+  if(!m_readbackFrame.empty())
+  {
+    nvvk::Buffer readback = m_readback;
+    m_readback            = nvvk::Buffer();
+    m_retired->add([alloc = m_alloc, readback]() mutable {
+      alloc->unmap(readback);
+      alloc->destroy(readback);
+    });
+  }
+  m_size = size;
+
+  auto statsCreateInfo = nvvk::makeImage2DCreateInfo(size, vk::Format::eR32G32B32A32Sfloat,
+                                                     vk::ImageUsageFlagBits::eStorage);
+  nvvk::Image             image  = m_alloc->createImage(statsCreateInfo);
+  vk::ImageViewCreateInfo ivInfo = nvvk::makeImageViewCreateInfo(image.image, statsCreateInfo);
+  m_statsTexture                 = m_alloc->createTexture(image, ivInfo);
+  m_statsTexture.descriptor.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+  m_debug.setObjectName(m_statsTexture.image, "AdaptiveStats");
+
+  vk::DeviceSize pixelSize = sizeof(PixelListHeader) + sizeof(uint32_t) * size.width * size.height;
+  m_pixelBuffer            = m_alloc->createBuffer(pixelSize, vkBU::eStorageBuffer
+                                                       | vkBU::eIndirectBuffer
+                                                       | vkBU::eTransferSrc | vkBU::eTransferDst);
+  m_debug.setObjectName(m_pixelBuffer.buffer, "AdaptivePixels");
+
+  m_readback = m_alloc->createBuffer(nbFrames * sizeof(PixelListHeader), vkBU::eTransferDst,
+                                     vk::MemoryPropertyFlagBits::eHostVisible
+                                         | vk::MemoryPropertyFlagBits::eHostCoherent);
+  m_readbackMapped = reinterpret_cast<const PixelListHeader*>(m_alloc->map(m_readback));
+  m_readbackFrame.assign(nbFrames, -1);
+  m_converged = false;
+  m_remaining = size.width * size.height;
+
+  nvvk::cmdBarrierImageLayout(cmdBuf, m_statsTexture.image, vk::ImageLayout::eUndefined,
+                              vk::ImageLayout::eGeneral);
+
+  if(m_dset)
+    updateDescriptorSet();
+}
+
+//--------------------------------------------------------------------------------------------------
+// Compute pipeline compacting the pixels which did not converge
+//
+void AdaptiveSampler::createPipeline()
+{
+  using vkDS = vk::DescriptorSetLayoutBinding;
+  using vkDT = vk::DescriptorType;
+  using vkSS = vk::ShaderStageFlagBits;
+
+  m_dsetLayoutBinding.addBinding(vkDS(0, vkDT::eStorageImage, 1, vkSS::eCompute));
+  m_dsetLayoutBinding.addBinding(vkDS(1, vkDT::eStorageBuffer, 1, vkSS::eCompute));
+  m_dsetLayout = m_dsetLayoutBinding.createLayout(m_device);
+  m_descPool   = m_retired->createPool(m_dsetLayoutBinding, m_device);
+  updateDescriptorSet();
+
+  vk::PushConstantRange        pushConstant{vkSS::eCompute, 0, sizeof(PushConstant)};
+  vk::PipelineLayoutCreateInfo layoutInfo{{}, 1, &m_dsetLayout, 1, &pushConstant};
+  m_pipelineLayout = m_device.createPipelineLayout(layoutInfo);
+
+  vk::ComputePipelineCreateInfo computePipelineCreateInfo{{}, {}, m_pipelineLayout};
+  computePipelineCreateInfo.stage = nvvk::createShaderStageInfo(
+      m_device, nvh::loadFile("shaders/adaptive.comp.spv", true, defaultSearchPaths),
+      VK_SHADER_STAGE_COMPUTE_BIT);
+  {
+    PipelineCache::Timer timer(*m_pipelineCache, "adaptive sampling");
+    m_pipeline =
+        m_device.createComputePipeline(m_pipelineCache->get(), computePipelineCreateInfo, nullptr);
+  }
+  m_device.destroy(computePipelineCreateInfo.stage.module);
+  m_debug.setObjectName(m_pipeline, "AdaptiveSampling");
+}
+
+// The frames in flight may still use the previous set
+void AdaptiveSampler::updateDescriptorSet()
+{
+  m_retired->replaceSet(m_device, m_descPool, m_dsetLayout, m_dset);
+  vk::DescriptorBufferInfo            pixelInfo{m_pixelBuffer.buffer, 0, VK_WHOLE_SIZE};
+  std::vector<vk::WriteDescriptorSet> writes;
+  writes.emplace_back(m_dsetLayoutBinding.makeWrite(m_dset, 0, &m_statsTexture.descriptor));
+  writes.emplace_back(m_dsetLayoutBinding.makeWrite(m_dset, 1, &pixelInfo));
+  m_device.updateDescriptorSets(static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
+}
+
+//--------------------------------------------------------------------------------------------------
+// The first frames are accumulated everywhere, to get a first estimate of the variance
+//
+AdaptiveSampler::Mode AdaptiveSampler::mode(bool enabled, int frame) const
+{
+  if(!enabled)
+    return eOff;
+  return frame < m_minFrames ? eFullFrame : ePixelList;
+}
+
+//--------------------------------------------------------------------------------------------------
+// Reading the number of pixels left by a previous frame of the same accumulation
+// - Must be called after waiting for the fence of curFrame
+//
+bool AdaptiveSampler::converged(int frame, uint32_t curFrame)
+{
+  if(frame == 0)
+  {
+    // The slots hold counts of the previous accumulation
+    std::fill(m_readbackFrame.begin(), m_readbackFrame.end(), -1);
+    m_converged = false;
+    m_remaining = m_size.width * m_size.height;
+    return false;
+  }
+  if(!m_converged && m_readbackFrame[curFrame] >= 0)
+  {
+    m_remaining = m_readbackMapped[curFrame].width;
+    m_converged = m_remaining == 0;
+  }
+  return m_converged;
+}
+
+//--------------------------------------------------------------------------------------------------
+// Filling the pixel list with the pixels above the threshold, and sending their number to the
+// read back slot of the frame
+//
+void AdaptiveSampler::cmdBuildPixelList(const vk::CommandBuffer& cmdBuf,
+                                        int                      frame,
+                                        int                      maxFrames,
+                                        uint32_t                 curFrame)
+{
+  using vkAF = vk::AccessFlagBits;
+  using vkPS = vk::PipelineStageFlagBits;
+
+  m_debug.beginLabel(cmdBuf, "Adaptive pixel list");
+
+  // The previous ray tracing wrote the statistics and read the pixel list
+  vk::MemoryBarrier rtToList{vkAF::eShaderWrite | vkAF::eShaderRead | vkAF::eIndirectCommandRead,
+                             vkAF::eTransferWrite | vkAF::eShaderRead | vkAF::eShaderWrite};
+  cmdBuf.pipelineBarrier(vkPS::eRayTracingShaderKHR | vkPS::eDrawIndirect,
+                         vkPS::eTransfer | vkPS::eComputeShader, {}, rtToList, {}, {});
+
+  PixelListHeader header{0, 1, 1, 0};
+  cmdBuf.updateBuffer<PixelListHeader>(m_pixelBuffer.buffer, 0, header);
+  vk::MemoryBarrier resetToList{vkAF::eTransferWrite, vkAF::eShaderRead | vkAF::eShaderWrite};
+  cmdBuf.pipelineBarrier(vkPS::eTransfer, vkPS::eComputeShader, {}, resetToList, {}, {});
+
+  PushConstant pushC{m_threshold, m_minFrames, maxFrames, static_cast<int>(m_size.width),
+                     static_cast<int>(m_size.height)};
+  cmdBuf.bindPipeline(vk::PipelineBindPoint::eCompute, m_pipeline);
+  cmdBuf.bindDescriptorSets(vk::PipelineBindPoint::eCompute, m_pipelineLayout, 0, m_dset, {});
+  cmdBuf.pushConstants<PushConstant>(m_pipelineLayout, vk::ShaderStageFlagBits::eCompute, 0,
+                                     pushC);
+  cmdBuf.dispatch((m_size.width + 15) / 16, (m_size.height + 15) / 16, 1);
+
+  // The list is used by the ray generation shader and as the launch size
+  vk::MemoryBarrier listToRt{vkAF::eShaderWrite, vkAF::eShaderRead | vkAF::eIndirectCommandRead
+                                                     | vkAF::eTransferRead};
+  cmdBuf.pipelineBarrier(vkPS::eComputeShader,
+                         vkPS::eRayTracingShaderKHR | vkPS::eDrawIndirect | vkPS::eTransfer, {},
+                         listToRt, {}, {});
+
+  vk::BufferCopy region{0, curFrame * sizeof(PixelListHeader), sizeof(PixelListHeader)};
+  cmdBuf.copyBuffer(m_pixelBuffer.buffer, m_readback.buffer, region);
+  vk::MemoryBarrier toHost{vkAF::eTransferWrite, vkAF::eHostRead};
+  cmdBuf.pipelineBarrier(vkPS::eTransfer, vkPS::eHost, {}, toHost, {}, {});
+  m_readbackFrame[curFrame] = frame;
+
+  m_debug.endLabel(cmdBuf);
+}
@@ -0,0 +1,138 @@
+/* Copyright (c) 2014-2018, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+
+#include "nvvk/debug_util_vk.hpp"
+#include "nvvk/descriptorsets_vk.hpp"
+#include "pipeline_cache.hpp"
+#include "retired_resources.hpp"
+#include "vkalloc.hpp"
+
+//--------------------------------------------------------------------------------------------------
+// Adaptive progressive accumulation
+// - The ray generation shader keeps the luminance mean, squared mean and number of accumulated
+//   frames of each pixel in the statistics image
+// - After the first frames, cmdBuildPixelList compacts the pixels whose error is still above the
+//   threshold in the pixel buffer, which also holds the arguments of traceRaysIndirectKHR
+// - The number of remaining pixels is read back a few frames later, accumulation stops when it
+//   reaches zero
+//
+class AdaptiveSampler
+{
+public:
+  // How the ray generation shader selects its pixel and accumulates (pushC.adaptive)
+  enum Mode
+  {
+    eOff       = 0,  // Full screen, same number of samples everywhere
+    eFullFrame = 1,  // Full screen, updating the statistics
+    ePixelList = 2,  // One launch per pixel of the list
+  };
+
+  void setup(const vk::Device& device,
+             nvvk::Allocator*  allocator,
+             uint32_t          queueFamily,
+             PipelineCache*    pipelineCache,
+             RetiredResources* retired);
+  void destroy();
+
+  // The layout of the statistics image is set in `cmdBuf`. The frames in flight may still use the
+  // previous resources and descriptor set, they are retired.
+  void createResources(const vk::Extent2D&      size,
+                       uint32_t                 nbFrames,
+                       const vk::CommandBuffer& cmdBuf);
+  void createPipeline();
+  // Pixels of the next frames, at most the size of createResources
+  void setRenderSize(const vk::Extent2D& size) { m_size = size; }
+
+  // Threshold on the relative standard error of the pixel luminance
+  void setThreshold(float threshold) { m_threshold = threshold; }
+  // Frames accumulated everywhere before building the pixel list
+  void setMinFrames(int minFrames) { m_minFrames = minFrames; }
+
+  Mode mode(bool enabled, int frame) const;
+  // True once no pixel is left, based on the counts of previous frames
+  bool converged(int frame, uint32_t curFrame);
+  void cmdBuildPixelList(const vk::CommandBuffer& cmdBuf,
+                         int                      frame,
+                         int                      maxFrames,
+                         uint32_t                 curFrame);
+
+  const nvvk::Texture& statsTexture() const { return m_statsTexture; }
+  vk::Buffer           pixelBuffer() const { return m_pixelBuffer.buffer; }
+  // Pixels left during the last known frame
+  uint32_t remainingPixels() const { return m_remaining; }
+
+private:
+  // Header of the pixel buffer, followed by the pixel coordinates
+  struct PixelListHeader
+  {
+    uint32_t width;  // VkTraceRaysIndirectCommandKHR
+    uint32_t height;
+    uint32_t depth;
+    uint32_t pad;
+  };
+
+  void updateDescriptorSet();
+
+  struct PushConstant
+  {
+    float threshold;
+    int   minFrames;
+    int   maxFrames;
+    int   width;
+    int   height;
+  };
+
+  nvvk::DescriptorSetBindings m_dsetLayoutBinding;
+  vk::DescriptorPool          m_descPool;
+  vk::DescriptorSetLayout     m_dsetLayout;
+  vk::DescriptorSet           m_dset;
+  vk::Pipeline                m_pipeline;
+  vk::PipelineLayout          m_pipelineLayout;
+
+  nvvk::Texture m_statsTexture;  // Luminance mean, squared mean, frames, -
+  nvvk::Buffer  m_pixelBuffer;   // PixelListHeader + pixel coordinates
+  nvvk::Buffer  m_readback;      // One PixelListHeader per frame in flight
+  vk::Extent2D  m_size;          // Rendered part of the images
+
+  const PixelListHeader* m_readbackMapped{nullptr};
+  std::vector<int>       m_readbackFrame;  // Frame written in each slot of m_readback, -1 if none
+  uint32_t               m_remaining{0};
+  bool                   m_converged{false};
+  float                  m_threshold{0.02f};
+  int                    m_minFrames{4};
+
+  nvvk::Allocator*  m_alloc{nullptr};  // Allocator for buffer, images, acceleration structures
+  PipelineCache*    m_pipelineCache{nullptr};
+  RetiredResources* m_retired{nullptr};
+  vk::Device        m_device;
+  int               m_graphicsQueueIndex{0};
+  nvvk::DebugUtil   m_debug;  // Utility to name objects
+};
@@ -0,0 +1,295 @@
+/* Copyright (c) 2014-2018, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <cstddef>
+
+#include "bounce_queue.hpp"
+#include "nvh/fileoperations.hpp"
+#include "nvvk/commands_vk.hpp"
+#include "nvvk/images_vk.hpp"
+#include "nvvk/shaders_vk.hpp"
+
+extern std::vector<std::string> defaultSearchPaths;
+
+//////////////////////////////////////////////////////////////////////////
+// Wavefront bounces
+//////////////////////////////////////////////////////////////////////////
+
+void BounceQueue::setup(const vk::Device& device,
+                        nvvk::Allocator*  allocator,
+                        uint32_t          queueFamily,
+                        PipelineCache*    pipelineCache,
+                        RetiredResources* retired)
+{
+  m_device             = device;
+  m_alloc              = allocator;
+  m_graphicsQueueIndex = queueFamily;
+  m_pipelineCache      = pipelineCache;
+  m_retired            = retired;
+  m_debug.setup(m_device);
+}
+
+void BounceQueue::destroy()
+{
+  m_device.destroy(m_pipeline);
+  m_device.destroy(m_pipelineLayout);
+  m_device.destroy(m_descPool);
+  m_device.destroy(m_dsetLayout);
+  m_alloc->destroy(m_unsorted);
+  m_alloc->destroy(m_sorted);
+  m_alloc->destroy(m_bins);
+  m_alloc->destroy(m_radianceTexture);
+}
+
+//--------------------------------------------------------------------------------------------------
+// Queues of one ray per pixel, bins and radiance image of the size of the rendering
+//
+void BounceQueue::createResources(const vk::Extent2D& size, const vk::CommandBuffer& cmdBuf)
+{
+  using vkBU = vk::BufferUsageFlagBits;
+  using vkAF = vk::AccessFlagBits;
+  using vkPS = vk::PipelineStageFlagBits;
+
+  m_retired->destroy(m_alloc, m_unsorted);
+  m_retired->destroy(m_alloc, m_sorted);
+  m_retired->destroy(m_alloc, m_bins);
+  m_retired->destroy(m_alloc, m_radianceTexture);
+  m_size = size;
+
+  vk::DeviceSize       queueSize = sizeof(Header) + sizeof(Ray) * size.width * size.height;
+  vk::BufferUsageFlags usage     =
+      vkBU::eStorageBuffer | vkBU::eIndirectBuffer | vkBU::eTransferDst;
+
+  m_unsorted = m_alloc->createBuffer(queueSize, usage);
+  m_sorted   = m_alloc->createBuffer(queueSize, usage);
+  m_bins     = m_alloc->createBuffer(kNbBins * sizeof(uint32_t),
+                                     vkBU::eStorageBuffer | vkBU::eTransferDst);
+  m_debug.setObjectName(m_unsorted.buffer, "BounceUnsorted");
+  m_debug.setObjectName(m_sorted.buffer, "BounceSorted");
+  m_debug.setObjectName(m_bins.buffer, "BounceBins");
+
+  auto createInfo = nvvk::makeImage2DCreateInfo(size, vk::Format::eR32G32B32A32Sfloat,
+                                                vk::ImageUsageFlagBits::eStorage);
+  nvvk::Image             image  = m_alloc->createImage(createInfo);
+  vk::ImageViewCreateInfo ivInfo = nvvk::makeImageViewCreateInfo(image.image, createInfo);
+  m_radianceTexture              = m_alloc->createTexture(image, ivInfo);
+  m_radianceTexture.descriptor.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+  m_debug.setObjectName(m_radianceTexture.image, "BounceRadiance");
+
+  // Empty queues, the first launch of a frame only writes the unsorted one
+  Header header{0, 1, 1, 0, {0, 1, 1}, 0};
+  cmdBuf.updateBuffer<Header>(m_unsorted.buffer, 0, header);
+  cmdBuf.updateBuffer<Header>(m_sorted.buffer, 0, header);
+  vk::MemoryBarrier headersToUses{vkAF::eTransferWrite,
+                                  vkAF::eShaderRead | vkAF::eShaderWrite
+                                      | vkAF::eIndirectCommandRead};
+  cmdBuf.pipelineBarrier(vkPS::eTransfer,
+                         vkPS::eRayTracingShaderKHR | vkPS::eComputeShader | vkPS::eDrawIndirect,
+                         {}, headersToUses, {}, {});
+  nvvk::cmdBarrierImageLayout(cmdBuf, m_radianceTexture.image, vk::ImageLayout::eUndefined,
+                              vk::ImageLayout::eGeneral);
+}
+
+//--------------------------------------------------------------------------------------------------
+// Compute pipeline of all the passes of bounce_sort.comp
+//
+void BounceQueue::createPipeline(bool separateAccum)
+{
+  using vkDS = vk::DescriptorSetLayoutBinding;
+  using vkDT = vk::DescriptorType;
+  using vkSS = vk::ShaderStageFlagBits;
+
+  // Unsorted (0) and sorted (1) queues, bins (2), radiance (3), accumulation (4) and reduced
+  // precision output (5)
+  m_dsetLayoutBinding.addBinding(vkDS(0, vkDT::eStorageBuffer, 1, vkSS::eCompute));
+  m_dsetLayoutBinding.addBinding(vkDS(1, vkDT::eStorageBuffer, 1, vkSS::eCompute));
+  m_dsetLayoutBinding.addBinding(vkDS(2, vkDT::eStorageBuffer, 1, vkSS::eCompute));
+  m_dsetLayoutBinding.addBinding(vkDS(3, vkDT::eStorageImage, 1, vkSS::eCompute));
+  m_dsetLayoutBinding.addBinding(vkDS(4, vkDT::eStorageImage, 1, vkSS::eCompute));
+  m_dsetLayoutBinding.addBinding(vkDS(5, vkDT::eStorageImage, 1, vkSS::eCompute));
+  m_dsetLayout = m_dsetLayoutBinding.createLayout(m_device);
+  m_descPool   = m_retired->createPool(m_dsetLayoutBinding, m_device);
+
+  vk::PushConstantRange        pushConstant{vkSS::eCompute, 0, sizeof(PushConstant)};
+  vk::PipelineLayoutCreateInfo layoutInfo{{}, 1, &m_dsetLayout, 1, &pushConstant};
+  m_pipelineLayout = m_device.createPipelineLayout(layoutInfo);
+
+  // SEPARATE_ACCUM: the result is also written to the reduced precision output image
+  int                        separate = separateAccum ? 1 : 0;
+  vk::SpecializationMapEntry specEntry{0, 0, sizeof(int)};
+  vk::SpecializationInfo     specInfo{1, &specEntry, sizeof(int), &separate};
+
+  vk::ComputePipelineCreateInfo computePipelineCreateInfo{{}, {}, m_pipelineLayout};
+  computePipelineCreateInfo.stage = nvvk::createShaderStageInfo(
+      m_device, nvh::loadFile("shaders/bounce_sort.comp.spv", true, defaultSearchPaths),
+      VK_SHADER_STAGE_COMPUTE_BIT);
+  computePipelineCreateInfo.stage.setPSpecializationInfo(&specInfo);
+  {
+    PipelineCache::Timer timer(*m_pipelineCache, "wavefront bounces");
+    m_pipeline =
+        m_device.createComputePipeline(m_pipelineCache->get(), computePipelineCreateInfo, nullptr);
+  }
+  m_device.destroy(computePipelineCreateInfo.stage.module);
+  m_debug.setObjectName(m_pipeline, "BounceSort");
+}
+
+//--------------------------------------------------------------------------------------------------
+// Writes the queues and the images to a new descriptor set
+// - Required when changing resolution
+//
+void BounceQueue::updateDescriptorSet(const vk::ImageView& outputImage,
+                                      const vk::ImageView& accumImage)
+{
+  m_retired->replaceSet(m_device, m_descPool, m_dsetLayout, m_dset);
+  vk::DescriptorBufferInfo unsortedInfo{m_unsorted.buffer, 0, VK_WHOLE_SIZE};
+  vk::DescriptorBufferInfo sortedInfo{m_sorted.buffer, 0, VK_WHOLE_SIZE};
+  vk::DescriptorBufferInfo binsInfo{m_bins.buffer, 0, VK_WHOLE_SIZE};
+  vk::DescriptorImageInfo  accumInfo{{}, accumImage, vk::ImageLayout::eGeneral};
+  vk::DescriptorImageInfo  imageInfo{{}, outputImage, vk::ImageLayout::eGeneral};
+
+  std::vector<vk::WriteDescriptorSet> writes;
+  writes.emplace_back(m_dsetLayoutBinding.makeWrite(m_dset, 0, &unsortedInfo));
+  writes.emplace_back(m_dsetLayoutBinding.makeWrite(m_dset, 1, &sortedInfo));
+  writes.emplace_back(m_dsetLayoutBinding.makeWrite(m_dset, 2, &binsInfo));
+  writes.emplace_back(m_dsetLayoutBinding.makeWrite(m_dset, 3, &m_radianceTexture.descriptor));
+  writes.emplace_back(m_dsetLayoutBinding.makeWrite(m_dset, 4, &accumInfo));
+  writes.emplace_back(m_dsetLayoutBinding.makeWrite(m_dset, 5, &imageInfo));
+  m_device.updateDescriptorSets(static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
+}
+
+void BounceQueue::cmdPass(const vk::CommandBuffer& cmdBuf, const PushConstant& pushC)
+{
+  cmdBuf.bindPipeline(vk::PipelineBindPoint::eCompute, m_pipeline);
+  cmdBuf.bindDescriptorSets(vk::PipelineBindPoint::eCompute, m_pipelineLayout, 0, m_dset, {});
+  cmdBuf.pushConstants<PushConstant>(m_pipelineLayout, vk::ShaderStageFlagBits::eCompute, 0,
+                                     pushC);
+}
+
+//--------------------------------------------------------------------------------------------------
+// The count of the unsorted queue is reset, the previous frame may have been interrupted
+//
+void BounceQueue::cmdReset(const vk::CommandBuffer& cmdBuf)
+{
+  using vkAF = vk::AccessFlagBits;
+  using vkPS = vk::PipelineStageFlagBits;
+
+  vk::MemoryBarrier toReset{vkAF::eShaderRead | vkAF::eShaderWrite, vkAF::eTransferWrite};
+  cmdBuf.pipelineBarrier(vkPS::eRayTracingShaderKHR | vkPS::eComputeShader, vkPS::eTransfer, {},
+                         toReset, {}, {});
+  cmdBuf.fillBuffer(m_unsorted.buffer, 0, sizeof(uint32_t), 0);
+  vk::MemoryBarrier resetToRt{vkAF::eTransferWrite, vkAF::eShaderRead | vkAF::eShaderWrite};
+  cmdBuf.pipelineBarrier(vkPS::eTransfer, vkPS::eRayTracingShaderKHR, {}, resetToRt, {}, {});
+}
+
+//--------------------------------------------------------------------------------------------------
+// Counting sort of the rays appended by the last launch, the sizes of the dispatches and of the
+// next launch are written by the GPU
+//
+void BounceQueue::cmdSort(const vk::CommandBuffer& cmdBuf)
+{
+  using vkAF = vk::AccessFlagBits;
+  using vkPS = vk::PipelineStageFlagBits;
+
+  m_debug.beginLabel(cmdBuf, "Bounce sort");
+
+  // The launch appended the rays and read the sorted queue
+  vk::MemoryBarrier rtToSort{vkAF::eShaderWrite | vkAF::eShaderRead | vkAF::eIndirectCommandRead,
+                             vkAF::eTransferWrite | vkAF::eShaderRead | vkAF::eShaderWrite};
+  cmdBuf.pipelineBarrier(vkPS::eRayTracingShaderKHR | vkPS::eDrawIndirect,
+                         vkPS::eTransfer | vkPS::eComputeShader, {}, rtToSort, {}, {});
+  cmdBuf.fillBuffer(m_bins.buffer, 0, VK_WHOLE_SIZE, 0);
+
+  vk::MemoryBarrier betweenPasses{vkAF::eTransferWrite | vkAF::eShaderWrite,
+                                  vkAF::eShaderRead | vkAF::eShaderWrite
+                                      | vkAF::eIndirectCommandRead};
+  auto              passBarrier = [&] {
+    cmdBuf.pipelineBarrier(vkPS::eTransfer | vkPS::eComputeShader,
+                           vkPS::eComputeShader | vkPS::eDrawIndirect, {}, betweenPasses, {}, {});
+  };
+  passBarrier();
+
+  PushConstant pushC{eLaunchSizes, 0, 0, m_cellSize, static_cast<int>(m_size.width),
+                     static_cast<int>(m_size.height)};
+  cmdPass(cmdBuf, pushC);
+  cmdBuf.dispatch(1, 1, 1);
+  passBarrier();
+
+  pushC.pass = eHistogram;
+  cmdPass(cmdBuf, pushC);
+  cmdBuf.dispatchIndirect(m_unsorted.buffer, offsetof(Header, groups));
+  passBarrier();
+
+  pushC.pass = ePrefixSum;
+  cmdPass(cmdBuf, pushC);
+  cmdBuf.dispatch(1, 1, 1);
+  passBarrier();
+
+  pushC.pass = eScatter;
+  cmdPass(cmdBuf, pushC);
+  cmdBuf.dispatchIndirect(m_unsorted.buffer, offsetof(Header, groups));
+
+  // The next launch appends to the empty unsorted queue, and reads the sorted one and its size
+  vk::MemoryBarrier sortToReset{vkAF::eShaderRead | vkAF::eShaderWrite | vkAF::eIndirectCommandRead,
+                                vkAF::eTransferWrite};
+  cmdBuf.pipelineBarrier(vkPS::eComputeShader | vkPS::eDrawIndirect, vkPS::eTransfer, {},
+                         sortToReset, {}, {});
+  cmdBuf.fillBuffer(m_unsorted.buffer, 0, sizeof(uint32_t), 0);
+  vk::MemoryBarrier sortToRt{vkAF::eShaderWrite | vkAF::eTransferWrite,
+                             vkAF::eShaderRead | vkAF::eShaderWrite | vkAF::eIndirectCommandRead};
+  cmdBuf.pipelineBarrier(vkPS::eComputeShader | vkPS::eTransfer,
+                         vkPS::eRayTracingShaderKHR | vkPS::eDrawIndirect, {}, sortToRt, {}, {});
+
+  m_debug.endLabel(cmdBuf);
+}
+
+//--------------------------------------------------------------------------------------------------
+// Accumulating the average of the samples summed in the radiance image
+//
+void BounceQueue::cmdResolve(const vk::CommandBuffer& cmdBuf, int frame, int nbSamples)
+{
+  using vkAF = vk::AccessFlagBits;
+  using vkPS = vk::PipelineStageFlagBits;
+
+  m_debug.beginLabel(cmdBuf, "Bounce resolve");
+
+  vk::MemoryBarrier rtToResolve{vkAF::eShaderWrite, vkAF::eShaderRead | vkAF::eShaderWrite};
+  cmdBuf.pipelineBarrier(vkPS::eRayTracingShaderKHR, vkPS::eComputeShader, {}, rtToResolve, {},
+                         {});
+
+  PushConstant pushC{eResolve, frame, nbSamples, m_cellSize, static_cast<int>(m_size.width),
+                     static_cast<int>(m_size.height)};
+  cmdPass(cmdBuf, pushC);
+  cmdBuf.dispatch((m_size.width * m_size.height + kGroupSize - 1) / kGroupSize, 1, 1);
+
+  // The result is displayed by the post pass, and the images are written again by the next frame
+  vk::MemoryBarrier resolveToNext{vkAF::eShaderWrite, vkAF::eShaderRead | vkAF::eShaderWrite};
+  cmdBuf.pipelineBarrier(vkPS::eComputeShader,
+                         vkPS::eFragmentShader | vkPS::eRayTracingShaderKHR | vkPS::eTransfer,
+                         {}, resolveToNext, {}, {});
+
+  m_debug.endLabel(cmdBuf);
+}
@@ -0,0 +1,150 @@
+/* Copyright (c) 2014-2018, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+
+#include "nvvk/debug_util_vk.hpp"
+#include "nvvk/descriptorsets_vk.hpp"
+#include "pipeline_cache.hpp"
+#include "retired_resources.hpp"
+#include "vkalloc.hpp"
+
+//--------------------------------------------------------------------------------------------------
+// Wavefront bounces: one launch per bounce instead of the loop of the ray generation shader
+// - The first launch traces the camera rays of one sample (WAVEFRONT in raytrace.rgen), and appends
+//   the reflected rays to the unsorted queue. The rays which ended (miss, diffuse surface) are not
+//   appended.
+// - cmdSort() bins the rays by direction octant and origin cell (counting sort), so that the rays
+//   traced together are coherent, and sets the size of the next launch (traceRaysIndirectKHR)
+// - Each following launch reads the sorted queue and appends to the unsorted one, the radiance of
+//   the paths is summed in the radiance image
+// - cmdResolve() accumulates the average of the samples, as the ray generation shader does
+//
+class BounceQueue
+{
+public:
+  void setup(const vk::Device& device,
+             nvvk::Allocator*  allocator,
+             uint32_t          queueFamily,
+             PipelineCache*    pipelineCache,
+             RetiredResources* retired);
+  void destroy();
+
+  // The queues hold one ray per pixel. They are emptied and the radiance image gets its layout in
+  // `cmdBuf`, the frames in flight may still use the previous resources, they are retired.
+  void createResources(const vk::Extent2D& size, const vk::CommandBuffer& cmdBuf);
+  void createPipeline(bool separateAccum);
+  // Pixels traced by the next frames, the queues and the radiance image may hold more
+  void setRenderSize(const vk::Extent2D& size) { m_size = size; }
+  // The accumulation image gets the result, as well as the output image when it has a reduced
+  // precision. The descriptor set is replaced.
+  void updateDescriptorSet(const vk::ImageView& outputImage, const vk::ImageView& accumImage);
+
+  // Size of the cells binning the ray origins, in world units
+  void setCellSize(float cellSize) { m_cellSize = cellSize; }
+
+  // Emptying the unsorted queue before the first launch of the frame
+  void cmdReset(const vk::CommandBuffer& cmdBuf);
+  // After a launch: sorting its rays for the next launch, and emptying the unsorted queue
+  void cmdSort(const vk::CommandBuffer& cmdBuf);
+  // After the last launch of the frame
+  void cmdResolve(const vk::CommandBuffer& cmdBuf, int frame, int nbSamples);
+
+  // Read by the launches after the first one, which also take their size from its header
+  vk::Buffer           sortedBuffer() const { return m_sorted.buffer; }
+  vk::Buffer           unsortedBuffer() const { return m_unsorted.buffer; }
+  const nvvk::Texture& radianceTexture() const { return m_radianceTexture; }
+
+  // Matching BounceQueueHeader and BounceRay in bounce_queue.glsl
+  struct Header
+  {
+    uint32_t count;  // VkTraceRaysIndirectCommandKHR
+    uint32_t height;
+    uint32_t depth;
+    uint32_t pad0;
+    uint32_t groups[3];  // VkDispatchIndirectCommand
+    uint32_t pad1;
+  };
+  struct Ray
+  {
+    float    origin[3];
+    uint32_t pixel;
+    float    direction[3];
+    uint32_t seed;
+    float    attenuation[3];
+  };
+  static_assert(sizeof(Header) == 32 && sizeof(Ray) == 44, "Must match bounce_queue.glsl");
+
+private:
+  // Passes of bounce_sort.comp
+  enum Pass
+  {
+    eLaunchSizes = 0,
+    eHistogram   = 1,
+    ePrefixSum   = 2,
+    eScatter     = 3,
+    eResolve     = 4,
+  };
+
+  struct PushConstant
+  {
+    int   pass;
+    int   frame;
+    int   nbSamples;
+    float cellSize;
+    int   width;
+    int   height;
+  };
+
+  static const uint32_t kNbBins    = 4096;
+  static const uint32_t kGroupSize = 256;
+
+  void cmdPass(const vk::CommandBuffer& cmdBuf, const PushConstant& pushC);
+
+  nvvk::DescriptorSetBindings m_dsetLayoutBinding;
+  vk::DescriptorPool          m_descPool;
+  vk::DescriptorSetLayout     m_dsetLayout;
+  vk::DescriptorSet           m_dset;
+  vk::Pipeline                m_pipeline;
+  vk::PipelineLayout          m_pipelineLayout;
+
+  nvvk::Buffer  m_unsorted;         // Header + rays appended by the last launch
+  nvvk::Buffer  m_sorted;           // Header + rays of the next launch
+  nvvk::Buffer  m_bins;             // Counts, then offsets of the bins
+  nvvk::Texture m_radianceTexture;  // Sum of the samples of the frame
+  vk::Extent2D  m_size;
+  float         m_cellSize{1.f};
+
+  nvvk::Allocator*  m_alloc{nullptr};  // Allocator for buffer, images, acceleration structures
+  PipelineCache*    m_pipelineCache{nullptr};
+  RetiredResources* m_retired{nullptr};
+  vk::Device        m_device;
+  int               m_graphicsQueueIndex{0};
+  nvvk::DebugUtil   m_debug;  // Utility to name objects
+};
@@ -0,0 +1,126 @@
+/* Copyright (c) 2014-2018, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "geometry_pool.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+//////////////////////////////////////////////////////////////////////////
+// Geometry pool
+//////////////////////////////////////////////////////////////////////////
+
+void GeometryPool::setup(const vk::Device& device, nvvk::Allocator* allocator)
+{
+  m_device = device;
+  m_alloc  = allocator;
+}
+
+void GeometryPool::destroy()
+{
+  releaseStaging();
+  for(auto& b : m_blocks)
+    m_alloc->destroy(b.buffer);
+  m_blocks.clear();
+}
+
+//--------------------------------------------------------------------------------------------------
+// Reserving a range and recording the copy of the data in it
+//
+GeometryRange GeometryPool::upload(const vk::CommandBuffer& cmdBuf,
+                                   vk::DeviceSize           size,
+                                   const void*              data)
+{
+  GeometryRange range;
+  if(size == 0)
+    return range;
+
+  Block& block  = findBlock(size);
+  range.buffer  = block.buffer.buffer;
+  range.offset  = block.used;
+  range.size    = size;
+  range.address = block.address + block.used;
+  block.used    = (block.used + size + kAlignment - 1) & ~(kAlignment - 1);
+
+  nvvk::Buffer staging = m_alloc->createBuffer(size, vk::BufferUsageFlagBits::eTransferSrc,
+                                               vk::MemoryPropertyFlagBits::eHostVisible
+                                                   | vk::MemoryPropertyFlagBits::eHostCoherent);
+  MemoryStats::shared().add(MemoryCategory::eStaging,
+                            MemoryStats::sizeOf(m_device, staging.buffer));
+  memcpy(m_alloc->map(staging), data, size);
+  m_alloc->unmap(staging);
+  cmdBuf.copyBuffer(staging.buffer, range.buffer, vk::BufferCopy(0, range.offset, size));
+  m_staging.push_back(staging);
+  return range;
+}
+
+void GeometryPool::releaseStaging()
+{
+  for(auto& s : m_staging)
+  {
+    MemoryStats::shared().remove(MemoryCategory::eStaging, MemoryStats::sizeOf(m_device, s.buffer));
+    m_alloc->destroy(s);
+  }
+  m_staging.clear();
+}
+
+vk::DeviceSize GeometryPool::allocatedSize() const
+{
+  vk::DeviceSize size = 0;
+  for(const auto& b : m_blocks)
+    size += b.size;
+  return size;
+}
+
+vk::DeviceSize GeometryPool::usedSize() const
+{
+  vk::DeviceSize size = 0;
+  for(const auto& b : m_blocks)
+    size += std::min(b.used, b.size);
+  return size;
+}
+
+//--------------------------------------------------------------------------------------------------
+// Last block if the range fits, otherwise a new one. Ranges larger than the block size, or all of
+// them without a block size, get a block of their own.
+//
+GeometryPool::Block& GeometryPool::findBlock(vk::DeviceSize size)
+{
+  if(m_blockSize > 0 && !m_blocks.empty() && m_blocks.back().used + size <= m_blocks.back().size)
+    return m_blocks.back();
+
+  using vkBU = vk::BufferUsageFlagBits;
+  Block block;
+  block.size   = std::max(size, m_blockSize);
+  block.buffer = m_alloc->createBuffer(block.size, vkBU::eVertexBuffer | vkBU::eIndexBuffer
+                                                       | vkBU::eStorageBuffer
+                                                       | vkBU::eShaderDeviceAddress
+                                                       | vkBU::eTransferDst);
+  block.address = m_device.getBufferAddress({block.buffer.buffer});
+  m_blocks.push_back(block);
+  return m_blocks.back();
+}
@@ -0,0 +1,94 @@
+/* Copyright (c) 2014-2018, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+
+#include <vector>
+
+#include "memory_stats.hpp"
+#include "vkalloc.hpp"
+
+// Part of a buffer of the geometry pool
+struct GeometryRange
+{
+  vk::Buffer        buffer;
+  vk::DeviceSize    offset{0};
+  vk::DeviceSize    size{0};
+  vk::DeviceAddress address{0};  // Of the first byte of the range
+};
+
+//--------------------------------------------------------------------------------------------------
+// Storage of the vertices, indices and materials of all objects
+// - With a block size, ranges are suballocated from a few large buffers, otherwise each range
+//   gets its own buffer
+// - All buffers can be used as vertex, index and storage buffers, and by their device address
+// - upload() records the copy from a staging buffer, released by releaseStaging() once the
+//   command buffer completed
+//
+class GeometryPool
+{
+public:
+  void setup(const vk::Device& device, nvvk::Allocator* allocator);
+  void destroy();
+
+  // 0 for one buffer per range, must be set before the first upload
+  void setBlockSize(vk::DeviceSize blockSize) { m_blockSize = blockSize; }
+
+  GeometryRange upload(const vk::CommandBuffer& cmdBuf, vk::DeviceSize size, const void* data);
+  template <typename T>
+  GeometryRange upload(const vk::CommandBuffer& cmdBuf, const std::vector<T>& data)
+  {
+    return upload(cmdBuf, sizeof(T) * data.size(), data.data());
+  }
+  void releaseStaging();
+
+  uint32_t       nbBuffers() const { return static_cast<uint32_t>(m_blocks.size()); }
+  vk::DeviceSize allocatedSize() const;
+  vk::DeviceSize usedSize() const;
+
+private:
+  struct Block
+  {
+    nvvk::Buffer      buffer;
+    vk::DeviceSize    size{0};
+    vk::DeviceSize    used{0};
+    vk::DeviceAddress address{0};
+  };
+
+  // Offset alignment of the ranges, enough for any index, vertex and storage use
+  static const vk::DeviceSize kAlignment = 256;
+
+  Block& findBlock(vk::DeviceSize size);
+
+  vk::Device                m_device;
+  nvvk::Allocator*          m_alloc{nullptr};
+  vk::DeviceSize            m_blockSize{0};
+  std::vector<Block>        m_blocks;
+  std::vector<nvvk::Buffer> m_staging;
+};
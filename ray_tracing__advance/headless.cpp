@@ -0,0 +1,476 @@
+/* Copyright (c) 2014-2018, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <thread>
+
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "fileformats/stb_image_write.h"
+
+#include "headless.hpp"
+#include "hello_vulkan.h"
+#include "memory_stats.hpp"
+#include "nvh/cameramanipulator.hpp"
+#include "nvh/nvprint.hpp"
+
+//--------------------------------------------------------------------------------------------------
+// Reading the positions of the camera, see headless.hpp for the format
+//
+bool CameraPath::load(const std::string& filename)
+{
+  std::ifstream file(filename);
+  if(!file)
+    return false;
+
+  m_keys.clear();
+  std::string line;
+  while(std::getline(file, line))
+  {
+    if(line.empty() || line[0] == '#')
+      continue;
+    std::istringstream values(line);
+    Key                key;
+    values >> key.eye.x >> key.eye.y >> key.eye.z;
+    values >> key.center.x >> key.center.y >> key.center.z;
+    values >> key.up.x >> key.up.y >> key.up.z;
+    if(values.fail())
+    {
+      LOGE("Camera path %s: cannot read \"%s\"\n", filename.c_str(), line.c_str());
+      return false;
+    }
+    values >> key.fov;  // Optional
+    m_keys.push_back(key);
+  }
+  return !m_keys.empty();
+}
+
+CameraPath::Key CameraPath::evaluate(float t) const
+{
+  if(m_keys.size() < 2)
+    return m_keys.empty() ? Key() : m_keys[0];
+
+  float  segment = std::min(std::max(t, 0.f), 1.f) * float(m_keys.size() - 1);
+  size_t i       = std::min(static_cast<size_t>(segment), m_keys.size() - 2);
+  float  f       = segment - float(i);
+
+  const Key& a = m_keys[i];
+  const Key& b = m_keys[i + 1];
+  Key        key;
+  key.eye    = a.eye * (1.f - f) + b.eye * f;
+  key.center = a.center * (1.f - f) + b.center * f;
+  key.up     = a.up * (1.f - f) + b.up * f;
+  key.fov    = a.fov * (1.f - f) + b.fov * f;
+  return key;
+}
+
+//--------------------------------------------------------------------------------------------------
+// Uncompressed scanline OpenEXR, with 32-bit float R, G, B and A channels
+//
+static bool writeExr(const std::string& filename, const vk::Extent2D& size, const float* rgba)
+{
+  std::ofstream file(filename, std::ios::binary);
+  if(!file)
+    return false;
+
+  auto writeInt   = [&](int32_t v) { file.write(reinterpret_cast<const char*>(&v), 4); };
+  auto writeFloat = [&](float v) { file.write(reinterpret_cast<const char*>(&v), 4); };
+  auto writeAttr  = [&](const char* name, const char* type, int32_t byteSize) {
+    file.write(name, strlen(name) + 1);
+    file.write(type, strlen(type) + 1);
+    writeInt(byteSize);
+  };
+  const int32_t width  = static_cast<int32_t>(size.width);
+  const int32_t height = static_cast<int32_t>(size.height);
+
+  // Magic number and version 2, single part scanline file
+  writeInt(20000630);
+  writeInt(2);
+
+  // Channels are stored in alphabetical order
+  const char* channels[] = {"A", "B", "G", "R"};
+  writeAttr("channels", "chlist", 4 * 18 + 1);
+  for(const char* c : channels)
+  {
+    file.write(c, 2);
+    writeInt(2);  // FLOAT
+    writeInt(0);  // pLinear and reserved
+    writeInt(1);  // xSampling
+    writeInt(1);  // ySampling
+  }
+  file.put(0);
+  writeAttr("compression", "compression", 1);
+  file.put(0);  // NO_COMPRESSION
+  for(const char* window : {"dataWindow", "displayWindow"})
+  {
+    writeAttr(window, "box2i", 16);
+    writeInt(0);
+    writeInt(0);
+    writeInt(width - 1);
+    writeInt(height - 1);
+  }
+  writeAttr("lineOrder", "lineOrder", 1);
+  file.put(0);  // INCREASING_Y
+  writeAttr("pixelAspectRatio", "float", 4);
+  writeFloat(1.f);
+  writeAttr("screenWindowCenter", "v2f", 8);
+  writeFloat(0.f);
+  writeFloat(0.f);
+  writeAttr("screenWindowWidth", "float", 4);
+  writeFloat(1.f);
+  file.put(0);  // End of the header
+
+  // Offsets of the scanlines, each one being its y, its byte size and its channels
+  const int32_t lineBytes  = width * 4 * static_cast<int32_t>(sizeof(float));
+  uint64_t      lineOffset = static_cast<uint64_t>(file.tellp()) + uint64_t(height) * 8;
+  for(int32_t y = 0; y < height; y++)
+  {
+    file.write(reinterpret_cast<const char*>(&lineOffset), 8);
+    lineOffset += 8 + lineBytes;
+  }
+
+  std::vector<float> line(size_t(width) * 4);
+  for(int32_t y = 0; y < height; y++)
+  {
+    const float* src = rgba + size_t(y) * width * 4;
+    for(int32_t c = 0; c < 4; c++)
+      for(int32_t x = 0; x < width; x++)
+        line[c * width + x] = src[x * 4 + (3 - c)];  // A, B, G, R
+    writeInt(y);
+    writeInt(lineBytes);
+    file.write(reinterpret_cast<const char*>(line.data()), lineBytes);
+  }
+  return file.good();
+}
+
+// Reading the files of writeExr only: uncompressed scanlines of float A, B, G and R channels
+static bool readExr(const std::string& filename, vk::Extent2D& size, std::vector<float>& rgba)
+{
+  std::ifstream file(filename, std::ios::binary);
+  if(!file)
+    return false;
+
+  auto readInt = [&]() {
+    int32_t v = 0;
+    file.read(reinterpret_cast<char*>(&v), 4);
+    return v;
+  };
+  auto readString = [&]() {
+    std::string s;
+    std::getline(file, s, '\0');
+    return s;
+  };
+  if(readInt() != 20000630 || readInt() != 2)
+    return false;
+
+  // Attributes until an empty name
+  int32_t width = 0, height = 0;
+  bool    uncompressed = false;
+  for(std::string name = readString(); file && !name.empty(); name = readString())
+  {
+    std::string       type     = readString();
+    int32_t           byteSize = readInt();
+    std::vector<char> value(std::max(byteSize, 0));
+    file.read(value.data(), value.size());
+    if(name == "dataWindow" && byteSize == 16)
+    {
+      int32_t box[4];
+      memcpy(box, value.data(), sizeof(box));
+      width  = box[2] - box[0] + 1;
+      height = box[3] - box[1] + 1;
+    }
+    else if(name == "compression")
+      uncompressed = byteSize == 1 && value[0] == 0;
+  }
+  if(!file || !uncompressed || width <= 0 || height <= 0)
+    return false;
+
+  // The scanlines follow their offsets, in increasing y
+  file.seekg(int64_t(height) * 8, std::ios::cur);
+  size = vk::Extent2D(uint32_t(width), uint32_t(height));
+  rgba.resize(size_t(width) * height * 4);
+  const int32_t      lineBytes = width * 4 * static_cast<int32_t>(sizeof(float));
+  std::vector<float> line(size_t(width) * 4);
+  for(int32_t y = 0; y < height; y++)
+  {
+    if(readInt() != y || readInt() != lineBytes)
+      return false;
+    file.read(reinterpret_cast<char*>(line.data()), lineBytes);
+    float* dst = rgba.data() + size_t(y) * width * 4;
+    for(int32_t c = 0; c < 4; c++)
+      for(int32_t x = 0; x < width; x++)
+        dst[x * 4 + (3 - c)] = line[c * width + x];  // A, B, G, R
+  }
+  return file.good();
+}
+
+// Same gamma as the post pass
+static bool writePng(const std::string& filename, const vk::Extent2D& size, const float* rgba)
+{
+  std::vector<uint8_t> pixels(size_t(size.width) * size.height * 4);
+  for(size_t i = 0; i < pixels.size(); i++)
+  {
+    float v   = (i % 4 == 3) ? 1.f : std::pow(std::min(std::max(rgba[i], 0.f), 1.f), 1.f / 2.2f);
+    pixels[i] = static_cast<uint8_t>(v * 255.f + 0.5f);
+  }
+  return stbi_write_png(filename.c_str(), size.width, size.height, 4, pixels.data(),
+                        size.width * 4)
+         != 0;
+}
+
+static bool writeImage(const std::string& filename, const vk::Extent2D& size, const float* rgba)
+{
+  std::string extension = filename.substr(std::min(filename.find_last_of('.'), filename.size()));
+  std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+  if(extension == ".exr")
+    return writeExr(filename, size, rgba);
+  if(extension == ".png")
+    return writePng(filename, size, rgba);
+  LOGE("Headless: unknown image format %s, expecting .png or .exr\n", filename.c_str());
+  return false;
+}
+
+//--------------------------------------------------------------------------------------------------
+// Flat JSON object, the passes being an object of their average GPU time
+//
+bool HeadlessReport::write(const std::string& filename) const
+{
+  std::ofstream file(filename);
+  if(!file)
+  {
+    LOGE("Headless: cannot write %s\n", filename.c_str());
+    return false;
+  }
+  file << "{\n";
+  file << "  \"device\": \"" << device << "\",\n";
+  file << "  \"width\": " << settings.size.width << ",\n";
+  file << "  \"height\": " << settings.size.height << ",\n";
+  file << "  \"frames\": " << settings.nbFrames << ",\n";
+  file << "  \"samples\": " << nbSamples << ",\n";
+  file << "  \"frameMs\": " << frameMs << ",\n";
+  file << "  \"gpuFrameMs\": " << gpuFrameMs << ",\n";
+  file << "  \"raysPerSec\": " << raysPerSec << ",\n";
+  file << "  \"asBuildMs\": " << asBuildMs << ",\n";
+  file << "  \"asMemoryMB\": " << asMemoryMB << ",\n";
+  file << "  \"passes\": {";
+  for(size_t i = 0; i < passes.size(); i++)
+    file << (i ? ", " : "") << "\"" << passes[i].name << "\": " << passes[i].avgMs;
+  file << "}\n";
+  file << "}\n";
+  return file.good();
+}
+
+//--------------------------------------------------------------------------------------------------
+// Rendering the frames, then logging the timings and writing the requested files
+//
+int runHeadless(HelloVulkan& helloVk, const HeadlessSettings& settings)
+{
+  CameraPath path;
+  if(!settings.cameraFile.empty() && !path.load(settings.cameraFile))
+  {
+    LOGE("Headless: cannot load the camera path %s\n", settings.cameraFile.c_str());
+    return 1;
+  }
+  // All textures resident, the placeholders would change the images and the timings
+  while(helloVk.m_textureStreamer.busy())
+  {
+    helloVk.updateTextures();
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  helloVk.updateTextures();
+
+  // Every frame is traced, a static camera accumulating over all of them. With a split, the parts
+  // before this one accumulated their frames on other GPUs.
+  helloVk.m_maxFrames = std::max(helloVk.m_maxFrames, settings.nbFrames);
+  helloVk.raytracer().setFrameOffset(settings.splitIndex * settings.nbFrames);
+  helloVk.hybrid().setFrameOffset(settings.splitIndex * settings.nbFrames);
+  CameraManip.setWindowSize(settings.size.width, settings.size.height);
+  const nvmath::vec4f clearColor(1.f, 1.f, 1.f, 1.f);
+
+  auto start       = std::chrono::high_resolution_clock::now();
+  int  submissions = 0;
+  for(int frame = 0; frame < settings.nbFrames; frame++)
+  {
+    if(!path.empty())
+    {
+      float           t   = float(frame) / float(std::max(settings.nbFrames - 1, 1));
+      CameraPath::Key key = path.evaluate(t);
+      CameraManip.setLookat(key.eye, key.center, key.up);
+      CameraManip.setFov(key.fov);
+    }
+    helloVk.updateUniformBuffer();
+    submissions += helloVk.renderHeadless(clearColor);
+  }
+  std::chrono::duration<double, std::milli> elapsed =
+      std::chrono::high_resolution_clock::now() - start;
+  helloVk.m_profiler.flush();
+
+  // Timings of the last frames, at most GpuProfiler::kHistory
+  HeadlessReport report;
+  report.device     = helloVk.getPhysicalDevice().getProperties().deviceName;
+  report.settings   = settings;
+  report.nbSamples  = helloVk.m_nbSamples;
+  report.frameMs    = elapsed.count() / double(settings.nbFrames);
+  report.passes     = helloVk.m_profiler.stats();
+  report.asBuildMs  = helloVk.m_asBuildMs;
+  report.asMemoryMB = double(MemoryStats::shared().current(MemoryCategory::eBlas)
+                             + MemoryStats::shared().current(MemoryCategory::eTlas))
+                      / (1024.0 * 1024.0);
+  // The timings are per submission, a frame has several of them with a tile budget
+  double perFrame = double(submissions) / double(settings.nbFrames);
+  for(const auto& s : report.passes)
+  {
+    report.gpuFrameMs += s.avgMs * perFrame;
+    if(s.name == "Ray trace" && s.avgMs > 0)
+    {
+      vk::Extent2D size = helloVk.renderSize();
+      double       rays = double(size.width) * size.height * report.nbSamples;
+      report.raysPerSec = rays / (s.avgMs * perFrame * 1e-3);
+    }
+  }
+
+  LOGI("Headless: %d frames of %ux%u, %d samples per pixel and frame on %s\n", settings.nbFrames,
+       settings.size.width, settings.size.height, report.nbSamples, report.device.c_str());
+  if(settings.splitCount > 1)
+    LOGI("  Part %d of %d of the accumulation\n", settings.splitIndex + 1, settings.splitCount);
+  LOGI("  Wall time: %.3f ms per frame, GPU time: %.3f ms per frame\n", report.frameMs,
+       report.gpuFrameMs);
+  for(const auto& s : report.passes)
+    LOGI("  %-20s avg %8.3f ms, min %8.3f ms, max %8.3f ms\n", s.name.c_str(), s.avgMs, s.minMs,
+         s.maxMs);
+  LOGI("  %.1f Mrays/s, AS built in %.2f ms, %.2f MB\n", report.raysPerSec * 1e-6,
+       report.asBuildMs, report.asMemoryMB);
+
+  bool success = true;
+  if(!settings.timingsFile.empty())
+    success &= helloVk.m_profiler.exportCsv(settings.timingsFile);
+  if(!settings.reportFile.empty())
+    success &= report.write(settings.reportFile);
+  if(!settings.imageFile.empty())
+  {
+    vk::Extent2D       size   = helloVk.renderSize();
+    std::vector<float> pixels = helloVk.offscreen().readAccumulation(size);
+    if(writeImage(settings.imageFile, size, pixels.data()))
+      LOGI("Headless: image written to %s\n", settings.imageFile.c_str());
+    else
+      success = false;
+  }
+  return success ? 0 : 1;
+}
+
+//--------------------------------------------------------------------------------------------------
+// Split accumulation: each process renders its part on its own GPU and writes it as EXR, then the
+// parts are averaged, all of them having the same number of frames. The processes only share the
+// command line, each one loading the scene and building the acceleration structures on its GPU.
+// The reports and timings are the ones of each process, they are not written.
+//
+int runSplitHeadless(int argc, char** argv, const HeadlessSettings& settings, int nbGpus)
+{
+  if(settings.imageFile.empty())
+  {
+    LOGE("Headless: -gpus needs -output, the image averaging the GPUs\n");
+    return 1;
+  }
+
+  // Arguments of this process, without the ones set for each GPU and the output files
+  std::stringstream args;
+  for(int i = 1; i < argc; i++)
+  {
+    const char* arg = argv[i];
+    if(strcmp(arg, "-gpus") == 0 || strcmp(arg, "-device") == 0 || strcmp(arg, "-output") == 0
+       || strcmp(arg, "-timings") == 0 || strcmp(arg, "-report") == 0)
+    {
+      i++;
+      continue;
+    }
+    if(strcmp(arg, "-split") == 0)
+    {
+      i += 2;
+      continue;
+    }
+    args << " \"" << arg << "\"";
+  }
+
+  std::vector<std::string> parts(nbGpus);
+  std::vector<int>         exitCodes(nbGpus, 1);
+  std::vector<std::thread> processes;
+  for(int gpu = 0; gpu < nbGpus; gpu++)
+  {
+    parts[gpu] = settings.imageFile + ".gpu" + std::to_string(gpu) + ".exr";
+    std::stringstream cmd;
+    cmd << "\"" << argv[0] << "\"" << args.str() << " -device " << gpu << " -split " << gpu << " "
+        << nbGpus << " -output \"" << parts[gpu] << "\"";
+    LOGI("Headless: GPU %d: %s\n", gpu, cmd.str().c_str());
+#ifdef WIN32
+    // cmd.exe removes the first and the last quotes of the command
+    std::string command = "\"" + cmd.str() + "\"";
+#else
+    std::string command = cmd.str();
+#endif
+    processes.emplace_back(
+        [&exitCodes, gpu, command] { exitCodes[gpu] = std::system(command.c_str()); });
+  }
+  for(auto& p : processes)
+    p.join();
+
+  vk::Extent2D       size;
+  std::vector<float> sum;
+  for(int gpu = 0; gpu < nbGpus; gpu++)
+  {
+    vk::Extent2D       partSize;
+    std::vector<float> part;
+    if(exitCodes[gpu] != 0 || !readExr(parts[gpu], partSize, part)
+       || (gpu > 0 && (partSize.width != size.width || partSize.height != size.height)))
+    {
+      LOGE("Headless: GPU %d did not complete (exit code %d)\n", gpu, exitCodes[gpu]);
+      return 1;
+    }
+    if(gpu == 0)
+    {
+      size = partSize;
+      sum.assign(part.size(), 0.f);
+    }
+    for(size_t i = 0; i < part.size(); i++)
+      sum[i] += part[i];
+    std::remove(parts[gpu].c_str());
+  }
+  for(auto& v : sum)
+    v /= float(nbGpus);
+
+  if(!writeImage(settings.imageFile, size, sum.data()))
+    return 1;
+  LOGI("Headless: %d frames on %d GPUs averaged in %s\n", settings.nbFrames * nbGpus, nbGpus,
+       settings.imageFile.c_str());
+  return 0;
+}
@@ -0,0 +1,123 @@
+/* Copyright (c) 2014-2018, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+
+#include "gpu_profiler.hpp"
+#include "nvmath/nvmath.h"
+
+class HelloVulkan;
+
+//--------------------------------------------------------------------------------------------------
+// Camera positions spread evenly over the frames, and interpolated linearly between them
+//
+// One position per line, lines starting with '#' are ignored:
+//   eye.x eye.y eye.z  center.x center.y center.z  up.x up.y up.z  [fov in degrees]
+//
+class CameraPath
+{
+public:
+  struct Key
+  {
+    nvmath::vec3f eye{5.f, 4.f, -4.f};
+    nvmath::vec3f center{0.f, 1.f, 0.f};
+    nvmath::vec3f up{0.f, 1.f, 0.f};
+    float         fov{60.f};
+  };
+
+  bool load(const std::string& filename);
+  bool empty() const { return m_keys.empty(); }
+
+  // Camera at t, from 0 for the first position to 1 for the last one
+  Key evaluate(float t) const;
+
+private:
+  std::vector<Key> m_keys;
+};
+
+//--------------------------------------------------------------------------------------------------
+// Rendering without window nor swapchain, for benchmarks and regression runs
+// - The frames are ray traced in the offscreen framebuffer one at a time, at a fixed resolution
+//   and sample count, following the camera path if any
+// - All textures are resident before the first frame, so that every run renders the same images
+// - The GPU time of the passes is logged when done, and optionally written as CSV
+// - With a tile budget (-tileSize, -tileBudget), each frame is submitted in several parts
+// - With -hybrid, the frames are rendered by the hybrid mode instead (see HybridRenderer)
+// - With -temporal, the accumulation follows the camera path (see TemporalAccumulator)
+// - With -wavefront, the bounces are traced in separate launches (see BounceQueue)
+// - With -renderScale, the frames are ray traced and written at the reduced size, there is no
+//   upsampling without the post pass
+// - With -split i n, the frames are the part i of n of a longer accumulation, continuing the random
+//   sequences of the parts before it. With -gpus n, runSplitHeadless renders the n parts on n GPUs
+//   at the same time and averages their images.
+// - The accumulation image of the last frame is optionally written as PNG (gamma corrected) or
+//   EXR (linear), depending on the extension of the file
+//
+struct HeadlessSettings
+{
+  vk::Extent2D size{1280, 720};
+  int          nbFrames{100};
+  std::string  cameraFile;     // Default camera of the sample if empty
+  std::string  imageFile;      // .png or .exr
+  std::string  timingsFile;    // GPU time of each pass and frame
+  std::string  reportFile;     // Summary read by the benchmark suite, see HeadlessReport
+  int          splitIndex{0};  // Part of the accumulation rendered by this process
+  int          splitCount{1};
+};
+
+// Summary of a headless run, written as JSON for the benchmark suite (benchmark/)
+struct HeadlessReport
+{
+  std::string                     device;
+  HeadlessSettings                settings;
+  int                             nbSamples{0};
+  double                          frameMs{0};     // Wall time, including the submissions
+  double                          gpuFrameMs{0};  // Sum of the passes
+  double                          raysPerSec{0};  // Camera rays of the ray tracing pass
+  double                          asBuildMs{0};
+  double                          asMemoryMB{0};  // BLAS and TLAS
+  std::vector<GpuProfiler::Stats> passes;
+
+  bool write(const std::string& filename) const;
+};
+
+// Returns the exit code of the application
+int runHeadless(HelloVulkan& helloVk, const HeadlessSettings& settings);
+
+// One process of the application per GPU, each one on its own device with -device and -split, the
+// other arguments being the ones of this process. Returns the exit code of the application.
+//
+// The GPUs are not used as a device group: AppBase, the allocators, the acceleration structure
+// builder and the swapchain all work on a single device, and a group would need a device mask on
+// every allocation, build and submission, plus peer memory to composite the images. Splitting the
+// samples of a static accumulation needs none of it, each process renders a full image and only
+// the average crosses the GPUs. The interactive mode renders on one GPU.
+int runSplitHeadless(int argc, char** argv, const HeadlessSettings& settings, int nbGpus);
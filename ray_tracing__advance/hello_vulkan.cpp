@@ -25,6 +25,10 @@
  * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
 #include <sstream>
 #include <vulkan/vulkan.hpp>
 
@@ -35,7 +39,13 @@ extern std::vector<std::string> defaultSearchPaths;
 
 #define STB_IMAGE_IMPLEMENTATION
 #include "fileformats/stb_image.h"
+#include "obj_cache.h"
 #include "obj_loader.h"
+#include "implicit_clusters.hpp"
+#include "mesh_lod.hpp"
+#include "startup_scheduler.hpp"
+#include "threadpool.hpp"
+#include "vertex_packing.hpp"
 
 #include "hello_vulkan.h"
 #include "nvh//cameramanipulator.hpp"
@@ -47,6 +57,15 @@ extern std::vector<std::string> defaultSearchPaths;
 #include "nvvk/renderpasses_vk.hpp"
 
 
+// FNV-1a, identifying the content of the BLAS cache
+static uint64_t hashBytes(uint64_t hash, const void* data, size_t size)
+{
+  const uint8_t* bytes = static_cast<const uint8_t*>(data);
+  for(size_t i = 0; i < size; i++)
+    hash = (hash ^ bytes[i]) * 1099511628211ull;
+  return hash;
+}
+
 // Holding the camera matrices
 struct CameraMatrices
 {
@@ -55,6 +74,7 @@ struct CameraMatrices
   nvmath::mat4f viewInverse;
   // #VKRay
   nvmath::mat4f projInverse;
+  nvmath::mat4f prevViewProj;  // Temporal accumulation
 };
 
 //--------------------------------------------------------------------------------------------------
@@ -83,14 +103,28 @@ void HelloVulkan::setup(const vk::Instance&       instance,
   m_alloc.init(device, physicalDevice, m_memAllocator);
 #endif
   m_debug.setup(m_device);
+  MemoryStats::shared().setup(physicalDevice);
+  m_geometry.setup(device, &m_alloc);
+
 
+  // Pipelines compiled in a previous run are taken from the cache
+  m_pipelineCache.init(device, physicalDevice, std::string(PROJECT_NAME) + ".pipelinecache");
 
-  m_offscreen.setup(device, &m_alloc, queueFamily);
-  m_raytrace.setup(device, physicalDevice, &m_alloc, queueFamily);
+  m_textureStreamer.setup(device, physicalDevice, &m_alloc, queueFamily, &m_pipelineCache);
+
+  // The render targets are replaced while the frames in flight use the previous ones
+  m_offscreen.setup(device, &m_alloc, queueFamily, &m_pipelineCache, &m_retired);
+  m_raytrace.setup(device, physicalDevice, &m_alloc, queueFamily, &m_pipelineCache, &m_retired);
+  m_adaptive.setup(device, &m_alloc, queueFamily, &m_pipelineCache, &m_retired);
+  m_hybrid.setup(device, &m_alloc, queueFamily, &m_pipelineCache, &m_retired);
+  m_temporalAccum.setup(device, &m_alloc, queueFamily, &m_pipelineCache, &m_retired);
+  m_bounces.setup(device, &m_alloc, queueFamily, &m_pipelineCache, &m_retired);
+  m_rayStats.setup(device, &m_alloc, queueFamily, &m_retired);
 }
 
 //--------------------------------------------------------------------------------------------------
-// Called at each frame to update the camera matrix
+// Called at each frame to update the camera matrix, after prepareFrame: the slot of the frame is
+// no longer read by the GPU
 //
 void HelloVulkan::updateUniformBuffer()
 {
@@ -103,19 +137,23 @@ void HelloVulkan::updateUniformBuffer()
   ubo.viewInverse = nvmath::invert(ubo.view);
   // #VKRay
   ubo.projInverse = nvmath::invert(ubo.proj);
+  // The camera of the previous call, which is the previous frame
+  ubo.prevViewProj = m_prevViewProj;
+  m_prevViewProj   = ubo.proj * ubo.view;
 
+  vk::DeviceSize offset = frameSlot() * m_cameraStride;
 #if defined(NVVK_ALLOC_DEDICATED)
-  void* data = m_device.mapMemory(m_cameraMat.allocation, 0, sizeof(CameraMatrices));
+  void* data = m_device.mapMemory(m_cameraMat.allocation, offset, sizeof(CameraMatrices));
   memcpy(data, &ubo, sizeof(ubo));
   m_device.unmapMemory(m_cameraMat.allocation);
 #elif defined(NVVK_ALLOC_DMA)
-  void* data = m_memAllocator.map(m_cameraMat.allocation);
-  memcpy(data, &ubo, sizeof(ubo));
+  char* data = reinterpret_cast<char*>(m_memAllocator.map(m_cameraMat.allocation));
+  memcpy(data + offset, &ubo, sizeof(ubo));
   m_memAllocator.unmap(m_cameraMat.allocation);
 #elif defined(NVVK_ALLOC_VMA)
   void* data;
   vmaMapMemory(m_memAllocator, m_cameraMat.allocation, &data);
-  memcpy(data, &ubo, sizeof(ubo));
+  memcpy(reinterpret_cast<char*>(data) + offset, &ubo, sizeof(ubo));
   vmaUnmapMemory(m_memAllocator, m_cameraMat.allocation);
 #endif
 }
@@ -129,40 +167,40 @@ void HelloVulkan::createDescriptorSetLayout()
   using vkDT     = vk::DescriptorType;
   using vkSS     = vk::ShaderStageFlagBits;
   uint32_t nbTxt = static_cast<uint32_t>(m_textures.size());
-  uint32_t nbObj = static_cast<uint32_t>(m_objModel.size());
 
-  // Camera matrices (binding = 0)
+  // Camera matrices (binding = 0), the compute stage is the shading of the hybrid mode
   m_descSetLayoutBind.addBinding(
-      vkDS(0, vkDT::eUniformBuffer, 1, vkSS::eVertex | vkSS::eRaygenKHR));
-  // Materials (binding = 1)
+      vkDS(0, vkDT::eUniformBuffer, 1, vkSS::eVertex | vkSS::eRaygenKHR | vkSS::eCompute));
+  // Device addresses of the data of all objects (binding = 1)
   m_descSetLayoutBind.addBinding(
-      vkDS(1, vkDT::eStorageBuffer, nbObj + 1,  // Adding Implicit mat too
-           vkSS::eVertex | vkSS::eFragment | vkSS::eClosestHitKHR | vkSS::eAnyHitKHR));
+      vkDS(1, vkDT::eStorageBuffer, 1,
+           vkSS::eFragment | vkSS::eClosestHitKHR | vkSS::eAnyHitKHR | vkSS::eIntersectionKHR
+               | vkSS::eCompute));
   // Scene description (binding = 2)
   m_descSetLayoutBind.addBinding(  //
       vkDS(2, vkDT::eStorageBuffer, 1,
-           vkSS::eVertex | vkSS::eFragment | vkSS::eClosestHitKHR | vkSS::eAnyHitKHR));
+           vkSS::eVertex | vkSS::eFragment | vkSS::eClosestHitKHR | vkSS::eAnyHitKHR
+               | vkSS::eCompute));
   // Textures (binding = 3)
-  m_descSetLayoutBind.addBinding(
-      vkDS(3, vkDT::eCombinedImageSampler, nbTxt, vkSS::eFragment | vkSS::eClosestHitKHR));
-  // Materials (binding = 4)
-  m_descSetLayoutBind.addBinding(vkDS(4, vkDT::eStorageBuffer, nbObj,
-                                      vkSS::eFragment | vkSS::eClosestHitKHR | vkSS::eAnyHitKHR));
-  // Storing vertices (binding = 5)
-  m_descSetLayoutBind.addBinding(  //
-      vkDS(5, vkDT::eStorageBuffer, nbObj, vkSS::eClosestHitKHR | vkSS::eAnyHitKHR));
-  // Storing indices (binding = 6)
-  m_descSetLayoutBind.addBinding(  //
-      vkDS(6, vkDT::eStorageBuffer, nbObj, vkSS::eClosestHitKHR | vkSS::eAnyHitKHR));
+  m_descSetLayoutBind.addBinding(vkDS(3, vkDT::eCombinedImageSampler, nbTxt,
+                                      vkSS::eFragment | vkSS::eClosestHitKHR | vkSS::eCompute));
   // Storing implicit obj (binding = 7)
   m_descSetLayoutBind.addBinding(  //
       vkDS(7, vkDT::eStorageBuffer, 1,
            vkSS::eClosestHitKHR | vkSS::eIntersectionKHR | vkSS::eAnyHitKHR));
+  // Lights of the scene (binding = 8) and their alias table (binding = 9)
+  m_descSetLayoutBind.addBinding(
+      vkDS(8, vkDT::eStorageBuffer, 1, vkSS::eClosestHitKHR | vkSS::eCallableKHR));
+  m_descSetLayoutBind.addBinding(vkDS(9, vkDT::eStorageBuffer, 1, vkSS::eClosestHitKHR));
 
 
+  // One set per frame in flight, differing by the slot of the camera matrices
   m_descSetLayout = m_descSetLayoutBind.createLayout(m_device);
-  m_descPool      = m_descSetLayoutBind.createPool(m_device, 1);
-  m_descSet       = nvvk::allocateDescriptorSet(m_device, m_descPool, m_descSetLayout);
+  m_descPool      = m_descSetLayoutBind.createPool(m_device, framesInFlight());
+  m_descSets.resize(framesInFlight());
+  m_texturesDirty.assign(framesInFlight(), false);
+  for(auto& descSet : m_descSets)
+    descSet = nvvk::allocateDescriptorSet(m_device, m_descPool, m_descSetLayout);
 }
 
 //--------------------------------------------------------------------------------------------------
@@ -172,29 +210,10 @@ void HelloVulkan::updateDescriptorSet()
 {
   std::vector<vk::WriteDescriptorSet> writes;
 
-  // Camera matrices and scene description
-  vk::DescriptorBufferInfo dbiUnif{m_cameraMat.buffer, 0, VK_WHOLE_SIZE};
-  writes.emplace_back(m_descSetLayoutBind.makeWrite(m_descSet, 0, &dbiUnif));
-  vk::DescriptorBufferInfo dbiSceneDesc{m_sceneDesc.buffer, 0, VK_WHOLE_SIZE};
-  writes.emplace_back(m_descSetLayoutBind.makeWrite(m_descSet, 2, &dbiSceneDesc));
-
-  // All material buffers, 1 buffer per OBJ
-  std::vector<vk::DescriptorBufferInfo> dbiMat;
-  std::vector<vk::DescriptorBufferInfo> dbiMatIdx;
-  std::vector<vk::DescriptorBufferInfo> dbiVert;
-  std::vector<vk::DescriptorBufferInfo> dbiIdx;
-  for(auto& model : m_objModel)
-  {
-    dbiMat.emplace_back(model.matColorBuffer.buffer, 0, VK_WHOLE_SIZE);
-    dbiMatIdx.emplace_back(model.matIndexBuffer.buffer, 0, VK_WHOLE_SIZE);
-    dbiVert.emplace_back(model.vertexBuffer.buffer, 0, VK_WHOLE_SIZE);
-    dbiIdx.emplace_back(model.indexBuffer.buffer, 0, VK_WHOLE_SIZE);
-  }
-  dbiMat.emplace_back(m_implObjects.implMatBuf.buffer, 0, VK_WHOLE_SIZE);  // Adding implicit mat
-  writes.emplace_back(m_descSetLayoutBind.makeWriteArray(m_descSet, 1, dbiMat.data()));
-  writes.emplace_back(m_descSetLayoutBind.makeWriteArray(m_descSet, 4, dbiMatIdx.data()));
-  writes.emplace_back(m_descSetLayoutBind.makeWriteArray(m_descSet, 5, dbiVert.data()));
-  writes.emplace_back(m_descSetLayoutBind.makeWriteArray(m_descSet, 6, dbiIdx.data()));
+  // Camera matrices of the slot of each set
+  std::vector<vk::DescriptorBufferInfo> dbiUnif;
+  for(uint32_t slot = 0; slot < m_descSets.size(); slot++)
+    dbiUnif.emplace_back(m_cameraMat.buffer, slot * m_cameraStride, sizeof(CameraMatrices));
 
   // All texture samplers
   std::vector<vk::DescriptorImageInfo> diit;
@@ -202,10 +221,24 @@ void HelloVulkan::updateDescriptorSet()
   {
     diit.push_back(texture.descriptor);
   }
-  writes.emplace_back(m_descSetLayoutBind.makeWriteArray(m_descSet, 3, diit.data()));
 
+  vk::DescriptorBufferInfo dbiSceneDesc{m_sceneDesc.buffer, 0, VK_WHOLE_SIZE};
+  vk::DescriptorBufferInfo dbiObjDesc{m_objDesc.buffer, 0, VK_WHOLE_SIZE};
   vk::DescriptorBufferInfo dbiImplDesc{m_implObjects.implBuf.buffer, 0, VK_WHOLE_SIZE};
-  writes.emplace_back(m_descSetLayoutBind.makeWrite(m_descSet, 7, &dbiImplDesc));
+  vk::DescriptorBufferInfo dbiLights{m_lightBuf.buffer, 0, VK_WHOLE_SIZE};
+  vk::DescriptorBufferInfo dbiLightAliases{m_lightAliasBuf.buffer, 0, VK_WHOLE_SIZE};
+  for(uint32_t slot = 0; slot < m_descSets.size(); slot++)
+  {
+    const vk::DescriptorSet& descSet = m_descSets[slot];
+    writes.emplace_back(m_descSetLayoutBind.makeWrite(descSet, 0, &dbiUnif[slot]));
+    writes.emplace_back(m_descSetLayoutBind.makeWrite(descSet, 2, &dbiSceneDesc));
+    // The data of all objects is reached through their device addresses
+    writes.emplace_back(m_descSetLayoutBind.makeWrite(descSet, 1, &dbiObjDesc));
+    writes.emplace_back(m_descSetLayoutBind.makeWriteArray(descSet, 3, diit.data()));
+    writes.emplace_back(m_descSetLayoutBind.makeWrite(descSet, 7, &dbiImplDesc));
+    writes.emplace_back(m_descSetLayoutBind.makeWrite(descSet, 8, &dbiLights));
+    writes.emplace_back(m_descSetLayoutBind.makeWrite(descSet, 9, &dbiLightAliases));
+  }
 
   // Writing the information
   m_device.updateDescriptorSets(static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
@@ -230,21 +263,69 @@ void HelloVulkan::createGraphicsPipeline()
   pipelineLayoutCreateInfo.setPPushConstantRanges(&pushConstantRanges);
   m_pipelineLayout = m_device.createPipelineLayout(pipelineLayoutCreateInfo);
 
-  // Creating the Pipeline
+  {
+    PipelineCache::Timer timer(m_pipelineCache, "graphics");
+    m_graphicsPipeline =
+        createRasterPipeline(m_offscreen.renderPass(), "shaders/frag_shader.frag.spv", 1);
+  }
+  m_debug.setObjectName(m_graphicsPipeline, "Graphics");
+
+  // Same vertex stage, writing the G-buffer of the hybrid mode
+  if(m_hybridSupported)
+  {
+    PipelineCache::Timer timer(m_pipelineCache, "G-buffer");
+    m_gbufferPipeline = createRasterPipeline(m_hybrid.gbufferRenderPass(),
+                                             "shaders/gbuffer.frag.spv",
+                                             HybridRenderer::kNbGBufferAttachments);
+    m_debug.setObjectName(m_gbufferPipeline, "GBuffer");
+  }
+}
+
+//--------------------------------------------------------------------------------------------------
+// Pipeline drawing the OBJ instances with the vertex layout of the models, the fragment shader
+// writing nbColorAttachments outputs
+//
+vk::Pipeline HelloVulkan::createRasterPipeline(const vk::RenderPass& renderPass,
+                                               const std::string&    fragShader,
+                                               uint32_t              nbColorAttachments)
+{
+  using vkSS = vk::ShaderStageFlagBits;
+
   std::vector<std::string>                paths = defaultSearchPaths;
-  nvvk::GraphicsPipelineGeneratorCombined gpb(m_device, m_pipelineLayout, m_offscreen.renderPass());
+  nvvk::GraphicsPipelineGeneratorCombined gpb(m_device, m_pipelineLayout, renderPass);
   gpb.depthStencilState.depthTestEnable = true;
-  gpb.addShader(nvh::loadFile("shaders/vert_shader.vert.spv", true, paths), vkSS::eVertex);
-  gpb.addShader(nvh::loadFile("shaders/frag_shader.frag.spv", true, paths), vkSS::eFragment);
-  gpb.addBindingDescription({0, sizeof(VertexObj)});
-  gpb.addAttributeDescriptions(std::vector<vk::VertexInputAttributeDescription>{
-      {0, 0, vk::Format::eR32G32B32Sfloat, offsetof(VertexObj, pos)},
-      {1, 0, vk::Format::eR32G32B32Sfloat, offsetof(VertexObj, nrm)},
-      {2, 0, vk::Format::eR32G32B32Sfloat, offsetof(VertexObj, color)},
-      {3, 0, vk::Format::eR32G32Sfloat, offsetof(VertexObj, texCoord)}});
-
-  m_graphicsPipeline = gpb.createPipeline();
-  m_debug.setObjectName(m_graphicsPipeline, "Graphics");
+  for(uint32_t i = 1; i < nbColorAttachments; i++)
+    gpb.addBlendAttachmentState(
+        nvvk::GraphicsPipelineState::makePipelineColorBlendAttachmentState());
+
+  // PACKED_VERTICES: the normal is fetched in octahedral encoding
+  int                        packed = m_packedVertices ? 1 : 0;
+  vk::SpecializationMapEntry specEntry{0, 0, sizeof(int)};
+  vk::SpecializationInfo     specInfo{1, &specEntry, sizeof(int), &packed};
+  gpb.addShader(nvh::loadFile("shaders/vert_shader.vert.spv", true, paths), vkSS::eVertex)
+      .setPSpecializationInfo(&specInfo);
+  gpb.addShader(nvh::loadFile(fragShader, true, paths), vkSS::eFragment);
+  if(m_packedVertices)
+  {
+    // The vertex fetch expands the quantized attributes, except the normal
+    gpb.addBindingDescription({0, sizeof(nvmath::vec3f)});
+    gpb.addBindingDescription({1, sizeof(VertexAttribPacked)});
+    gpb.addAttributeDescriptions(std::vector<vk::VertexInputAttributeDescription>{
+        {0, 0, vk::Format::eR32G32B32Sfloat, 0},
+        {1, 1, vk::Format::eR16G16Snorm, offsetof(VertexAttribPacked, normal)},
+        {2, 1, vk::Format::eR8G8B8A8Unorm, offsetof(VertexAttribPacked, color)},
+        {3, 1, vk::Format::eR16G16Sfloat, offsetof(VertexAttribPacked, texCoord)}});
+  }
+  else
+  {
+    gpb.addBindingDescription({0, sizeof(VertexObj)});
+    gpb.addAttributeDescriptions(std::vector<vk::VertexInputAttributeDescription>{
+        {0, 0, vk::Format::eR32G32B32Sfloat, offsetof(VertexObj, pos)},
+        {1, 0, vk::Format::eR32G32B32Sfloat, offsetof(VertexObj, nrm)},
+        {2, 0, vk::Format::eR32G32B32Sfloat, offsetof(VertexObj, color)},
+        {3, 0, vk::Format::eR32G32Sfloat, offsetof(VertexObj, texCoord)}});
+  }
+  return gpb.createPipeline(m_pipelineCache.get());
 }
 
 //--------------------------------------------------------------------------------------------------
@@ -254,51 +335,144 @@ void HelloVulkan::loadModel(const std::string& filename, nvmath::mat4f transform
 {
   using vkBU = vk::BufferUsageFlagBits;
 
-  ObjLoader loader;
-  loader.loadModel(filename);
+  // Using the binary cache next to the OBJ when it is up to date, otherwise parsing
+  // the OBJ and writing the cache for the next run.
+  ObjCache cache;
+  if(!cache.load(filename))
+  {
+    ObjLoader loader;
+    loader.loadModel(filename);
+    ObjCache::save(filename, loader);
+    cache.assign(std::move(loader));
+  }
+
+  // A BLAS cache written with other files, or other versions of them, is not used
+  uint64_t fileSize = 0, fileTime = 0;
+  ObjCache::fileStamp(filename, fileSize, fileTime);
+  m_sceneKey = hashBytes(m_sceneKey, filename.data(), filename.size());
+  m_sceneKey = hashBytes(m_sceneKey, &fileSize, sizeof(fileSize));
+  m_sceneKey = hashBytes(m_sceneKey, &fileTime, sizeof(fileTime));
+  // The materials decide which triangles are alpha-tested (partitionAlphaTriangles)
+  m_sceneKey = hashBytes(m_sceneKey, cache.materials(), cache.materialsSize());
+
+  // Textures shared with the models already loaded are not loaded again
+  std::vector<int> textureIndices = createTextureImages(cache.textures());
+
+  // Converting from Srgb to linear and pointing the materials to the shared textures
+  // (mapped pages are copy-on-write, the file is untouched)
+  for(uint32_t i = 0; i < cache.nbMaterials(); i++)
+  {
+    MaterialObj& m = cache.materials()[i];
+    m.ambient      = nvmath::pow(m.ambient, 2.2f);
+    m.diffuse      = nvmath::pow(m.diffuse, 2.2f);
+    m.specular     = nvmath::pow(m.specular, 2.2f);
+    if(m.textureID >= 0)
+      m.textureID = textureIndices[m.textureID];
+  }
+
+  // The opaque triangles and the alpha-tested ones are separate geometries of the BLAS, only the
+  // latter invoking the any-hit shader
+  uint32_t nbTriangles        = std::min(cache.nbIndices() / 3, cache.nbMatIndx());
+  uint32_t nbOpaqueTriangles = partitionAlphaTriangles(
+      cache.indices(), cache.matIndx(), nbTriangles, cache.materials(), cache.nbMaterials());
 
-  // Converting from Srgb to linear
-  for(auto& m : loader.m_materials)
+  // Emissive triangles, placed in the scene by createLightBuffers for each instance of the model
+  std::vector<LightDesc> emitters;
+  for(uint32_t t = 0; m_emissiveLights && t < nbTriangles; t++)
   {
-    m.ambient  = nvmath::pow(m.ambient, 2.2f);
-    m.diffuse  = nvmath::pow(m.diffuse, 2.2f);
-    m.specular = nvmath::pow(m.specular, 2.2f);
+    const MaterialObj& m = cache.materials()[cache.matIndx()[t]];
+    if(std::max(std::max(m.emission.x, m.emission.y), m.emission.z) <= 0.f)
+      continue;
+    const uint32_t* tri = cache.indices() + t * 3;
+    LightDesc       light;
+    light.type      = eLightTriangle;
+    light.position  = cache.vertices()[tri[0]].pos;
+    light.direction = cache.vertices()[tri[1]].pos;
+    light.vertex2   = cache.vertices()[tri[2]].pos;
+    light.color     = m.emission;
+    emitters.push_back(light);
   }
 
   ObjInstance instance;
   instance.objIndex    = static_cast<uint32_t>(m_objModel.size());
   instance.transform   = transform;
   instance.transformIT = nvmath::transpose(nvmath::invert(transform));
-  instance.txtOffset   = static_cast<uint32_t>(m_textures.size());
 
   ObjModel model;
-  model.nbIndices  = static_cast<uint32_t>(loader.m_indices.size());
-  model.nbVertices = static_cast<uint32_t>(loader.m_vertices.size());
+  model.nbIndices         = cache.nbIndices();
+  model.nbVertices        = cache.nbVertices();
+  model.nbOpaqueTriangles = nbOpaqueTriangles;
+  model.boundingSphere    = meshBoundingSphere(cache.vertices(), cache.nbVertices());
+
+  // Levels of detail, the cells doubling at each step. The steps removing less than a quarter of
+  // the triangles of the previous level are skipped.
+  std::vector<MeshLod> lods;
+  uint32_t             lodTriangles = nbTriangles;
+  float                cellSize     = model.boundingSphere.w / 32.f;
+  for(int step = 0; step < 8 && static_cast<int>(lods.size()) < m_nbLods; step++, cellSize *= 2.f)
+  {
+    MeshLod lod = simplifyMesh(cache.vertices(), cache.nbVertices(), cache.indices(),
+                               cache.matIndx(), nbTriangles, nbOpaqueTriangles, cellSize);
+    if(lod.matIndx.empty())
+      break;
+    if(lod.matIndx.size() > lodTriangles * 3 / 4)
+      continue;
+    lodTriangles = static_cast<uint32_t>(lod.matIndx.size());
+    lods.emplace_back(std::move(lod));
+  }
 
-  // Create the buffers on Device and copy vertices, indices and materials
+  // Copy vertices, indices and materials in the geometry pool
+  // The data is uploaded directly from the mapped cache into the staging buffers
   nvvk::CommandPool cmdBufGet(m_device, m_graphicsQueueIndex);
   vk::CommandBuffer cmdBuf = cmdBufGet.createCommandBuffer();
-  model.vertexBuffer =
-      m_alloc.createBuffer(cmdBuf, loader.m_vertices,
-                           vkBU::eVertexBuffer | vkBU::eStorageBuffer | vkBU::eShaderDeviceAddress);
-  model.indexBuffer =
-      m_alloc.createBuffer(cmdBuf, loader.m_indices,
-                           vkBU::eIndexBuffer | vkBU::eStorageBuffer | vkBU::eShaderDeviceAddress);
-  model.matColorBuffer = m_alloc.createBuffer(cmdBuf, loader.m_materials, vkBU::eStorageBuffer);
-  model.matIndexBuffer = m_alloc.createBuffer(cmdBuf, loader.m_matIndx, vkBU::eStorageBuffer);
-  // Creates all textures found
-  createTextureImages(cmdBuf, loader.m_textures);
+  if(m_packedVertices)
+  {
+    std::vector<nvmath::vec3f>      positions;
+    std::vector<VertexAttribPacked> attributes;
+    packVertices(cache.vertices(), cache.nbVertices(), positions, attributes);
+    model.vertexStride = sizeof(nvmath::vec3f);
+    model.vertices     = m_geometry.upload(cmdBuf, positions);
+    model.attribs      = m_geometry.upload(cmdBuf, attributes);
+  }
+  else
+  {
+    model.vertices = m_geometry.upload(cmdBuf, cache.verticesSize(), cache.vertices());
+  }
+  // Small meshes: 16-bit indices, padded to a multiple of 4 bytes for the shader fetch
+  if(model.nbVertices < (1u << 16))
+    model.indexType = vk::IndexType::eUint16;
+  auto uploadIndices = [&](const uint32_t* indices, uint32_t count) {
+    if(model.indexType == vk::IndexType::eUint32)
+      return m_geometry.upload(cmdBuf, count * sizeof(uint32_t), indices);
+    std::vector<uint16_t> indices16((count + 1) & ~1u, 0);
+    std::copy(indices, indices + count, indices16.begin());
+    return m_geometry.upload(cmdBuf, indices16);
+  };
+  model.indices    = uploadIndices(cache.indices(), model.nbIndices);
+  model.matColors  = m_geometry.upload(cmdBuf, cache.materialsSize(), cache.materials());
+  model.matIndices = m_geometry.upload(cmdBuf, cache.matIndxSize(), cache.matIndx());
+  for(const MeshLod& lod : lods)
+  {
+    ObjLod level;
+    level.nbIndices         = static_cast<uint32_t>(lod.indices.size());
+    level.nbOpaqueTriangles = lod.nbOpaqueTriangles;
+    level.indices           = uploadIndices(lod.indices.data(), level.nbIndices);
+    level.matIndices        = m_geometry.upload(cmdBuf, lod.matIndx);
+    level.error             = lod.error;
+    model.lods.push_back(level);
+  }
+  // Hit group of the instances of the model
+  model.materialClass = materialClass(cache.materials(), cache.nbMaterials());
   cmdBufGet.submitAndWait(cmdBuf);
-  m_alloc.finalizeAndReleaseStaging();
-
-  std::string objNb = std::to_string(instance.objIndex);
-  m_debug.setObjectName(model.vertexBuffer.buffer, (std::string("vertex_" + objNb).c_str()));
-  m_debug.setObjectName(model.indexBuffer.buffer, (std::string("index_" + objNb).c_str()));
-  m_debug.setObjectName(model.matColorBuffer.buffer, (std::string("mat_" + objNb).c_str()));
-  m_debug.setObjectName(model.matIndexBuffer.buffer, (std::string("matIdx_" + objNb).c_str()));
+  m_geometry.releaseStaging();
+  MemoryStats::shared().add(MemoryCategory::eVertex, model.vertices.size + model.attribs.size);
+  MemoryStats::shared().add(MemoryCategory::eIndex, model.indices.size);
+  for(const ObjLod& lod : model.lods)
+    MemoryStats::shared().add(MemoryCategory::eIndex, lod.indices.size + lod.matIndices.size);
 
   m_objModel.emplace_back(model);
   m_objInstance.emplace_back(instance);
+  m_emitters.emplace_back(std::move(emitters));
 }
 
 //--------------------------------------------------------------------------------------------------
@@ -310,7 +484,12 @@ void HelloVulkan::createUniformBuffer()
   using vkBU = vk::BufferUsageFlagBits;
   using vkMP = vk::MemoryPropertyFlagBits;
 
-  m_cameraMat = m_alloc.createBuffer(sizeof(CameraMatrices), vkBU::eUniformBuffer,
+  // One slot per frame in flight, at the alignment of the uniform buffer offsets
+  vk::DeviceSize alignment =
+      m_physicalDevice.getProperties().limits.minUniformBufferOffsetAlignment;
+  m_cameraStride = (sizeof(CameraMatrices) + alignment - 1) / alignment * alignment;
+
+  m_cameraMat = m_alloc.createBuffer(m_cameraStride * framesInFlight(), vkBU::eUniformBuffer,
 #ifndef NVVK_ALLOC_VMA
                                      vkMP::eHostVisible | vkMP::eHostCoherent);
 #else
@@ -330,83 +509,121 @@ void HelloVulkan::createSceneDescriptionBuffer()
   using vkBU = vk::BufferUsageFlagBits;
   nvvk::CommandPool cmdGen(m_device, m_graphicsQueueIndex);
 
+  // Compact layout of the instances read by the shaders
+  std::vector<ObjInstanceDesc> instDesc(m_objInstance.size());
+  for(size_t i = 0; i < m_objInstance.size(); i++)
+  {
+    nvmath::mat4f rows = nvmath::transpose(m_objInstance[i].transform);
+    memcpy(instDesc[i].transfo, &rows, sizeof(instDesc[i].transfo));
+    instDesc[i].objId     = m_objInstance[i].objIndex;
+    instDesc[i].index16 = m_objModel[instDesc[i].objId].indexType == vk::IndexType::eUint16;
+  }
+
+  // Where the shaders find the data of each object, the clusters of implicit objects being last
+  size_t               nbClusters = std::max<size_t>(m_implObjects.clusters.size(), 1);
+  std::vector<ObjDesc> objDesc(m_objModel.size() + nbClusters);
+  for(size_t i = 0; i < m_objModel.size(); i++)
+  {
+    objDesc[i].vertexAddress        = m_objModel[i].vertices.address;
+    objDesc[i].attribAddress        = m_objModel[i].attribs.address;
+    objDesc[i].indexAddress         = m_objModel[i].indices.address;
+    objDesc[i].materialAddress      = m_objModel[i].matColors.address;
+    objDesc[i].materialIndexAddress = m_objModel[i].matIndices.address;
+    objDesc[i].firstAlphaTriangle   = m_objModel[i].nbOpaqueTriangles;
+  }
+  vk::DeviceAddress implMatAddress = m_device.getBufferAddress({m_implObjects.implMatBuf.buffer});
+  for(size_t c = 0; c < nbClusters; c++)
+  {
+    ObjDesc& desc        = objDesc[m_objModel.size() + c];
+    desc.materialAddress = implMatAddress;
+    if(c < m_implObjects.clusters.size())
+      desc.firstImplicit = m_implObjects.clusters[c].first;
+  }
+  // The levels of detail, after the clusters, only have their own triangles
+  for(size_t i = 0; i < m_objModel.size(); i++)
+  {
+    for(ObjLod& lod : m_objModel[i].lods)
+    {
+      lod.objDescId             = static_cast<uint32_t>(objDesc.size());
+      ObjDesc desc              = objDesc[i];
+      desc.indexAddress         = lod.indices.address;
+      desc.materialIndexAddress = lod.matIndices.address;
+      desc.firstAlphaTriangle   = lod.nbOpaqueTriangles;
+      objDesc.push_back(desc);
+    }
+  }
+
   auto cmdBuf = cmdGen.createCommandBuffer();
-  m_sceneDesc = m_alloc.createBuffer(cmdBuf, m_objInstance, vkBU::eStorageBuffer);
+  m_sceneDesc = m_alloc.createBuffer(cmdBuf, instDesc, vkBU::eStorageBuffer);
+  m_objDesc   = m_alloc.createBuffer(cmdBuf, objDesc, vkBU::eStorageBuffer);
   cmdGen.submitAndWait(cmdBuf);
   m_alloc.finalizeAndReleaseStaging();
   m_debug.setObjectName(m_sceneDesc.buffer, "sceneDesc");
+  m_debug.setObjectName(m_objDesc.buffer, "objDesc");
 }
 
 //--------------------------------------------------------------------------------------------------
 // Creating all textures and samplers
 //
-void HelloVulkan::createTextureImages(const vk::CommandBuffer&        cmdBuf,
-                                      const std::vector<std::string>& textures)
+std::vector<int> HelloVulkan::createTextureImages(const std::vector<std::string>& textures)
 {
-  using vkIU = vk::ImageUsageFlagBits;
+  std::vector<int> indices;
 
-  vk::SamplerCreateInfo samplerCreateInfo{
-      {}, vk::Filter::eLinear, vk::Filter::eLinear, vk::SamplerMipmapMode::eLinear};
-  samplerCreateInfo.setMaxLod(FLT_MAX);
-  vk::Format format = vk::Format::eR8G8B8A8Srgb;
-
-  // If no textures are present, create a dummy one to accommodate the pipeline layout
+  // If no textures are present, the placeholder accommodates the pipeline layout
   if(textures.empty() && m_textures.empty())
   {
-    nvvk::Texture texture;
-
-    std::array<uint8_t, 4> color{255u, 255u, 255u, 255u};
-    vk::DeviceSize         bufferSize      = sizeof(color);
-    auto                   imgSize         = vk::Extent2D(1, 1);
-    auto                   imageCreateInfo = nvvk::makeImage2DCreateInfo(imgSize, format);
-
-    // Creating the VKImage
-    nvvk::Image image = m_alloc.createImage(cmdBuf, bufferSize, color.data(), imageCreateInfo);
-    vk::ImageViewCreateInfo ivInfo = nvvk::makeImageViewCreateInfo(image.image, imageCreateInfo);
-    texture                        = m_alloc.createTexture(image, ivInfo, samplerCreateInfo);
-
-    // The image format must be in VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL
-    nvvk::cmdBarrierImageLayout(cmdBuf, texture.image, vk::ImageLayout::eUndefined,
-                                vk::ImageLayout::eShaderReadOnlyOptimal);
-    m_textures.push_back(texture);
+    m_textures.push_back(m_textureStreamer.placeholder());
+    return indices;
   }
-  else
+
+  // Decoding all new images in the background, the placeholder is used until updateTextures()
+  for(const auto& texture : textures)
   {
-    // Uploading all images
-    for(const auto& texture : textures)
+    std::stringstream o;
+    o << "media/textures/" << texture;
+    std::string txtFile = nvh::findFile(o.str(), defaultSearchPaths);
+    std::string key     = txtFile.empty() ? o.str() : txtFile;
+
+    auto it = m_textureRegistry.find(key);
+    if(it == m_textureRegistry.end())
     {
-      std::stringstream o;
-      int               texWidth, texHeight, texChannels;
-      o << "media/textures/" << texture;
-      std::string txtFile = nvh::findFile(o.str(), defaultSearchPaths);
-
-      stbi_uc* pixels =
-          stbi_load(txtFile.c_str(), &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
-
-      // Handle failure
-      if(!pixels)
-      {
-        texWidth = texHeight = 1;
-        texChannels          = 4;
-        std::array<uint8_t, 4> color{255u, 0u, 255u, 255u};
-        pixels = reinterpret_cast<stbi_uc*>(color.data());
-      }
-
-      vk::DeviceSize bufferSize = static_cast<uint64_t>(texWidth) * texHeight * sizeof(uint8_t) * 4;
-      auto           imgSize    = vk::Extent2D(texWidth, texHeight);
-      auto imageCreateInfo = nvvk::makeImage2DCreateInfo(imgSize, format, vkIU::eSampled, true);
-
-      {
-        nvvk::Image image = m_alloc.createImage(cmdBuf, bufferSize, pixels, imageCreateInfo);
-        nvvk::cmdGenerateMipmaps(cmdBuf, image.image, format, imgSize, imageCreateInfo.mipLevels);
-        vk::ImageViewCreateInfo ivInfo =
-            nvvk::makeImageViewCreateInfo(image.image, imageCreateInfo);
-        nvvk::Texture texture = m_alloc.createTexture(image, ivInfo, samplerCreateInfo);
-
-        m_textures.push_back(texture);
-      }
+      it = m_textureRegistry.emplace(key, static_cast<int>(m_textures.size())).first;
+      m_textureStreamer.request(static_cast<uint32_t>(m_textures.size()), txtFile);
+      m_textures.push_back(m_textureStreamer.placeholder());
     }
+    indices.push_back(it->second);
+  }
+  return indices;
+}
+
+//--------------------------------------------------------------------------------------------------
+// Binding the textures which became resident since the last call, after prepareFrame
+// - Only the set of the frame slot is rewritten: the others can still be used by the frames in
+//   flight, they are rewritten when their slot comes
+//
+void HelloVulkan::updateTextures()
+{
+  std::vector<TextureStreamer::Resident> resident = m_textureStreamer.update();
+  for(auto& r : resident)
+    m_textures[r.slot] = r.texture;
+  if(!resident.empty())
+    m_texturesDirty.assign(m_descSets.size(), true);
+
+  uint32_t slot = frameSlot();
+  if(!m_texturesDirty[slot])
+    return;
+  m_texturesDirty[slot] = false;
+
+  std::vector<vk::DescriptorImageInfo> diit;
+  for(auto& texture : m_textures)
+  {
+    diit.push_back(texture.descriptor);
   }
+  std::vector<vk::WriteDescriptorSet> writes;
+  writes.emplace_back(m_descSetLayoutBind.makeWriteArray(m_descSets[slot], 3, diit.data()));
+  m_device.updateDescriptorSets(writes, nullptr);
+  // The accumulation restarts until the sets of all slots have the textures
+  resetFrame();
 }
 
 //--------------------------------------------------------------------------------------------------
@@ -414,33 +631,54 @@ void HelloVulkan::createTextureImages(const vk::CommandBuffer&        cmdBuf,
 //
 void HelloVulkan::destroyResources()
 {
+  // The device is idle, the render targets which were replaced go before their pools
+  m_retired.releaseAll();
   m_device.destroy(m_graphicsPipeline);
+  m_device.destroy(m_gbufferPipeline);
   m_device.destroy(m_pipelineLayout);
   m_device.destroy(m_descPool);
   m_device.destroy(m_descSetLayout);
   m_alloc.destroy(m_cameraMat);
   m_alloc.destroy(m_sceneDesc);
+  m_alloc.destroy(m_objDesc);
   m_alloc.destroy(m_implObjects.implBuf);
   m_alloc.destroy(m_implObjects.implMatBuf);
-
+  if(m_implStagingMapped)
+    m_alloc.unmap(m_implStaging);
+  m_alloc.destroy(m_implStaging);
+  m_implStagingMapped = nullptr;
+  m_alloc.destroy(m_lightBuf);
+  m_alloc.destroy(m_lightAliasBuf);
   for(auto& m : m_objModel)
   {
-    m_alloc.destroy(m.vertexBuffer);
-    m_alloc.destroy(m.indexBuffer);
-    m_alloc.destroy(m.matColorBuffer);
-    m_alloc.destroy(m.matIndexBuffer);
+    MemoryStats::shared().remove(MemoryCategory::eVertex, m.vertices.size + m.attribs.size);
+    MemoryStats::shared().remove(MemoryCategory::eIndex, m.indices.size);
   }
+  m_geometry.destroy();
 
   for(auto& t : m_textures)
   {
+    if(t.image == m_textureStreamer.placeholder().image)
+      continue;
+    MemoryStats::shared().remove(MemoryCategory::eTexture, MemoryStats::sizeOf(m_device, t.image));
     m_alloc.destroy(t);
   }
+  m_textureStreamer.destroy();
 
   //#Post
   m_offscreen.destroy();
 
   // #VKRay
   m_raytrace.destroy();
+  m_adaptive.destroy();
+  m_hybrid.destroy();
+  m_temporalAccum.destroy();
+  m_bounces.destroy();
+  m_rayStats.destroy();
+
+  m_profiler.destroy();
+  m_pipelineCache.save();
+  m_pipelineCache.destroy();
 
   m_alloc.deinit();
 #ifdef NVVK_ALLOC_DMA
@@ -454,20 +692,28 @@ void HelloVulkan::destroyResources()
 // Drawing the scene in raster mode
 //
 void HelloVulkan::rasterize(const vk::CommandBuffer& cmdBuf)
+{
+  m_debug.beginLabel(cmdBuf, "Rasterize");
+  drawInstances(cmdBuf, m_graphicsPipeline);
+  m_debug.endLabel(cmdBuf);
+}
+
+//--------------------------------------------------------------------------------------------------
+// Drawing all OBJ instances with a pipeline of createRasterPipeline, in the current render pass
+//
+void HelloVulkan::drawInstances(const vk::CommandBuffer& cmdBuf, const vk::Pipeline& pipeline)
 {
   using vkPBP = vk::PipelineBindPoint;
   using vkSS  = vk::ShaderStageFlagBits;
-  vk::DeviceSize offset{0};
-
-  m_debug.beginLabel(cmdBuf, "Rasterize");
 
-  // Dynamic Viewport
-  cmdBuf.setViewport(0, {vk::Viewport(0, 0, (float)m_size.width, (float)m_size.height, 0, 1)});
-  cmdBuf.setScissor(0, {{{0, 0}, {m_size.width, m_size.height}}});
+  // Dynamic Viewport, the offscreen and G-buffer images have the render size
+  vk::Extent2D size = renderSize();
+  cmdBuf.setViewport(0, {vk::Viewport(0, 0, (float)size.width, (float)size.height, 0, 1)});
+  cmdBuf.setScissor(0, {{{0, 0}, {size.width, size.height}}});
 
   // Drawing all triangles
-  cmdBuf.bindPipeline(vkPBP::eGraphics, m_graphicsPipeline);
-  cmdBuf.bindDescriptorSets(vkPBP::eGraphics, m_pipelineLayout, 0, {m_descSet}, {});
+  cmdBuf.bindPipeline(vkPBP::eGraphics, pipeline);
+  cmdBuf.bindDescriptorSets(vkPBP::eGraphics, m_pipelineLayout, 0, {frameDescSet()}, {});
   for(int i = 0; i < m_objInstance.size(); ++i)
   {
     auto& inst                 = m_objInstance[i];
@@ -476,21 +722,132 @@ void HelloVulkan::rasterize(const vk::CommandBuffer& cmdBuf)
     cmdBuf.pushConstants<ObjPushConstants>(m_pipelineLayout, vkSS::eVertex | vkSS::eFragment, 0,
                                            m_pushConstants);
 
-    cmdBuf.bindVertexBuffers(0, {model.vertexBuffer.buffer}, {offset});
-    cmdBuf.bindIndexBuffer(model.indexBuffer.buffer, 0, vk::IndexType::eUint32);
+    if(model.attribs.buffer)
+      cmdBuf.bindVertexBuffers(0, {model.vertices.buffer, model.attribs.buffer},
+                               {model.vertices.offset, model.attribs.offset});
+    else
+      cmdBuf.bindVertexBuffers(0, {model.vertices.buffer}, {model.vertices.offset});
+    cmdBuf.bindIndexBuffer(model.indices.buffer, model.indices.offset, model.indexType);
     cmdBuf.drawIndexed(model.nbIndices, 1, 0, 0, 0);
   }
-  m_debug.endLabel(cmdBuf);
 }
 
 //--------------------------------------------------------------------------------------------------
-// Handling resize of the window
+// Handling resize of the window: the render targets follow in the next frame, see
+// cmdUpdateRenderTargets
 //
-void HelloVulkan::onResize(int /*w*/, int /*h*/)
+void HelloVulkan::onResize(int /*w*/, int /*h*/) {}
+
+//--------------------------------------------------------------------------------------------------
+// Following the render size, at the start of the command buffer of each frame, once prepareFrame
+// returned. Most changes fit in the current render targets, the passes then only render a smaller
+// or larger part of them: dragging the border of the window does not reallocate the images and
+// replace the descriptor sets at each step.
+//
+// The targets which are replaced are destroyed when the slot of the frame comes back, the frames
+// in flight still use them and nothing waits for the device. Their images get their layouts in
+// `cmdBuf`.
+//
+void HelloVulkan::cmdUpdateRenderTargets(const vk::CommandBuffer& cmdBuf)
+{
+  m_retired.beginFrame(frameSlot());
+
+  vk::Extent2D size = renderSize();
+  if(size == m_targetSize)
+    return;
+  vk::Extent2D capacity = targetCapacity(size);
+  if(capacity != m_targetCapacity)
+    createRenderTargets(capacity, cmdBuf);
+  else
+    m_rayStats.cmdClear(cmdBuf);
+  setRenderTargetSize(size);
+  // The accumulation, the statistics and the histories restart in the new size
+  resetFrame();
+}
+
+//--------------------------------------------------------------------------------------------------
+// Capacity of the render targets for `size`: rounded up to a multiple of 256 pixels, and kept as
+// long as it holds `size` without being more than twice the rounded size. The headless frames
+// have a fixed size, their targets have exactly that size.
+//
+vk::Extent2D HelloVulkan::targetCapacity(const vk::Extent2D& size) const
 {
-  m_offscreen.createFramebuffer(m_size);
+  if(m_headless)
+    return size;
+  auto         roundUp = [](uint32_t v) { return (v + 255) / 256 * 256; };
+  vk::Extent2D rounded{roundUp(size.width), roundUp(size.height)};
+
+  const vk::Extent2D& current  = m_targetCapacity;
+  bool                fits     = size.width <= current.width && size.height <= current.height;
+  bool                wasteful = uint64_t(current.width) * current.height
+                                 > 2ull * rounded.width * rounded.height;
+  return fits && !wasteful ? current : rounded;
+}
+
+void HelloVulkan::createRenderTargets(const vk::Extent2D& capacity, const vk::CommandBuffer& cmdBuf)
+{
+  vk::Extent2D size = capacity;
+  m_targetCapacity  = capacity;
+  m_offscreen.createFramebuffer(size, cmdBuf);
   m_offscreen.updateDescriptorSet();
-  m_raytrace.updateRtDescriptorSet(m_offscreen.colorTexture().descriptor.imageView);
+  m_rayStats.createResources(size, framesInFlight(), cmdBuf);
+  m_offscreen.setHeatBuffer(m_rayStats.buffer());
+  m_adaptive.createResources(size, framesInFlight(), cmdBuf);
+  m_temporalAccum.createResources(size, cmdBuf);
+  m_temporalAccum.updateDescriptorSet(m_offscreen.colorTexture().descriptor.imageView,
+                                      m_offscreen.accumTexture().descriptor.imageView);
+  m_bounces.createResources(size, cmdBuf);
+  m_bounces.updateDescriptorSet(m_offscreen.colorTexture().descriptor.imageView,
+                                m_offscreen.accumTexture().descriptor.imageView);
+  m_raytrace.updateRtDescriptorSet(m_offscreen.colorTexture().descriptor.imageView,
+                                   m_offscreen.accumTexture().descriptor.imageView,
+                                   m_offscreen.depthGuideTexture().descriptor.imageView,
+                                   m_adaptive, m_temporalAccum, m_bounces, m_rayStats);
+  if(m_hybridSupported)
+  {
+    m_hybrid.createGBuffer(size, cmdBuf);
+    m_hybrid.updateDescriptorSet(m_raytrace.tlas(), m_offscreen.colorTexture().descriptor.imageView,
+                                 m_offscreen.accumTexture().descriptor.imageView);
+  }
+}
+
+// Part of the render targets rendered by the next frames, at most their capacity
+void HelloVulkan::setRenderTargetSize(const vk::Extent2D& size)
+{
+  m_targetSize = size;
+  m_offscreen.setRenderSize(size);
+  m_adaptive.setRenderSize(size);
+  m_temporalAccum.setRenderSize(size);
+  m_bounces.setRenderSize(size);
+  m_raytrace.setRenderSize(size);
+  if(m_hybridSupported)
+    m_hybrid.setRenderSize(size);
+}
+
+//--------------------------------------------------------------------------------------------------
+// Render scale, clamped from 1/4 to 1. The render targets follow in the next frame.
+//
+void HelloVulkan::setRenderScale(float scale)
+{
+  m_renderScale = std::min(std::max(scale, 0.25f), 1.f);
+}
+
+vk::Extent2D HelloVulkan::renderSize() const
+{
+  return {std::max(uint32_t(m_size.width * m_renderScale + 0.5f), 1u),
+          std::max(uint32_t(m_size.height * m_renderScale + 0.5f), 1u)};
+}
+
+//--------------------------------------------------------------------------------------------------
+// Headless mode, replacing createSurface(): there is no swapchain, and the frames are never
+// presented. The render pass is only created for the post pipeline, which is never drawn.
+//
+void HelloVulkan::setupHeadless(const vk::Extent2D& size)
+{
+  m_headless    = true;
+  m_size        = size;
+  m_depthFormat = static_cast<vk::Format>(nvvk::findDepthFormat(m_physicalDevice));
+  createRenderPass();
 }
 
 //--------------------------------------------------------------------------------------------------
@@ -498,10 +855,22 @@ void HelloVulkan::onResize(int /*w*/, int /*h*/)
 //
 void HelloVulkan::initOffscreen()
 {
-  m_offscreen.createFramebuffer(m_size);
+  // The pools of the replaced descriptor sets have a set for each frame in flight
+  m_retired.setFramesInFlight(framesInFlight());
+
+  nvvk::CommandPool genCmdBuf(m_device, m_graphicsQueueIndex);
+  vk::CommandBuffer cmdBuf = genCmdBuf.createCommandBuffer();
+  vk::Extent2D      size   = targetCapacity(renderSize());
+  m_targetCapacity         = size;
+  m_offscreen.createFramebuffer(size, cmdBuf);
   m_offscreen.createDescriptor();
   m_offscreen.createPipeline(m_renderPass);
   m_offscreen.updateDescriptorSet();
+  m_rayStats.createResources(size, framesInFlight(), cmdBuf);
+  m_offscreen.setHeatBuffer(m_rayStats.buffer());
+  if(m_hybridSupported)
+    m_hybrid.createGBuffer(size, cmdBuf);
+  genCmdBuf.submitAndWait(cmdBuf);
 }
 
 //--------------------------------------------------------------------------------------------------
@@ -509,28 +878,275 @@ void HelloVulkan::initOffscreen()
 //
 void HelloVulkan::initRayTracing()
 {
-  m_raytrace.createBottomLevelAS(m_objModel, m_implObjects);
-  m_raytrace.createTopLevelAS(m_objInstance, m_implObjects);
-  m_raytrace.createRtDescriptorSet(m_offscreen.colorTexture().descriptor.imageView);
-  m_raytrace.createRtPipeline(m_descSetLayout);
+  // Compacting the BLAS, and building them in batches using at most 128 MB of scratch memory
+  m_raytrace.setBlasBuildOptions(true, 128ull * 1024 * 1024);
+  if(m_asCache)
+  {
+    // The vertex layout and the boxes of the implicit objects are in the BLAS as well
+    const auto& impl = m_implObjects.objImpl;
+    uint64_t    key  = hashBytes(m_sceneKey, &m_packedVertices, sizeof(m_packedVertices));
+    key              = hashBytes(key, &m_nbLods, sizeof(m_nbLods));
+    key              = hashBytes(key, impl.data(), impl.size() * sizeof(ObjImplicit));
+    m_raytrace.setBlasCache(std::string(PROJECT_NAME) + ".ascache", key);
+  }
+  m_raytrace.createRtDescriptorSetLayout();
+  {
+    nvvk::CommandPool genCmdBuf(m_device, m_graphicsQueueIndex);
+    vk::CommandBuffer cmdBuf = genCmdBuf.createCommandBuffer();
+    m_adaptive.createResources(m_targetCapacity, framesInFlight(), cmdBuf);
+    m_temporalAccum.createResources(m_targetCapacity, cmdBuf);
+    m_bounces.createResources(m_targetCapacity, cmdBuf);
+    genCmdBuf.submitAndWait(cmdBuf);
+  }
+
+  // The shader modules, the pipeline and the acceleration structures are independent until the
+  // descriptor set and the SBT, so they are created concurrently. The acceleration structures are
+  // the only ones submitting to the queue.
+  StartupScheduler                      scheduler;
+  std::vector<StartupScheduler::TaskId> shaders;
+  for(int i = 0; i < Raytracer::eNbRtShaders; i++)
+  {
+    auto shader = static_cast<Raytracer::RtShader>(i);
+    shaders.push_back(scheduler.add(Raytracer::rtShaderFile(shader),
+                                    [this, shader] { m_raytrace.loadRtShader(shader); }));
+  }
+  scheduler.add("ray tracing pipeline", [this] { m_raytrace.createRtPipeline(m_descSetLayout); },
+                shaders);
+  scheduler.add("adaptive sampling pipeline", [this] { m_adaptive.createPipeline(); });
+  scheduler.add("temporal accumulation pipeline", [this] {
+    m_temporalAccum.createPipeline(m_offscreen.separateAccumulation());
+  });
+  scheduler.add("wavefront bounces pipeline",
+                [this] { m_bounces.createPipeline(m_offscreen.separateAccumulation()); });
+  if(m_hybridSupported)
+    scheduler.add("hybrid pipeline", [this] {
+      m_hybrid.createPipeline(m_descSetLayout, m_offscreen.separateAccumulation(),
+                              m_packedVertices);
+    });
+  scheduler.add("acceleration structures", [this] {
+    auto start = std::chrono::high_resolution_clock::now();
+    m_raytrace.createBottomLevelAS(m_objModel, m_implObjects);
+    m_raytrace.createTopLevelAS(m_objModel, m_objInstance, m_implObjects);
+    m_asBuildMs = std::chrono::duration<double, std::milli>(
+                      std::chrono::high_resolution_clock::now() - start)
+                      .count();
+  });
+  scheduler.run();
+
+  m_raytrace.updateRtDescriptorSet(m_offscreen.colorTexture().descriptor.imageView,
+                                   m_offscreen.accumTexture().descriptor.imageView,
+                                   m_offscreen.depthGuideTexture().descriptor.imageView,
+                                   m_adaptive, m_temporalAccum, m_bounces, m_rayStats);
+  m_temporalAccum.updateDescriptorSet(m_offscreen.colorTexture().descriptor.imageView,
+                                      m_offscreen.accumTexture().descriptor.imageView);
+  m_bounces.updateDescriptorSet(m_offscreen.colorTexture().descriptor.imageView,
+                                m_offscreen.accumTexture().descriptor.imageView);
   m_raytrace.createRtShaderBindingTable();
+  if(m_hybridSupported)
+    m_hybrid.updateDescriptorSet(m_raytrace.tlas(), m_offscreen.colorTexture().descriptor.imageView,
+                                 m_offscreen.accumTexture().descriptor.imageView);
+  setRenderTargetSize(renderSize());
+}
+
+//--------------------------------------------------------------------------------------------------
+// Pipeline specialized for the quality settings, compiled when they change. Called before the
+// recording of the frame, so the compilation does not stall it.
+//
+void HelloVulkan::updateRtVariant()
+{
+  if(m_renderMode != RenderMode::eRayTracer)
+    return;
+
+  Raytracer::RtVariant variant;
+  variant.nbSamples      = m_nbSamples;
+  variant.maxDepth       = m_maxDepth;
+  variant.lightType      = m_specializeLight ? m_pushConstants.lightType : -1;
+  variant.separateAccum  = m_offscreen.separateAccumulation() ? 1 : 0;
+  variant.packedVertices = m_packedVertices ? 1 : 0;
+  variant.temporal       = temporalFrames() ? 1 : 0;
+  variant.wavefront      = wavefrontFrames() ? 1 : 0;
+  variant.rayStats       = m_countRays ? 1 : 0;
+  m_raytrace.setRtVariant(variant);
 }
 
 //--------------------------------------------------------------------------------------------------
-// Ray trace the scene
+// Ray trace the scene, with the variant of updateRtVariant()
 //
 void HelloVulkan::raytrace(const vk::CommandBuffer& cmdBuf, const nvmath::vec4f& clearColor)
 {
+  animateImplicits(cmdBuf);
+  updateLods(cmdBuf);
   updateFrame();
-  if(m_pushConstants.frame >= m_maxFrames)
+  if(m_framesSinceMotion >= m_maxFrames)
     return;
 
-  m_raytrace.raytrace(cmdBuf, clearColor, m_descSet, m_size, m_pushConstants);
+  // Wavefront bounces: the whole image, sample after sample
+  if(wavefrontFrames())
+  {
+    GpuProfiler::Section section(m_profiler, cmdBuf, "Ray trace");
+    m_bounces.setCellSize(m_wavefrontCellSize);
+    beginRayStats(cmdBuf);
+    m_raytrace.raytraceWavefront(cmdBuf, clearColor, frameDescSet(), renderSize(), m_pushConstants,
+                                 m_bounces);
+    endRayStats(cmdBuf);
+    return;
+  }
+
+  // Adaptive sampling: stopping once all pixels converged, otherwise tracing only the pixels
+  // above the threshold. It is not combined with the temporal accumulation.
+  m_adaptive.setThreshold(m_adaptiveThreshold);
+  AdaptiveSampler::Mode adaptiveMode =
+      m_adaptive.mode(m_adaptiveSampling && !temporalFrames(), m_pushConstants.frame);
+  if(adaptiveMode != AdaptiveSampler::eOff)
+  {
+    if(m_adaptive.converged(m_pushConstants.frame, getCurFrame()))
+      return;
+    if(adaptiveMode == AdaptiveSampler::ePixelList)
+    {
+      GpuProfiler::Section section(m_profiler, cmdBuf, "Adaptive pixel list");
+      m_adaptive.cmdBuildPixelList(cmdBuf, m_pushConstants.frame, m_maxFrames, getCurFrame());
+    }
+  }
+
+  // Tiles left in the pass which fit in the time budget
+  std::vector<vk::Rect2D> tiles{{{}, renderSize()}};
+  if(tiledFrames())
+  {
+    double lastMs = 0;
+    for(const auto& s : m_profiler.stats())
+      if(s.name == "Ray trace")
+        lastMs = s.lastMs;
+    tiles = m_tiles.nextTiles(lastMs);
+  }
+
+  {
+    GpuProfiler::Section section(m_profiler, cmdBuf, "Ray trace");
+    beginRayStats(cmdBuf);
+    m_raytrace.raytrace(cmdBuf, clearColor, frameDescSet(), tiles, m_pushConstants, m_adaptive,
+                        adaptiveMode);
+    endRayStats(cmdBuf);
+  }
+
+  // The samples of the frame are blended in the reprojected history
+  if(temporalFrames())
+  {
+    GpuProfiler::Section section(m_profiler, cmdBuf, "Temporal");
+    m_temporalAccum.setDepthTolerance(m_temporalDepthTolerance);
+    m_temporalAccum.cmdAccumulate(cmdBuf, m_pushConstants.frame, m_maxFrames);
+  }
+}
+
+//--------------------------------------------------------------------------------------------------
+// The counters of the frame, cleared before the ray tracing and copied to the read back slot of
+// the frame after it. The slot was last copied framesInFlight frames ago, its fence is passed.
+//
+void HelloVulkan::beginRayStats(const vk::CommandBuffer& cmdBuf)
+{
+  if(!m_countRays)
+    return;
+  m_rayStats.update(getCurFrame());
+  m_rayStats.cmdReset(cmdBuf);
+}
+
+void HelloVulkan::endRayStats(const vk::CommandBuffer& cmdBuf)
+{
+  if(m_countRays)
+    m_rayStats.cmdReadback(cmdBuf, getCurFrame());
+}
+
+//--------------------------------------------------------------------------------------------------
+// Hybrid frame: the G-buffer only depends on the camera, it is rasterized on the first frame of the
+// accumulation, then the shading of each frame traces new shadow, reflection and occlusion rays
+//
+void HelloVulkan::renderHybrid(const vk::CommandBuffer& cmdBuf, const nvmath::vec4f& clearColor)
+{
+  animateImplicits(cmdBuf);
+  updateLods(cmdBuf);
+  updateFrame();
+  if(m_framesSinceMotion >= m_maxFrames)
+    return;
+
+  if(m_pushConstants.frame == 0)
+  {
+    GpuProfiler::Section section(m_profiler, cmdBuf, "G-buffer");
+    m_debug.beginLabel(cmdBuf, "G-buffer");
+    std::vector<vk::ClearValue> clearValues = m_hybrid.gbufferClearValues();
+    vk::RenderPassBeginInfo     renderPassBeginInfo;
+    renderPassBeginInfo.setClearValueCount(static_cast<uint32_t>(clearValues.size()));
+    renderPassBeginInfo.setPClearValues(clearValues.data());
+    renderPassBeginInfo.setRenderPass(m_hybrid.gbufferRenderPass());
+    renderPassBeginInfo.setFramebuffer(m_hybrid.gbufferFramebuffer());
+    renderPassBeginInfo.setRenderArea({{}, renderSize()});
+
+    m_hybrid.cmdBeginGBuffer(cmdBuf);
+    cmdBuf.beginRenderPass(renderPassBeginInfo, vk::SubpassContents::eInline);
+    drawInstances(cmdBuf, m_gbufferPipeline);
+    cmdBuf.endRenderPass();
+    m_hybrid.cmdEndGBuffer(cmdBuf);
+    m_debug.endLabel(cmdBuf);
+  }
+
+  GpuProfiler::Section section(m_profiler, cmdBuf, "Hybrid");
+  m_hybrid.setAmbientOcclusion(m_aoSamples, m_aoRadius);
+  m_hybrid.cmdShade(cmdBuf, frameDescSet(), m_pushConstants, clearColor);
+}
+
+//--------------------------------------------------------------------------------------------------
+// Tiles of tileSize pixels (0 for a single launch), traced in each frame until budgetMs of GPU
+// time (0 for the whole image)
+//
+void HelloVulkan::setTiling(uint32_t tileSize, float budgetMs)
+{
+  // The Ray trace section of the profiler is read back framesInFlight + 1 frames later
+  m_tiles.setup(tileSize, budgetMs, framesInFlight() + 1);
+  resetFrame();
+}
+
+bool HelloVulkan::tiledFrames() const
+{
+  return m_renderMode == RenderMode::eRayTracer && !m_adaptiveSampling && !m_temporal
+         && !(m_wavefront && m_raytrace.indirectTraceRays());
+}
+
+bool HelloVulkan::temporalFrames() const
+{
+  return m_renderMode == RenderMode::eRayTracer && m_temporal;
+}
+
+bool HelloVulkan::wavefrontFrames() const
+{
+  // The launches of the bounces take their size from BounceQueue::sortedBuffer
+  return m_renderMode == RenderMode::eRayTracer && m_wavefront && m_raytrace.indirectTraceRays()
+         && !m_adaptiveSampling && !temporalFrames();
+}
+
+//--------------------------------------------------------------------------------------------------
+// Headless frame: ray tracing the offscreen image and waiting for it. With a tile budget, the
+// tiles of the frame are submitted in several parts, keeping each submission short.
+//
+int HelloVulkan::renderHeadless(const nvmath::vec4f& clearColor)
+{
+  updateRtVariant();
+  nvvk::CommandPool genCmdBuf(m_device, m_graphicsQueueIndex);
+  int               submissions = 0;
+  do
+  {
+    vk::CommandBuffer cmdBuf = genCmdBuf.createCommandBuffer();
+    m_profiler.beginFrame();
+    if(m_renderMode == RenderMode::eHybrid)
+      renderHybrid(cmdBuf, clearColor);
+    else
+      raytrace(cmdBuf, clearColor);
+    genCmdBuf.submitAndWait(cmdBuf);
+    submissions++;
+  } while(tiledFrames() && !m_tiles.passDone() && m_framesSinceMotion < m_maxFrames);
+  return submissions;
 }
 
 //--------------------------------------------------------------------------------------------------
 // If the camera matrix has changed, resets the frame.
 // otherwise, increments frame.
+// With temporal accumulation, the frame goes on and only the frames since the last motion restart
 //
 void HelloVulkan::updateFrame()
 {
@@ -539,15 +1155,26 @@ void HelloVulkan::updateFrame()
   auto& m = CameraManip.getMatrix();
   if(memcmp(&refCamMatrix.a00, &m.a00, sizeof(nvmath::mat4f)) != 0)
   {
-    resetFrame();
+    if(temporalFrames() && m_pushConstants.frame >= 0)
+      m_framesSinceMotion = -1;
+    else
+      resetFrame();
     refCamMatrix = m;
   }
-  m_pushConstants.frame++;
+  // With tiles, the next frame is accumulated once all tiles of the pass were traced
+  if(!tiledFrames() || m_tiles.passDone())
+  {
+    m_pushConstants.frame++;
+    m_framesSinceMotion++;
+    m_tiles.beginPass(renderSize());
+  }
 }
 
 void HelloVulkan::resetFrame()
 {
   m_pushConstants.frame = -1;
+  m_framesSinceMotion   = -1;
+  m_tiles.restart();
 }
 
 
@@ -571,6 +1198,14 @@ void HelloVulkan::addImplCube(nvmath::vec3f minumum, nvmath::vec3f maximum, int
   m_implObjects.objImpl.push_back(impl);
 }
 
+// Spheres with their center in xyz and their radius in w, all of the same material
+void HelloVulkan::addImplSpheres(const std::vector<nvmath::vec4f>& spheres, int matId)
+{
+  size_t first = m_implObjects.objImpl.size();
+  m_implObjects.objImpl.resize(first + spheres.size());
+  implicitSphereAabbs(spheres.data(), spheres.size(), matId, m_implObjects.objImpl.data() + first);
+}
+
 void HelloVulkan::addImplMaterial(const MaterialObj& mat)
 {
   m_implObjects.implMat.push_back(mat);
@@ -593,13 +1228,183 @@ void HelloVulkan::createImplictBuffers()
   if(m_implObjects.implMat.empty())
     m_implObjects.implMat.push_back({});
 
+  // Spatial clusters, each one is a BLAS
+  m_implObjects.clusters = clusterImplicits(m_implObjects.objImpl, m_implObjects.clusterSize);
+  LOGI("Implicit objects: %d in %d clusters\n", int(m_implObjects.objImpl.size()),
+       int(m_implObjects.clusters.size()));
+
   auto cmdBuf           = cmdGen.createCommandBuffer();
-  m_implObjects.implBuf = m_alloc.createBuffer(cmdBuf, m_implObjects.objImpl,
-                                               vkBU::eStorageBuffer | vkBU::eShaderDeviceAddress);
-  m_implObjects.implMatBuf =
-      m_alloc.createBuffer(cmdBuf, m_implObjects.implMat, vkBU::eStorageBuffer);
+  m_implObjects.implBuf = m_alloc.createBuffer(
+      cmdBuf, m_implObjects.objImpl,
+      vkBU::eStorageBuffer | vkBU::eShaderDeviceAddress | vkBU::eTransferDst);
+  m_implObjects.implMatBuf = m_alloc.createBuffer(
+      cmdBuf, m_implObjects.implMat, vkBU::eStorageBuffer | vkBU::eShaderDeviceAddress);
   cmdGen.submitAndWait(cmdBuf);
   m_alloc.finalizeAndReleaseStaging();
   m_debug.setObjectName(m_implObjects.implBuf.buffer, "implicitObj");
+  if(m_implObjects.dynamic)
+  {
+    m_implObjects.rest = m_implObjects.objImpl;
+    m_implStart        = std::chrono::steady_clock::now();
+  }
   m_debug.setObjectName(m_implObjects.implMatBuf.buffer, "implicitMat");
 }
+
+//--------------------------------------------------------------------------------------------------
+// Uploading the implicit objects [first, first + count) after they were modified in objImpl, and
+// refitting the clusters containing them, in the command buffer of the frame. The objects are
+// staged in the slot of the frame, free once its fence was signaled. Moving objects far from their
+// cluster degrades the BLAS, a new createImplictBuffers and initRayTracing rebuild the clusters.
+//
+void HelloVulkan::updateImplicits(const vk::CommandBuffer& cmdBuf, uint32_t first, uint32_t count)
+{
+  using vkAF = vk::AccessFlagBits;
+  using vkPS = vk::PipelineStageFlagBits;
+
+  uint32_t nbObjects = static_cast<uint32_t>(m_implObjects.objImpl.size());
+  if(!m_implObjects.dynamic || first >= nbObjects)
+    return;
+  count = std::min(count, nbObjects - first);
+
+  if(!m_implStaging.buffer)
+  {
+    m_implStaging = m_alloc.createBuffer(nbObjects * sizeof(ObjImplicit) * framesInFlight(),
+                                         vk::BufferUsageFlagBits::eTransferSrc,
+                                         vk::MemoryPropertyFlagBits::eHostVisible
+                                             | vk::MemoryPropertyFlagBits::eHostCoherent);
+    m_implStagingMapped = reinterpret_cast<ObjImplicit*>(m_alloc.map(m_implStaging));
+    m_debug.setObjectName(m_implStaging.buffer, "implicitStaging");
+  }
+  uint32_t       slotFirst = frameSlot() * nbObjects + first;
+  vk::DeviceSize size      = count * sizeof(ObjImplicit);
+  memcpy(m_implStagingMapped + slotFirst, m_implObjects.objImpl.data() + first, size);
+
+  // The traces and the refits of the previous frames read the objects, and the refits of the
+  // previous frame wrote the BLAS and the scratch buffer reused by these ones
+  vk::MemoryBarrier previous(vkAF::eAccelerationStructureWriteKHR,
+                             vkAF::eAccelerationStructureReadKHR
+                                 | vkAF::eAccelerationStructureWriteKHR);
+  cmdBuf.pipelineBarrier(vkPS::eRayTracingShaderKHR | vkPS::eComputeShader
+                             | vkPS::eAccelerationStructureBuildKHR,
+                         vkPS::eTransfer | vkPS::eAccelerationStructureBuildKHR, {}, {previous},
+                         {}, {});
+  cmdBuf.copyBuffer(m_implStaging.buffer, m_implObjects.implBuf.buffer,
+                    vk::BufferCopy(slotFirst * sizeof(ObjImplicit), first * sizeof(ObjImplicit),
+                                   size));
+  vk::BufferMemoryBarrier uploaded(vkAF::eTransferWrite,
+                                   vkAF::eShaderRead | vkAF::eAccelerationStructureReadKHR,
+                                   VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED,
+                                   m_implObjects.implBuf.buffer, 0, VK_WHOLE_SIZE);
+  cmdBuf.pipelineBarrier(vkPS::eTransfer,
+                         vkPS::eAccelerationStructureBuildKHR | vkPS::eRayTracingShaderKHR
+                             | vkPS::eComputeShader,
+                         {}, {}, {uploaded}, {});
+
+  // The clusters are contiguous ranges in the order of objImpl
+  std::vector<uint32_t> clusters;
+  for(uint32_t c = 0; c < static_cast<uint32_t>(m_implObjects.clusters.size()); c++)
+  {
+    const ImplCluster& cluster = m_implObjects.clusters[c];
+    if(cluster.first < first + count && first < cluster.first + cluster.count)
+      clusters.push_back(c);
+  }
+  m_raytrace.cmdRefitImplicitClusters(cmdBuf, frameSlot(), m_implObjects, clusters);
+  resetFrame();
+}
+
+//--------------------------------------------------------------------------------------------------
+// Bouncing the implicit spheres over their rest position, with a phase depending on the position,
+// in blocks on the thread pool. The cubes do not move. All the clusters are refit in the frame.
+//
+void HelloVulkan::animateImplicits(const vk::CommandBuffer& cmdBuf)
+{
+  if(!m_implObjects.dynamic || !m_animateImplicits)
+    return;
+
+  const float                  kHeight    = 0.2f;  // Amplitude of the bounces
+  const size_t                 kBlockSize = 4096;  // Objects per job
+  std::chrono::duration<float> time       = std::chrono::steady_clock::now() - m_implStart;
+  size_t                       count      = m_implObjects.objImpl.size();
+  ThreadPool::shared().parallelFor((count + kBlockSize - 1) / kBlockSize, [&](size_t block) {
+    size_t end = std::min((block + 1) * kBlockSize, count);
+    for(size_t i = block * kBlockSize; i < end; i++)
+    {
+      const ObjImplicit& rest = m_implObjects.rest[i];
+      if(rest.objType != eSphere)
+        continue;
+      float phase = 3.f * time.count() + 2.f * (rest.minimum.x + rest.minimum.z);
+      float lift  = kHeight * std::abs(std::sin(phase));
+      m_implObjects.objImpl[i].minimum.y = rest.minimum.y + lift;
+      m_implObjects.objImpl[i].maximum.y = rest.maximum.y + lift;
+    }
+  });
+  updateImplicits(cmdBuf, 0, static_cast<uint32_t>(count));
+}
+
+//--------------------------------------------------------------------------------------------------
+// Selecting the levels of detail and the masks of the instances for the camera of the frame, only
+// when the camera or the settings changed since the last selection. The TLAS is updated in the
+// command buffer of the frame, before its traces.
+//
+void HelloVulkan::updateLods(const vk::CommandBuffer& cmdBuf)
+{
+  if(m_nbLods == 0)
+    return;
+
+  Raytracer::LodCamera camera;
+  camera.view        = CameraManip.getMatrix();
+  camera.tanHalfFovY = std::tan(deg2rad(CameraManip.getFov()) * 0.5f);
+  camera.aspect      = m_size.width / static_cast<float>(m_size.height);
+  camera.pixelScale  = renderSize().height / (2.f * camera.tanHalfFovY);
+  if(m_lodsSelected && memcmp(&camera, &m_lodCamera, sizeof(camera)) == 0
+     && memcmp(&m_lodSettings, &m_lodSettingsSelected, sizeof(m_lodSettings)) == 0)
+    return;
+
+  m_raytrace.updateInstanceLods(cmdBuf, frameSlot(), m_objModel, m_objInstance, camera,
+                                m_lodSettings);
+  m_lodsSelected        = true;
+  m_lodCamera           = camera;
+  m_lodSettingsSelected = m_lodSettings;
+}
+
+//--------------------------------------------------------------------------------------------------
+// Creating the buffers of the lights added with addLight and of the emissive triangles of the
+// instances, with the alias table picking them in proportion to their power
+//
+void HelloVulkan::createLightBuffers()
+{
+  using vkBU = vk::BufferUsageFlagBits;
+
+  std::vector<LightDesc> lights = m_lights;
+  for(const auto& inst : m_objInstance)
+  {
+    for(LightDesc light : m_emitters[inst.objIndex])
+    {
+      light.position  = nvmath::vec3f(inst.transform * nvmath::vec4f(light.position, 1.f));
+      light.direction = nvmath::vec3f(inst.transform * nvmath::vec4f(light.direction, 1.f));
+      light.vertex2   = nvmath::vec3f(inst.transform * nvmath::vec4f(light.vertex2, 1.f));
+      lights.push_back(light);
+    }
+  }
+  std::vector<LightAlias> aliases = buildLightAliasTable(lights);
+  LOGI("Lights: %d, %d emissive triangles\n", int(m_lights.size()),
+       int(lights.size() - m_lights.size()));
+
+  // Not allowing empty buffers, the shaders only read the lights when the table has entries
+  if(lights.empty())
+    lights.push_back({});
+  uint32_t             count = static_cast<uint32_t>(aliases.size());
+  std::vector<uint8_t> aliasData(sizeof(uint32_t) + std::max(count, 1u) * sizeof(LightAlias), 0);
+  memcpy(aliasData.data(), &count, sizeof(count));
+  if(count > 0)
+    memcpy(aliasData.data() + sizeof(count), aliases.data(), count * sizeof(LightAlias));
+
+  nvvk::CommandPool cmdGen(m_device, m_graphicsQueueIndex);
+  auto              cmdBuf = cmdGen.createCommandBuffer();
+  m_lightBuf               = m_alloc.createBuffer(cmdBuf, lights, vkBU::eStorageBuffer);
+  m_lightAliasBuf          = m_alloc.createBuffer(cmdBuf, aliasData, vkBU::eStorageBuffer);
+  cmdGen.submitAndWait(cmdBuf);
+  m_alloc.finalizeAndReleaseStaging();
+  m_debug.setObjectName(m_lightBuf.buffer, "lights");
+  m_debug.setObjectName(m_lightAliasBuf.buffer, "lightAliases");
+}
@@ -26,6 +26,10 @@
  */
 #pragma once
 
+#include <chrono>
+#include <unordered_map>
+
+#include "gpu_profiler.hpp"
 #include "vkalloc.hpp"
 
 #include "nvvk/allocator_dedicated_vk.hpp"
@@ -34,10 +38,19 @@
 
 // #VKRay
 #include "nvvk/raytraceKHR_vk.hpp"
+#include "adaptive.hpp"
+#include "bounce_queue.hpp"
+#include "hybrid.hpp"
+#include "lights.hpp"
 #include "offscreen.hpp"
+#include "ray_stats.hpp"
+#include "retired_resources.hpp"
+#include "temporal.hpp"
 
 #include "obj.hpp"
 #include "raytrace.hpp"
+#include "texture_streamer.hpp"
+#include "tile_scheduler.hpp"
 
 //--------------------------------------------------------------------------------------------------
 // Simple rasterizer of OBJ objects
@@ -59,15 +72,49 @@ public:
   void updateDescriptorSet();
   void createUniformBuffer();
   void createSceneDescriptionBuffer();
-  void createTextureImages(const vk::CommandBuffer&        cmdBuf,
-                           const std::vector<std::string>& textures);
+  std::vector<int> createTextureImages(const std::vector<std::string>& textures);
+  void updateTextures();
   void updateUniformBuffer();
   void onResize(int /*w*/, int /*h*/) override;
   void destroyResources();
   void rasterize(const vk::CommandBuffer& cmdBuff);
 
-  Offscreen& offscreen() { return m_offscreen; }
-  Raytracer& raytracer() { return m_raytrace; }
+  // Raster: the scene is rasterized and lit without shadows
+  // Ray tracer: the camera rays are traced, with all the ray tracing features
+  // Hybrid: the scene is rasterized in a G-buffer, shadows, reflections and ambient occlusion are
+  //         traced with ray queries, see HybridRenderer
+  enum class RenderMode
+  {
+    eRaster,
+    eRayTracer,
+    eHybrid,
+  };
+  RenderMode m_renderMode{RenderMode::eRayTracer};
+  bool       m_hybridSupported{false};  // rayQuery feature, to set before initOffscreen
+
+  // Fraction of the window size at which the offscreen image is rendered, the post pass upsamples
+  // it. The render targets follow the render size in cmdUpdateRenderTargets, at the start of the
+  // command buffer of each frame.
+  void         setRenderScale(float scale);
+  float        renderScale() const { return m_renderScale; }
+  vk::Extent2D renderSize() const;
+  void         cmdUpdateRenderTargets(const vk::CommandBuffer& cmdBuf);
+
+  Offscreen&      offscreen() { return m_offscreen; }
+  Raytracer&      raytracer() { return m_raytrace; }
+  HybridRenderer& hybrid() { return m_hybrid; }
+
+  // #Headless: no swapchain, frames are ray traced in the offscreen framebuffer one at a time
+  void setupHeadless(const vk::Extent2D& size);
+  // Returns the number of submissions, more than one when the tiles are spread over a budget
+  int renderHeadless(const nvmath::vec4f& clearColor);
+  // Frames the GPU can work on at the same time
+  uint32_t framesInFlight() const
+  {
+    return m_headless ? 1 : static_cast<uint32_t>(getFramebuffers().size());
+  }
+  // Ring slot of the per-frame resources of the current frame, free once prepareFrame returned
+  uint32_t frameSlot() const { return m_headless ? 0 : getCurFrame(); }
 
   ObjPushConstants m_pushConstants;
 
@@ -75,44 +122,166 @@ public:
   std::vector<ObjModel>    m_objModel;
   std::vector<ObjInstance> m_objInstance;
 
+  // Positions and quantized attributes in separate streams, must be set before loading models
+  bool m_packedVertices{false};
+  // The triangles of the emissive materials are lights, must be set before loading models
+  bool m_emissiveLights{false};
+  // Simplified levels of each model, traced by the distant instances (see mesh_lod.hpp). Must be
+  // set before loading models, updateLods selects the levels when the camera moved, in the
+  // command buffer of the frame.
+  int                    m_nbLods{0};
+  Raytracer::LodSettings m_lodSettings;
+  void                   updateLods(const vk::CommandBuffer& cmdBuf);
+
 
   // Graphic pipeline
-  vk::PipelineLayout          m_pipelineLayout;
-  vk::Pipeline                m_graphicsPipeline;
-  nvvk::DescriptorSetBindings m_descSetLayoutBind;
-  vk::DescriptorPool          m_descPool;
-  vk::DescriptorSetLayout     m_descSetLayout;
-  vk::DescriptorSet           m_descSet;
+  vk::PipelineLayout             m_pipelineLayout;
+  vk::Pipeline                   m_graphicsPipeline;
+  nvvk::DescriptorSetBindings    m_descSetLayoutBind;
+  vk::DescriptorPool             m_descPool;
+  vk::DescriptorSetLayout        m_descSetLayout;
+  std::vector<vk::DescriptorSet> m_descSets;  // One per frame in flight, with its camera slot
+  vk::DescriptorSet              frameDescSet() const { return m_descSets[frameSlot()]; }
+  std::vector<bool>              m_texturesDirty;  // Sets lacking textures, see updateTextures
 
   int  m_maxFrames{10};
+  int  m_nbSamples{5};            // Ray tracing samples per pixel and frame
+  int  m_maxDepth{10};            // Ray tracing reflection depth
+  bool m_specializeLight{false};  // Light type as a constant of the ray tracing pipeline
   void resetFrame();
   void updateFrame();
 
-  nvvk::Buffer               m_cameraMat;  // Device-Host of the camera matrices
+  // Adaptive sampling: spending the samples on the pixels which did not converge
+  bool  m_adaptiveSampling{false};
+  float m_adaptiveThreshold{0.02f};  // Relative error below which a pixel has converged
+
+  // Temporal accumulation: moving the camera reprojects the accumulation instead of restarting it,
+  // see TemporalAccumulator. m_maxFrames is the longest history of a pixel.
+  bool  m_temporal{false};
+  float m_temporalDepthTolerance{0.05f};  // Relative difference of depth rejecting the history
+  bool  temporalFrames() const;
+
+  // Wavefront bounces: one launch per bounce of the samples, with the rays sorted in between, see
+  // BounceQueue. Not combined with adaptive sampling nor temporal accumulation, and only with the
+  // rayTracingIndirectTraceRays feature.
+  bool  m_wavefront{false};
+  float m_wavefrontCellSize{1.f};  // Size of the cells binning the ray origins
+  bool  wavefrontFrames() const;
+
+  // Ray statistics: the ray tracer mode counts its rays in m_rayStats with a RAY_STATS variant, and
+  // the post pass can show the rays of each pixel
+  bool  m_countRays{false};
+  float m_heatmapRays{0.f};  // Rays of a pixel at the top of the heatmap, 0 to show the image
+  void  beginRayStats(const vk::CommandBuffer& cmdBuf);
+  void  endRayStats(const vk::CommandBuffer& cmdBuf);
+
+  // Tiled launches, see TileScheduler. Adaptive sampling, temporal accumulation, wavefront bounces
+  // and the hybrid mode always render whole frames.
+  void          setTiling(uint32_t tileSize, float budgetMs);
+  bool          tiledFrames() const;
+  TileScheduler m_tiles;
+
+  // Ambient occlusion of the hybrid mode
+  int   m_aoSamples{4};   // Rays per pixel and frame, 0 to disable it
+  float m_aoRadius{1.f};  // Distance of the occluders
+
+  nvvk::Buffer               m_cameraMat;  // Device-Host of the camera matrices, one per frame slot
   nvvk::Buffer               m_sceneDesc;  // Device buffer of the OBJ instances
+  nvvk::Buffer               m_objDesc;    // Device buffer of the 'ObjDesc' of the objects
   std::vector<nvvk::Texture> m_textures;   // vector of all textures of the scene
 
-  nvvk::DebugUtil m_debug;  // Utility to name objects
+  TextureStreamer m_textureStreamer;  // Uploads the textures, placeholders are bound until then
+  GeometryPool    m_geometry;         // Vertices, indices and materials of all OBJ
+  std::unordered_map<std::string, int> m_textureRegistry;  // Texture file to index in m_textures
+
+  nvvk::DebugUtil m_debug;          // Utility to name objects
+  PipelineCache   m_pipelineCache;  // Shared by all pipelines, saved in destroyResources
+  GpuProfiler     m_profiler;       // GPU time of the passes of the frames
 
   nvvk::Allocator    m_alloc;  // Allocator for buffer, images, acceleration structures
   nvvk::MemAllocator m_memAllocator;
 
   // #Post
-  Offscreen m_offscreen;
-  void      initOffscreen();
+  Offscreen        m_offscreen;
+  RetiredResources m_retired;  // Render targets replaced while frames in flight use them
+  void             initOffscreen();
 
 
   // #VKRay
-  Raytracer m_raytrace;
+  Raytracer           m_raytrace;
+  AdaptiveSampler     m_adaptive;
+  TemporalAccumulator m_temporalAccum;
+  BounceQueue         m_bounces;
+  RayStats            m_rayStats;
 
   void initRayTracing();
+  void updateRtVariant();
   void raytrace(const vk::CommandBuffer& cmdBuf, const nvmath::vec4f& clearColor);
 
+  // #Hybrid
+  HybridRenderer m_hybrid;
+  vk::Pipeline   m_gbufferPipeline;  // Rasterizing the scene in the G-buffer of m_hybrid
+
+  void renderHybrid(const vk::CommandBuffer& cmdBuf, const nvmath::vec4f& clearColor);
+
+  double m_asBuildMs{0};  // Creation of the acceleration structures, waiting for the GPU builds
+  bool   m_asCache{true};  // Loading the BLAS serialized by the previous launch, if still valid
+
   // Implicit
   ImplInst m_implObjects;
 
   void addImplSphere(nvmath::vec3f center, float radius, int matId);
+  void addImplSpheres(const std::vector<nvmath::vec4f>& spheres, int matId);
   void addImplCube(nvmath::vec3f minumum, nvmath::vec3f maximum, int matId);
   void addImplMaterial(const MaterialObj& mat);
+  // Reorders objImpl in clusters of m_implObjects.clusterSize objects (see clusterImplicits)
   void createImplictBuffers();
+  // With m_implObjects.dynamic, refitting the clusters of the objects modified in objImpl, in the
+  // command buffer of the frame
+  void updateImplicits(const vk::CommandBuffer& cmdBuf, uint32_t first, uint32_t count);
+  // With m_implObjects.dynamic and m_animateImplicits, the spheres bounce around their rest
+  void animateImplicits(const vk::CommandBuffer& cmdBuf);
+
+  bool                                  m_animateImplicits{false};
+  nvvk::Buffer                          m_implStaging;  // One slot of all objects per frame
+  ObjImplicit*                          m_implStagingMapped{nullptr};
+  std::chrono::steady_clock::time_point m_implStart;  // Time 0 of animateImplicits
+
+  // Lights sampled by the closest-hit shaders with the light of the push constants, see lights.hpp
+  std::vector<LightDesc> m_lights;
+  nvvk::Buffer           m_lightBuf;       // LightDesc of m_lights and of the emissive triangles
+  nvvk::Buffer           m_lightAliasBuf;  // Number of entries, then the alias table
+
+  void addLight(const LightDesc& light) { m_lights.push_back(light); }
+  void createLightBuffers();
+
+private:
+  vk::Pipeline createRasterPipeline(const vk::RenderPass& renderPass,
+                                    const std::string&    fragShader,
+                                    uint32_t              nbColorAttachments);
+  void         drawInstances(const vk::CommandBuffer& cmdBuf, const vk::Pipeline& pipeline);
+  // Render targets: offscreen framebuffer, G-buffer and sampling resources. They are allocated at
+  // a capacity larger than the render size (see targetCapacity), the passes only use the part of
+  // the render size.
+  void         createRenderTargets(const vk::Extent2D& capacity, const vk::CommandBuffer& cmdBuf);
+  void         setRenderTargetSize(const vk::Extent2D& size);
+  vk::Extent2D targetCapacity(const vk::Extent2D& size) const;
+
+  bool         m_headless{false};
+  float        m_renderScale{1.f};
+  vk::Extent2D m_targetCapacity;                     // Size of the render targets
+  vk::Extent2D m_targetSize;                         // Rendered part of the render targets
+  uint64_t     m_sceneKey{14695981039346656037ull};  // Hash of the model files, for the BLAS cache
+
+  std::vector<std::vector<LightDesc>> m_emitters;  // Emissive triangles of each model, object space
+
+  vk::DeviceSize m_cameraStride{0};  // Between the slots of m_cameraMat
+
+  // Camera and settings of the last selection of the levels of detail
+  bool                   m_lodsSelected{false};
+  Raytracer::LodCamera   m_lodCamera;
+  Raytracer::LodSettings m_lodSettingsSelected;
+
+  int           m_framesSinceMotion{-1};  // Same as the frame, unless temporal frames moved
+  nvmath::mat4f m_prevViewProj{1};        // Camera of the previous frame, for the motion
 };
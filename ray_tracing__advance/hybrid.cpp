@@ -0,0 +1,297 @@
+/* Copyright (c) 2014-2018, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "hybrid.hpp"
+#include "nvh/fileoperations.hpp"
+#include "nvvk/commands_vk.hpp"
+#include "nvvk/images_vk.hpp"
+#include "nvvk/renderpasses_vk.hpp"
+#include "nvvk/shaders_vk.hpp"
+
+extern std::vector<std::string> defaultSearchPaths;
+
+//////////////////////////////////////////////////////////////////////////
+// Hybrid rendering
+//////////////////////////////////////////////////////////////////////////
+
+void HybridRenderer::setup(const vk::Device& device,
+                           nvvk::Allocator*  allocator,
+                           uint32_t          queueFamily,
+                           PipelineCache*    pipelineCache,
+                           RetiredResources* retired)
+{
+  m_device             = device;
+  m_alloc              = allocator;
+  m_graphicsQueueIndex = queueFamily;
+  m_pipelineCache      = pipelineCache;
+  m_retired            = retired;
+  m_debug.setup(m_device);
+}
+
+void HybridRenderer::destroy()
+{
+  m_device.destroy(m_pipeline);
+  m_device.destroy(m_pipelineLayout);
+  m_device.destroy(m_descPool);
+  m_device.destroy(m_dsetLayout);
+  for(auto& t : m_gbuffer)
+    m_alloc->destroy(t);
+  m_alloc->destroy(m_depthTexture);
+  m_device.destroy(m_renderPass);
+  m_device.destroy(m_framebuffer);
+}
+
+//--------------------------------------------------------------------------------------------------
+// Attachment of the G-buffer, read by the shading pass with texelFetch
+//
+nvvk::Texture HybridRenderer::createAttachment(const vk::Extent2D& size,
+                                               vk::Format          format,
+                                               const char*         name)
+{
+  auto createInfo = nvvk::makeImage2DCreateInfo(size, format,
+                                                vk::ImageUsageFlagBits::eColorAttachment
+                                                    | vk::ImageUsageFlagBits::eSampled);
+  nvvk::Image             image  = m_alloc->createImage(createInfo);
+  vk::ImageViewCreateInfo ivInfo = nvvk::makeImageViewCreateInfo(image.image, createInfo);
+  vk::SamplerCreateInfo   samplerInfo{{}, vk::Filter::eNearest, vk::Filter::eNearest};
+  nvvk::Texture           texture = m_alloc->createTexture(image, ivInfo, samplerInfo);
+  texture.descriptor.imageLayout  = VK_IMAGE_LAYOUT_GENERAL;
+  m_debug.setObjectName(texture.image, name);
+  return texture;
+}
+
+//--------------------------------------------------------------------------------------------------
+// G-buffer images, depth buffer and frame buffer of the size of the rendering
+//
+void HybridRenderer::createGBuffer(const vk::Extent2D& size, const vk::CommandBuffer& cmdBuf)
+{
+  for(auto& t : m_gbuffer)
+    m_retired->destroy(m_alloc, t);
+  m_retired->destroy(m_alloc, m_depthTexture);
+  m_size = size;
+
+  static const char* names[kNbGBufferAttachments] = {"GBufferPosition", "GBufferNormal",
+                                                     "GBufferTexColor", "GBufferMaterial"};
+  for(uint32_t i = 0; i < kNbGBufferAttachments; i++)
+    m_gbuffer[i] = createAttachment(size, m_formats[i], names[i]);
+
+  // Creating the depth buffer
+  {
+    auto depthCreateInfo =
+        nvvk::makeImage2DCreateInfo(size, m_depthFormat,
+                                    vk::ImageUsageFlagBits::eDepthStencilAttachment);
+    nvvk::Image image = m_alloc->createImage(depthCreateInfo);
+
+    vk::ImageViewCreateInfo depthStencilView;
+    depthStencilView.setViewType(vk::ImageViewType::e2D);
+    depthStencilView.setFormat(m_depthFormat);
+    depthStencilView.setSubresourceRange({vk::ImageAspectFlagBits::eDepth, 0, 1, 0, 1});
+    depthStencilView.setImage(image.image);
+
+    m_depthTexture = m_alloc->createTexture(image, depthStencilView);
+  }
+
+  // The attachments stay in the general layout, where the shading pass reads them
+  for(auto& t : m_gbuffer)
+    nvvk::cmdBarrierImageLayout(cmdBuf, t.image, vk::ImageLayout::eUndefined,
+                                vk::ImageLayout::eGeneral);
+  nvvk::cmdBarrierImageLayout(cmdBuf, m_depthTexture.image, vk::ImageLayout::eUndefined,
+                              vk::ImageLayout::eDepthStencilAttachmentOptimal,
+                              vk::ImageAspectFlagBits::eDepth);
+
+  if(!m_renderPass)
+  {
+    std::vector<vk::Format> formats(m_formats.begin(), m_formats.end());
+    m_renderPass = nvvk::createRenderPass(m_device, formats, m_depthFormat, 1, true, true,
+                                          vk::ImageLayout::eGeneral, vk::ImageLayout::eGeneral);
+  }
+
+  std::vector<vk::ImageView> attachments;
+  for(auto& t : m_gbuffer)
+    attachments.push_back(t.descriptor.imageView);
+  attachments.push_back(m_depthTexture.descriptor.imageView);
+
+  if(m_framebuffer)
+  {
+    vk::Framebuffer framebuffer = m_framebuffer;
+    m_retired->add([device = m_device, framebuffer] { device.destroy(framebuffer); });
+  }
+  vk::FramebufferCreateInfo info;
+  info.setRenderPass(m_renderPass);
+  info.setAttachmentCount(static_cast<uint32_t>(attachments.size()));
+  info.setPAttachments(attachments.data());
+  info.setWidth(size.width);
+  info.setHeight(size.height);
+  info.setLayers(1);
+  m_framebuffer = m_device.createFramebuffer(info);
+}
+
+std::vector<vk::ClearValue> HybridRenderer::gbufferClearValues() const
+{
+  // A position with a zero w is a pixel without geometry
+  std::vector<vk::ClearValue> clearValues(kNbGBufferAttachments + 1);
+  for(uint32_t i = 0; i < kNbGBufferAttachments; i++)
+    clearValues[i].setColor(std::array<float, 4>({0.f, 0.f, 0.f, 0.f}));
+  clearValues.back().setDepthStencil({1.0f, 0});
+  return clearValues;
+}
+
+//--------------------------------------------------------------------------------------------------
+// Compute pipeline shading the G-buffer
+//
+void HybridRenderer::createPipeline(const vk::DescriptorSetLayout& sceneDescLayout,
+                                    bool                           separateAccum,
+                                    bool                           packedVertices)
+{
+  using vkDS = vk::DescriptorSetLayoutBinding;
+  using vkDT = vk::DescriptorType;
+  using vkSS = vk::ShaderStageFlagBits;
+
+  // TLAS (0), G-buffer (1-4), accumulation (5) and reduced precision output (6)
+  m_dsetLayoutBinding.addBinding(vkDS(0, vkDT::eAccelerationStructureKHR, 1, vkSS::eCompute));
+  for(uint32_t i = 0; i < kNbGBufferAttachments; i++)
+    m_dsetLayoutBinding.addBinding(vkDS(1 + i, vkDT::eCombinedImageSampler, 1, vkSS::eCompute));
+  m_dsetLayoutBinding.addBinding(vkDS(5, vkDT::eStorageImage, 1, vkSS::eCompute));
+  m_dsetLayoutBinding.addBinding(vkDS(6, vkDT::eStorageImage, 1, vkSS::eCompute));
+  m_dsetLayout = m_dsetLayoutBinding.createLayout(m_device);
+  m_descPool   = m_retired->createPool(m_dsetLayoutBinding, m_device);
+
+  std::vector<vk::DescriptorSetLayout> layouts{m_dsetLayout, sceneDescLayout};
+  vk::PushConstantRange                pushConstant{vkSS::eCompute, 0, sizeof(PushConstant)};
+  vk::PipelineLayoutCreateInfo layoutInfo{{}, static_cast<uint32_t>(layouts.size()), layouts.data(),
+                                          1, &pushConstant};
+  m_pipelineLayout = m_device.createPipelineLayout(layoutInfo);
+
+  // SEPARATE_ACCUM: the result is also written to the reduced precision output image
+  // PACKED_VERTICES: positions and quantized attributes are separate streams
+  std::array<int, 2> constants{separateAccum ? 1 : 0, packedVertices ? 1 : 0};
+
+  std::array<vk::SpecializationMapEntry, 2> specEntries{
+      vk::SpecializationMapEntry{0, 0, sizeof(int)},
+      vk::SpecializationMapEntry{1, sizeof(int), sizeof(int)}};
+  vk::SpecializationInfo specInfo{static_cast<uint32_t>(specEntries.size()), specEntries.data(),
+                                  sizeof(constants), constants.data()};
+
+  vk::ComputePipelineCreateInfo computePipelineCreateInfo{{}, {}, m_pipelineLayout};
+  computePipelineCreateInfo.stage = nvvk::createShaderStageInfo(
+      m_device, nvh::loadFile("shaders/hybrid.comp.spv", true, defaultSearchPaths),
+      VK_SHADER_STAGE_COMPUTE_BIT);
+  computePipelineCreateInfo.stage.setPSpecializationInfo(&specInfo);
+  {
+    PipelineCache::Timer timer(*m_pipelineCache, "hybrid shading");
+    m_pipeline =
+        m_device.createComputePipeline(m_pipelineCache->get(), computePipelineCreateInfo, nullptr);
+  }
+  m_device.destroy(computePipelineCreateInfo.stage.module);
+  m_debug.setObjectName(m_pipeline, "HybridShading");
+}
+
+//--------------------------------------------------------------------------------------------------
+// Writes the TLAS, the G-buffer and the output images to a new descriptor set
+// - Required when changing resolution
+//
+void HybridRenderer::updateDescriptorSet(const vk::AccelerationStructureKHR& tlas,
+                                         const vk::ImageView&                outputImage,
+                                         const vk::ImageView&                accumImage)
+{
+  m_retired->replaceSet(m_device, m_descPool, m_dsetLayout, m_dset);
+  vk::WriteDescriptorSetAccelerationStructureKHR descASInfo;
+  descASInfo.setAccelerationStructureCount(1);
+  descASInfo.setPAccelerationStructures(&tlas);
+  vk::DescriptorImageInfo accumInfo{{}, accumImage, vk::ImageLayout::eGeneral};
+  vk::DescriptorImageInfo imageInfo{{}, outputImage, vk::ImageLayout::eGeneral};
+
+  std::vector<vk::WriteDescriptorSet> writes;
+  writes.emplace_back(m_dsetLayoutBinding.makeWrite(m_dset, 0, &descASInfo));
+  for(uint32_t i = 0; i < kNbGBufferAttachments; i++)
+    writes.emplace_back(m_dsetLayoutBinding.makeWrite(m_dset, 1 + i, &m_gbuffer[i].descriptor));
+  writes.emplace_back(m_dsetLayoutBinding.makeWrite(m_dset, 5, &accumInfo));
+  writes.emplace_back(m_dsetLayoutBinding.makeWrite(m_dset, 6, &imageInfo));
+  m_device.updateDescriptorSets(static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
+}
+
+//--------------------------------------------------------------------------------------------------
+// The frames in flight may still shade the previous G-buffer
+//
+void HybridRenderer::cmdBeginGBuffer(const vk::CommandBuffer& cmdBuf)
+{
+  using vkPS = vk::PipelineStageFlagBits;
+  cmdBuf.pipelineBarrier(vkPS::eComputeShader,
+                         vkPS::eEarlyFragmentTests | vkPS::eColorAttachmentOutput, {}, {}, {}, {});
+}
+
+void HybridRenderer::cmdEndGBuffer(const vk::CommandBuffer& cmdBuf)
+{
+  using vkAF = vk::AccessFlagBits;
+  using vkPS = vk::PipelineStageFlagBits;
+  vk::MemoryBarrier gbufferToShade{vkAF::eColorAttachmentWrite, vkAF::eShaderRead};
+  cmdBuf.pipelineBarrier(vkPS::eColorAttachmentOutput, vkPS::eComputeShader, {}, gbufferToShade,
+                         {}, {});
+}
+
+//--------------------------------------------------------------------------------------------------
+// Shading all pixels of the G-buffer, and accumulating the result with the previous frames
+//
+void HybridRenderer::cmdShade(const vk::CommandBuffer& cmdBuf,
+                              const vk::DescriptorSet& sceneDescSet,
+                              const ObjPushConstants&  sceneConstants,
+                              const nvmath::vec4f&     clearColor)
+{
+  using vkAF = vk::AccessFlagBits;
+  using vkPS = vk::PipelineStageFlagBits;
+
+  m_debug.beginLabel(cmdBuf, "Hybrid");
+
+  PushConstant pushC;
+  pushC.clearColor           = clearColor;
+  pushC.lightPosition        = sceneConstants.lightPosition;
+  pushC.lightIntensity       = sceneConstants.lightIntensity;
+  pushC.lightDirection       = sceneConstants.lightDirection;
+  pushC.lightSpotCutoff      = sceneConstants.lightSpotCutoff;
+  pushC.lightSpotOuterCutoff = sceneConstants.lightSpotOuterCutoff;
+  pushC.lightType            = sceneConstants.lightType;
+  pushC.frame                = sceneConstants.frame;
+  pushC.frameOffset          = m_frameOffset;
+  pushC.aoSamples            = m_aoSamples;
+  pushC.aoRadius             = m_aoRadius;
+  pushC.width                = static_cast<int>(m_size.width);
+  pushC.height               = static_cast<int>(m_size.height);
+
+  cmdBuf.bindPipeline(vk::PipelineBindPoint::eCompute, m_pipeline);
+  cmdBuf.bindDescriptorSets(vk::PipelineBindPoint::eCompute, m_pipelineLayout, 0,
+                            {m_dset, sceneDescSet}, {});
+  cmdBuf.pushConstants<PushConstant>(m_pipelineLayout, vk::ShaderStageFlagBits::eCompute, 0,
+                                     pushC);
+  cmdBuf.dispatch((m_size.width + 15) / 16, (m_size.height + 15) / 16, 1);
+
+  // The result is displayed by the post pass, and accumulated by the next frame
+  vk::MemoryBarrier shadeToPost{vkAF::eShaderWrite, vkAF::eShaderRead | vkAF::eShaderWrite};
+  cmdBuf.pipelineBarrier(vkPS::eComputeShader, vkPS::eFragmentShader | vkPS::eComputeShader, {},
+                         shadeToPost, {}, {});
+
+  m_debug.endLabel(cmdBuf);
+}
@@ -0,0 +1,152 @@
+/* Copyright (c) 2014-2018, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <array>
+#include <vulkan/vulkan.hpp>
+
+#include "nvmath/nvmath.h"
+#include "nvvk/debug_util_vk.hpp"
+#include "nvvk/descriptorsets_vk.hpp"
+#include "obj.hpp"
+#include "pipeline_cache.hpp"
+#include "retired_resources.hpp"
+#include "vkalloc.hpp"
+
+//--------------------------------------------------------------------------------------------------
+// Hybrid rendering: rasterized primary visibility, ray traced secondary effects
+// - The scene is rasterized in the G-buffer (gbuffer.frag): world position and coverage, normal,
+//   textured albedo, and the instance and triangle of each pixel
+// - A compute pass (hybrid.comp) shades the G-buffer, tracing ray queries against the TLAS of the
+//   ray tracer for the shadows, the one-bounce reflections and the ambient occlusion
+// - The G-buffer only changes with the camera: it is rasterized on the first frame of an
+//   accumulation, and the next frames only accumulate the shading
+//
+// The implicit objects are not rasterized, and the ray queries skip them as well (kMaskTriangles).
+// Requires the rayQuery feature of VK_KHR_ray_tracing.
+//
+class HybridRenderer
+{
+public:
+  // G-buffer color attachments, in the order of the outputs of gbuffer.frag
+  static const uint32_t kNbGBufferAttachments = 4;
+
+  void setup(const vk::Device& device,
+             nvvk::Allocator*  allocator,
+             uint32_t          queueFamily,
+             PipelineCache*    pipelineCache,
+             RetiredResources* retired);
+  void destroy();
+
+  // G-buffer of the size of the rendering, the render pass is created on the first call. The
+  // layouts of the attachments are set in `cmdBuf`, the frames in flight may still use the previous
+  // ones, they are retired.
+  void createGBuffer(const vk::Extent2D& size, const vk::CommandBuffer& cmdBuf);
+  // Part of the G-buffer rendered and shaded by the next frames, at most its size
+  void setRenderSize(const vk::Extent2D& size) { m_size = size; }
+  // Set 0 is the set of the hybrid pass, set 1 the scene descriptor set
+  void createPipeline(const vk::DescriptorSetLayout& sceneDescLayout,
+                      bool                           separateAccum,
+                      bool                           packedVertices);
+  // The accumulation image is the output image unless the output has a reduced precision. The
+  // descriptor set is replaced.
+  void updateDescriptorSet(const vk::AccelerationStructureKHR& tlas,
+                           const vk::ImageView&                outputImage,
+                           const vk::ImageView&                accumImage);
+
+  // Rays per pixel and frame, and their length
+  void setAmbientOcclusion(int samples, float radius)
+  {
+    m_aoSamples = samples;
+    m_aoRadius  = radius;
+  }
+  // Frames accumulated elsewhere before the first one, as Raytracer::setFrameOffset
+  void setFrameOffset(int offset) { m_frameOffset = offset; }
+
+  const vk::RenderPass&  gbufferRenderPass() const { return m_renderPass; }
+  const vk::Framebuffer& gbufferFramebuffer() const { return m_framebuffer; }
+  // Clear values of the attachments of the G-buffer render pass, depth last
+  std::vector<vk::ClearValue> gbufferClearValues() const;
+
+  // Barriers between the G-buffer and the shading, before and after the render pass
+  void cmdBeginGBuffer(const vk::CommandBuffer& cmdBuf);
+  void cmdEndGBuffer(const vk::CommandBuffer& cmdBuf);
+  void cmdShade(const vk::CommandBuffer& cmdBuf,
+                const vk::DescriptorSet& sceneDescSet,
+                const ObjPushConstants&  sceneConstants,
+                const nvmath::vec4f&     clearColor);
+
+private:
+  struct PushConstant
+  {
+    nvmath::vec4f clearColor;
+    nvmath::vec3f lightPosition;
+    float         lightIntensity;
+    nvmath::vec3f lightDirection;
+    float         lightSpotCutoff;
+    float         lightSpotOuterCutoff;
+    int           lightType;
+    int           frame;
+    int           frameOffset;
+    int           aoSamples;
+    float         aoRadius;
+    int           width;
+    int           height;
+  };
+
+  nvvk::Texture createAttachment(const vk::Extent2D& size, vk::Format format, const char* name);
+
+  nvvk::DescriptorSetBindings m_dsetLayoutBinding;
+  vk::DescriptorPool          m_descPool;
+  vk::DescriptorSetLayout     m_dsetLayout;
+  vk::DescriptorSet           m_dset;
+  vk::Pipeline                m_pipeline;
+  vk::PipelineLayout          m_pipelineLayout;
+  vk::RenderPass              m_renderPass;
+  vk::Framebuffer             m_framebuffer;
+
+  // Position and coverage, normal, texture color, and instance and triangle, see gbuffer.frag
+  std::array<vk::Format, kNbGBufferAttachments> m_formats{
+      vk::Format::eR32G32B32A32Sfloat, vk::Format::eR16G16B16A16Sfloat, vk::Format::eR8G8B8A8Srgb,
+      vk::Format::eR32G32Uint};
+  std::array<nvvk::Texture, kNbGBufferAttachments> m_gbuffer;
+  nvvk::Texture                                    m_depthTexture;
+  vk::Format                                       m_depthFormat{vk::Format::eD32Sfloat};
+  vk::Extent2D                                     m_size;
+
+  int   m_aoSamples{4};
+  float m_aoRadius{1.f};
+  int   m_frameOffset{0};
+
+  nvvk::Allocator*  m_alloc{nullptr};  // Allocator for buffer, images, acceleration structures
+  PipelineCache*    m_pipelineCache{nullptr};
+  RetiredResources* m_retired{nullptr};
+  vk::Device        m_device;
+  int               m_graphicsQueueIndex{0};
+  nvvk::DebugUtil   m_debug;  // Utility to name objects
+};
@@ -0,0 +1,132 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <numeric>
+#include <vector>
+
+#include "nvmath/nvmath.h"
+#include "obj.hpp"
+#include "threadpool.hpp"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define IMPLICIT_AABBS_SSE2 1
+#endif
+
+//--------------------------------------------------------------------------------------------------
+// Spatial clusters of implicit objects
+// - The objects are sorted along a Morton curve of their centers, then split in ranges of at most
+//   `clusterSize` objects: each range is a compact region of the scene, with its own BLAS and
+//   TLAS instance, so that the TLAS culls most of them and a modified range is refit alone
+// - Large sets are added in bulk, with their boxes computed in one pass (implicitSphereAabbs)
+//
+
+// Boxes of the spheres (center in xyz, radius in w), in blocks on the thread pool. With SSE2, a
+// sphere is one 4-wide load and its box two 4-wide stores: the minimum and the maximum are the
+// sphere minus and plus the broadcast radius, shuffled in the layout of ObjImplicit.
+inline void implicitSphereAabbs(const nvmath::vec4f* spheres,
+                                size_t               count,
+                                int                  matId,
+                                ObjImplicit*         objects)
+{
+  static_assert(sizeof(ObjImplicit) == 8 * sizeof(float), "ObjImplicit must be 2 vec4 stores");
+  const size_t kBlockSize = 4096;  // Spheres per job
+  size_t       nbBlocks   = (count + kBlockSize - 1) / kBlockSize;
+  ThreadPool::shared().parallelFor(nbBlocks, [&](size_t block) {
+    size_t begin = block * kBlockSize;
+    size_t end   = std::min(begin + kBlockSize, count);
+#ifdef IMPLICIT_AABBS_SSE2
+    // objType and matId are the last 2 lanes of the second store
+    __m128 tail = _mm_castsi128_ps(_mm_set_epi32(matId, eSphere, 0, 0));
+    for(size_t i = begin; i < end; i++)
+    {
+      __m128 s  = _mm_loadu_ps(&spheres[i].x);
+      __m128 w  = _mm_shuffle_ps(s, s, _MM_SHUFFLE(3, 3, 3, 3));
+      __m128 lo = _mm_sub_ps(s, w);
+      __m128 hi = _mm_add_ps(s, w);
+      // (lo.x, lo.y, lo.z, hi.x) then (hi.y, hi.z, objType, matId)
+      __m128 mid = _mm_shuffle_ps(lo, hi, _MM_SHUFFLE(0, 0, 2, 2));
+      float* dst = reinterpret_cast<float*>(objects + i);
+      _mm_storeu_ps(dst, _mm_shuffle_ps(lo, mid, _MM_SHUFFLE(2, 0, 1, 0)));
+      _mm_storeu_ps(dst + 4, _mm_shuffle_ps(hi, tail, _MM_SHUFFLE(3, 2, 2, 1)));
+    }
+#else
+    for(size_t i = begin; i < end; i++)
+    {
+      const nvmath::vec4f& s = spheres[i];
+      ObjImplicit&         o = objects[i];
+      o.minimum              = nvmath::vec3f(s.x - s.w, s.y - s.w, s.z - s.w);
+      o.maximum              = nvmath::vec3f(s.x + s.w, s.y + s.w, s.z + s.w);
+      o.objType              = eSphere;
+      o.matId                = matId;
+    }
+#endif
+  });
+}
+
+// 10 bits of each coordinate in [0,1], interleaved
+inline uint32_t mortonCode(const nvmath::vec3f& p)
+{
+  auto spread = [](float v) {
+    uint32_t x = std::min(static_cast<uint32_t>(std::max(v, 0.f) * 1024.f), 1023u);
+    x          = (x | (x << 16)) & 0x030000FF;
+    x          = (x | (x << 8)) & 0x0300F00F;
+    x          = (x | (x << 4)) & 0x030C30C3;
+    x          = (x | (x << 2)) & 0x09249249;
+    return x;
+  };
+  return (spread(p.x) << 2) | (spread(p.y) << 1) | spread(p.z);
+}
+
+// Reordering `objects` along the Morton curve and returning the clusters covering all of them.
+// The order is stable, a set already sorted keeps its order.
+inline std::vector<ImplCluster> clusterImplicits(std::vector<ObjImplicit>& objects,
+                                                 uint32_t                  clusterSize)
+{
+  std::vector<ImplCluster> clusters;
+  uint32_t                 count = static_cast<uint32_t>(objects.size());
+  clusterSize                    = std::max(clusterSize, 1u);
+  if(count == 0)
+    return clusters;
+
+  // A single cluster keeps the order of the objects
+  if(count > clusterSize)
+  {
+    nvmath::vec3f lo(1e30f), hi(-1e30f);
+    for(const auto& o : objects)
+    {
+      nvmath::vec3f c = (o.minimum + o.maximum) * 0.5f;
+      for(int k = 0; k < 3; k++)
+      {
+        lo[k] = std::min(lo[k], c[k]);
+        hi[k] = std::max(hi[k], c[k]);
+      }
+    }
+    nvmath::vec3f extent = hi - lo;
+    float         scale  = 1.f / std::max(std::max(extent.x, extent.y), std::max(extent.z, 1e-6f));
+
+    std::vector<uint32_t> codes(count);
+    for(uint32_t i = 0; i < count; i++)
+      codes[i] = mortonCode(((objects[i].minimum + objects[i].maximum) * 0.5f - lo) * scale);
+
+    std::vector<uint32_t> order(count);
+    std::iota(order.begin(), order.end(), 0u);
+    std::stable_sort(order.begin(), order.end(),
+                     [&](uint32_t a, uint32_t b) { return codes[a] < codes[b]; });
+
+    std::vector<ObjImplicit> sorted(count);
+    for(uint32_t i = 0; i < count; i++)
+      sorted[i] = objects[order[i]];
+    objects.swap(sorted);
+  }
+
+  for(uint32_t first = 0; first < count; first += clusterSize)
+  {
+    ImplCluster cluster;
+    cluster.first = first;
+    cluster.count = std::min(clusterSize, count - first);
+    clusters.push_back(cluster);
+  }
+  return clusters;
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "nvmath/nvmath.h"
+
+//--------------------------------------------------------------------------------------------------
+// Lights of the scene, in addition to the light of the push constants
+// - Point, spot and directional lights, and the emissive triangles of the OBJ materials
+// - The closest-hit shaders pick one light per hit from an alias table in which the probability
+//   of a light is proportional to its power, and call the callable shader of its type
+// - When the scene has lights, the light of the push constants still gets half of the hits
+//
+enum LightType
+{
+  eLightPoint       = 0,
+  eLightSpot        = 1,
+  eLightDirectional = 2,
+  eLightTriangle    = 3,  // Callable of the emissive triangles
+};
+
+// Light as read by the shaders, matching `LightDesc` in raycommon.glsl. The emissive triangles
+// have their vertices in position, direction and vertex2, and their emission in color.
+struct LightDesc
+{
+  nvmath::vec3f position{0.f};
+  int32_t       type{eLightPoint};
+  nvmath::vec3f direction{0.f, -1.f, 0.f};
+  float         intensity{1.f};
+  nvmath::vec3f color{1.f};
+  float         spotCutoff{0.f};  // Cosines of the cutoff angles
+  nvmath::vec3f vertex2{0.f};
+  float         spotOuterCutoff{0.f};
+};
+static_assert(sizeof(LightDesc) == 64, "Must match LightDesc in raycommon.glsl");
+
+// Entry of the alias table, matching `LightAlias` in raycommon.glsl
+struct LightAlias
+{
+  float    threshold{1.f};  // Probability of keeping this entry instead of its alias
+  float    pdf{0.f};        // Probability of picking the light of this entry
+  uint32_t alias{0};
+};
+
+// Power used to pick the lights, the emissive triangles by their area
+inline float lightPower(const LightDesc& light)
+{
+  float luminance = nvmath::dot(light.color, nvmath::vec3f(0.2126f, 0.7152f, 0.0722f));
+  if(light.type != eLightTriangle)
+    return light.intensity * luminance;
+  nvmath::vec3f normal = nvmath::cross(light.direction - light.position,
+                                       light.vertex2 - light.position);
+  return light.intensity * luminance * 0.5f * nvmath::length(normal);
+}
+
+// Alias table of the lights (Vose), picking a light in constant time: entry i is kept with the
+// probability of its threshold, otherwise it is its alias. Empty if no light has any power.
+inline std::vector<LightAlias> buildLightAliasTable(const std::vector<LightDesc>& lights)
+{
+  const size_t       n = lights.size();
+  std::vector<float> scaled(n);
+  double             total = 0;
+  for(size_t i = 0; i < n; i++)
+    total += std::max(lightPower(lights[i]), 0.f);
+  if(total <= 0)
+    return {};
+
+  std::vector<LightAlias> table(n);
+  std::vector<uint32_t>   small, large;
+  for(size_t i = 0; i < n; i++)
+  {
+    table[i].pdf = float(std::max(lightPower(lights[i]), 0.f) / total);
+    scaled[i]    = table[i].pdf * float(n);
+    (scaled[i] < 1.f ? small : large).push_back(uint32_t(i));
+  }
+  while(!small.empty() && !large.empty())
+  {
+    uint32_t s = small.back();
+    uint32_t l = large.back();
+    small.pop_back();
+    table[s].threshold = scaled[s];
+    table[s].alias     = l;
+    scaled[l]          = (scaled[l] + scaled[s]) - 1.f;
+    if(scaled[l] < 1.f)
+    {
+      large.pop_back();
+      small.push_back(l);
+    }
+  }
+  // The remaining entries are kept, up to rounding
+  for(uint32_t i : small)
+    table[i].threshold = 1.f;
+  for(uint32_t i : large)
+    table[i].threshold = 1.f;
+  return table;
+}
@@ -36,6 +36,8 @@ VULKAN_HPP_DEFAULT_DISPATCH_LOADER_DYNAMIC_STORAGE
 #include "imgui.h"
 #include "imgui_impl_glfw.h"
 
+#include "gpu_profiler_ui.hpp"
+#include "headless.hpp"
 #include "hello_vulkan.h"
 #include "nvh/cameramanipulator.hpp"
 #include "nvh/fileoperations.hpp"
@@ -44,6 +46,7 @@ VULKAN_HPP_DEFAULT_DISPATCH_LOADER_DYNAMIC_STORAGE
 #include "nvvk/commands_vk.hpp"
 #include "nvvk/context_vk.hpp"
 
+#include <cstring>
 #include <random>
 
 //////////////////////////////////////////////////////////////////////////
@@ -105,8 +108,138 @@ void renderUI(HelloVulkan& helloVk)
   }
   changed |= ImGui::InputInt("Max Frames", &helloVk.m_maxFrames);
   helloVk.m_maxFrames = std::max(helloVk.m_maxFrames, 1);
+  // Each combination is a pipeline variant, compiled the first time it is used
+  changed |= ImGui::SliderInt("Samples per frame", &helloVk.m_nbSamples, 1, 16);
+  changed |= ImGui::SliderInt("Max depth", &helloVk.m_maxDepth, 1, 10);
+  changed |= ImGui::Checkbox("Specialized light type", &helloVk.m_specializeLight);
+  // Adaptive sampling and temporal accumulation exclude each other
+  if(ImGui::Checkbox("Adaptive sampling", &helloVk.m_adaptiveSampling))
+  {
+    helloVk.m_temporal = helloVk.m_temporal && !helloVk.m_adaptiveSampling;
+    changed            = true;
+  }
+  if(helloVk.m_adaptiveSampling)
+  {
+    changed |= ImGui::SliderFloat("Error threshold", &helloVk.m_adaptiveThreshold, 0.001f, 0.1f,
+                                  "%.3f", 2.f);
+    ImGui::Text("Remaining pixels: %u", helloVk.m_adaptive.remainingPixels());
+  }
+  if(ImGui::Checkbox("Temporal accumulation", &helloVk.m_temporal))
+  {
+    helloVk.m_adaptiveSampling = helloVk.m_adaptiveSampling && !helloVk.m_temporal;
+    changed                    = true;
+  }
+  if(helloVk.m_temporal)
+    changed |= ImGui::SliderFloat("Depth tolerance", &helloVk.m_temporalDepthTolerance, 0.001f,
+                                  0.5f, "%.3f", 2.f);
+  // Ignored with adaptive sampling or temporal accumulation. The bounces after the first one are
+  // indirect launches.
+  if(helloVk.raytracer().indirectTraceRays())
+    changed |= ImGui::Checkbox("Wavefront bounces", &helloVk.m_wavefront);
+  if(helloVk.m_wavefront)
+    changed |= ImGui::SliderFloat("Ray sort cell", &helloVk.m_wavefrontCellSize, 0.01f, 10.f,
+                                  "%.2f", 2.f);
+  // The clusters can only be refit when built for it, see -dynamicImplicits
+  if(helloVk.m_implObjects.dynamic)
+    changed |= ImGui::Checkbox("Animate implicit objects", &helloVk.m_animateImplicits);
+  // Counted by another pipeline variant, the counters are the ones of a previous frame
+  changed |= ImGui::Checkbox("Ray statistics", &helloVk.m_countRays);
+  if(helloVk.m_countRays)
+  {
+    const RayStats::Counters& c = helloVk.m_rayStats.counters();
+    ImGui::SliderFloat("Heatmap rays", &helloVk.m_heatmapRays, 0.f, 256.f, "%.0f");
+    ImGui::Text("Camera rays: %u, reflections: %u, shadow rays: %u", c.primaryRays, c.bounceRays,
+                c.shadowRays);
+    ImGui::Text("Any-hit calls: %u, ignored: %u", c.anyHits, c.ignoredHits);
+    float depths[RayStats::kNbDepths];
+    for(int i = 0; i < RayStats::kNbDepths; i++)
+      depths[i] = float(c.depths[i]);
+    ImGui::PlotHistogram("Paths per bounce", depths, RayStats::kNbDepths);
+  }
+  // The levels of detail are selected again, the accumulation goes on
+  if(helloVk.m_nbLods > 0)
+  {
+    ImGui::SliderFloat("LOD error (pixels)", &helloVk.m_lodSettings.pixelError, 0.1f, 16.f, "%.1f");
+    ImGui::SliderFloat("Far diameter (pixels)", &helloVk.m_lodSettings.tinyPixels, 0.f, 16.f,
+                       "%.1f");
+  }
+  if(helloVk.m_renderMode == HelloVulkan::RenderMode::eHybrid)
+  {
+    changed |= ImGui::SliderInt("AO rays", &helloVk.m_aoSamples, 0, 16);
+    changed |= ImGui::SliderFloat("AO radius", &helloVk.m_aoRadius, 0.1f, 10.f);
+  }
   if(changed)
     helloVk.resetFrame();
+
+  // Resolution of the rendering, the window is upsampled from it
+  float renderScale = helloVk.renderScale();
+  if(ImGui::SliderFloat("Render scale", &renderScale, 0.25f, 1.f, "%.2f"))
+    helloVk.setRenderScale(renderScale);
+  vk::Extent2D renderSize = helloVk.renderSize();
+  ImGui::Text("Render size: %u x %u", renderSize.width, renderSize.height);
+
+  // Tiled launches, a pass being spread over the frames which fit in the budget
+  int   tileSize = int(helloVk.m_tiles.tileSize());
+  float budgetMs = helloVk.m_tiles.budgetMs();
+  bool  tiling   = ImGui::InputInt("Tile size", &tileSize, 64, 256);
+  tiling |= ImGui::SliderFloat("Tile budget ms", &budgetMs, 0.f, 50.f, "%.1f");
+  if(tiling)
+    helloVk.setTiling(uint32_t(std::max(tileSize, 0)), std::max(budgetMs, 0.f));
+  if(helloVk.m_tiles.enabled() && helloVk.tiledFrames())
+    ImGui::Text("Tiles left in the pass: %u / %u", helloVk.m_tiles.tilesLeft(),
+                helloVk.m_tiles.tileCount());
+}
+
+// Memory used per category, and by the heaps as reported by VK_EXT_memory_budget
+void renderMemoryUI(HelloVulkan& helloVk)
+{
+  if(!ImGui::CollapsingHeader("Memory"))
+    return;
+
+  const float  mb    = 1.f / (1024.f * 1024.f);
+  MemoryStats& stats = MemoryStats::shared();
+  ImGui::Text("Allocator: %s", VKALLOC_BACKEND_NAME);
+  ImGui::Columns(3, "memory", false);
+  ImGui::Text("Category");
+  ImGui::NextColumn();
+  ImGui::Text("MB");
+  ImGui::NextColumn();
+  ImGui::Text("Peak MB");
+  ImGui::NextColumn();
+  for(uint32_t i = 0; i < uint32_t(MemoryCategory::eCount); i++)
+  {
+    auto category = MemoryCategory(i);
+    ImGui::Text("%s", MemoryStats::name(category));
+    ImGui::NextColumn();
+    ImGui::Text("%.2f", stats.current(category) * mb);
+    ImGui::NextColumn();
+    ImGui::Text("%.2f", stats.peak(category) * mb);
+    ImGui::NextColumn();
+  }
+  ImGui::Columns(1);
+  ImGui::Text("Geometry pool: %u buffer(s), %.2f of %.2f MB used", helloVk.m_geometry.nbBuffers(),
+              helloVk.m_geometry.usedSize() * mb, helloVk.m_geometry.allocatedSize() * mb);
+
+  if(!stats.hasBudget())
+  {
+    ImGui::Text("VK_EXT_memory_budget not supported");
+    return;
+  }
+  auto           heaps       = stats.queryHeaps();
+  vk::DeviceSize deviceUsage = 0;
+  for(size_t i = 0; i < heaps.size(); i++)
+  {
+    const auto& heap = heaps[i];
+    ImGui::Text("Heap %d%s: %.1f / %.1f MB", int(i), heap.deviceLocal ? " (device)" : "",
+                heap.usage * mb, heap.budget * mb);
+    ImGui::ProgressBar(heap.budget > 0 ? float(heap.usage) / float(heap.budget) : 0.f);
+    if(heap.deviceLocal)
+      deviceUsage += heap.usage;
+  }
+  // Render targets, uniform buffers, unused parts of the allocator blocks, ...
+  vk::DeviceSize tracked = stats.total() - stats.current(MemoryCategory::eStaging);
+  if(deviceUsage > tracked)
+    ImGui::Text("Not attributed: %.2f MB", (deviceUsage - tracked) * mb);
 }
 
 //////////////////////////////////////////////////////////////////////////
@@ -120,29 +253,214 @@ static int const SAMPLE_HEIGHT = 720;
 //
 int main(int argc, char** argv)
 {
-  UNUSED(argc);
+  // Precision of the offscreen color image: -color rgba32f|rgba16f|b10g11r11
+  // Separate position and quantized attribute streams: -packedVertices
+  // Suballocating the geometry of all objects from 64 MB buffers: -geometryPool
+  // Building the BLAS even if they were serialized by the previous launch: -noAsCache
+  // Keeping the textures decoded by stb_image in RGBA8 rather than BC1/BC3: -noTextureCompression
+  // Ray tracing in tiles of n pixels, spread over frames of ms GPU time: -tileSize n
+  //   [-tileBudget ms]
+  // Rasterized primary visibility and ray queries for the other effects: -hybrid
+  // Accumulation reprojected when the camera moves: -temporal
+  // One launch per bounce, with the rays sorted in between: -wavefront (needs
+  //   rayTracingIndirectTraceRays)
+  // Rendering at a fraction of the window size, upsampled by the post pass: -renderScale s
+  // Random point lights sampled with the light of the UI: -lights n
+  // Triangles of the emissive materials as lights: -emissiveLights
+  // Random implicit spheres, in BLAS clusters of n objects: -particles count [-clusterSize n]
+  // Implicit spheres bouncing, their clusters refit every frame: -dynamicImplicits
+  // Up to n simplified levels of each model, within an error of px pixels: -lods n [-lodError px]
+  // Rendering without window, see headless.hpp: -headless [-width w] [-height h] [-frames n]
+  //   [-samples s] [-camera path.txt] [-output image.png|image.exr] [-timings timings.csv]
+  //   [-report report.json]
+  // Compatible device n instead of the first one: -device n
+  // Headless frames as the part i of n of a longer accumulation: -split i n
+  // Headless accumulation split over n GPUs, one process each, see runSplitHeadless: -gpus n
+  Offscreen::ColorMode colorMode      = Offscreen::ColorMode::eRGBA32F;
+  bool                 packedVertices = false;
+  bool                 geometryPool   = false;
+  bool                 asCache        = true;
+  bool                 texCompression = true;
+  int                  tileSize       = 0;
+  float                tileBudgetMs   = 0.f;
+  bool                 hybrid         = false;
+  bool                 temporal       = false;
+  bool                 wavefront      = false;
+  float                renderScale    = 1.f;
+  int                  nbLights       = 0;
+  bool                 emissiveLights = false;
+  int                  nbParticles    = 0;
+  int                  clusterSize    = 0;  // Default of ImplInst if 0
+  bool                 dynImplicits   = false;
+  int                  nbLods         = 0;
+  float                lodError       = 0.f;  // Default of Raytracer::LodSettings if 0
+  bool                 headless       = false;
+  int                  nbSamples      = 0;  // Default of HelloVulkan if 0
+  int                  deviceIndex    = 0;
+  int                  nbGpus         = 1;
+  HeadlessSettings     headlessSettings;
+  for(int i = 1; i < argc; i++)
+  {
+    if(strcmp(argv[i], "-color") == 0 && i + 1 < argc)
+    {
+      std::string mode = argv[++i];
+      if(mode == "rgba16f")
+        colorMode = Offscreen::ColorMode::eRGBA16F;
+      else if(mode == "b10g11r11")
+        colorMode = Offscreen::ColorMode::eB10G11R11;
+    }
+    else if(strcmp(argv[i], "-packedVertices") == 0)
+    {
+      packedVertices = true;
+    }
+    else if(strcmp(argv[i], "-geometryPool") == 0)
+    {
+      geometryPool = true;
+    }
+    else if(strcmp(argv[i], "-noAsCache") == 0)
+    {
+      asCache = false;
+    }
+    else if(strcmp(argv[i], "-noTextureCompression") == 0)
+    {
+      texCompression = false;
+    }
+    else if(strcmp(argv[i], "-tileSize") == 0 && i + 1 < argc)
+    {
+      tileSize = std::max(atoi(argv[++i]), 0);
+    }
+    else if(strcmp(argv[i], "-tileBudget") == 0 && i + 1 < argc)
+    {
+      tileBudgetMs = std::max(float(atof(argv[++i])), 0.f);
+    }
+    else if(strcmp(argv[i], "-hybrid") == 0)
+    {
+      hybrid = true;
+    }
+    else if(strcmp(argv[i], "-temporal") == 0)
+    {
+      temporal = true;
+    }
+    else if(strcmp(argv[i], "-wavefront") == 0)
+    {
+      wavefront = true;
+    }
+    else if(strcmp(argv[i], "-renderScale") == 0 && i + 1 < argc)
+    {
+      renderScale = float(atof(argv[++i]));
+    }
+    else if(strcmp(argv[i], "-lights") == 0 && i + 1 < argc)
+    {
+      nbLights = std::max(atoi(argv[++i]), 0);
+    }
+    else if(strcmp(argv[i], "-emissiveLights") == 0)
+    {
+      emissiveLights = true;
+    }
+    else if(strcmp(argv[i], "-particles") == 0 && i + 1 < argc)
+    {
+      nbParticles = std::max(atoi(argv[++i]), 0);
+    }
+    else if(strcmp(argv[i], "-clusterSize") == 0 && i + 1 < argc)
+    {
+      clusterSize = std::max(atoi(argv[++i]), 0);
+    }
+    else if(strcmp(argv[i], "-dynamicImplicits") == 0)
+    {
+      dynImplicits = true;
+    }
+    else if(strcmp(argv[i], "-lods") == 0 && i + 1 < argc)
+    {
+      nbLods = std::max(atoi(argv[++i]), 0);
+    }
+    else if(strcmp(argv[i], "-lodError") == 0 && i + 1 < argc)
+    {
+      lodError = std::max(float(atof(argv[++i])), 0.f);
+    }
+    else if(strcmp(argv[i], "-headless") == 0)
+    {
+      headless = true;
+    }
+    else if(strcmp(argv[i], "-width") == 0 && i + 1 < argc)
+    {
+      headlessSettings.size.width = std::max(atoi(argv[++i]), 1);
+    }
+    else if(strcmp(argv[i], "-height") == 0 && i + 1 < argc)
+    {
+      headlessSettings.size.height = std::max(atoi(argv[++i]), 1);
+    }
+    else if(strcmp(argv[i], "-frames") == 0 && i + 1 < argc)
+    {
+      headlessSettings.nbFrames = std::max(atoi(argv[++i]), 1);
+    }
+    else if(strcmp(argv[i], "-samples") == 0 && i + 1 < argc)
+    {
+      nbSamples = std::max(atoi(argv[++i]), 1);
+    }
+    else if(strcmp(argv[i], "-camera") == 0 && i + 1 < argc)
+    {
+      headlessSettings.cameraFile = argv[++i];
+    }
+    else if(strcmp(argv[i], "-output") == 0 && i + 1 < argc)
+    {
+      headlessSettings.imageFile = argv[++i];
+    }
+    else if(strcmp(argv[i], "-timings") == 0 && i + 1 < argc)
+    {
+      headlessSettings.timingsFile = argv[++i];
+    }
+    else if(strcmp(argv[i], "-report") == 0 && i + 1 < argc)
+    {
+      headlessSettings.reportFile = argv[++i];
+    }
+    else if(strcmp(argv[i], "-device") == 0 && i + 1 < argc)
+    {
+      deviceIndex = std::max(atoi(argv[++i]), 0);
+    }
+    else if(strcmp(argv[i], "-split") == 0 && i + 2 < argc)
+    {
+      headlessSettings.splitCount = std::max(atoi(argv[i + 2]), 1);
+      headlessSettings.splitIndex =
+          std::min(std::max(atoi(argv[i + 1]), 0), headlessSettings.splitCount - 1);
+      i += 2;
+    }
+    else if(strcmp(argv[i], "-gpus") == 0 && i + 1 < argc)
+    {
+      nbGpus = std::max(atoi(argv[++i]), 1);
+    }
+  }
+
+  // The processes of the GPUs render the frames
+  if(headless && nbGpus > 1)
+    return runSplitHeadless(argc, argv, headlessSettings, nbGpus);
+  if(nbGpus > 1)
+    LOGW("-gpus requires -headless, the window is rendered on one GPU\n");
 
   // Setup GLFW window
-  glfwSetErrorCallback(onErrorCallback);
-  if(!glfwInit())
+  GLFWwindow* window = nullptr;
+  if(!headless)
   {
-    return 1;
+    glfwSetErrorCallback(onErrorCallback);
+    if(!glfwInit())
+    {
+      return 1;
+    }
+    glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
+    window = glfwCreateWindow(SAMPLE_WIDTH, SAMPLE_HEIGHT, "NVIDIA Vulkan Raytracing Tutorial",
+                              nullptr, nullptr);
+
+    // Setup Vulkan
+    if(!glfwVulkanSupported())
+    {
+      printf("GLFW: Vulkan Not Supported\n");
+      return 1;
+    }
   }
-  glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
-  GLFWwindow* window = glfwCreateWindow(SAMPLE_WIDTH, SAMPLE_HEIGHT,
-                                        "NVIDIA Vulkan Raytracing Tutorial", nullptr, nullptr);
 
   // Setup camera
   CameraManip.setWindowSize(SAMPLE_WIDTH, SAMPLE_HEIGHT);
   CameraManip.setLookat(nvmath::vec3f(5, 4, -4), nvmath::vec3f(0, 1, 0), nvmath::vec3f(0, 1, 0));
 
-  // Setup Vulkan
-  if(!glfwVulkanSupported())
-  {
-    printf("GLFW: Vulkan Not Supported\n");
-    return 1;
-  }
-
   // setup some basic things for the sample, logging file for example
   NVPSystem system(argv[0], PROJECT_NAME);
 
@@ -160,16 +478,19 @@ int main(int argc, char** argv)
   // Requesting Vulkan extensions and layers
   nvvk::ContextCreateInfo contextInfo(true);
   contextInfo.setVersion(1, 2);
-  contextInfo.addInstanceLayer("VK_LAYER_LUNARG_monitor", true);
-  contextInfo.addInstanceExtension(VK_KHR_SURFACE_EXTENSION_NAME);
+  if(!headless)
+  {
+    contextInfo.addInstanceLayer("VK_LAYER_LUNARG_monitor", true);
+    contextInfo.addInstanceExtension(VK_KHR_SURFACE_EXTENSION_NAME);
 #ifdef WIN32
-  contextInfo.addInstanceExtension(VK_KHR_WIN32_SURFACE_EXTENSION_NAME);
+    contextInfo.addInstanceExtension(VK_KHR_WIN32_SURFACE_EXTENSION_NAME);
 #else
-  contextInfo.addInstanceExtension(VK_KHR_XLIB_SURFACE_EXTENSION_NAME);
-  contextInfo.addInstanceExtension(VK_KHR_XCB_SURFACE_EXTENSION_NAME);
+    contextInfo.addInstanceExtension(VK_KHR_XLIB_SURFACE_EXTENSION_NAME);
+    contextInfo.addInstanceExtension(VK_KHR_XCB_SURFACE_EXTENSION_NAME);
 #endif
+    contextInfo.addDeviceExtension(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
+  }
   contextInfo.addInstanceExtension(VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME);
-  contextInfo.addDeviceExtension(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
   contextInfo.addDeviceExtension(VK_KHR_DEDICATED_ALLOCATION_EXTENSION_NAME);
   contextInfo.addDeviceExtension(VK_KHR_GET_MEMORY_REQUIREMENTS_2_EXTENSION_NAME);
   contextInfo.addDeviceExtension(VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME);
@@ -180,6 +501,7 @@ int main(int argc, char** argv)
   contextInfo.addDeviceExtension(VK_KHR_PIPELINE_LIBRARY_EXTENSION_NAME);
   contextInfo.addDeviceExtension(VK_KHR_DEFERRED_HOST_OPERATIONS_EXTENSION_NAME);
   contextInfo.addDeviceExtension(VK_KHR_BUFFER_DEVICE_ADDRESS_EXTENSION_NAME);
+  contextInfo.addDeviceExtension(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME, true);  // Optional
 
   // Creating Vulkan base application
   nvvk::Context vkctx{};
@@ -187,27 +509,76 @@ int main(int argc, char** argv)
   // Find all compatible devices
   auto compatibleDevices = vkctx.getCompatibleDevices(contextInfo);
   assert(!compatibleDevices.empty());
-  // Use a compatible device
-  vkctx.initDevice(compatibleDevices[0], contextInfo);
+  // Use a compatible device, the first one unless -device
+  if(deviceIndex >= static_cast<int>(compatibleDevices.size()))
+  {
+    printf("Device %d requested, %d compatible devices\n", deviceIndex,
+           static_cast<int>(compatibleDevices.size()));
+    return 1;
+  }
+  vkctx.initDevice(compatibleDevices[deviceIndex], contextInfo);
+
+  // The output image is written without format qualifier, its format depends on the color mode
+  // (Offscreen::setColorMode). The context enables the core features which are supported.
+  vk::PhysicalDeviceFeatures features = vk::PhysicalDevice(vkctx.m_physicalDevice).getFeatures();
+  if(!features.shaderStorageImageWriteWithoutFormat)
+  {
+    printf("shaderStorageImageWriteWithoutFormat is not supported by the device\n");
+    return 1;
+  }
 
   // Create example
   HelloVulkan helloVk;
 
-  // Window need to be opened to get the surface on which to draw
-  const vk::SurfaceKHR surface = helloVk.getVkSurface(vkctx.m_instance, window);
-  vkctx.setGCTQueueWithPresent(surface);
+  if(headless)
+  {
+    helloVk.setup(vkctx.m_instance, vkctx.m_device, vkctx.m_physicalDevice,
+                  vkctx.m_queueGCT.familyIndex);
+    helloVk.setupHeadless(headlessSettings.size);
+  }
+  else
+  {
+    // Window need to be opened to get the surface on which to draw
+    const vk::SurfaceKHR surface = helloVk.getVkSurface(vkctx.m_instance, window);
+    vkctx.setGCTQueueWithPresent(surface);
+
+    helloVk.setup(vkctx.m_instance, vkctx.m_device, vkctx.m_physicalDevice,
+                  vkctx.m_queueGCT.familyIndex);
+    helloVk.createSurface(surface, SAMPLE_WIDTH, SAMPLE_HEIGHT);
+    helloVk.createDepthBuffer();
+    helloVk.createRenderPass();
+    helloVk.createFrameBuffers();
+
+    // Setup Imgui
+    helloVk.initGUI(0);  // Using sub-pass 0
+  }
+  helloVk.m_profiler.setup(vkctx.m_device, vkctx.m_physicalDevice, helloVk.framesInFlight());
 
-  helloVk.setup(vkctx.m_instance, vkctx.m_device, vkctx.m_physicalDevice,
-                vkctx.m_queueGCT.familyIndex);
-  helloVk.createSurface(surface, SAMPLE_WIDTH, SAMPLE_HEIGHT);
-  helloVk.createDepthBuffer();
-  helloVk.createRenderPass();
-  helloVk.createFrameBuffers();
+  // The hybrid mode traces ray queries from a compute shader
+  helloVk.m_hybridSupported = raytracingFeature.rayQuery == VK_TRUE;
+  if(hybrid && helloVk.m_hybridSupported)
+    helloVk.m_renderMode = HelloVulkan::RenderMode::eHybrid;
+  else if(hybrid)
+    LOGW("Ray queries are not supported, the hybrid mode is not available\n");
 
-  // Setup Imgui
-  helloVk.initGUI(0);  // Using sub-pass 0
+  helloVk.m_temporal  = temporal;
+  helloVk.m_wavefront = wavefront && helloVk.raytracer().indirectTraceRays();
+  if(wavefront && !helloVk.m_wavefront)
+    LOGW("Indirect ray tracing is not supported, the wavefront bounces are not available\n");
+  helloVk.setRenderScale(renderScale);
 
   // Creating scene
+  helloVk.m_packedVertices = packedVertices;
+  helloVk.m_emissiveLights = emissiveLights;
+  helloVk.m_asCache        = asCache;
+  helloVk.m_nbLods         = nbLods;
+  helloVk.m_textureStreamer.setBlockCompression(texCompression);
+  if(lodError > 0.f)
+    helloVk.m_lodSettings.pixelError = lodError;
+  if(nbSamples > 0)
+    helloVk.m_nbSamples = nbSamples;
+  if(geometryPool)
+    helloVk.m_geometry.setBlockSize(64ull << 20);
   helloVk.loadModel(nvh::findFile("media/scenes/Medieval_building.obj", defaultSearchPaths));
   helloVk.loadModel(nvh::findFile("media/scenes/plane.obj", defaultSearchPaths));
   helloVk.loadModel(nvh::findFile("media/scenes/wuson.obj", defaultSearchPaths),
@@ -225,7 +596,6 @@ int main(int argc, char** argv)
 
     ObjInstance inst;
     inst.objIndex       = wusonIndex;
-    inst.txtOffset      = 0;
     float         scale = fabsf(disn(gen));
     nvmath::mat4f mat   = nvmath::translation_mat4(nvmath::vec3f{dis(gen), 0.f, dis(gen) + 6});
     //    mat              = mat * nvmath::rotation_mat4_x(dis(gen));
@@ -251,11 +621,36 @@ int main(int argc, char** argv)
   helloVk.addImplCube({-6.1, 0, -6}, {-6, 10, 6}, 0);
   helloVk.addImplSphere({1, 2, 4}, 1.f, 1);
 
+  // Particles of the reflective material, over the plane
+  std::uniform_real_distribution<float> disp(0.f, 1.f);
+  std::vector<nvmath::vec4f>            particles(nbParticles);
+  for(auto& p : particles)
+    p = nvmath::vec4f(disp(gen) * 12.f - 6.f, disp(gen) * 6.f, disp(gen) * 12.f - 6.f, 0.02f);
+  helloVk.addImplSpheres(particles, 0);
+  if(clusterSize > 0)
+    helloVk.m_implObjects.clusterSize = uint32_t(clusterSize);
+  helloVk.m_implObjects.dynamic = dynImplicits;
+  helloVk.m_animateImplicits    = dynImplicits;
+
+  // Point lights of random colors over the scene
+  std::uniform_real_distribution<float> disl(0.f, 1.f);
+  for(int n = 0; n < nbLights; ++n)
+  {
+    LightDesc light;
+    light.position  = nvmath::vec3f(disl(gen) * 20.f - 10.f, 1.f + disl(gen) * 8.f,
+                                    disl(gen) * 20.f - 10.f);
+    light.color     = nvmath::vec3f(disl(gen), disl(gen), disl(gen));
+    light.intensity = 20.f;
+    helloVk.addLight(light);
+  }
+
 
+  helloVk.offscreen().setColorMode(colorMode, vkctx.m_physicalDevice);
   helloVk.initOffscreen();
   Offscreen& offscreen = helloVk.offscreen();
 
   helloVk.createImplictBuffers();
+  helloVk.createLightBuffers();
 
 
   helloVk.createDescriptorSetLayout();
@@ -266,10 +661,22 @@ int main(int argc, char** argv)
 
   // #VKRay
   helloVk.initRayTracing();
+  MemoryStats::shared().log();
+  if(tileSize > 0)
+    helloVk.setTiling(uint32_t(tileSize), tileBudgetMs);
 
 
-  nvmath::vec4f clearColor   = nvmath::vec4f(1, 1, 1, 1.00f);
-  bool          useRaytracer = true;
+  if(headless)
+  {
+    int result = runHeadless(helloVk, headlessSettings);
+    helloVk.getDevice().waitIdle();
+    helloVk.destroyResources();
+    helloVk.destroy();
+    vkctx.deinit();
+    return result;
+  }
+
+  nvmath::vec4f clearColor = nvmath::vec4f(1, 1, 1, 1.00f);
 
 
   helloVk.setupGlfwCallbacks(window);
@@ -286,35 +693,48 @@ int main(int argc, char** argv)
     ImGui_ImplGlfw_NewFrame();
     ImGui::NewFrame();
 
-    // Updating camera buffer
-    helloVk.updateUniformBuffer();
-
     // Show UI window.
     if(1 == 1)
     {
       bool changed = false;
       // Edit 3 floats representing a color
       changed |= ImGui::ColorEdit3("Clear color", reinterpret_cast<float*>(&clearColor));
-      // Switch between raster and ray tracing
-      changed |= ImGui::Checkbox("Ray Tracer mode", &useRaytracer);
+      // Switch between raster, ray tracing and hybrid
+      int mode = static_cast<int>(helloVk.m_renderMode);
+      changed |= ImGui::Combo("Renderer", &mode,
+                              helloVk.m_hybridSupported ? "Raster\0Ray tracer\0Hybrid\0\0"
+                                                        : "Raster\0Ray tracer\0\0");
+      helloVk.m_renderMode = static_cast<HelloVulkan::RenderMode>(mode);
       if(changed)
         helloVk.resetFrame();
 
 
       renderUI(helloVk);
+      renderMemoryUI(helloVk);
+      renderGpuProfilerUI(helloVk.m_profiler);
       ImGui::Text("Application average %.3f ms/frame (%.1f FPS)",
                   1000.0f / ImGui::GetIO().Framerate, ImGui::GetIO().Framerate);
       ImGui::Render();
     }
 
+    // Compiling the ray tracing pipeline of new settings before recording the frame
+    helloVk.updateRtVariant();
+
     // Start rendering the scene
     helloVk.prepareFrame();
+    // Updating camera buffer, the fence of prepareFrame protects the slot of the frame
+    helloVk.updateUniformBuffer();
+    // Binding the textures uploaded since the last frame, in the set of the slot
+    helloVk.updateTextures();
+    helloVk.m_profiler.beginFrame();
 
     // Start command buffer of this frame
     auto                     curFrame = helloVk.getCurFrame();
     const vk::CommandBuffer& cmdBuff  = helloVk.getCommandBuffers()[curFrame];
 
     cmdBuff.begin({vk::CommandBufferUsageFlagBits::eOneTimeSubmit});
+    // Render targets of a new size, the frames in flight keep the previous ones
+    helloVk.cmdUpdateRenderTargets(cmdBuff);
 
     // Clearing screen
     vk::ClearValue clearValues[2];
@@ -329,15 +749,20 @@ int main(int argc, char** argv)
       offscreenRenderPassBeginInfo.setPClearValues(clearValues);
       offscreenRenderPassBeginInfo.setRenderPass(offscreen.renderPass());
       offscreenRenderPassBeginInfo.setFramebuffer(offscreen.frameBuffer());
-      offscreenRenderPassBeginInfo.setRenderArea({{}, helloVk.getSize()});
+      offscreenRenderPassBeginInfo.setRenderArea({{}, helloVk.renderSize()});
 
       // Rendering Scene
-      if(useRaytracer)
+      if(helloVk.m_renderMode == HelloVulkan::RenderMode::eRayTracer)
       {
         helloVk.raytrace(cmdBuff, clearColor);
       }
+      else if(helloVk.m_renderMode == HelloVulkan::RenderMode::eHybrid)
+      {
+        helloVk.renderHybrid(cmdBuff, clearColor);
+      }
       else
       {
+        GpuProfiler::Section section(helloVk.m_profiler, cmdBuff, "Rasterize");
         cmdBuff.beginRenderPass(offscreenRenderPassBeginInfo, vk::SubpassContents::eInline);
         helloVk.rasterize(cmdBuff);
         cmdBuff.endRenderPass();
@@ -353,9 +778,12 @@ int main(int argc, char** argv)
       postRenderPassBeginInfo.setFramebuffer(helloVk.getFramebuffers()[curFrame]);
       postRenderPassBeginInfo.setRenderArea({{}, helloVk.getSize()});
 
+      GpuProfiler::Section section(helloVk.m_profiler, cmdBuff, "Post and UI");
       cmdBuff.beginRenderPass(postRenderPassBeginInfo, vk::SubpassContents::eInline);
-      // Rendering tonemapper
-      offscreen.draw(cmdBuff, helloVk.getSize());
+      // Rendering tonemapper, upsampling along the depth traced by the ray tracer, or its heatmap
+      bool rayTracer = helloVk.m_renderMode == HelloVulkan::RenderMode::eRayTracer;
+      offscreen.draw(cmdBuff, helloVk.getSize(), rayTracer,
+                     rayTracer && helloVk.m_countRays ? helloVk.m_heatmapRays : 0.f);
       // Rendering UI
       ImGui::RenderDrawDataVK(cmdBuff, ImGui::GetDrawData());
       cmdBuff.endRenderPass();
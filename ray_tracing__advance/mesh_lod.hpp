@@ -0,0 +1,93 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include "nvmath/nvmath.h"
+#include "obj_loader.h"
+
+//--------------------------------------------------------------------------------------------------
+// Levels of detail of the triangle meshes, traced instead of the full mesh by distant instances
+// - A level is a vertex clustering of the mesh: the vertices in a cell of a grid are merged into
+//   the first of them, and the triangles which collapse are removed. The vertices are the ones of
+//   the full mesh, only the indices and the material of each triangle differ.
+// - The order of the triangles is kept, so the opaque ones still come first
+//   (partitionAlphaTriangles)
+// - The error of a level is the size of its cells, Raytracer::updateInstanceLods compares it
+//   projected on screen to a tolerance in pixels
+//
+
+struct MeshLod
+{
+  std::vector<uint32_t> indices;
+  std::vector<uint32_t> matIndx;  // Material of each triangle
+  uint32_t              nbOpaqueTriangles{0};
+  float                 error{0.f};  // Size of the cells, in object space
+};
+
+// Sphere around the box of the positions, center in xyz and radius in w
+inline nvmath::vec4f meshBoundingSphere(const VertexObj* vertices, uint32_t nbVertices)
+{
+  if(nbVertices == 0)
+    return nvmath::vec4f(0.f);
+  nvmath::vec3f lo(1e30f), hi(-1e30f);
+  for(uint32_t v = 0; v < nbVertices; v++)
+  {
+    for(int k = 0; k < 3; k++)
+    {
+      lo[k] = std::min(lo[k], vertices[v].pos[k]);
+      hi[k] = std::max(hi[k], vertices[v].pos[k]);
+    }
+  }
+  nvmath::vec3f center = (lo + hi) * 0.5f;
+  return nvmath::vec4f(center.x, center.y, center.z, nvmath::length(hi - center));
+}
+
+// Merging the vertices in cells of `cellSize`. The triangles [0, nbOpaqueTriangles) are the opaque
+// ones, as in ObjModel.
+inline MeshLod simplifyMesh(const VertexObj* vertices,
+                            uint32_t         nbVertices,
+                            const uint32_t*  indices,
+                            const uint32_t*  matIndx,
+                            uint32_t         nbTriangles,
+                            uint32_t         nbOpaqueTriangles,
+                            float            cellSize)
+{
+  MeshLod lod;
+  lod.error = cellSize;
+
+  // Vertex kept for each vertex, the first one of its cell
+  std::vector<uint32_t>                  remap(nbVertices);
+  std::unordered_map<uint64_t, uint32_t> cells;
+  cells.reserve(nbVertices / 4);
+  float scale = 1.f / std::max(cellSize, 1e-6f);
+  for(uint32_t v = 0; v < nbVertices; v++)
+  {
+    // 21 bits per axis, centered on 0
+    uint64_t key = 0;
+    for(int k = 0; k < 3; k++)
+    {
+      int64_t c = static_cast<int64_t>(std::floor(vertices[v].pos[k] * scale)) + (1 << 20);
+      c         = std::min<int64_t>(std::max<int64_t>(c, 0), (1 << 21) - 1);
+      key       = (key << 21) | static_cast<uint64_t>(c);
+    }
+    remap[v] = cells.emplace(key, v).first->second;
+  }
+
+  for(uint32_t t = 0; t < nbTriangles; t++)
+  {
+    uint32_t a = remap[indices[t * 3 + 0]];
+    uint32_t b = remap[indices[t * 3 + 1]];
+    uint32_t c = remap[indices[t * 3 + 2]];
+    if(a == b || b == c || c == a)
+      continue;
+    lod.indices.insert(lod.indices.end(), {a, b, c});
+    lod.matIndx.push_back(matIndx[t]);
+    if(t < nbOpaqueTriangles)
+      lod.nbOpaqueTriangles++;
+  }
+  return lod;
+}
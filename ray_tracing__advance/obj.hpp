@@ -1,26 +1,147 @@
 #pragma once
+#include <algorithm>
+#include <vector>
+
+#include "geometry_pool.hpp"
 #include "obj_loader.h"
 
-// The OBJ model
+// Hit group of the objects, from the features of their materials. The closest-hit shader of each
+// class only has the features of the class (MATERIAL_FEATURES), and only the alpha-tested class
+// has an any-hit shader: the instances of the other classes are forced opaque.
+enum class MaterialClass
+{
+  eOpaque,       // Neither texture, reflection nor transparency
+  eTextured,     // Textured
+  eReflective,   // Reflective (illum 3), possibly textured
+  eAlphaTested,  // Transparent (illum 4), possibly with the other features
+  eNbClasses
+};
+
+// Transparent materials, the only ones for which the any-hit shader can ignore a hit
+inline bool isAlphaTested(const MaterialObj& material)
+{
+  return material.illum == 4 && material.dissolve < 1.f;
+}
+
+// The most general class needed by the materials of an object
+inline MaterialClass materialClass(const MaterialObj* materials, uint32_t count)
+{
+  MaterialClass cls = MaterialClass::eOpaque;
+  for(uint32_t i = 0; i < count; i++)
+  {
+    MaterialClass m = MaterialClass::eOpaque;
+    if(isAlphaTested(materials[i]))
+      m = MaterialClass::eAlphaTested;
+    else if(materials[i].illum == 3)
+      m = MaterialClass::eReflective;
+    else if(materials[i].textureID >= 0)
+      m = MaterialClass::eTextured;
+    cls = std::max(cls, m);
+  }
+  return cls;
+}
+
+// Reordering the triangles, the opaque ones first and the alpha-tested ones last, each triangle
+// keeping its material. Returns the number of opaque triangles.
+inline uint32_t partitionAlphaTriangles(uint32_t*          indices,
+                                        uint32_t*          matIndx,
+                                        uint32_t           nbTriangles,
+                                        const MaterialObj* materials,
+                                        uint32_t           nbMaterials)
+{
+  auto alpha = [&](uint32_t t) {
+    return matIndx[t] < nbMaterials && isAlphaTested(materials[matIndx[t]]);
+  };
+  std::vector<uint32_t> order;
+  order.reserve(nbTriangles);
+  for(uint32_t t = 0; t < nbTriangles; t++)
+    if(!alpha(t))
+      order.push_back(t);
+  uint32_t nbOpaque = static_cast<uint32_t>(order.size());
+  if(nbOpaque == nbTriangles || nbOpaque == 0)
+    return nbOpaque;
+  for(uint32_t t = 0; t < nbTriangles; t++)
+    if(alpha(t))
+      order.push_back(t);
+
+  std::vector<uint32_t> oldIndices(indices, indices + 3 * nbTriangles);
+  std::vector<uint32_t> oldMatIndx(matIndx, matIndx + nbTriangles);
+  for(uint32_t t = 0; t < nbTriangles; t++)
+  {
+    for(uint32_t v = 0; v < 3; v++)
+      indices[3 * t + v] = oldIndices[3 * order[t] + v];
+    matIndx[t] = oldMatIndx[order[t]];
+  }
+  return nbOpaque;
+}
+
+// The OBJ model, its data is in ranges of the geometry pool
+// Simplified level of an ObjModel, over the vertices of the model (see mesh_lod.hpp)
+struct ObjLod
+{
+  uint32_t      nbIndices{0};
+  uint32_t      nbOpaqueTriangles{0};
+  GeometryRange indices;
+  GeometryRange matIndices;
+  float         error{0.f};    // Size of the merged cells, in object space
+  uint32_t      blasId{0};     // Set by createBottomLevelAS
+  uint32_t      objDescId{0};  // `ObjDesc` of the level, set by createSceneDescriptionBuffer
+};
+
 struct ObjModel
 {
-  uint32_t   nbIndices{0};
-  uint32_t   nbVertices{0};
-  nvvk::Buffer vertexBuffer;    // Device buffer of all 'Vertex'
-  nvvk::Buffer indexBuffer;     // Device buffer of the indices forming triangles
-  nvvk::Buffer matColorBuffer;  // Device buffer of array of 'Wavefront material'
-  nvvk::Buffer matIndexBuffer;  // Device buffer of array of 'Wavefront material'
+  uint32_t      nbIndices{0};
+  uint32_t      nbVertices{0};
+  uint32_t      vertexStride{sizeof(VertexObj)};  // Stride of the positions in `vertices`
+  GeometryRange vertices;    // All 'Vertex', or only the positions if packed
+  GeometryRange attribs;     // All 'VertexAttribPacked', if packed
+  GeometryRange indices;     // Indices forming triangles
+  GeometryRange matColors;   // Array of 'Wavefront material'
+  GeometryRange matIndices;  // Material index of each triangle
+
+  vk::IndexType indexType{vk::IndexType::eUint32};  // 16-bit when all vertices can be indexed
+  MaterialClass materialClass{MaterialClass::eAlphaTested};
+  uint32_t      nbOpaqueTriangles{0};  // The alpha-tested triangles follow the opaque ones
+
+  nvmath::vec4f       boundingSphere{0.f};  // Center and radius in object space
+  std::vector<ObjLod> lods;                 // Coarser levels after the model itself, finest first
+};
+
+// Device addresses of the data of an object, matching `ObjDesc` in wavefront.glsl
+// The entries of the models come first, then the clusters of implicit objects, with only the
+// materials and their first object, then the levels of detail of the models. The custom index of
+// a TLAS instance is the entry of its BLAS.
+struct ObjDesc
+{
+  vk::DeviceAddress vertexAddress{0};
+  vk::DeviceAddress attribAddress{0};
+  vk::DeviceAddress indexAddress{0};
+  vk::DeviceAddress materialAddress{0};
+  vk::DeviceAddress materialIndexAddress{0};
+  uint32_t          firstAlphaTriangle{0};  // First triangle of the alpha-tested geometry
+  uint32_t          firstImplicit{0};       // First object of an implicit cluster
 };
 
 // Instance of the OBJ
 struct ObjInstance
 {
   uint32_t      objIndex{0};     // Reference to the `m_objModel`
-  uint32_t      txtOffset{0};    // Offset in `m_textures`
   nvmath::mat4f transform{1};    // Position of the instance
   nvmath::mat4f transformIT{1};  // Inverse transpose
 };
 
+// Instance as read by the shaders, matching `sceneDesc` in wavefront.glsl
+// The 3x4 transform and the indices fill 64 bytes, so an instance never straddles two cache lines.
+// The normal matrix is rebuilt in the shaders from the 3x3 part.
+struct ObjInstanceDesc
+{
+  nvmath::vec4f transfo[3];      // Rows of the object to world matrix
+  uint32_t      objId{0};        // Reference to the `m_objModel`
+  uint32_t      index16{0};      // 1 if the indices of the object are 16-bit
+  uint32_t      padding[2]{0, 0};
+};
+static_assert(sizeof(ObjInstanceDesc) == 64, "Must match sceneDesc in wavefront.glsl");
+
 // Information pushed at each draw call
 struct ObjPushConstants
 {
@@ -49,13 +170,25 @@ struct ObjImplicit
   int           matId{0};
 };
 
+// Contiguous objects of `ImplInst::objImpl` in one BLAS, see clusterImplicits
+struct ImplCluster
+{
+  uint32_t first{0};
+  uint32_t count{0};
+  int      blasId{-1};
+};
+
 // All implicit objects
 struct ImplInst
 {
   std::vector<ObjImplicit> objImpl;     // All objects
   std::vector<MaterialObj> implMat;     // All materials used by implicit obj
-  nvvk::Buffer               implBuf;     // Buffer of objects
-  nvvk::Buffer               implMatBuf;  // Buffer of material
-  int                      blasId;
+  nvvk::Buffer             implBuf;     // Buffer of objects
+  nvvk::Buffer             implMatBuf;  // Buffer of material
   nvmath::mat4f            transform{1};
+
+  std::vector<ImplCluster> clusters;           // One BLAS and one TLAS instance each
+  uint32_t                 clusterSize{65536};  // Maximum number of objects of a cluster
+  bool                     dynamic{false};      // Refit by HelloVulkan::updateImplicits
+  std::vector<ObjImplicit> rest;                // With dynamic, objImpl before any animation
 };
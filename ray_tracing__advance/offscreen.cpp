@@ -26,8 +26,12 @@
  */
 
 
+#include <cstring>
+
+#include "memory_stats.hpp"
 #include "offscreen.hpp"
 #include "nvh/fileoperations.hpp"
+#include "nvh/nvprint.hpp"
 #include "nvvk/commands_vk.hpp"
 #include "nvvk/descriptorsets_vk.hpp"
 #include "nvvk/pipeline_vk.hpp"
@@ -39,11 +43,17 @@ extern std::vector<std::string> defaultSearchPaths;
 // Post-processing
 //////////////////////////////////////////////////////////////////////////
 
-void Offscreen::setup(const vk::Device& device, nvvk::Allocator* allocator, uint32_t queueFamily)
+void Offscreen::setup(const vk::Device& device,
+                      nvvk::Allocator*  allocator,
+                      uint32_t          queueFamily,
+                      PipelineCache*    pipelineCache,
+                      RetiredResources* retired)
 {
   m_device             = device;
   m_alloc              = allocator;
   m_graphicsQueueIndex = queueFamily;
+  m_pipelineCache      = pipelineCache;
+  m_retired            = retired;
   m_debug.setup(m_device);
 }
 
@@ -54,25 +64,53 @@ void Offscreen::destroy()
   m_device.destroy(m_descPool);
   m_device.destroy(m_dsetLayout);
   m_alloc->destroy(m_colorTexture);
+  m_alloc->destroy(m_accumTexture);
   m_alloc->destroy(m_depthTexture);
+  m_alloc->destroy(m_depthGuideTexture);
   m_device.destroy(m_renderPass);
   m_device.destroy(m_framebuffer);
 }
 
+//--------------------------------------------------------------------------------------------------
+// Reduced precision color image, halving or more the bandwidth of the raster and post passes and of
+// the ray tracing writes. The accumulation itself stays in 32-bit floats.
+//
+void Offscreen::setColorMode(ColorMode mode, const vk::PhysicalDevice& physicalDevice)
+{
+  const vk::FormatFeatureFlags required = vk::FormatFeatureFlagBits::eColorAttachment
+                                          | vk::FormatFeatureFlagBits::eSampledImage
+                                          | vk::FormatFeatureFlagBits::eStorageImage;
+  auto supported = [&](vk::Format format) {
+    return (physicalDevice.getFormatProperties(format).optimalTilingFeatures & required)
+           == required;
+  };
+
+  m_colorFormat = vk::Format::eR32G32B32A32Sfloat;
+  if(mode == ColorMode::eB10G11R11 && supported(vk::Format::eB10G11R11UfloatPack32))
+    m_colorFormat = vk::Format::eB10G11R11UfloatPack32;
+  else if(mode != ColorMode::eRGBA32F && supported(vk::Format::eR16G16B16A16Sfloat))
+    m_colorFormat = vk::Format::eR16G16B16A16Sfloat;
+  LOGI("Offscreen color format: %s\n", vk::to_string(m_colorFormat).c_str());
+}
+
 //--------------------------------------------------------------------------------------------------
 // Creating an offscreen frame buffer and the associated render pass
 //
-void Offscreen::createFramebuffer(VkExtent2D& size)
+void Offscreen::createFramebuffer(VkExtent2D& size, const vk::CommandBuffer& cmdBuf)
 {
-  m_alloc->destroy(m_colorTexture);
-  m_alloc->destroy(m_depthTexture);
+  m_retired->destroy(m_alloc, m_colorTexture);
+  m_retired->destroy(m_alloc, m_accumTexture);
+  m_retired->destroy(m_alloc, m_depthTexture);
+  m_retired->destroy(m_alloc, m_depthGuideTexture);
+  m_renderSize = size;
 
   // Creating the color image
   {
     auto colorCreateInfo = nvvk::makeImage2DCreateInfo(size, m_colorFormat,
                                                        vk::ImageUsageFlagBits::eColorAttachment
                                                            | vk::ImageUsageFlagBits::eSampled
-                                                           | vk::ImageUsageFlagBits::eStorage);
+                                                           | vk::ImageUsageFlagBits::eStorage
+                                                           | vk::ImageUsageFlagBits::eTransferSrc);
 
     nvvk::Image               image  = m_alloc->createImage(colorCreateInfo);
     vk::ImageViewCreateInfo ivInfo = nvvk::makeImageViewCreateInfo(image.image, colorCreateInfo);
@@ -80,6 +118,35 @@ void Offscreen::createFramebuffer(VkExtent2D& size)
     m_colorTexture.descriptor.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
   }
 
+  // Creating the accumulation image, only used by ray tracing
+  if(separateAccumulation())
+  {
+    auto accumCreateInfo =
+        nvvk::makeImage2DCreateInfo(size, m_accumFormat,
+                                    vk::ImageUsageFlagBits::eStorage
+                                        | vk::ImageUsageFlagBits::eTransferSrc);
+
+    nvvk::Image             image  = m_alloc->createImage(accumCreateInfo);
+    vk::ImageViewCreateInfo ivInfo = nvvk::makeImageViewCreateInfo(image.image, accumCreateInfo);
+    m_accumTexture                 = m_alloc->createTexture(image, ivInfo);
+    m_accumTexture.descriptor.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+    m_debug.setObjectName(m_accumTexture.image, "Accumulation");
+  }
+
+  // Creating the depth guide of the upsampling, written by ray tracing and read by the post pass
+  {
+    auto guideCreateInfo =
+        nvvk::makeImage2DCreateInfo(size, vk::Format::eR32Sfloat,
+                                    vk::ImageUsageFlagBits::eStorage
+                                        | vk::ImageUsageFlagBits::eSampled);
+
+    nvvk::Image             image  = m_alloc->createImage(guideCreateInfo);
+    vk::ImageViewCreateInfo ivInfo = nvvk::makeImageViewCreateInfo(image.image, guideCreateInfo);
+    m_depthGuideTexture            = m_alloc->createTexture(image, ivInfo, vk::SamplerCreateInfo());
+    m_depthGuideTexture.descriptor.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+    m_debug.setObjectName(m_depthGuideTexture.image, "DepthGuide");
+  }
+
 
   // Creating the depth buffer
   {
@@ -98,17 +165,16 @@ void Offscreen::createFramebuffer(VkExtent2D& size)
   }
 
   // Setting the image layout for both color and depth
-  {
-    nvvk::CommandPool genCmdBuf(m_device, m_graphicsQueueIndex);
-    auto              cmdBuf = genCmdBuf.createCommandBuffer();
-    nvvk::cmdBarrierImageLayout(cmdBuf, m_colorTexture.image, vk::ImageLayout::eUndefined,
+  nvvk::cmdBarrierImageLayout(cmdBuf, m_colorTexture.image, vk::ImageLayout::eUndefined,
+                              vk::ImageLayout::eGeneral);
+  if(separateAccumulation())
+    nvvk::cmdBarrierImageLayout(cmdBuf, m_accumTexture.image, vk::ImageLayout::eUndefined,
                                 vk::ImageLayout::eGeneral);
-    nvvk::cmdBarrierImageLayout(cmdBuf, m_depthTexture.image, vk::ImageLayout::eUndefined,
-                                vk::ImageLayout::eDepthStencilAttachmentOptimal,
-                                vk::ImageAspectFlagBits::eDepth);
-
-    genCmdBuf.submitAndWait(cmdBuf);
-  }
+  nvvk::cmdBarrierImageLayout(cmdBuf, m_depthGuideTexture.image, vk::ImageLayout::eUndefined,
+                              vk::ImageLayout::eGeneral);
+  nvvk::cmdBarrierImageLayout(cmdBuf, m_depthTexture.image, vk::ImageLayout::eUndefined,
+                              vk::ImageLayout::eDepthStencilAttachmentOptimal,
+                              vk::ImageAspectFlagBits::eDepth);
 
   // Creating a renderpass for the offscreen
   if(!m_renderPass)
@@ -121,7 +187,11 @@ void Offscreen::createFramebuffer(VkExtent2D& size)
   std::vector<vk::ImageView> attachments = {m_colorTexture.descriptor.imageView,
                                             m_depthTexture.descriptor.imageView};
 
-  m_device.destroy(m_framebuffer);
+  if(m_framebuffer)
+  {
+    vk::Framebuffer framebuffer = m_framebuffer;
+    m_retired->add([device = m_device, framebuffer] { device.destroy(framebuffer); });
+  }
   vk::FramebufferCreateInfo info;
   info.setRenderPass(m_renderPass);
   info.setAttachmentCount(2);
@@ -139,7 +209,8 @@ void Offscreen::createFramebuffer(VkExtent2D& size)
 void Offscreen::createPipeline(vk::RenderPass& renderPass)
 {
   // Push constants in the fragment shader
-  vk::PushConstantRange pushConstantRanges = {vk::ShaderStageFlagBits::eFragment, 0, sizeof(float)};
+  vk::PushConstantRange pushConstantRanges = {vk::ShaderStageFlagBits::eFragment, 0,
+                                              sizeof(PostPushConstant)};
 
   // Creating the pipeline layout
   vk::PipelineLayoutCreateInfo pipelineLayoutCreateInfo;
@@ -158,7 +229,10 @@ void Offscreen::createPipeline(vk::RenderPass& renderPass)
   pipelineGenerator.addShader(nvh::loadFile("shaders/post.frag.spv", true, paths),
                               vk::ShaderStageFlagBits::eFragment);
   pipelineGenerator.rasterizationState.setCullMode(vk::CullModeFlagBits::eNone);
-  m_pipeline = pipelineGenerator.createPipeline();
+  {
+    PipelineCache::Timer timer(*m_pipelineCache, "post");
+    m_pipeline = pipelineGenerator.createPipeline(m_pipelineCache->get());
+  }
   m_debug.setObjectName(m_pipeline, "post");
 }
 
@@ -173,36 +247,96 @@ void Offscreen::createDescriptor()
   using vkSS = vk::ShaderStageFlagBits;
 
   m_dsetLayoutBinding.addBinding(vkDS(0, vkDT::eCombinedImageSampler, 1, vkSS::eFragment));
+  m_dsetLayoutBinding.addBinding(vkDS(1, vkDT::eCombinedImageSampler, 1, vkSS::eFragment));
+  m_dsetLayoutBinding.addBinding(vkDS(2, vkDT::eStorageBuffer, 1, vkSS::eFragment));
   m_dsetLayout = m_dsetLayoutBinding.createLayout(m_device);
-  m_descPool   = m_dsetLayoutBinding.createPool(m_device);
-  m_dset       = nvvk::allocateDescriptorSet(m_device, m_descPool, m_dsetLayout);
+  m_descPool   = m_retired->createPool(m_dsetLayoutBinding, m_device);
 }
 
 //--------------------------------------------------------------------------------------------------
-// Update the output
+// Update the output. The frames in flight may still use the previous set.
 //
 void Offscreen::updateDescriptorSet()
 {
-  vk::WriteDescriptorSet writeDescriptorSets =
-      m_dsetLayoutBinding.makeWrite(m_dset, 0, &m_colorTexture.descriptor);
-  m_device.updateDescriptorSets(writeDescriptorSets, nullptr);
+  m_retired->replaceSet(m_device, m_descPool, m_dsetLayout, m_dset);
+  std::vector<vk::WriteDescriptorSet> writes;
+  writes.emplace_back(m_dsetLayoutBinding.makeWrite(m_dset, 0, &m_colorTexture.descriptor));
+  writes.emplace_back(m_dsetLayoutBinding.makeWrite(m_dset, 1, &m_depthGuideTexture.descriptor));
+  m_device.updateDescriptorSets(static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
+}
+
+void Offscreen::setHeatBuffer(vk::Buffer buffer)
+{
+  vk::DescriptorBufferInfo heatInfo{buffer, 0, VK_WHOLE_SIZE};
+  vk::WriteDescriptorSet   write = m_dsetLayoutBinding.makeWrite(m_dset, 2, &heatInfo);
+  m_device.updateDescriptorSets(write, nullptr);
 }
 
 //--------------------------------------------------------------------------------------------------
 // Draw a full screen quad with the attached image
 //
-void Offscreen::draw(vk::CommandBuffer cmdBuf, VkExtent2D& size)
+void Offscreen::draw(vk::CommandBuffer cmdBuf,
+                     VkExtent2D&       size,
+                     bool              depthGuided,
+                     float             heatmapRays)
 {
   m_debug.beginLabel(cmdBuf, "Post");
 
   cmdBuf.setViewport(0, {vk::Viewport(0, 0, (float)size.width, (float)size.height, 0, 1)});
   cmdBuf.setScissor(0, {{{0, 0}, {size.width, size.height}}});
 
-  auto aspectRatio = static_cast<float>(size.width) / static_cast<float>(size.height);
-  cmdBuf.pushConstants<float>(m_pipelineLayout, vk::ShaderStageFlagBits::eFragment, 0, aspectRatio);
+  PostPushConstant pushC;
+  pushC.aspectRatio = static_cast<float>(size.width) / static_cast<float>(size.height);
+  pushC.depthGuided = depthGuided ? 1 : 0;
+  pushC.width       = static_cast<int>(m_renderSize.width);
+  pushC.height      = static_cast<int>(m_renderSize.height);
+  pushC.heatmapRays = heatmapRays;
+  cmdBuf.pushConstants<PostPushConstant>(m_pipelineLayout, vk::ShaderStageFlagBits::eFragment, 0,
+                                         pushC);
   cmdBuf.bindPipeline(vk::PipelineBindPoint::eGraphics, m_pipeline);
   cmdBuf.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, m_pipelineLayout, 0, m_dset, {});
   cmdBuf.draw(3, 1, 0, 0);
 
   m_debug.endLabel(cmdBuf);
 }
+
+//--------------------------------------------------------------------------------------------------
+// Copy of the accumulation image to the host, the image stays in the general layout
+//
+std::vector<float> Offscreen::readAccumulation(const vk::Extent2D& size)
+{
+  vk::DeviceSize byteSize = vk::DeviceSize(size.width) * size.height * 4 * sizeof(float);
+  nvvk::Buffer   readback = m_alloc->createBuffer(byteSize, vk::BufferUsageFlagBits::eTransferDst,
+                                                vk::MemoryPropertyFlagBits::eHostVisible
+                                                    | vk::MemoryPropertyFlagBits::eHostCoherent);
+  vk::DeviceSize tracked  = MemoryStats::sizeOf(m_device, readback.buffer);
+  MemoryStats::shared().add(MemoryCategory::eStaging, tracked);
+
+  {
+    nvvk::CommandPool genCmdBuf(m_device, m_graphicsQueueIndex);
+    auto              cmdBuf = genCmdBuf.createCommandBuffer();
+
+    vk::MemoryBarrier shaderWrites(vk::AccessFlagBits::eShaderWrite,
+                                   vk::AccessFlagBits::eTransferRead);
+    cmdBuf.pipelineBarrier(vk::PipelineStageFlagBits::eRayTracingShaderKHR,
+                           vk::PipelineStageFlagBits::eTransfer, {}, {shaderWrites}, {}, {});
+    vk::BufferImageCopy region;
+    region.setImageSubresource({vk::ImageAspectFlagBits::eColor, 0, 0, 1});
+    region.setImageExtent({size.width, size.height, 1});
+    cmdBuf.copyImageToBuffer(accumTexture().image, vk::ImageLayout::eGeneral, readback.buffer,
+                             {region});
+    vk::MemoryBarrier transferWrites(vk::AccessFlagBits::eTransferWrite,
+                                     vk::AccessFlagBits::eHostRead);
+    cmdBuf.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eHost,
+                           {}, {transferWrites}, {}, {});
+    genCmdBuf.submitAndWait(cmdBuf);
+  }
+
+  std::vector<float> pixels(size_t(size.width) * size.height * 4);
+  memcpy(pixels.data(), m_alloc->map(readback), byteSize);
+  m_alloc->unmap(readback);
+
+  MemoryStats::shared().remove(MemoryCategory::eStaging, tracked);
+  m_alloc->destroy(readback);
+  return pixels;
+}
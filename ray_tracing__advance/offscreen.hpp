@@ -25,10 +25,13 @@
  * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <vector>
 #include <vulkan/vulkan.hpp>
 
 #include "nvvk/debug_util_vk.hpp"
 #include "nvvk/descriptorsets_vk.hpp"
+#include "pipeline_cache.hpp"
+#include "retired_resources.hpp"
 #include "vkalloc.hpp"
 
 //--------------------------------------------------------------------------------------------------
@@ -36,24 +39,74 @@
 // screen back buffer, this class create the output frame buffer 'createFramebuffer',
 // and use the pipeline from 'createPipeline' to render a quad 'draw' with the colorTexture
 // image
+//
+// The framebuffer can be smaller than the window (render scale), the post pass then upsamples
+// it, weighting the texels by their depth in the guide image when the ray tracer wrote it
+//
+// The images, the framebuffer and the descriptor set replaced by createFramebuffer and
+// updateDescriptorSet are destroyed once the frames in flight are done with them, see
+// RetiredResources
 
 class Offscreen
 {
 public:
-  void setup(const vk::Device& device, nvvk::Allocator* allocator, uint32_t queueFamily);
+  void setup(const vk::Device& device,
+             nvvk::Allocator*  allocator,
+             uint32_t          queueFamily,
+             PipelineCache*    pipelineCache,
+             RetiredResources* retired);
   void destroy();
 
-  void createFramebuffer(VkExtent2D& size);
+  // Format of the color image, to set before createFramebuffer. With a reduced precision, ray
+  // tracing accumulates in a separate RGBA32F image and writes the result in the color image.
+  enum class ColorMode
+  {
+    eRGBA32F,
+    eRGBA16F,
+    eB10G11R11,  // Falls back to RGBA16F if it cannot be a storage image
+  };
+  void setColorMode(ColorMode mode, const vk::PhysicalDevice& physicalDevice);
+  bool separateAccumulation() const { return m_colorFormat != m_accumFormat; }
+
+  // The layouts of the images are set in `cmdBuf`, before their first use
+  void createFramebuffer(VkExtent2D& size, const vk::CommandBuffer& cmdBuf);
   void createPipeline(vk::RenderPass& renderPass);
+  // Part of the images upsampled by the post pass, at most the size of createFramebuffer
+  void setRenderSize(const vk::Extent2D& size) { m_renderSize = size; }
   void createDescriptor();
+  // Replacing the descriptor set, with the images of createFramebuffer
   void updateDescriptorSet();
-  void draw(vk::CommandBuffer cmdBuf, VkExtent2D& size);
+  // Buffer of RayStats, with the rays of each pixel shown by the heatmap. It must be set after
+  // each updateDescriptorSet.
+  void setHeatBuffer(vk::Buffer buffer);
+  // `size` is the size of the window. The upsampling only follows the edges of the depth guide
+  // if `depthGuided`, otherwise it is bilinear. With `heatmapRays`, the image is replaced by the
+  // heatmap of the rays traced by each pixel, red from that many rays.
+  void draw(vk::CommandBuffer cmdBuf, VkExtent2D& size, bool depthGuided, float heatmapRays = 0.f);
+  // RGBA32F pixels of the accumulation image, once the ray tracing writes are submitted
+  std::vector<float> readAccumulation(const vk::Extent2D& size);
 
   const vk::RenderPass&  renderPass() { return m_renderPass; }
   const vk::Framebuffer& frameBuffer() { return m_framebuffer; }
   const nvvk::Texture&   colorTexture() { return m_colorTexture; }
+  // R32F view depth of the primary hits, written by the ray tracing
+  const nvvk::Texture& depthGuideTexture() { return m_depthGuideTexture; }
+  // RGBA32F image in which ray tracing accumulates, the color image unless separateAccumulation
+  const nvvk::Texture& accumTexture()
+  {
+    return separateAccumulation() ? m_accumTexture : m_colorTexture;
+  }
 
 private:
+  struct PostPushConstant
+  {
+    float aspectRatio;
+    int   depthGuided;
+    int   width;
+    int   height;
+    float heatmapRays;
+  };
+
   nvvk::DescriptorSetBindings m_dsetLayoutBinding;
   vk::DescriptorPool          m_descPool;
   vk::DescriptorSetLayout     m_dsetLayout;
@@ -65,11 +118,17 @@ private:
 
   nvvk::Texture m_colorTexture;
   vk::Format    m_colorFormat{vk::Format::eR32G32B32A32Sfloat};
+  nvvk::Texture m_accumTexture;
+  vk::Format    m_accumFormat{vk::Format::eR32G32B32A32Sfloat};
   nvvk::Texture m_depthTexture;
   vk::Format    m_depthFormat{vk::Format::eD32Sfloat};
+  nvvk::Texture m_depthGuideTexture;
+  vk::Extent2D  m_renderSize;
 
-  nvvk::Allocator* m_alloc{nullptr};  // Allocator for buffer, images, acceleration structures
-  vk::Device       m_device;
-  int              m_graphicsQueueIndex{0};
-  nvvk::DebugUtil  m_debug;  // Utility to name objects
+  nvvk::Allocator*  m_alloc{nullptr};  // Allocator for buffer, images, acceleration structures
+  PipelineCache*    m_pipelineCache{nullptr};
+  RetiredResources* m_retired{nullptr};
+  vk::Device        m_device;
+  int               m_graphicsQueueIndex{0};
+  nvvk::DebugUtil   m_debug;  // Utility to name objects
 };
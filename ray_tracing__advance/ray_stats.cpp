@@ -0,0 +1,154 @@
+/* Copyright (c) 2014-2018, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <cstring>
+
+#include "ray_stats.hpp"
+
+//////////////////////////////////////////////////////////////////////////
+// Ray statistics
+//////////////////////////////////////////////////////////////////////////
+
+void RayStats::setup(const vk::Device& device,
+                     nvvk::Allocator*  allocator,
+                     uint32_t          queueFamily,
+                     RetiredResources* retired)
+{
+  m_device             = device;
+  m_alloc              = allocator;
+  m_graphicsQueueIndex = queueFamily;
+  m_retired            = retired;
+  m_debug.setup(m_device);
+}
+
+void RayStats::destroy()
+{
+  m_alloc->destroy(m_buffer);
+  if(!m_readbackValid.empty())
+    m_alloc->unmap(m_readback);
+  m_alloc->destroy(m_readback);
+  m_readbackValid.clear();
+}
+
+//--------------------------------------------------------------------------------------------------
+// The heat starts at zero, the pixels not traced yet are at the bottom of the heatmap
+//
+void RayStats::createResources(const vk::Extent2D&      size,
+                               uint32_t                 nbFrames,
+                               const vk::CommandBuffer& cmdBuf)
+{
+  using vkBU = vk::BufferUsageFlagBits;
+  using vkAF = vk::AccessFlagBits;
+  using vkPS = vk::PipelineStageFlagBits;
+
+  m_retired->destroy(m_alloc, m_buffer);
+  if(!m_readbackValid.empty())
+  {
+    nvvk::Buffer readback = m_readback;
+    m_readback            = nvvk::Buffer();
+    m_retired->add([alloc = m_alloc, readback]() mutable {
+      alloc->unmap(readback);
+      alloc->destroy(readback);
+    });
+  }
+
+  vk::DeviceSize bufferSize = sizeof(Counters) + sizeof(uint32_t) * size.width * size.height;
+  m_buffer = m_alloc->createBuffer(bufferSize, vkBU::eStorageBuffer | vkBU::eTransferSrc
+                                                   | vkBU::eTransferDst);
+  m_debug.setObjectName(m_buffer.buffer, "RayStats");
+
+  m_readback = m_alloc->createBuffer(nbFrames * sizeof(Counters), vkBU::eTransferDst,
+                                     vk::MemoryPropertyFlagBits::eHostVisible
+                                         | vk::MemoryPropertyFlagBits::eHostCoherent);
+  m_readbackMapped = reinterpret_cast<const Counters*>(m_alloc->map(m_readback));
+  m_readbackValid.assign(nbFrames, 0);
+  m_counters = {};
+
+  cmdClear(cmdBuf);
+}
+
+//--------------------------------------------------------------------------------------------------
+// The heat is indexed with the width of the render size, the heat of another size would be
+// scrambled
+//
+void RayStats::cmdClear(const vk::CommandBuffer& cmdBuf)
+{
+  using vkAF = vk::AccessFlagBits;
+  using vkPS = vk::PipelineStageFlagBits;
+
+  // The previous frames traced, displayed and copied the buffer
+  vk::MemoryBarrier toClear{vkAF::eShaderRead | vkAF::eShaderWrite | vkAF::eTransferRead,
+                            vkAF::eTransferWrite};
+  cmdBuf.pipelineBarrier(vkPS::eRayTracingShaderKHR | vkPS::eFragmentShader | vkPS::eTransfer,
+                         vkPS::eTransfer, {}, toClear, {}, {});
+  cmdBuf.fillBuffer(m_buffer.buffer, 0, VK_WHOLE_SIZE, 0);
+  vk::MemoryBarrier clearToUses{vkAF::eTransferWrite,
+                                vkAF::eShaderRead | vkAF::eShaderWrite | vkAF::eTransferWrite};
+  cmdBuf.pipelineBarrier(vkPS::eTransfer,
+                         vkPS::eRayTracingShaderKHR | vkPS::eFragmentShader | vkPS::eTransfer, {},
+                         clearToUses, {}, {});
+}
+
+void RayStats::update(uint32_t curFrame)
+{
+  if(m_readbackValid[curFrame] != 0)
+    memcpy(&m_counters, &m_readbackMapped[curFrame], sizeof(Counters));
+}
+
+void RayStats::cmdReset(const vk::CommandBuffer& cmdBuf)
+{
+  using vkAF = vk::AccessFlagBits;
+  using vkPS = vk::PipelineStageFlagBits;
+
+  // The previous frame counted in the buffer, displayed the heat and copied the counters
+  vk::MemoryBarrier toReset{vkAF::eShaderRead | vkAF::eShaderWrite | vkAF::eTransferRead,
+                            vkAF::eTransferWrite};
+  cmdBuf.pipelineBarrier(vkPS::eRayTracingShaderKHR | vkPS::eFragmentShader | vkPS::eTransfer,
+                         vkPS::eTransfer, {}, toReset, {}, {});
+  cmdBuf.fillBuffer(m_buffer.buffer, 0, sizeof(Counters), 0);
+  vk::MemoryBarrier resetToRt{vkAF::eTransferWrite, vkAF::eShaderRead | vkAF::eShaderWrite};
+  cmdBuf.pipelineBarrier(vkPS::eTransfer, vkPS::eRayTracingShaderKHR, {}, resetToRt, {}, {});
+}
+
+//--------------------------------------------------------------------------------------------------
+// The counters go to the slot of the frame, and the heat to the post pass
+//
+void RayStats::cmdReadback(const vk::CommandBuffer& cmdBuf, uint32_t curFrame)
+{
+  using vkAF = vk::AccessFlagBits;
+  using vkPS = vk::PipelineStageFlagBits;
+
+  vk::MemoryBarrier rtToReads{vkAF::eShaderWrite, vkAF::eTransferRead | vkAF::eShaderRead};
+  cmdBuf.pipelineBarrier(vkPS::eRayTracingShaderKHR, vkPS::eTransfer | vkPS::eFragmentShader, {},
+                         rtToReads, {}, {});
+
+  vk::BufferCopy region{0, curFrame * sizeof(Counters), sizeof(Counters)};
+  cmdBuf.copyBuffer(m_buffer.buffer, m_readback.buffer, region);
+  vk::MemoryBarrier toHost{vkAF::eTransferWrite, vkAF::eHostRead};
+  cmdBuf.pipelineBarrier(vkPS::eTransfer, vkPS::eHost, {}, toHost, {}, {});
+  m_readbackValid[curFrame] = 1;
+}
@@ -0,0 +1,104 @@
+/* Copyright (c) 2014-2018, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <vector>
+#include <vulkan/vulkan.hpp>
+
+#include "nvvk/debug_util_vk.hpp"
+#include "retired_resources.hpp"
+#include "vkalloc.hpp"
+
+//--------------------------------------------------------------------------------------------------
+// Ray statistics, counted by the ray tracing shaders of the RAY_STATS variants (see ray_stats.glsl)
+// - The counters of a frame: camera, reflection and shadow rays, any-hit invocations and the
+//   intersections they ignore, and the number of paths ending after each number of bounces
+// - The rays traced by each pixel in the last frame which traced it, shown as a heatmap by the
+//   post pass
+// - cmdReset() clears the counters before the ray tracing of the frame, cmdReadback() copies them
+//   to the read back slot of the frame, which update() reads once the fence of the slot is passed
+//
+class RayStats
+{
+public:
+  static const int kNbDepths = 16;  // Bounces of the histogram, the last bucket has the deeper ones
+
+  // Matching RayStatsCounters in ray_stats.glsl
+  struct Counters
+  {
+    uint32_t primaryRays;
+    uint32_t bounceRays;
+    uint32_t shadowRays;
+    uint32_t anyHits;
+    uint32_t ignoredHits;  // ignoreIntersectionEXT of the any-hit shaders
+    uint32_t pad[3];
+    uint32_t depths[kNbDepths];  // Paths by number of bounces
+  };
+  static_assert(sizeof(Counters) == 96, "Must match ray_stats.glsl");
+
+  void setup(const vk::Device& device,
+             nvvk::Allocator*  allocator,
+             uint32_t          queueFamily,
+             RetiredResources* retired);
+  void destroy();
+
+  // Counters and one heat value per pixel of `size`, and one read back slot per frame in flight.
+  // They are cleared in `cmdBuf`, the frames in flight may still use the previous buffers, they
+  // are retired.
+  void createResources(const vk::Extent2D&      size,
+                       uint32_t                 nbFrames,
+                       const vk::CommandBuffer& cmdBuf);
+  vk::Buffer buffer() const { return m_buffer.buffer; }
+  // Counters and heat to zero, when the render size changes within the buffer
+  void cmdClear(const vk::CommandBuffer& cmdBuf);
+
+  // Once the fence of the frame is passed: reading the counters copied by the previous use of its
+  // slot
+  void update(uint32_t curFrame);
+  // Before the ray tracing of the frame, the heat of the pixels is kept
+  void cmdReset(const vk::CommandBuffer& cmdBuf);
+  // After the ray tracing of the frame
+  void cmdReadback(const vk::CommandBuffer& cmdBuf, uint32_t curFrame);
+
+  // Counters of the last frame read back, all zero if none
+  const Counters& counters() const { return m_counters; }
+
+private:
+  nvvk::Buffer m_buffer;    // Counters + heat of each pixel
+  nvvk::Buffer m_readback;  // One Counters per frame in flight
+
+  const Counters*  m_readbackMapped{nullptr};
+  std::vector<int> m_readbackValid;  // 1 when the slot was written by cmdReadback
+  Counters         m_counters{};
+
+  nvvk::Allocator*  m_alloc{nullptr};  // Allocator for buffer, images, acceleration structures
+  RetiredResources* m_retired{nullptr};
+  vk::Device        m_device;
+  int               m_graphicsQueueIndex{0};
+  nvvk::DebugUtil   m_debug;  // Utility to name objects
+};
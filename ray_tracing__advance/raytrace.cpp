@@ -26,6 +26,8 @@
  */
 
 
+#include <cmath>
+
 #include "raytrace.hpp"
 #include "nvh/fileoperations.hpp"
 #include "nvvk/descriptorsets_vk.hpp"
@@ -35,22 +37,37 @@
 
 extern std::vector<std::string> defaultSearchPaths;
 
+// Stages reading RtPushConstants
+static const vk::ShaderStageFlags s_rtPushStages =
+    vk::ShaderStageFlagBits::eRaygenKHR | vk::ShaderStageFlagBits::eClosestHitKHR
+    | vk::ShaderStageFlagBits::eMissKHR | vk::ShaderStageFlagBits::eCallableKHR;
+
 
 void Raytracer::setup(const vk::Device&         device,
                       const vk::PhysicalDevice& physicalDevice,
-                      nvvk::Allocator*            allocator,
-                      uint32_t                  queueFamily)
+                      nvvk::Allocator*          allocator,
+                      uint32_t                  queueFamily,
+                      PipelineCache*            pipelineCache,
+                      RetiredResources*         retired)
 {
   m_device             = device;
   m_physicalDevice     = physicalDevice;
   m_alloc              = allocator;
   m_graphicsQueueIndex = queueFamily;
+  m_pipelineCache      = pipelineCache;
+  m_retired            = retired;
 
   // Requesting ray tracing properties
   auto properties = m_physicalDevice.getProperties2<vk::PhysicalDeviceProperties2,
                                                     vk::PhysicalDeviceRayTracingPropertiesKHR>();
   m_rtProperties  = properties.get<vk::PhysicalDeviceRayTracingPropertiesKHR>();
+  // The context enables the ray tracing features which are supported
+  auto features = m_physicalDevice.getFeatures2<vk::PhysicalDeviceFeatures2,
+                                                vk::PhysicalDeviceRayTracingFeaturesKHR>();
+  const auto& rtFeatures = features.get<vk::PhysicalDeviceRayTracingFeaturesKHR>();
+  m_indirectTraceRays    = rtFeatures.rayTracingIndirectTraceRays == VK_TRUE;
   m_rtBuilder.setup(m_device, allocator, m_graphicsQueueIndex);
+  m_sbt.setup(m_device, allocator, m_graphicsQueueIndex, m_rtProperties);
 
   m_debug.setup(device);
 }
@@ -59,64 +76,118 @@ void Raytracer::setup(const vk::Device&         device,
 void Raytracer::destroy()
 {
   m_rtBuilder.destroy();
+  if(m_implicitScratch.buffer)
+    MemoryStats::shared().remove(MemoryCategory::eScratch,
+                                 MemoryStats::sizeOf(m_device, m_implicitScratch.buffer));
+  m_alloc->destroy(m_implicitScratch);
+  m_implicitScratchOffsets.clear();
   m_device.destroy(m_rtDescPool);
   m_device.destroy(m_rtDescSetLayout);
-  m_device.destroy(m_rtPipeline);
   m_device.destroy(m_rtPipelineLayout);
-  m_alloc->destroy(m_rtSBTBuffer);
+  for(auto& v : m_rtVariants)
+  {
+    m_device.destroy(v.second.pipeline);
+    MemoryStats::shared().remove(MemoryCategory::eSbt,
+                                 MemoryStats::sizeOf(m_device, v.second.sbt.buffer));
+    m_alloc->destroy(v.second.sbt);
+  }
+  m_rtVariants.clear();
+  m_rtPipeline  = vk::Pipeline();
+  m_rtSBTBuffer = nvvk::Buffer();
+  for(auto& module : m_rtShaderModules)
+  {
+    m_device.destroy(module);
+    module = vk::ShaderModule();
+  }
+}
+
+//--------------------------------------------------------------------------------------------------
+// Compaction of the BLAS, and scratch memory allowed for building BLAS simultaneously
+//
+void Raytracer::setBlasBuildOptions(bool compact, vk::DeviceSize scratchBudget)
+{
+  m_rtBuilder.setCompaction(compact);
+  m_rtBuilder.setScratchBudget(scratchBudget);
+}
+
+void Raytracer::setBlasCache(const std::string& filename, uint64_t sceneKey)
+{
+  m_rtBuilder.setBlasCache(filename, sceneKey);
 }
 
 //--------------------------------------------------------------------------------------------------
 // Converting a OBJ primitive to the ray tracing geometry used for the BLAS
 //
-nvvk::RaytracingBuilderKHR::Blas Raytracer::objectToVkGeometryKHR(const ObjModel& model)
+nvvk::RaytracingBuilderKHR::Blas Raytracer::objectToVkGeometryKHR(const ObjModel& model,
+                                                                  const ObjLod*   lod)
 {
+  // The levels of detail only have their own indices
+  uint32_t          nbIndices    = lod ? lod->nbIndices : model.nbIndices;
+  uint32_t          nbOpaqueTris = lod ? lod->nbOpaqueTriangles : model.nbOpaqueTriangles;
+  vk::DeviceAddress indexAddress = lod ? lod->indices.address : model.indices.address;
+
   // Setting up the creation info of acceleration structure
   vk::AccelerationStructureCreateGeometryTypeInfoKHR asCreate;
   asCreate.setGeometryType(vk::GeometryTypeKHR::eTriangles);
-  asCreate.setIndexType(vk::IndexType::eUint32);
+  asCreate.setIndexType(model.indexType);
   asCreate.setVertexFormat(vk::Format::eR32G32B32Sfloat);
-  asCreate.setMaxPrimitiveCount(model.nbIndices / 3);  // Nb triangles
+  asCreate.setMaxPrimitiveCount(nbIndices / 3);  // Nb triangles
   asCreate.setMaxVertexCount(model.nbVertices);
   asCreate.setAllowsTransforms(VK_FALSE);  // No adding transformation matrices
 
   // Building part
-  vk::DeviceAddress vertexAddress = m_device.getBufferAddress({model.vertexBuffer.buffer});
-  vk::DeviceAddress indexAddress  = m_device.getBufferAddress({model.indexBuffer.buffer});
+  vk::DeviceAddress vertexAddress = model.vertices.address;
 
   vk::AccelerationStructureGeometryTrianglesDataKHR triangles;
   triangles.setVertexFormat(asCreate.vertexFormat);
   triangles.setVertexData(vertexAddress);
-  triangles.setVertexStride(sizeof(VertexObj));
+  triangles.setVertexStride(model.vertexStride);
   triangles.setIndexType(asCreate.indexType);
   triangles.setIndexData(indexAddress);
   triangles.setTransformData({});
 
-  // Setting up the build info of the acceleration
-  vk::AccelerationStructureGeometryKHR asGeom;
-  asGeom.setGeometryType(asCreate.geometryType);
-  asGeom.setFlags(vk::GeometryFlagBitsKHR::eNoDuplicateAnyHitInvocation);  // For AnyHit
-  asGeom.geometry.setTriangles(triangles);
-
-
-  vk::AccelerationStructureBuildOffsetInfoKHR offset;
-  offset.setFirstVertex(0);
-  offset.setPrimitiveCount(asCreate.maxPrimitiveCount);
-  offset.setPrimitiveOffset(0);
-  offset.setTransformOffset(0);
+  // Two geometries over the same buffers: the opaque triangles, which never invoke the any-hit
+  // shader, then the alpha-tested ones (see partitionAlphaTriangles). The hit shaders add
+  // ObjDesc::firstAlphaTriangle to the primitive index of the second geometry.
+  uint32_t       nbTriangles = nbIndices / 3;
+  uint32_t       nbOpaque    = std::min(nbOpaqueTris, nbTriangles);
+  vk::DeviceSize indexSize   = model.indexType == vk::IndexType::eUint16 ? 2 : 4;
 
   nvvk::RaytracingBuilderKHR::Blas blas;
-  blas.asGeometry.emplace_back(asGeom);
-  blas.asCreateGeometryInfo.emplace_back(asCreate);
-  blas.asBuildOffsetInfo.emplace_back(offset);
+  for(uint32_t part = 0; part < 2; part++)
+  {
+    uint32_t first = part == 0 ? 0 : nbOpaque;
+    uint32_t count = part == 0 ? nbOpaque : nbTriangles - nbOpaque;
+    if(count == 0)
+      continue;
+
+    // Setting up the build info of the acceleration
+    vk::AccelerationStructureGeometryKHR asGeom;
+    asGeom.setGeometryType(asCreate.geometryType);
+    asGeom.setFlags(part == 0 ? vk::GeometryFlagBitsKHR::eOpaque
+                              : vk::GeometryFlagBitsKHR::eNoDuplicateAnyHitInvocation);
+    asGeom.geometry.setTriangles(triangles);
+
+    vk::AccelerationStructureBuildOffsetInfoKHR offset;
+    offset.setFirstVertex(0);
+    offset.setPrimitiveCount(count);
+    offset.setPrimitiveOffset(static_cast<uint32_t>(first * 3 * indexSize));
+    offset.setTransformOffset(0);
+
+    asCreate.setMaxPrimitiveCount(count);
+    blas.asGeometry.emplace_back(asGeom);
+    blas.asCreateGeometryInfo.emplace_back(asCreate);
+    blas.asBuildOffsetInfo.emplace_back(offset);
+  }
   return blas;
 }
 
 
 //--------------------------------------------------------------------------------------------------
-// Returning the ray tracing geometry used for the BLAS, containing all spheres
+// Returning the ray tracing geometry used for the BLAS of a cluster of implicit objects
 //
-nvvk::RaytracingBuilderKHR::Blas Raytracer::implicitToVkGeometryKHR(const ImplInst& implicitObj)
+nvvk::RaytracingBuilderKHR::Blas Raytracer::implicitToVkGeometryKHR(const ImplInst&    implicitObj,
+                                                                    const ImplCluster& cluster)
 {
 
   // Setting up the creation info of acceleration structure
@@ -124,7 +195,7 @@ nvvk::RaytracingBuilderKHR::Blas Raytracer::implicitToVkGeometryKHR(const ImplIn
   asCreate.setGeometryType(vk::GeometryTypeKHR::eAabbs);
   asCreate.setIndexType(vk::IndexType::eNoneKHR);
   asCreate.setVertexFormat(vk::Format::eUndefined);
-  asCreate.setMaxPrimitiveCount(static_cast<uint32_t>(implicitObj.objImpl.size()));  // Nb triangles
+  asCreate.setMaxPrimitiveCount(cluster.count);  // Nb boxes
   asCreate.setMaxVertexCount(0);
   asCreate.setAllowsTransforms(VK_FALSE);  // No adding transformation matrices
 
@@ -144,10 +215,12 @@ nvvk::RaytracingBuilderKHR::Blas Raytracer::implicitToVkGeometryKHR(const ImplIn
   vk::AccelerationStructureBuildOffsetInfoKHR offset;
   offset.setFirstVertex(0);
   offset.setPrimitiveCount(asCreate.maxPrimitiveCount);
-  offset.setPrimitiveOffset(0);
+  offset.setPrimitiveOffset(cluster.first * static_cast<uint32_t>(sizeof(ObjImplicit)));
   offset.setTransformOffset(0);
 
   nvvk::RaytracingBuilderKHR::Blas blas;
+  if(implicitObj.dynamic)
+    blas.flags = vk::BuildAccelerationStructureFlagBitsKHR::eAllowUpdate;
   blas.asGeometry.emplace_back(asGeom);
   blas.asCreateGeometryInfo.emplace_back(asCreate);
   blas.asBuildOffsetInfo.emplace_back(offset);
@@ -168,12 +241,21 @@ void Raytracer::createBottomLevelAS(std::vector<ObjModel>& models, ImplInst& imp
     allBlas.emplace_back(blas);
   }
 
-  // Adding implicit
-  if(!implicitObj.objImpl.empty())
+  // Adding implicit, one BLAS per cluster
+  for(auto& cluster : implicitObj.clusters)
   {
-    auto blas = implicitToVkGeometryKHR(implicitObj);
-    allBlas.emplace_back(blas);
-    implicitObj.blasId = static_cast<int>(allBlas.size() - 1);  // remember blas ID for tlas
+    allBlas.emplace_back(implicitToVkGeometryKHR(implicitObj, cluster));
+    cluster.blasId = static_cast<int>(allBlas.size() - 1);  // remember blas ID for tlas
+  }
+
+  // Levels of detail, selected by updateInstanceLods
+  for(auto& model : models)
+  {
+    for(auto& lod : model.lods)
+    {
+      allBlas.emplace_back(objectToVkGeometryKHR(model, &lod));
+      lod.blasId = static_cast<uint32_t>(allBlas.size() - 1);
+    }
   }
 
 
@@ -181,40 +263,197 @@ void Raytracer::createBottomLevelAS(std::vector<ObjModel>& models, ImplInst& imp
                                      | vk::BuildAccelerationStructureFlagBitsKHR::eAllowCompaction);
 }
 
-void Raytracer::createTopLevelAS(std::vector<ObjInstance>& instances, ImplInst& implicitObj)
+void Raytracer::createTopLevelAS(const std::vector<ObjModel>& models,
+                                 std::vector<ObjInstance>&    instances,
+                                 ImplInst&                    implicitObj)
 {
-  std::vector<nvvk::RaytracingBuilderKHR::Instance> tlas;
-  tlas.reserve(instances.size());
+  std::vector<nvvk::RaytracingBuilderKHR::Instance>& tlas = m_tlasInstances;
+  tlas.clear();
+  tlas.reserve(instances.size() + implicitObj.clusters.size());
+  m_instanceSpheres.resize(instances.size());
+  bool hasLods = false;
   for(int i = 0; i < static_cast<int>(instances.size()); i++)
   {
+    // Hit group of the material class of the object, the classes without transparency skip the
+    // any-hit shader (forced opaque)
+    const ObjModel& model = models[instances[i].objIndex];
+    MaterialClass   cls   = model.materialClass;
+
+    // World bounds, with the largest scale of the transformation
+    const nvmath::mat4f& m      = instances[i].transform;
+    const nvmath::vec4f& sphere = model.boundingSphere;
+    nvmath::vec4f        center = m * nvmath::vec4f(sphere.x, sphere.y, sphere.z, 1.f);
+    float                scale  = 0.f;
+    for(int k = 0; k < 3; k++)
+    {
+      nvmath::vec4f axis(0.f);
+      axis[k]              = 1.f;
+      nvmath::vec4f column = m * axis;
+      scale                = std::max(scale, std::sqrt(nvmath::dot(column, column)));  // w is 0
+    }
+    m_instanceSpheres[i] = nvmath::vec4f(center.x, center.y, center.z, sphere.w * scale);
+    hasLods              = hasLods || !model.lods.empty();
+
     nvvk::RaytracingBuilderKHR::Instance rayInst;
     rayInst.transform  = instances[i].transform;  // Position of the instance
-    rayInst.instanceId = i;                       // gl_InstanceID
+    rayInst.instanceId = instances[i].objIndex;   // ObjDesc of the BLAS, see updateInstanceLods
     rayInst.blasId     = instances[i].objIndex;
-    rayInst.hitGroupId = 0;  // We will use the same hit group for all objects
+    rayInst.hitGroupId = static_cast<uint32_t>(cls);
+    rayInst.mask       = kMaskTriangles;
     rayInst.flags      = VK_GEOMETRY_INSTANCE_TRIANGLE_FACING_CULL_DISABLE_BIT_KHR;
+    if(cls != MaterialClass::eAlphaTested)
+      rayInst.flags |= VK_GEOMETRY_INSTANCE_FORCE_OPAQUE_BIT_KHR;
     tlas.emplace_back(rayInst);
   }
 
-  // Add the blas containing all implicit
-  if(!implicitObj.objImpl.empty())
+  // Add the blas of each cluster of implicit objects, their ObjDesc follow the ones of the models
+  m_firstImplicitInstance = static_cast<uint32_t>(tlas.size());
+  for(size_t c = 0; c < implicitObj.clusters.size(); c++)
   {
     nvvk::RaytracingBuilderKHR::Instance rayInst;
-    rayInst.transform  = implicitObj.transform;                      // Position of the instance
-    rayInst.instanceId = static_cast<uint32_t>(implicitObj.blasId);  // Same for material index
-    rayInst.blasId     = static_cast<uint32_t>(implicitObj.blasId);
-    rayInst.hitGroupId = 1;  // We will use the same hit group for all objects (the second one)
+    rayInst.transform  = implicitObj.transform;                     // Position of the instance
+    rayInst.instanceId = static_cast<uint32_t>(models.size() + c);  // ObjDesc of the cluster
+    rayInst.blasId     = static_cast<uint32_t>(implicitObj.clusters[c].blasId);
+    rayInst.hitGroupId = kProceduralHitGroup;  // After the hit groups of the material classes
+    rayInst.mask       = kMaskImplicit;
     rayInst.flags      = VK_GEOMETRY_INSTANCE_TRIANGLE_FACING_CULL_DISABLE_BIT_KHR;
     tlas.emplace_back(rayInst);
   }
 
-  m_rtBuilder.buildTlas(tlas, vk::BuildAccelerationStructureFlagBitsKHR::ePreferFastTrace);
+  vk::BuildAccelerationStructureFlagsKHR flags =
+      vk::BuildAccelerationStructureFlagBitsKHR::ePreferFastTrace;
+  if(implicitObj.dynamic || hasLods)
+    flags |= vk::BuildAccelerationStructureFlagBitsKHR::eAllowUpdate;
+  m_rtBuilder.buildTlas(tlas, flags);
+  // The scratch memory of the builds is not needed anymore, the refits allocate a smaller one
+  m_rtBuilder.releaseScratch();
 }
 
 //--------------------------------------------------------------------------------------------------
-// This descriptor set holds the Acceleration structure and the output image
+// Refitting the BLAS of the clusters whose objects were modified in the implicit buffer, and the
+// TLAS over their new bounds, in the command buffer of the frame. The clusters must have been
+// built with ImplInst::dynamic.
 //
-void Raytracer::createRtDescriptorSet(const vk::ImageView& outputImage)
+void Raytracer::cmdRefitImplicitClusters(const vk::CommandBuffer&     cmdBuf,
+                                         uint32_t                     frameSlot,
+                                         const ImplInst&              implicitObj,
+                                         const std::vector<uint32_t>& clusters)
+{
+  if(clusters.empty())
+    return;
+
+  // Each cluster refits in its own region of the scratch buffer, the refits of the next frame
+  // are ordered after these ones by the caller
+  if(!m_implicitScratch.buffer)
+  {
+    vk::DeviceSize size{0};
+    for(const auto& cluster : implicitObj.clusters)
+    {
+      m_implicitScratchOffsets.push_back(size);
+      size += m_rtBuilder.getBlasUpdateScratchSize(static_cast<uint32_t>(cluster.blasId));
+    }
+    vk::BufferUsageFlags usage = vk::BufferUsageFlagBits::eRayTracingKHR
+                                 | vk::BufferUsageFlagBits::eShaderDeviceAddress;
+    m_implicitScratch =
+        m_alloc->createBuffer(size, usage, vk::MemoryPropertyFlagBits::eDeviceLocal);
+    MemoryStats::shared().add(MemoryCategory::eScratch,
+                              MemoryStats::sizeOf(m_device, m_implicitScratch.buffer));
+    m_debug.setObjectName(m_implicitScratch.buffer, "implicitRefitScratch");
+  }
+  vk::DeviceAddress scratchAddress = m_device.getBufferAddress({m_implicitScratch.buffer});
+
+  std::vector<RaytracingBuilder::InstanceRange> dirty;
+  for(uint32_t c : clusters)
+  {
+    m_rtBuilder.cmdUpdateBlas(cmdBuf, static_cast<uint32_t>(implicitObj.clusters[c].blasId),
+                              scratchAddress + m_implicitScratchOffsets[c]);
+    dirty.push_back({m_firstImplicitInstance + c, 1});
+  }
+
+  // The TLAS update reads the bounds of the refit BLAS
+  vk::MemoryBarrier barrier(vk::AccessFlagBits::eAccelerationStructureWriteKHR,
+                            vk::AccessFlagBits::eAccelerationStructureReadKHR);
+  cmdBuf.pipelineBarrier(vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR,
+                         vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR, {}, {barrier},
+                         {}, {});
+  m_rtBuilder.cmdUpdateTlas(cmdBuf, frameSlot, m_tlasInstances, std::move(dirty));
+}
+
+//--------------------------------------------------------------------------------------------------
+// Level of detail and mask of the instances of the models, from their size on screen
+// - The level is the coarsest one whose error is below settings.pixelError pixels
+// - The instances smaller than settings.tinyPixels or farther than settings.farDistance get
+//   kMaskFar, only the camera rays trace them. Those outside of the frustum are not traced at all.
+// - Only the modified instances are written, refitting the TLAS (or rebuilding it, see updateTlas)
+//   in the command buffer of the frame, without waiting for the GPU
+//
+uint32_t Raytracer::updateInstanceLods(const vk::CommandBuffer&        cmdBuf,
+                                       uint32_t                        frameSlot,
+                                       const std::vector<ObjModel>&    models,
+                                       const std::vector<ObjInstance>& instances,
+                                       const LodCamera&                camera,
+                                       const LodSettings&              settings)
+{
+  // Normals of the side planes of the frustum, which go through the eye
+  float tanX  = camera.tanHalfFovY * camera.aspect;
+  float normX = 1.f / std::sqrt(1.f + tanX * tanX);
+  float normY = 1.f / std::sqrt(1.f + camera.tanHalfFovY * camera.tanHalfFovY);
+
+  std::vector<RaytracingBuilder::InstanceRange> dirty;
+  for(uint32_t i = 0; i < static_cast<uint32_t>(instances.size()); i++)
+  {
+    const ObjModel&      model  = models[instances[i].objIndex];
+    const nvmath::vec4f& sphere = m_instanceSpheres[i];
+    nvmath::vec4f        view   = camera.view * nvmath::vec4f(sphere.x, sphere.y, sphere.z, 1.f);
+    float distance = std::max(nvmath::length(nvmath::vec3f(view.x, view.y, view.z)), 1e-6f);
+    float pixels   = camera.pixelScale / distance;  // Pixels of one unit at the instance
+
+    // The error of the levels scales with the instance
+    uint32_t blasId    = instances[i].objIndex;
+    uint32_t objDescId = instances[i].objIndex;
+    float    scale     = sphere.w / std::max(model.boundingSphere.w, 1e-6f);
+    for(const ObjLod& lod : model.lods)
+    {
+      if(lod.error * scale * pixels > settings.pixelError)
+        break;
+      blasId    = lod.blasId;
+      objDescId = lod.objDescId;
+    }
+
+    // The camera looks down -z
+    uint32_t mask = kMaskTriangles;
+    if(2.f * sphere.w * pixels < settings.tinyPixels || distance - sphere.w > settings.farDistance)
+    {
+      bool outside = view.z > sphere.w
+                     || (std::abs(view.x) + tanX * view.z) * normX > sphere.w
+                     || (std::abs(view.y) + camera.tanHalfFovY * view.z) * normY > sphere.w;
+      mask = outside ? 0 : kMaskFar;
+    }
+
+    nvvk::RaytracingBuilderKHR::Instance& inst = m_tlasInstances[i];
+    if(inst.blasId == blasId && inst.instanceId == objDescId && inst.mask == mask)
+      continue;
+    inst.blasId     = blasId;
+    inst.instanceId = objDescId;
+    inst.mask       = mask;
+    if(!dirty.empty() && dirty.back().first + dirty.back().count == i)
+      dirty.back().count++;
+    else
+      dirty.push_back({i, 1});
+  }
+
+  uint32_t nbChanged = 0;
+  for(const auto& r : dirty)
+    nbChanged += r.count;
+  if(!dirty.empty())
+    m_rtBuilder.cmdUpdateTlas(cmdBuf, frameSlot, m_tlasInstances, dirty);
+  return nbChanged;
+}
+
+//--------------------------------------------------------------------------------------------------
+// Layout of the ray tracing descriptor set, needed by the pipeline before the TLAS exists
+//
+void Raytracer::createRtDescriptorSetLayout()
 {
   using vkDT   = vk::DescriptorType;
   using vkSS   = vk::ShaderStageFlagBits;
@@ -224,120 +463,203 @@ void Raytracer::createRtDescriptorSet(const vk::ImageView& outputImage)
                                           vkSS::eRaygenKHR | vkSS::eClosestHitKHR));  // TLAS
   m_rtDescSetLayoutBind.addBinding(
       vkDSLB(1, vkDT::eStorageImage, 1, vkSS::eRaygenKHR));  // Output image
+  m_rtDescSetLayoutBind.addBinding(
+      vkDSLB(2, vkDT::eStorageImage, 1, vkSS::eRaygenKHR));  // Adaptive sampling statistics
+  m_rtDescSetLayoutBind.addBinding(
+      vkDSLB(3, vkDT::eStorageBuffer, 1, vkSS::eRaygenKHR));  // Adaptive sampling pixels
+  m_rtDescSetLayoutBind.addBinding(
+      vkDSLB(4, vkDT::eStorageImage, 1, vkSS::eRaygenKHR));  // Reduced precision output
+  m_rtDescSetLayoutBind.addBinding(
+      vkDSLB(5, vkDT::eStorageImage, 1, vkSS::eRaygenKHR));  // Temporal accumulation motion
+  m_rtDescSetLayoutBind.addBinding(
+      vkDSLB(6, vkDT::eStorageImage, 1, vkSS::eRaygenKHR));  // Depth guide of the upsampling
+  m_rtDescSetLayoutBind.addBinding(
+      vkDSLB(7, vkDT::eStorageBuffer, 1, vkSS::eRaygenKHR));  // Wavefront rays of the launch
+  m_rtDescSetLayoutBind.addBinding(
+      vkDSLB(8, vkDT::eStorageBuffer, 1, vkSS::eRaygenKHR));  // Wavefront rays of the next launch
+  m_rtDescSetLayoutBind.addBinding(
+      vkDSLB(9, vkDT::eStorageImage, 1, vkSS::eRaygenKHR));  // Wavefront radiance
+  m_rtDescSetLayoutBind.addBinding(vkDSLB(10, vkDT::eStorageBuffer, 1,
+                                          vkSS::eRaygenKHR | vkSS::eClosestHitKHR
+                                              | vkSS::eAnyHitKHR));  // Ray statistics
 
-  m_rtDescPool      = m_rtDescSetLayoutBind.createPool(m_device);
+  m_rtDescPool      = m_retired->createPool(m_rtDescSetLayoutBind, m_device);
   m_rtDescSetLayout = m_rtDescSetLayoutBind.createLayout(m_device);
-  m_rtDescSet       = m_device.allocateDescriptorSets({m_rtDescPool, 1, &m_rtDescSetLayout})[0];
+}
 
+//--------------------------------------------------------------------------------------------------
+// This descriptor set holds the Acceleration structure, the output images, the adaptive sampling
+// and the temporal accumulation resources
+// - Required when changing resolution, in a new set
+//
+void Raytracer::updateRtDescriptorSet(const vk::ImageView&       outputImage,
+                                      const vk::ImageView&       accumImage,
+                                      const vk::ImageView&       depthGuideImage,
+                                      const AdaptiveSampler&     adaptive,
+                                      const TemporalAccumulator& temporal,
+                                      const BounceQueue&         bounces,
+                                      const RayStats&            rayStats)
+{
+  m_retired->replaceSet(m_device, m_rtDescPool, m_rtDescSetLayout, m_rtDescSet);
+
+  // (0) TLAS
   vk::AccelerationStructureKHR                   tlas = m_rtBuilder.getAccelerationStructure();
   vk::WriteDescriptorSetAccelerationStructureKHR descASInfo;
   descASInfo.setAccelerationStructureCount(1);
   descASInfo.setPAccelerationStructures(&tlas);
+  // (1) Accumulation and (4) output, which are the same image in full precision
+  vk::DescriptorImageInfo accumInfo{{}, accumImage, vk::ImageLayout::eGeneral};
   vk::DescriptorImageInfo imageInfo{{}, outputImage, vk::ImageLayout::eGeneral};
+  // (2) Statistics and (3) pixel list
+  vk::DescriptorBufferInfo pixelInfo{adaptive.pixelBuffer(), 0, VK_WHOLE_SIZE};
 
   std::vector<vk::WriteDescriptorSet> writes;
   writes.emplace_back(m_rtDescSetLayoutBind.makeWrite(m_rtDescSet, 0, &descASInfo));
-  writes.emplace_back(m_rtDescSetLayoutBind.makeWrite(m_rtDescSet, 1, &imageInfo));
+  writes.emplace_back(m_rtDescSetLayoutBind.makeWrite(m_rtDescSet, 1, &accumInfo));
+  writes.emplace_back(m_rtDescSetLayoutBind.makeWrite(m_rtDescSet, 4, &imageInfo));
+  writes.emplace_back(
+      m_rtDescSetLayoutBind.makeWrite(m_rtDescSet, 2, &adaptive.statsTexture().descriptor));
+  writes.emplace_back(m_rtDescSetLayoutBind.makeWrite(m_rtDescSet, 3, &pixelInfo));
+  // (5) Motion and (6) depth guide
+  vk::DescriptorImageInfo depthGuideInfo{{}, depthGuideImage, vk::ImageLayout::eGeneral};
+  writes.emplace_back(
+      m_rtDescSetLayoutBind.makeWrite(m_rtDescSet, 5, &temporal.motionTexture().descriptor));
+  writes.emplace_back(m_rtDescSetLayoutBind.makeWrite(m_rtDescSet, 6, &depthGuideInfo));
+  // (7, 8) Wavefront queues and (9) radiance
+  vk::DescriptorBufferInfo sortedInfo{bounces.sortedBuffer(), 0, VK_WHOLE_SIZE};
+  vk::DescriptorBufferInfo unsortedInfo{bounces.unsortedBuffer(), 0, VK_WHOLE_SIZE};
+  writes.emplace_back(m_rtDescSetLayoutBind.makeWrite(m_rtDescSet, 7, &sortedInfo));
+  writes.emplace_back(m_rtDescSetLayoutBind.makeWrite(m_rtDescSet, 8, &unsortedInfo));
+  writes.emplace_back(
+      m_rtDescSetLayoutBind.makeWrite(m_rtDescSet, 9, &bounces.radianceTexture().descriptor));
+  // (10) Ray statistics
+  vk::DescriptorBufferInfo rayStatsInfo{rayStats.buffer(), 0, VK_WHOLE_SIZE};
+  writes.emplace_back(m_rtDescSetLayoutBind.makeWrite(m_rtDescSet, 10, &rayStatsInfo));
   m_device.updateDescriptorSets(static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
 }
 
 
 //--------------------------------------------------------------------------------------------------
-// Writes the output image to the descriptor set
-// - Required when changing resolution
+// SPIR-V file of each shader of the ray tracing pipeline
 //
-void Raytracer::updateRtDescriptorSet(const vk::ImageView& outputImage)
+const char* Raytracer::rtShaderFile(RtShader shader)
 {
-  using vkDT = vk::DescriptorType;
-
-  // (1) Output buffer
-  vk::DescriptorImageInfo imageInfo{{}, outputImage, vk::ImageLayout::eGeneral};
-  vk::WriteDescriptorSet  wds{m_rtDescSet, 1, 0, 1, vkDT::eStorageImage, &imageInfo};
-  m_device.updateDescriptorSets(wds, nullptr);
+  switch(shader)
+  {
+    case eRaygen:
+      return "shaders/raytrace.rgen.spv";
+    case eMiss:
+      return "shaders/raytrace.rmiss.spv";
+    case eShadowMiss:
+      // The second miss shader is invoked when a shadow ray misses the geometry. It
+      // simply indicates that no occlusion has been found
+      return "shaders/raytraceShadow.rmiss.spv";
+    case eClosestHit:
+      return "shaders/raytrace.rchit.spv";
+    case eAnyHit:
+      return "shaders/raytrace.rahit.spv";
+    case eClosestHit2:
+      return "shaders/raytrace2.rchit.spv";
+    case eAnyHit2:
+      return "shaders/raytrace2.rahit.spv";
+    case eIntersection:
+      return "shaders/raytrace.rint.spv";
+    case eCallPoint:
+      return "shaders/light_point.rcall.spv";
+    case eCallSpot:
+      return "shaders/light_spot.rcall.spv";
+    case eCallInf:
+      return "shaders/light_inf.rcall.spv";
+    case eCallTriangle:
+      return "shaders/light_triangle.rcall.spv";
+    default:
+      return nullptr;
+  }
 }
 
+//--------------------------------------------------------------------------------------------------
+// Reading and creating one shader module, each of them can be loaded from a different thread
+//
+void Raytracer::loadRtShader(RtShader shader)
+{
+  std::vector<std::string> paths = defaultSearchPaths;
+  m_rtShaderModules[shader] =
+      nvvk::createShaderModule(m_device, nvh::loadFile(rtShaderFile(shader), true, paths));
+}
 
 //--------------------------------------------------------------------------------------------------
 // Pipeline for the ray tracer: all shaders, raygen, chit, miss
+// - The shader modules are loaded by loadRtShader, and kept for the other variants
+// - Creates the pipeline of the current variant
 //
 void Raytracer::createRtPipeline(vk::DescriptorSetLayout& sceneDescLayout)
 {
-  std::vector<std::string> paths = defaultSearchPaths;
+  const auto& sm = m_rtShaderModules;
 
-  vk::ShaderModule raygenSM =
-      nvvk::createShaderModule(m_device,  //
-                               nvh::loadFile("shaders/raytrace.rgen.spv", true, paths));
-  vk::ShaderModule missSM =
-      nvvk::createShaderModule(m_device,  //
-                               nvh::loadFile("shaders/raytrace.rmiss.spv", true, paths));
-
-  // The second miss shader is invoked when a shadow ray misses the geometry. It
-  // simply indicates that no occlusion has been found
-  vk::ShaderModule shadowmissSM =
-      nvvk::createShaderModule(m_device,
-                               nvh::loadFile("shaders/raytraceShadow.rmiss.spv", true, paths));
-
-
-  std::vector<vk::PipelineShaderStageCreateInfo> stages;
+  std::vector<vk::PipelineShaderStageCreateInfo>& stages = m_rtStages;
+  stages.clear();
+  m_rtStageClass.clear();
+  m_rtShaderGroups.clear();
+  m_sbt.clear();
 
   // Raygen
   vk::RayTracingShaderGroupCreateInfoKHR rg{vk::RayTracingShaderGroupTypeKHR::eGeneral,
                                             VK_SHADER_UNUSED_KHR, VK_SHADER_UNUSED_KHR,
                                             VK_SHADER_UNUSED_KHR, VK_SHADER_UNUSED_KHR};
-  stages.push_back({{}, vk::ShaderStageFlagBits::eRaygenKHR, raygenSM, "main"});
+  stages.push_back({{}, vk::ShaderStageFlagBits::eRaygenKHR, sm[eRaygen], "main"});
   rg.setGeneralShader(static_cast<uint32_t>(stages.size() - 1));
+  m_sbt.addGroup(SbtBuilder::eRaygen, static_cast<uint32_t>(m_rtShaderGroups.size()));
   m_rtShaderGroups.push_back(rg);
 
   // Miss
   vk::RayTracingShaderGroupCreateInfoKHR mg{vk::RayTracingShaderGroupTypeKHR::eGeneral,
                                             VK_SHADER_UNUSED_KHR, VK_SHADER_UNUSED_KHR,
                                             VK_SHADER_UNUSED_KHR, VK_SHADER_UNUSED_KHR};
-  stages.push_back({{}, vk::ShaderStageFlagBits::eMissKHR, missSM, "main"});
+  stages.push_back({{}, vk::ShaderStageFlagBits::eMissKHR, sm[eMiss], "main"});
   mg.setGeneralShader(static_cast<uint32_t>(stages.size() - 1));
+  m_sbt.addGroup(SbtBuilder::eMiss, static_cast<uint32_t>(m_rtShaderGroups.size()));
   m_rtShaderGroups.push_back(mg);
   // Shadow Miss
-  stages.push_back({{}, vk::ShaderStageFlagBits::eMissKHR, shadowmissSM, "main"});
+  stages.push_back({{}, vk::ShaderStageFlagBits::eMissKHR, sm[eShadowMiss], "main"});
   mg.setGeneralShader(static_cast<uint32_t>(stages.size() - 1));
+  m_sbt.addGroup(SbtBuilder::eMiss, static_cast<uint32_t>(m_rtShaderGroups.size()));
   m_rtShaderGroups.push_back(mg);
 
-  // Hit Group0 - Closest Hit + AnyHit
-  vk::ShaderModule chitSM =
-      nvvk::createShaderModule(m_device,  //
-                               nvh::loadFile("shaders/raytrace.rchit.spv", true, paths));
-  vk::ShaderModule ahitSM =
-      nvvk::createShaderModule(m_device,  //
-                               nvh::loadFile("shaders/raytrace.rahit.spv", true, paths));
+  // Hit groups 0 to eNbClasses - 1: triangles, one per material class (see MaterialClass). Their
+  // closest-hit stages are specialized to the features of the class, and only the alpha-tested
+  // group has the any-hit shader.
+  m_rtStageClass.resize(stages.size(), -1);
+  for(int cls = 0; cls < int(MaterialClass::eNbClasses); cls++)
+  {
+    vk::RayTracingShaderGroupCreateInfoKHR hg{vk::RayTracingShaderGroupTypeKHR::eTrianglesHitGroup,
+                                              VK_SHADER_UNUSED_KHR, VK_SHADER_UNUSED_KHR,
+                                              VK_SHADER_UNUSED_KHR, VK_SHADER_UNUSED_KHR};
+    stages.push_back({{}, vk::ShaderStageFlagBits::eClosestHitKHR, sm[eClosestHit], "main"});
+    m_rtStageClass.push_back(cls);
+    hg.setClosestHitShader(static_cast<uint32_t>(stages.size() - 1));
+    if(cls == int(MaterialClass::eAlphaTested))
+    {
+      stages.push_back({{}, vk::ShaderStageFlagBits::eAnyHitKHR, sm[eAnyHit], "main"});
+      m_rtStageClass.push_back(-1);
+      hg.setAnyHitShader(static_cast<uint32_t>(stages.size() - 1));
+    }
+    m_sbt.addGroup(SbtBuilder::eHit, static_cast<uint32_t>(m_rtShaderGroups.size()));
+    m_rtShaderGroups.push_back(hg);
+  }
 
-  vk::RayTracingShaderGroupCreateInfoKHR hg{vk::RayTracingShaderGroupTypeKHR::eTrianglesHitGroup,
-                                            VK_SHADER_UNUSED_KHR, VK_SHADER_UNUSED_KHR,
-                                            VK_SHADER_UNUSED_KHR, VK_SHADER_UNUSED_KHR};
-  stages.push_back({{}, vk::ShaderStageFlagBits::eClosestHitKHR, chitSM, "main"});
-  hg.setClosestHitShader(static_cast<uint32_t>(stages.size() - 1));
-  stages.push_back({{}, vk::ShaderStageFlagBits::eAnyHitKHR, ahitSM, "main"});
-  hg.setAnyHitShader(static_cast<uint32_t>(stages.size() - 1));
-  m_rtShaderGroups.push_back(hg);
-
-
-  // Hit Group1 - Closest Hit + Intersection (procedural)
-  vk::ShaderModule chit2SM =
-      nvvk::createShaderModule(m_device,  //
-                               nvh::loadFile("shaders/raytrace2.rchit.spv", true, paths));
-  vk::ShaderModule ahit2SM =
-      nvvk::createShaderModule(m_device,  //
-                               nvh::loadFile("shaders/raytrace2.rahit.spv", true, paths));
-  vk::ShaderModule rintSM =
-      nvvk::createShaderModule(m_device,  //
-                               nvh::loadFile("shaders/raytrace.rint.spv", true, paths));
+
+  // Hit group eNbClasses - Closest Hit + Intersection (procedural)
   {
     vk::RayTracingShaderGroupCreateInfoKHR hg{vk::RayTracingShaderGroupTypeKHR::eProceduralHitGroup,
                                               VK_SHADER_UNUSED_KHR, VK_SHADER_UNUSED_KHR,
                                               VK_SHADER_UNUSED_KHR, VK_SHADER_UNUSED_KHR};
-    stages.push_back({{}, vk::ShaderStageFlagBits::eClosestHitKHR, chit2SM, "main"});
+    stages.push_back({{}, vk::ShaderStageFlagBits::eClosestHitKHR, sm[eClosestHit2], "main"});
     hg.setClosestHitShader(static_cast<uint32_t>(stages.size() - 1));
-    stages.push_back({{}, vk::ShaderStageFlagBits::eAnyHitKHR, ahit2SM, "main"});
+    stages.push_back({{}, vk::ShaderStageFlagBits::eAnyHitKHR, sm[eAnyHit2], "main"});
     hg.setAnyHitShader(static_cast<uint32_t>(stages.size() - 1));
-    stages.push_back({{}, vk::ShaderStageFlagBits::eIntersectionKHR, rintSM, "main"});
+    stages.push_back({{}, vk::ShaderStageFlagBits::eIntersectionKHR, sm[eIntersection], "main"});
     hg.setIntersectionShader(static_cast<uint32_t>(stages.size() - 1));
+    m_sbt.addGroup(SbtBuilder::eHit, static_cast<uint32_t>(m_rtShaderGroups.size()));
     m_rtShaderGroups.push_back(hg);
   }
 
@@ -346,24 +668,24 @@ void Raytracer::createRtPipeline(vk::DescriptorSetLayout& sceneDescLayout)
                                                    VK_SHADER_UNUSED_KHR, VK_SHADER_UNUSED_KHR,
                                                    VK_SHADER_UNUSED_KHR, VK_SHADER_UNUSED_KHR};
 
-  vk::ShaderModule call0 =
-      nvvk::createShaderModule(m_device,
-                               nvh::loadFile("shaders/light_point.rcall.spv", true, paths));
-  vk::ShaderModule call1 =
-      nvvk::createShaderModule(m_device,
-                               nvh::loadFile("shaders/light_spot.rcall.spv", true, paths));
-  vk::ShaderModule call2 =
-      nvvk::createShaderModule(m_device, nvh::loadFile("shaders/light_inf.rcall.spv", true, paths));
-
-  stages.push_back({{}, vk::ShaderStageFlagBits::eCallableKHR, call0, "main"});
+  stages.push_back({{}, vk::ShaderStageFlagBits::eCallableKHR, sm[eCallPoint], "main"});
+  callGroup.setGeneralShader(static_cast<uint32_t>(stages.size() - 1));
+  m_sbt.addGroup(SbtBuilder::eCallable, static_cast<uint32_t>(m_rtShaderGroups.size()));
+  m_rtShaderGroups.push_back(callGroup);
+  stages.push_back({{}, vk::ShaderStageFlagBits::eCallableKHR, sm[eCallSpot], "main"});
   callGroup.setGeneralShader(static_cast<uint32_t>(stages.size() - 1));
+  m_sbt.addGroup(SbtBuilder::eCallable, static_cast<uint32_t>(m_rtShaderGroups.size()));
   m_rtShaderGroups.push_back(callGroup);
-  stages.push_back({{}, vk::ShaderStageFlagBits::eCallableKHR, call1, "main"});
+  stages.push_back({{}, vk::ShaderStageFlagBits::eCallableKHR, sm[eCallInf], "main"});
   callGroup.setGeneralShader(static_cast<uint32_t>(stages.size() - 1));
+  m_sbt.addGroup(SbtBuilder::eCallable, static_cast<uint32_t>(m_rtShaderGroups.size()));
   m_rtShaderGroups.push_back(callGroup);
-  stages.push_back({{}, vk::ShaderStageFlagBits::eCallableKHR, call2, "main"});
+  // Emissive triangles of the scene lights, see lights.hpp
+  stages.push_back({{}, vk::ShaderStageFlagBits::eCallableKHR, sm[eCallTriangle], "main"});
   callGroup.setGeneralShader(static_cast<uint32_t>(stages.size() - 1));
+  m_sbt.addGroup(SbtBuilder::eCallable, static_cast<uint32_t>(m_rtShaderGroups.size()));
   m_rtShaderGroups.push_back(callGroup);
+  m_rtStageClass.resize(stages.size(), -1);
 
 
   vk::PipelineLayoutCreateInfo pipelineLayoutCreateInfo;
@@ -384,6 +706,69 @@ void Raytracer::createRtPipeline(vk::DescriptorSetLayout& sceneDescLayout)
 
   m_rtPipelineLayout = m_device.createPipelineLayout(pipelineLayoutCreateInfo);
 
+  m_rtPipeline = createRtPipelineVariant(m_rtVariant);
+}
+
+//--------------------------------------------------------------------------------------------------
+// MATERIAL_FEATURES of the closest-hit shader of a material class
+//
+int Raytracer::materialFeatures(MaterialClass cls)
+{
+  switch(cls)
+  {
+    case MaterialClass::eOpaque:
+      return 0;
+    case MaterialClass::eTextured:
+      return kMaterialTextures;
+    default:
+      return kAllMaterialFeatures;
+  }
+}
+
+//--------------------------------------------------------------------------------------------------
+// Ray tracing pipeline with the specialization constants of the variant
+//
+vk::Pipeline Raytracer::createRtPipelineVariant(const RtVariant& variant)
+{
+  // Constants not declared by a shader are ignored, so all stages get the same values, except
+  // MATERIAL_FEATURES which depends on the hit group
+  struct StageConstants
+  {
+    RtVariant variant;
+    int       materialFeatures{kAllMaterialFeatures};
+  };
+  std::array<vk::SpecializationMapEntry, 9> entries{
+      vk::SpecializationMapEntry{0, offsetof(RtVariant, nbSamples), sizeof(int)},
+      vk::SpecializationMapEntry{1, offsetof(RtVariant, maxDepth), sizeof(int)},
+      vk::SpecializationMapEntry{2, offsetof(RtVariant, lightType), sizeof(int)},
+      vk::SpecializationMapEntry{3, offsetof(RtVariant, separateAccum), sizeof(int)},
+      vk::SpecializationMapEntry{4, offsetof(RtVariant, packedVertices), sizeof(int)},
+      vk::SpecializationMapEntry{5, offsetof(StageConstants, materialFeatures), sizeof(int)},
+      vk::SpecializationMapEntry{6, offsetof(RtVariant, temporal), sizeof(int)},
+      vk::SpecializationMapEntry{7, offsetof(RtVariant, wavefront), sizeof(int)},
+      vk::SpecializationMapEntry{8, offsetof(RtVariant, rayStats), sizeof(int)}};
+  const int nbClasses = int(MaterialClass::eNbClasses);
+  std::array<StageConstants, int(MaterialClass::eNbClasses) + 1>         constants;
+  std::array<vk::SpecializationInfo, int(MaterialClass::eNbClasses) + 1> specInfos;
+  for(int i = 0; i <= nbClasses; i++)
+  {
+    constants[i].variant = variant;
+    if(i < nbClasses)
+      constants[i].materialFeatures = materialFeatures(MaterialClass(i));
+    specInfos[i] = {static_cast<uint32_t>(entries.size()), entries.data(), sizeof(StageConstants),
+                    &constants[i]};
+  }
+
+  std::vector<vk::PipelineShaderStageCreateInfo> stages = m_rtStages;
+  for(size_t i = 0; i < stages.size(); i++)
+  {
+    int cls = m_rtStageClass[i] >= 0 ? m_rtStageClass[i] : nbClasses;
+    if(stages[i].stage == vk::ShaderStageFlagBits::eRaygenKHR
+       || stages[i].stage == vk::ShaderStageFlagBits::eClosestHitKHR
+       || stages[i].stage == vk::ShaderStageFlagBits::eAnyHitKHR)
+      stages[i].setPSpecializationInfo(&specInfos[cls]);
+  }
+
   // Assemble the shader stages and recursion depth info into the ray tracing pipeline
   vk::RayTracingPipelineCreateInfoKHR rayPipelineInfo;
   rayPipelineInfo.setStageCount(static_cast<uint32_t>(stages.size()));  // Stages are shaders
@@ -395,63 +780,76 @@ void Raytracer::createRtPipeline(vk::DescriptorSetLayout& sceneDescLayout)
 
   rayPipelineInfo.setMaxRecursionDepth(2);  // Ray depth
   rayPipelineInfo.setLayout(m_rtPipelineLayout);
-  m_rtPipeline = m_device.createRayTracingPipelineKHR({}, rayPipelineInfo).value;
-
-  m_device.destroy(raygenSM);
-  m_device.destroy(missSM);
-  m_device.destroy(shadowmissSM);
-  m_device.destroy(chitSM);
-  m_device.destroy(ahitSM);
-  m_device.destroy(chit2SM);
-  m_device.destroy(ahit2SM);
-  m_device.destroy(rintSM);
-  m_device.destroy(call0);
-  m_device.destroy(call1);
-  m_device.destroy(call2);
+
+  vk::Pipeline pipeline;
+  {
+    // The compilation is spread over the idle threads when the driver defers it
+    PipelineCache::Timer timer(*m_pipelineCache, "ray tracing");
+    vk::Result           result = createRayTracingPipelineDeferred(m_device, m_pipelineCache->get(),
+                                                         rayPipelineInfo, pipeline);
+    if(result != vk::Result::eSuccess && result != vk::Result::eOperationNotDeferredKHR)
+      LOGE("Ray tracing pipeline creation failed: %s\n", vk::to_string(result).c_str());
+  }
+  m_rtVariants[variant].pipeline = pipeline;
+  return pipeline;
 }
 
 //--------------------------------------------------------------------------------------------------
-// The Shader Binding Table (SBT)
-// - getting all shader handles and writing them in a SBT buffer
-// - Besides exception, this could be always done like this
-//   See how the SBT buffer is used in run()
+// Switching to the pipeline and SBT of the variant, creating them the first time
+// - The pipeline is compiled here, before the frame is recorded: new variants should only be
+//   requested when the settings change
+// - The SBT is recorded in the command buffer of the next frame (see bindRtPipeline), without
+//   waiting for the queue
 //
-void Raytracer::createRtShaderBindingTable()
+void Raytracer::setRtVariant(const RtVariant& variant)
 {
-  auto groupCount =
-      static_cast<uint32_t>(m_rtShaderGroups.size());               // 3 shaders: raygen, miss, chit
-  uint32_t groupHandleSize = m_rtProperties.shaderGroupHandleSize;  // Size of a program identifier
-
-  // Fetch all the shader handles used in the pipeline, so that they can be written in the SBT
-  uint32_t sbtSize = groupCount * groupHandleSize;
-
-  std::vector<uint8_t> shaderHandleStorage(sbtSize);
-  m_device.getRayTracingShaderGroupHandlesKHR(m_rtPipeline, 0, groupCount, sbtSize,
-                                              shaderHandleStorage.data());
-  // Write the handles in the SBT
-  nvvk::CommandPool genCmdBuf(m_device, m_graphicsQueueIndex);
-  vk::CommandBuffer cmdBuf = genCmdBuf.createCommandBuffer();
-
-  m_rtSBTBuffer =
-      m_alloc->createBuffer(cmdBuf, shaderHandleStorage, vk::BufferUsageFlagBits::eRayTracingKHR);
-  m_debug.setObjectName(m_rtSBTBuffer.buffer, "SBT");
+  if(variant == m_rtVariant)
+    return;
 
+  m_rtVariant = variant;
+  auto it     = m_rtVariants.find(variant);
+  if(it != m_rtVariants.end())
+  {
+    m_rtPipeline  = it->second.pipeline;
+    m_rtSBTBuffer = it->second.sbt;
+    return;
+  }
+
+  LOGI("Ray tracing variant: %d samples, depth %d, light %d\n", variant.nbSamples,
+       variant.maxDepth, variant.lightType);
+  m_rtPipeline  = createRtPipelineVariant(variant);
+  m_rtSBTBuffer = m_sbt.createBuffer();
+  m_debug.setObjectName(m_rtSBTBuffer.buffer, "SBT");
 
-  genCmdBuf.submitAndWait(cmdBuf);
+  uint32_t           nbGroups  = static_cast<uint32_t>(m_rtShaderGroups.size());
+  RtPipelineVariant& rtVariant = m_rtVariants[variant];
+  rtVariant.sbt                = m_rtSBTBuffer;
+  rtVariant.pendingSbt         = m_sbt.table(m_rtPipeline, nbGroups);
+}
 
-  m_alloc->finalizeAndReleaseStaging();
+//--------------------------------------------------------------------------------------------------
+// The Shader Binding Table (SBT)
+// - getting all shader handles and writing them in a SBT buffer, each kind of group in its own
+//   region (see SbtBuilder)
+// - the regions are the same for all variants, only the handles differ
+//
+void Raytracer::createRtShaderBindingTable()
+{
+  // The layout of the table was set by createRtPipeline, the same for all variants
+  m_rtSBTBuffer = m_sbt.create(m_rtPipeline, static_cast<uint32_t>(m_rtShaderGroups.size()));
+  m_debug.setObjectName(m_rtSBTBuffer.buffer, "SBT");
+  m_rtVariants[m_rtVariant].sbt = m_rtSBTBuffer;
 }
 
 //--------------------------------------------------------------------------------------------------
 // Ray Tracing the scene
 //
-void Raytracer::raytrace(const vk::CommandBuffer& cmdBuf,
-                         const nvmath::vec4f&     clearColor,
-                         vk::DescriptorSet&       sceneDescSet,
-                         vk::Extent2D&            size,
-                         ObjPushConstants&        sceneConstants)
+void Raytracer::bindRtPipeline(const vk::CommandBuffer& cmdBuf,
+                               const nvmath::vec4f&     clearColor,
+                               vk::DescriptorSet&       sceneDescSet,
+                               const ObjPushConstants&  sceneConstants,
+                               AdaptiveSampler::Mode    adaptiveMode)
 {
-  m_debug.beginLabel(cmdBuf, "Ray trace");
   // Initializing push constant values
   m_rtPushConstants.clearColor           = clearColor;
   m_rtPushConstants.lightPosition        = sceneConstants.lightPosition;
@@ -461,37 +859,144 @@ void Raytracer::raytrace(const vk::CommandBuffer& cmdBuf,
   m_rtPushConstants.lightSpotOuterCutoff = sceneConstants.lightSpotOuterCutoff;
   m_rtPushConstants.lightType            = sceneConstants.lightType;
   m_rtPushConstants.frame                = sceneConstants.frame;
+  m_rtPushConstants.adaptive             = adaptiveMode;
+  m_rtPushConstants.tileX                = 0;
+  m_rtPushConstants.tileY                = 0;
+  m_rtPushConstants.smpl                 = 0;
+  m_rtPushConstants.bounce               = 0;
+  m_rtPushConstants.width                = static_cast<int>(m_renderSize.width);
+  m_rtPushConstants.height               = static_cast<int>(m_renderSize.height);
+  m_rtPushConstants.frameOffset          = m_frameOffset;
+
+  // Table of a variant created since the last frame
+  std::vector<uint8_t>& pendingSbt = m_rtVariants[m_rtVariant].pendingSbt;
+  if(!pendingSbt.empty())
+  {
+    m_sbt.cmdUpload(cmdBuf, m_rtSBTBuffer, pendingSbt);
+    pendingSbt.clear();
+  }
 
   cmdBuf.bindPipeline(vk::PipelineBindPoint::eRayTracingKHR, m_rtPipeline);
   cmdBuf.bindDescriptorSets(vk::PipelineBindPoint::eRayTracingKHR, m_rtPipelineLayout, 0,
                             {m_rtDescSet, sceneDescSet}, {});
-  cmdBuf.pushConstants<RtPushConstants>(m_rtPipelineLayout,
-                                        vk::ShaderStageFlagBits::eRaygenKHR
-                                            | vk::ShaderStageFlagBits::eClosestHitKHR
-                                            | vk::ShaderStageFlagBits::eMissKHR
-                                            | vk::ShaderStageFlagBits::eCallableKHR,
-                                        0, m_rtPushConstants);
-
-  vk::DeviceSize progSize = m_rtProperties.shaderGroupHandleSize;  // Size of a program identifier
-  vk::DeviceSize rayGenOffset        = 0u * progSize;  // Start at the beginning of m_sbtBuffer
-  vk::DeviceSize missOffset          = 1u * progSize;  // Jump over raygen
-  vk::DeviceSize hitGroupOffset      = 3u * progSize;  // Jump over the previous shaders
-  vk::DeviceSize callableGroupOffset = 5u * progSize;  // Jump over the previous shaders
-  vk::DeviceSize sbtSize             = (vk::DeviceSize)m_rtShaderGroups.size() * progSize;
-
-  const vk::StridedBufferRegionKHR raygenShaderBindingTable = {m_rtSBTBuffer.buffer, rayGenOffset,
-                                                               progSize, sbtSize};
-  const vk::StridedBufferRegionKHR missShaderBindingTable   = {m_rtSBTBuffer.buffer, missOffset,
-                                                             progSize, sbtSize};
-  const vk::StridedBufferRegionKHR hitShaderBindingTable    = {m_rtSBTBuffer.buffer, hitGroupOffset,
-                                                            progSize, sbtSize};
-  const vk::StridedBufferRegionKHR callableShaderBindingTable = {
-      m_rtSBTBuffer.buffer, callableGroupOffset, progSize, sbtSize};
-
-  cmdBuf.traceRaysKHR(&raygenShaderBindingTable, &missShaderBindingTable, &hitShaderBindingTable,
-                      &callableShaderBindingTable,  //
-                      size.width, size.height, 1);  //
+  cmdBuf.pushConstants<RtPushConstants>(m_rtPipelineLayout, s_rtPushStages, 0, m_rtPushConstants);
+}
+
+void Raytracer::raytrace(const vk::CommandBuffer&       cmdBuf,
+                         const nvmath::vec4f&           clearColor,
+                         vk::DescriptorSet&             sceneDescSet,
+                         const std::vector<vk::Rect2D>& tiles,
+                         ObjPushConstants&              sceneConstants,
+                         const AdaptiveSampler&         adaptive,
+                         AdaptiveSampler::Mode          adaptiveMode)
+{
+  m_debug.beginLabel(cmdBuf, "Ray trace");
+  bindRtPipeline(cmdBuf, clearColor, sceneDescSet, sceneConstants, adaptiveMode);
+
+  // The hit group of an instance is its hitGroupId, see createTopLevelAS
+  const auto raygenShaderBindingTable   = m_sbt.region(SbtBuilder::eRaygen, m_rtSBTBuffer);
+  const auto missShaderBindingTable     = m_sbt.region(SbtBuilder::eMiss, m_rtSBTBuffer);
+  const auto hitShaderBindingTable      = m_sbt.region(SbtBuilder::eHit, m_rtSBTBuffer);
+  const auto callableShaderBindingTable = m_sbt.region(SbtBuilder::eCallable, m_rtSBTBuffer);
 
+  // Adaptive sampling: one launch per pixel of the list, its size is written by the GPU
+  if(adaptiveMode == AdaptiveSampler::ePixelList && m_indirectTraceRays)
+  {
+    cmdBuf.traceRaysIndirectKHR(&raygenShaderBindingTable, &missShaderBindingTable,
+                                &hitShaderBindingTable, &callableShaderBindingTable,
+                                adaptive.pixelBuffer(), 0);
+  }
+  else if(adaptiveMode == AdaptiveSampler::ePixelList)
+  {
+    // Without indirect launches, as many launches as the list can hold, the ray generation shader
+    // returns past its size
+    cmdBuf.traceRaysKHR(&raygenShaderBindingTable, &missShaderBindingTable,
+                        &hitShaderBindingTable, &callableShaderBindingTable,  //
+                        m_renderSize.width * m_renderSize.height, 1, 1);      //
+  }
+  else
+  {
+    // One launch per tile, the ray generation shader adds the offset of the tile to its pixel
+    for(const vk::Rect2D& tile : tiles)
+    {
+      if(tile.offset.x != 0 || tile.offset.y != 0)
+      {
+        int32_t offset[2] = {tile.offset.x, tile.offset.y};
+        cmdBuf.pushConstants(m_rtPipelineLayout, s_rtPushStages,
+                             offsetof(RtPushConstants, tileX), sizeof(offset), offset);
+      }
+      cmdBuf.traceRaysKHR(&raygenShaderBindingTable, &missShaderBindingTable,
+                          &hitShaderBindingTable, &callableShaderBindingTable,  //
+                          tile.extent.width, tile.extent.height, 1);            //
+    }
+  }
+
+
+  m_debug.endLabel(cmdBuf);
+}
+
+//--------------------------------------------------------------------------------------------------
+// Wavefront path tracing: each sample is traced with one launch per bounce
+// - The first launch covers the image, the next ones the rays of BounceQueue, sorted by direction
+//   and origin so that the rays of a subgroup traverse the same nodes and hit the same materials
+// - The radiance of the samples is summed in BounceQueue::radianceTexture, and averaged in the
+//   accumulation image at the end of the frame
+//
+void Raytracer::raytraceWavefront(const vk::CommandBuffer& cmdBuf,
+                                  const nvmath::vec4f&     clearColor,
+                                  vk::DescriptorSet&       sceneDescSet,
+                                  const vk::Extent2D&      size,
+                                  ObjPushConstants&        sceneConstants,
+                                  BounceQueue&             bounces)
+{
+  m_debug.beginLabel(cmdBuf, "Ray trace wavefront");
+  bindRtPipeline(cmdBuf, clearColor, sceneDescSet, sceneConstants, AdaptiveSampler::eOff);
+
+  const auto raygenShaderBindingTable   = m_sbt.region(SbtBuilder::eRaygen, m_rtSBTBuffer);
+  const auto missShaderBindingTable     = m_sbt.region(SbtBuilder::eMiss, m_rtSBTBuffer);
+  const auto hitShaderBindingTable      = m_sbt.region(SbtBuilder::eHit, m_rtSBTBuffer);
+  const auto callableShaderBindingTable = m_sbt.region(SbtBuilder::eCallable, m_rtSBTBuffer);
+
+  const vk::MemoryBarrier radianceBarrier{vk::AccessFlagBits::eShaderWrite,
+                                          vk::AccessFlagBits::eShaderRead
+                                              | vk::AccessFlagBits::eShaderWrite};
+
+  bounces.cmdReset(cmdBuf);
+  for(int s = 0; s < m_rtVariant.nbSamples; s++)
+  {
+    for(int b = 0; b < m_rtVariant.maxDepth; b++)
+    {
+      // The push constants of cmdSort, with another layout, replace the ones of the launches
+      m_rtPushConstants.smpl   = s;
+      m_rtPushConstants.bounce = b;
+      cmdBuf.pushConstants<RtPushConstants>(m_rtPipelineLayout, s_rtPushStages, 0,
+                                            m_rtPushConstants);
+
+      if(b == 0)
+      {
+        cmdBuf.traceRaysKHR(&raygenShaderBindingTable, &missShaderBindingTable,
+                            &hitShaderBindingTable, &callableShaderBindingTable,  //
+                            size.width, size.height, 1);                          //
+      }
+      else
+      {
+        // The sorted header starts with the launch size
+        cmdBuf.traceRaysIndirectKHR(&raygenShaderBindingTable, &missShaderBindingTable,
+                                    &hitShaderBindingTable, &callableShaderBindingTable,
+                                    bounces.sortedBuffer(), 0);
+      }
+
+      // The next launch adds to the radiance of this one
+      cmdBuf.pipelineBarrier(vk::PipelineStageFlagBits::eRayTracingShaderKHR,
+                             vk::PipelineStageFlagBits::eRayTracingShaderKHR
+                                 | vk::PipelineStageFlagBits::eComputeShader,
+                             vk::DependencyFlags(), {radianceBarrier}, {}, {});
+
+      if(b + 1 < m_rtVariant.maxDepth)
+        bounces.cmdSort(cmdBuf);
+    }
+  }
+  bounces.cmdResolve(cmdBuf, sceneConstants.frame, m_rtVariant.nbSamples);
 
   m_debug.endLabel(cmdBuf);
 }
@@ -27,12 +27,25 @@
 
 #include <vulkan/vulkan.hpp>
 
+#include <array>
+#include <map>
+#include <tuple>
+
 #include "nvvk/descriptorsets_vk.hpp"
 #include "vkalloc.hpp"
 
+#include "adaptive.hpp"
+#include "bounce_queue.hpp"
 #include "nvmath/nvmath.h"
 #include "nvvk/raytraceKHR_vk.hpp"
 #include "obj.hpp"
+#include "pipeline_cache.hpp"
+#include "ray_stats.hpp"
+#include "raytrace_builder.hpp"
+#include "retired_resources.hpp"
+#include "sbt_builder.hpp"
+#include "startup_scheduler.hpp"
+#include "temporal.hpp"
 
 class Raytracer
 {
@@ -40,25 +53,151 @@ public:
   void setup(const vk::Device&         device,
              const vk::PhysicalDevice& physicalDevice,
              nvvk::Allocator*          allocator,
-             uint32_t                  queueFamily);
+             uint32_t                  queueFamily,
+             PipelineCache*            pipelineCache,
+             RetiredResources*         retired);
   void destroy();
 
-  nvvk::RaytracingBuilderKHR::Blas objectToVkGeometryKHR(const ObjModel& model);
-  nvvk::RaytracingBuilderKHR::Blas implicitToVkGeometryKHR(const ImplInst& implicitObj);
+  // BLAS build options, to set before createBottomLevelAS
+  void setBlasBuildOptions(bool compact, vk::DeviceSize scratchBudget);
+  // File of the BLAS serialized by a previous launch, see RaytracingBuilder::setBlasCache
+  void setBlasCache(const std::string& filename, uint64_t sceneKey);
+
+  // Level `lod` of the model, the full mesh if null
+  nvvk::RaytracingBuilderKHR::Blas objectToVkGeometryKHR(const ObjModel& model,
+                                                         const ObjLod*   lod = nullptr);
+  nvvk::RaytracingBuilderKHR::Blas implicitToVkGeometryKHR(const ImplInst&    implicitObj,
+                                                           const ImplCluster& cluster);
+  // One BLAS per model, then one per cluster of implicit objects, then one per level of detail
   void createBottomLevelAS(std::vector<ObjModel>& models, ImplInst& implicitObj);
-  void createTopLevelAS(std::vector<ObjInstance>& instances, ImplInst& implicitObj);
-  void createRtDescriptorSet(const vk::ImageView& outputImage);
-  void updateRtDescriptorSet(const vk::ImageView& outputImage);
-  void createRtPipeline(vk::DescriptorSetLayout& sceneDescLayout);
-  void createRtShaderBindingTable();
-  void raytrace(const vk::CommandBuffer& cmdBuf,
-                const nvmath::vec4f&     clearColor,
-                vk::DescriptorSet&       sceneDescSet,
-                vk::Extent2D&            size,
-                ObjPushConstants&        sceneConstants);
+  // The instances use the hit group of the material class of their model
+  void createTopLevelAS(const std::vector<ObjModel>& models,
+                        std::vector<ObjInstance>&    instances,
+                        ImplInst&                    implicitObj);
+  // Indices in ImplInst::clusters of the clusters to refit, once the upload of their objects was
+  // recorded in `cmdBuf`. The TLAS update is staged in the ring slot `frameSlot` of the frame.
+  void cmdRefitImplicitClusters(const vk::CommandBuffer&     cmdBuf,
+                                uint32_t                     frameSlot,
+                                const ImplInst&              implicitObj,
+                                const std::vector<uint32_t>& clusters);
+  vk::AccelerationStructureKHR tlas() const { return m_rtBuilder.getAccelerationStructure(); }
+  // Instance masks: the ray queries of the hybrid renderer only trace the triangles, and only the
+  // camera rays trace the far instances (kMaskSecondary in raycommon.glsl)
+  static const uint32_t kMaskTriangles = 0x01;
+  static const uint32_t kMaskImplicit  = 0x02;
+  static const uint32_t kMaskFar       = 0x04;
+
+  // Camera of the primary rays, selecting the levels of detail
+  struct LodCamera
+  {
+    nvmath::mat4f view;
+    float         tanHalfFovY{1.f};
+    float         aspect{1.f};
+    float         pixelScale{1.f};  // Pixels of one unit at distance 1: height / (2 tanHalfFovY)
+  };
+  struct LodSettings
+  {
+    float pixelError{1.f};     // Largest error on screen of the selected level
+    float tinyPixels{2.f};     // Diameter on screen below which an instance is far
+    float farDistance{1e30f};  // Distance beyond which as well
+  };
+  // Selecting the level of detail and the mask of the instances of the models, returns the number
+  // of instances which changed. The TLAS update is recorded in `cmdBuf`, staged in the ring slot
+  // `frameSlot` of the frame.
+  uint32_t updateInstanceLods(const vk::CommandBuffer&        cmdBuf,
+                              uint32_t                        frameSlot,
+                              const std::vector<ObjModel>&    models,
+                              const std::vector<ObjInstance>& instances,
+                              const LodCamera&                camera,
+                              const LodSettings&              settings);
+
+  void createRtDescriptorSetLayout();
+  // The accumulation image is the output image unless the output has a reduced precision. The
+  // depth guide gets the view depth of the primary hits. The descriptor set is replaced, the
+  // frames in flight may still use the previous one.
+  void updateRtDescriptorSet(const vk::ImageView&       outputImage,
+                             const vk::ImageView&       accumImage,
+                             const vk::ImageView&       depthGuideImage,
+                             const AdaptiveSampler&     adaptive,
+                             const TemporalAccumulator& temporal,
+                             const BounceQueue&         bounces,
+                             const RayStats&            rayStats);
+  // Part of the images traced by the next launches, at most their size. Changing it does not touch
+  // the descriptor set.
+  void setRenderSize(const vk::Extent2D& size) { m_renderSize = size; }
+  // rayTracingIndirectTraceRays feature, without it the pixel list is traced by direct launches
+  // and raytraceWavefront is not available
+  bool indirectTraceRays() const { return m_indirectTraceRays; }
+  // Frames accumulated elsewhere before the first one, offsetting the random sequences: the image
+  // is then the continuation of an accumulation split over several GPUs (HeadlessSettings::split)
+  void setFrameOffset(int offset) { m_frameOffset = offset; }
+  // Shader modules can be loaded concurrently, all of them before createRtPipeline
+  enum RtShader
+  {
+    eRaygen,
+    eMiss,
+    eShadowMiss,
+    eClosestHit,
+    eAnyHit,
+    eClosestHit2,
+    eAnyHit2,
+    eIntersection,
+    eCallPoint,
+    eCallSpot,
+    eCallInf,
+    eCallTriangle,
+    eNbRtShaders
+  };
+  static const char* rtShaderFile(RtShader shader);
+  void               loadRtShader(RtShader shader);
+  void               createRtPipeline(vk::DescriptorSetLayout& sceneDescLayout);
+  void               createRtShaderBindingTable();
+
+  // Values specialized in the ray tracing shaders, each set of values has its own pipeline and SBT
+  struct RtVariant
+  {
+    int nbSamples{5};       // NBSAMPLES: samples per pixel and per frame
+    int maxDepth{10};       // MAX_DEPTH: reflection depth
+    int lightType{-1};      // LIGHT_TYPE: -1 to read the light type from the push constants
+    int separateAccum{0};   // SEPARATE_ACCUM: 1 to write the output apart from the accumulation
+    int packedVertices{0};  // PACKED_VERTICES: 1 if positions and attributes are separate streams
+    int temporal{0};        // TEMPORAL: 1 to write the samples and the motion for temporal.comp
+    int wavefront{0};       // WAVEFRONT: 1 for one launch per bounce, see BounceQueue
+    int rayStats{0};        // RAY_STATS: 1 to count the rays in RayStats
+
+    bool operator<(const RtVariant& o) const
+    {
+      return std::tie(nbSamples, maxDepth, lightType, separateAccum, packedVertices, temporal,
+                      wavefront, rayStats)
+             < std::tie(o.nbSamples, o.maxDepth, o.lightType, o.separateAccum, o.packedVertices,
+                        o.temporal, o.wavefront, o.rayStats);
+    }
+    bool operator==(const RtVariant& o) const { return !(o < *this || *this < o); }
+  };
+  // Variant used by raytrace(), its pipeline is created on first use. Must be called outside of
+  // the recording of a frame, the table of a new variant is uploaded by the next raytrace().
+  void setRtVariant(const RtVariant& variant);
+
+  // `tiles` are the regions of the image to trace, unless adaptive sampling traces a pixel list
+  void raytrace(const vk::CommandBuffer&       cmdBuf,
+                const nvmath::vec4f&           clearColor,
+                vk::DescriptorSet&             sceneDescSet,
+                const std::vector<vk::Rect2D>& tiles,
+                ObjPushConstants&              sceneConstants,
+                const AdaptiveSampler&         adaptive,
+                AdaptiveSampler::Mode          adaptiveMode);
+  // Whole image, one launch per sample and bounce with a WAVEFRONT variant
+  void raytraceWavefront(const vk::CommandBuffer& cmdBuf,
+                         const nvmath::vec4f&     clearColor,
+                         vk::DescriptorSet&       sceneDescSet,
+                         const vk::Extent2D&      size,
+                         ObjPushConstants&        sceneConstants,
+                         BounceQueue&             bounces);
 
 private:
   nvvk::Allocator*   m_alloc{nullptr};  // Allocator for buffer, images, acceleration structures
+  PipelineCache*     m_pipelineCache{nullptr};
+  RetiredResources*  m_retired{nullptr};
   vk::PhysicalDevice m_physicalDevice;
   vk::Device         m_device;
   int                m_graphicsQueueIndex{0};
@@ -66,15 +205,45 @@ private:
 
 
   vk::PhysicalDeviceRayTracingPropertiesKHR           m_rtProperties;
-  nvvk::RaytracingBuilderKHR                          m_rtBuilder;
+  RaytracingBuilder                                   m_rtBuilder;
+  std::vector<nvvk::RaytracingBuilderKHR::Instance>   m_tlasInstances;
+  std::vector<nvmath::vec4f>                          m_instanceSpheres;  // World bounds of models
+  vk::Extent2D                                        m_renderSize;
+  int                                                 m_frameOffset{0};
+  bool                                                m_indirectTraceRays{false};
+  uint32_t                                            m_firstImplicitInstance{0};
+  nvvk::Buffer                                        m_implicitScratch;  // Cluster refits
+  std::vector<vk::DeviceSize>                         m_implicitScratchOffsets;
   nvvk::DescriptorSetBindings                         m_rtDescSetLayoutBind;
   vk::DescriptorPool                                  m_rtDescPool;
   vk::DescriptorSetLayout                             m_rtDescSetLayout;
   vk::DescriptorSet                                   m_rtDescSet;
   std::vector<vk::RayTracingShaderGroupCreateInfoKHR> m_rtShaderGroups;
   vk::PipelineLayout                                  m_rtPipelineLayout;
-  vk::Pipeline                                        m_rtPipeline;
-  nvvk::Buffer                                        m_rtSBTBuffer;
+  vk::Pipeline                                        m_rtPipeline;   // Current variant
+  nvvk::Buffer                                        m_rtSBTBuffer;  // Current variant
+  SbtBuilder                                          m_sbt;          // Layout of the SBT
+  std::array<vk::ShaderModule, eNbRtShaders>          m_rtShaderModules;
+  std::vector<vk::PipelineShaderStageCreateInfo>      m_rtStages;
+  // MaterialClass of the closest-hit stages of m_rtStages, -1 for the other stages
+  std::vector<int> m_rtStageClass;
+
+  // MATERIAL_FEATURES bits of the closest-hit shader, matching raytrace.rchit
+  static const int      kMaterialTextures    = 1;
+  static const int      kMaterialReflections = 2;
+  static const int      kAllMaterialFeatures = kMaterialTextures | kMaterialReflections;
+  static const uint32_t kProceduralHitGroup  = uint32_t(MaterialClass::eNbClasses);
+  static int            materialFeatures(MaterialClass cls);
+
+  struct RtPipelineVariant
+  {
+    vk::Pipeline         pipeline;
+    nvvk::Buffer         sbt;
+    std::vector<uint8_t> pendingSbt;  // Content of `sbt`, until uploaded by bindRtPipeline
+  };
+  RtVariant                              m_rtVariant;
+  std::map<RtVariant, RtPipelineVariant> m_rtVariants;
+  vk::Pipeline                           createRtPipelineVariant(const RtVariant& variant);
 
   struct RtPushConstants
   {
@@ -86,5 +255,20 @@ private:
     float         lightSpotOuterCutoff{deg2rad(17.5f)};
     int           lightType{0};
     int           frame{0};
+    int           adaptive{0};  // AdaptiveSampler::Mode
+    int           tileX{0};     // Offset of the launch in the image
+    int           tileY{0};
+    int           smpl{0};  // Sample and bounce of a wavefront launch
+    int           bounce{0};
+    int           width{0};  // Rendered part of the images
+    int           height{0};
+    int           frameOffset{0};  // See setFrameOffset
   } m_rtPushConstants;
+
+  // Push constants of the frame, and binding the pipeline and the descriptor sets
+  void bindRtPipeline(const vk::CommandBuffer& cmdBuf,
+                      const nvmath::vec4f&     clearColor,
+                      vk::DescriptorSet&       sceneDescSet,
+                      const ObjPushConstants&  sceneConstants,
+                      AdaptiveSampler::Mode    adaptiveMode);
 };
@@ -0,0 +1,125 @@
+/* Copyright (c) 2014-2018, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <functional>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+
+#include "nvvk/descriptorsets_vk.hpp"
+#include "vkalloc.hpp"
+
+//--------------------------------------------------------------------------------------------------
+// Resources replaced while the frames in flight may still use them, such as the render targets
+// when the window grows: their destruction waits for these frames instead of the device
+// - The destructions queued during a frame go to the slot of the frame
+// - beginFrame(), once the fence of the slot is passed, runs the destructions queued the last time
+//   the slot was used. The frames submitted before that one are done as well.
+// - The descriptor sets are replaced rather than rewritten (replaceSet), at most once per frame
+//   and pool. The pools (createPool) hold the current set and one retired set per frame in flight:
+//   beginFrame released the one of the slot of the frame, so a replacement never waits for a set.
+//
+// Usage, setFramesInFlight() before the pools are created, then once per frame:
+//   retired.beginFrame(slot);
+//   if(replacing)
+//   {
+//     retired.destroy(alloc, texture);  // The previous texture, before creating its replacement
+//     retired.replaceSet(device, pool, layout, set);
+//   }
+//
+class RetiredResources
+{
+public:
+  void setFramesInFlight(uint32_t nbFrames) { m_slots.resize(std::max(nbFrames, 1u)); }
+
+  void beginFrame(uint32_t slot)
+  {
+    if(slot >= m_slots.size())
+      m_slots.resize(slot + 1);
+    m_slot = slot;
+    release(m_slots[slot]);
+  }
+
+  void add(std::function<void()> destroy)
+  {
+    if(m_slots.empty())
+      m_slots.resize(1);
+    m_slots[m_slot].push_back(std::move(destroy));
+  }
+
+  // Buffer or texture of the allocator, reset to an empty one
+  template <typename T>
+  void destroy(nvvk::Allocator* alloc, T& resource)
+  {
+    T retired = resource;
+    resource  = T();
+    add([alloc, retired]() mutable { alloc->destroy(retired); });
+  }
+
+  // Pool of the sets of `bindings` replaced by replaceSet
+  vk::DescriptorPool createPool(const nvvk::DescriptorSetBindings& bindings,
+                                const vk::Device&                  device) const
+  {
+    uint32_t maxSets = static_cast<uint32_t>(std::max(m_slots.size(), size_t(1))) + 1;
+    return bindings.createPool(device, maxSets,
+                               vk::DescriptorPoolCreateFlagBits::eFreeDescriptorSet);
+  }
+
+  // New set of `layout` replacing `set`, which may not be allocated yet
+  void replaceSet(const vk::Device&              device,
+                  const vk::DescriptorPool&      pool,
+                  const vk::DescriptorSetLayout& layout,
+                  vk::DescriptorSet&             set)
+  {
+    if(set)
+    {
+      vk::DescriptorSet retired = set;
+      add([device, pool, retired] { device.freeDescriptorSets(pool, retired); });
+    }
+    set = device.allocateDescriptorSets({pool, 1, &layout})[0];
+  }
+
+  // Once the device is idle, before destroying the descriptor pools
+  void releaseAll()
+  {
+    for(auto& s : m_slots)
+      release(s);
+  }
+
+private:
+  static void release(std::vector<std::function<void()>>& destructions)
+  {
+    for(auto& d : destructions)
+      d();
+    destructions.clear();
+  }
+
+  std::vector<std::vector<std::function<void()>>> m_slots;
+  uint32_t                                        m_slot{0};
+};
@@ -0,0 +1,24 @@
+// Rays of the wavefront bounces (see bounce_queue.hpp), matching BounceQueue::Ray and
+// BounceQueue::Header
+
+// Ray continuing a path, traced by the next launch
+struct BounceRay
+{
+  vec3 origin;
+  uint pixel;  // x | y << 16
+  vec3 direction;
+  uint seed;
+  vec3 attenuation;
+};
+
+// The first 3 values are the arguments of traceRaysIndirectKHR, the next ones the arguments of
+// vkCmdDispatchIndirect over the rays
+struct BounceQueueHeader
+{
+  uint count;
+  uint height;
+  uint depth;
+  uint pad0;
+  uvec3 groups;
+  uint  pad1;
+};
@@ -3,6 +3,8 @@
 #extension GL_EXT_nonuniform_qualifier : enable
 #extension GL_GOOGLE_include_directive : enable
 #extension GL_EXT_scalar_block_layout : enable
+#extension GL_EXT_buffer_reference2 : require
+#extension GL_EXT_shader_explicit_arithmetic_types_int64 : require
 
 #include "wavefront.glsl"
 
@@ -29,10 +31,9 @@ layout(location = 4) in vec3 worldPos;
 // Outgoing
 layout(location = 0) out vec4 outColor;
 // Buffers
-layout(binding = 1, scalar) buffer MatColorBufferObject { WaveFrontMaterial m[]; } materials[];
+layout(binding = 1, scalar) buffer ObjDescs { ObjDesc i[]; } objDescs;
 layout(binding = 2, scalar) buffer ScnDesc { sceneDesc i[]; } scnDesc;
 layout(binding = 3) uniform sampler2D[] textureSamplers;
-layout(binding = 4, scalar) buffer MatIndex { int i[]; } matIdx[];
 
 // clang-format on
 
@@ -40,11 +41,12 @@ layout(binding = 4, scalar) buffer MatIndex { int i[]; } matIdx[];
 void main()
 {
   // Object of this instance
-  int objId = scnDesc.i[pushC.instanceId].objId;
+  int     objId = scnDesc.i[pushC.instanceId].objId;
+  ObjDesc desc  = objDescs.i[objId];
 
   // Material of the object
-  int               matIndex = matIdx[objId].i[gl_PrimitiveID];
-  WaveFrontMaterial mat      = materials[objId].m[matIndex];
+  int               matIndex = MatIndices(desc.materialIndexAddress).i[gl_PrimitiveID];
+  WaveFrontMaterial mat      = Materials(desc.materialAddress).m[matIndex];
 
   vec3 N = normalize(fragNormal);
 
@@ -82,9 +84,7 @@ void main()
   vec3 diffuse = computeDiffuse(mat, LightDir, N);
   if(mat.textureId >= 0)
   {
-    int  txtOffset  = scnDesc.i[pushC.instanceId].txtOffset;
-    uint txtId      = txtOffset + mat.textureId;
-    vec3 diffuseTxt = texture(textureSamplers[txtId], fragTexCoord).xyz;
+    vec3 diffuseTxt = texture(textureSamplers[mat.textureId], fragTexCoord).xyz;
     diffuse *= diffuseTxt;
   }
 
@@ -0,0 +1,69 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_EXT_nonuniform_qualifier : enable
+#extension GL_GOOGLE_include_directive : enable
+#extension GL_EXT_scalar_block_layout : enable
+#extension GL_EXT_buffer_reference2 : require
+#extension GL_EXT_shader_explicit_arithmetic_types_int64 : require
+
+#include "random.glsl"
+#include "wavefront.glsl"
+
+
+layout(push_constant) uniform shaderInformation
+{
+  vec3  lightPosition;
+  float lightIntensity;
+  vec3  lightDirection;
+  float lightSpotCutoff;
+  float lightSpotOuterCutoff;
+  uint  instanceId;
+  int   lightType;
+  int   frame;
+}
+pushC;
+
+// clang-format off
+// Incoming
+layout(location = 1) in vec2 fragTexCoord;
+layout(location = 2) in vec3 fragNormal;
+layout(location = 3) in vec3 viewDir;
+layout(location = 4) in vec3 worldPos;
+// Outgoing: G-buffer of the hybrid renderer, see HybridRenderer
+layout(location = 0) out vec4  outPosition;  // World position, w is 1 where there is geometry
+layout(location = 1) out vec4  outNormal;    // World normal
+layout(location = 2) out vec4  outTexColor;  // Diffuse texture, white without texture
+layout(location = 3) out uvec2 outMaterial;  // Instance and triangle, for the material
+// Buffers
+layout(binding = 1, scalar) buffer ObjDescs { ObjDesc i[]; } objDescs;
+layout(binding = 2, scalar) buffer ScnDesc { sceneDesc i[]; } scnDesc;
+layout(binding = 3) uniform sampler2D[] textureSamplers;
+
+// clang-format on
+
+
+void main()
+{
+  // Object of this instance
+  int     objId = scnDesc.i[pushC.instanceId].objId;
+  ObjDesc desc  = objDescs.i[objId];
+
+  // Material of the object
+  int               matIndex = MatIndices(desc.materialIndexAddress).i[gl_PrimitiveID];
+  WaveFrontMaterial mat      = Materials(desc.materialAddress).m[matIndex];
+
+  // Same alpha test as raytrace.rahit, which skips the dissolved hits of the ray traced frames:
+  // the stochastic transparency becomes a screen-door pattern, one random value per pixel
+  uint seed = tea(uint(gl_FragCoord.y) << 16 | uint(gl_FragCoord.x), pushC.frame);
+  if(mat.dissolve == 0.0 || rnd(seed) > mat.dissolve)
+    discard;
+
+  vec3 texColor = vec3(1);
+  if(mat.textureId >= 0)
+    texColor = texture(textureSamplers[mat.textureId], fragTexCoord).xyz;
+
+  outPosition = vec4(worldPos, 1);
+  outNormal   = vec4(normalize(fragNormal), 0);
+  outTexColor = vec4(texColor, 1);
+  outMaterial = uvec2(pushC.instanceId, gl_PrimitiveID);
+}
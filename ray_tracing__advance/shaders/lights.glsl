@@ -0,0 +1,35 @@
+// Lights of the scene and their alias table (see lights.hpp), in the scene descriptor set.
+// Requires raycommon.glsl and random.glsl.
+
+// clang-format off
+layout(binding = 8, set = 1, scalar) buffer Lights { LightDesc l[]; } lights;
+layout(binding = 9, set = 1, scalar) buffer LightAliases { uint count; LightAlias a[]; } aliasTable;
+// clang-format on
+
+// Probability of picking the light of the push constants, when the scene has lights
+const float kPushLightProbability = 0.5;
+
+// Light of a hit: -1 for the light of the push constants, otherwise a light of the scene picked
+// in proportion to its power. `pdf` is the probability of the choice.
+int pickLight(inout uint seed, out float pdf)
+{
+  uint count = aliasTable.count;
+  pdf        = 1.0;
+  if(count == 0 || rnd(seed) < kPushLightProbability)
+  {
+    pdf = count == 0 ? 1.0 : kPushLightProbability;
+    return -1;
+  }
+
+  uint       entry = min(uint(rnd(seed) * float(count)), count - 1);
+  LightAlias alias = aliasTable.a[entry];
+  uint       light = rnd(seed) < alias.threshold ? entry : alias.alias;
+  pdf              = (1.0 - kPushLightProbability) * aliasTable.a[light].pdf;
+  return int(light);
+}
+
+// Callable shader of the light picked for a hit
+int lightCallable(int light, int pushLightType)
+{
+  return light < 0 ? pushLightType : lights.l[light].type;
+}
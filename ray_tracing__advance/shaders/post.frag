@@ -3,16 +3,70 @@ layout(location = 0) in vec2 outUV;
 layout(location = 0) out vec4 fragColor;
 
 layout(set = 0, binding = 0) uniform sampler2D noisyTxt;
+// View depth of the primary hits, at the resolution of noisyTxt
+layout(set = 0, binding = 1) uniform sampler2D depthTxt;
+// Rays traced by each pixel, after the 24 counters of RayStats (see ray_stats.glsl)
+layout(set = 0, binding = 2) readonly buffer RayHeat
+{
+  uint counters[24];
+  uint heat[];
+}
+rayHeat;
 
 layout(push_constant) uniform shaderInformation
 {
   float aspectRatio;
+  int   depthGuided;  // 0: bilinear upsampling
+  int   width;        // Rendered part of the images, which can be larger
+  int   height;
+  float heatmapRays;  // Rays of a pixel at the top of the heatmap, 0 to show the image
 }
 pushc;
 
+// Relative difference of depth halving the weight of a texel
+const float kDepthSigma = 0.02;
+
 void main()
 {
-  vec2  uv    = outUV;
+  ivec2 size = ivec2(pushc.width, pushc.height);
+
+  // Heatmap of the nearest texel: blue for no ray, then green and red
+  if(pushc.heatmapRays > 0.0)
+  {
+    ivec2 texel = clamp(ivec2(outUV * vec2(size)), ivec2(0), size - 1);
+    float rays  = float(rayHeat.heat[texel.y * size.x + texel.x]);
+    float t     = clamp(rays / pushc.heatmapRays, 0.0, 1.0);
+    fragColor   = vec4(smoothstep(0.5, 1.0, t), 1.0 - abs(2.0 * t - 1.0),
+                     1.0 - smoothstep(0.0, 0.5, t), 1.0);
+    return;
+  }
+
+  // The four texels around the pixel, which is a single texel at full resolution
+  vec2  p    = outUV * vec2(size) - 0.5;
+  ivec2 base = ivec2(floor(p));
+  vec2  f    = p - vec2(base);
+
+  // Edge aware: the texels on another surface than the nearest one are mostly ignored
+  float refDepth = texelFetch(depthTxt, clamp(ivec2(floor(p + 0.5)), ivec2(0), size - 1), 0).x;
+
+  vec4  color   = vec4(0);
+  float weights = 0.0;
+  for(int i = 0; i < 4; i++)
+  {
+    ivec2 offset = ivec2(i & 1, i >> 1);
+    ivec2 texel  = clamp(base + offset, ivec2(0), size - 1);
+    vec2  w2     = mix(1.0 - f, f, vec2(offset));
+    float w      = w2.x * w2.y;
+    if(pushc.depthGuided == 1)
+    {
+      float depth = texelFetch(depthTxt, texel, 0).x;
+      w *= 1.0 / (1.0 + abs(depth - refDepth) / (max(refDepth, 1e-4) * kDepthSigma));
+    }
+    color += texelFetch(noisyTxt, texel, 0) * w;
+    weights += w;
+  }
+  color /= max(weights, 1e-6);
+
   float gamma = 1. / 2.2;
-  fragColor   = pow(texture(noisyTxt, uv).rgba, vec4(gamma));
+  fragColor   = pow(color, vec4(gamma));
 }
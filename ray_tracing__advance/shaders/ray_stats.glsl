@@ -0,0 +1,33 @@
+// Ray statistics of the RAY_STATS variants (see ray_stats.hpp), the counters matching
+// RayStats::Counters. Without RAY_STATS, the counting is removed with the dead code.
+
+layout(constant_id = 8) const int RAY_STATS = 0;
+
+const int kRayStatsDepths = 16;
+
+struct RayStatsCounters
+{
+  uint primaryRays;
+  uint bounceRays;
+  uint shadowRays;
+  uint anyHits;
+  uint ignoredHits;
+  uint pad0;
+  uint pad1;
+  uint pad2;
+  uint depths[kRayStatsDepths];  // Paths by number of bounces
+};
+
+// The counters of the frame, then the rays of each pixel in the last frame which traced it
+layout(binding = 10, set = 0) buffer RayStatsBuffer
+{
+  RayStatsCounters counters;
+  uint             heat[];
+}
+rayStats;
+
+// Path which ended after `bounces` reflections
+void rayStatsPathEnd(int bounces)
+{
+  atomicAdd(rayStats.counters.depths[min(bounces, kRayStatsDepths - 1)], 1u);
+}
@@ -1,12 +1,19 @@
+// Instance masks of the traced rays: the far instances (Raytracer::kMaskFar) are only traced by
+// the camera rays
+const uint kMaskPrimary   = 0xFF;
+const uint kMaskSecondary = 0xFF & ~0x04;
+
 struct hitPayload
 {
-  vec3 hitValue;
-  uint seed;
-  int  depth;
-  vec3 attenuation;
-  int  done;
-  vec3 rayOrigin;
-  vec3 rayDir;
+  vec3  hitValue;
+  uint  seed;
+  int   depth;
+  vec3  attenuation;
+  int   done;
+  vec3  rayOrigin;
+  vec3  rayDir;
+  float hitT;        // Distance of the hit, negative on a miss
+  uint  shadowRays;  // Traced by the closest hit, counted by the RAY_STATS variants
 };
 
 
@@ -16,6 +23,32 @@ struct rayLight
   float outLightDistance;
   vec3  outLightDir;
   float outIntensity;
+  vec3  outColor;
+  int   inLightIndex;  // Light of the scene, -1 for the light of the push constants
+  vec2  inRandom;      // Point sampled on an area light
+};
+
+// Light of the scene, see lights.hpp. The emissive triangles have their vertices in position,
+// direction and vertex2, and their emission in color.
+struct LightDesc
+{
+  vec3  position;
+  int   type;
+  vec3  direction;
+  float intensity;
+  vec3  color;
+  float spotCutoff;
+  vec3  vertex2;
+  float spotOuterCutoff;
+};
+
+// Entry of the alias table of the lights: `threshold` is the probability of keeping the entry
+// instead of its alias, `pdf` the probability of picking the light of the entry
+struct LightAlias
+{
+  float threshold;
+  float pdf;
+  uint  alias;
 };
 
 struct Implicit
@@ -1,6 +1,8 @@
 #version 450
 #extension GL_ARB_separate_shader_objects : enable
 #extension GL_EXT_scalar_block_layout : enable
+#extension GL_EXT_buffer_reference2 : require
+#extension GL_EXT_shader_explicit_arithmetic_types_int64 : require
 #extension GL_GOOGLE_include_directive : enable
 
 #include "wavefront.glsl"
@@ -34,6 +36,9 @@ layout(location = 1) in vec3 inNormal;
 layout(location = 2) in vec3 inColor;
 layout(location = 3) in vec2 inTexCoord;
 
+// Specialized by the application, 1 when the normal is fetched in octahedral encoding
+layout(constant_id = 0) const int PACKED_VERTICES = 0;
+
 
 //layout(location = 0) flat out int matIndex;
 layout(location = 1) out vec2 fragTexCoord;
@@ -49,15 +54,15 @@ out gl_PerVertex
 
 void main()
 {
-  mat4 objMatrix   = scnDesc.i[pushC.instanceId].transfo;
-  mat4 objMatrixIT = scnDesc.i[pushC.instanceId].transfoIT;
+  vec4 transfo[3] = scnDesc.i[pushC.instanceId].transfo;
+  vec3 normal     = PACKED_VERTICES == 0 ? inNormal : decodeOctahedral(inNormal.xy);
 
   vec3 origin = vec3(ubo.viewI * vec4(0, 0, 0, 1));
 
-  worldPos     = vec3(objMatrix * vec4(inPosition, 1.0));
+  worldPos     = sceneTransformPoint(transfo, inPosition);
   viewDir      = vec3(worldPos - origin);
   fragTexCoord = inTexCoord;
-  fragNormal   = vec3(objMatrixIT * vec4(inNormal, 0.0));
+  fragNormal   = sceneTransformNormal(transfo, normal);
   //  matIndex     = inMatID;
 
   gl_Position = ubo.proj * ubo.view * vec4(worldPos, 1.0);
@@ -6,6 +6,34 @@ struct Vertex
   vec2 texCoord;
 };
 
+// Quantized attributes of a vertex, the position being in a separate stream
+struct VertexAttrib
+{
+  uint normal;    // Octahedral encoding, 2x snorm16
+  uint color;     // RGBA, 4x unorm8
+  uint texCoord;  // 2x half float
+};
+
+// Octahedral encoding to unit vector, the lower half of the octahedron is folded over the upper one
+vec3 decodeOctahedral(vec2 e)
+{
+  vec3  n = vec3(e.xy, 1.0 - abs(e.x) - abs(e.y));
+  float t = max(-n.z, 0.0);
+  n.x += n.x >= 0.0 ? -t : t;
+  n.y += n.y >= 0.0 ? -t : t;
+  return normalize(n);
+}
+
+Vertex unpackVertex(vec3 pos, VertexAttrib attrib)
+{
+  Vertex v;
+  v.pos      = pos;
+  v.nrm      = decodeOctahedral(unpackSnorm2x16(attrib.normal));
+  v.color    = unpackUnorm4x8(attrib.color).rgb;
+  v.texCoord = unpackHalf2x16(attrib.texCoord);
+  return v;
+}
+
 struct WaveFrontMaterial
 {
   vec3  ambient;
@@ -20,14 +48,64 @@ struct WaveFrontMaterial
   int   textureId;
 };
 
+// Device addresses of the data of an object, the last one only has the materials of the implicits
+struct ObjDesc
+{
+  uint64_t vertexAddress;         // Vertex, or positions with packed vertices
+  uint64_t attribAddress;         // VertexAttrib with packed vertices
+  uint64_t indexAddress;          // 16 or 32-bit indices
+  uint64_t materialAddress;       // WaveFrontMaterial
+  uint64_t materialIndexAddress;  // Material of each triangle
+  uint     firstAlphaTriangle;    // First triangle of the alpha-tested geometry of the BLAS
+  uint     firstImplicit;         // First object of an implicit cluster
+};
+
+// Triangle of the object from the geometry and primitive index of a hit: the BLAS has the opaque
+// triangles, then the alpha-tested ones in a second geometry
+uint objTriangle(ObjDesc desc, uint geometryIndex, uint primitiveId)
+{
+  return primitiveId + (geometryIndex != 0 ? desc.firstAlphaTriangle : 0);
+}
+
+// clang-format off
+layout(buffer_reference, scalar) buffer Vertices { Vertex v[]; };
+layout(buffer_reference, scalar) buffer Positions { vec3 p[]; };
+layout(buffer_reference, scalar) buffer Attributes { VertexAttrib a[]; };
+layout(buffer_reference, scalar) buffer Indices { uint i[]; };
+layout(buffer_reference, scalar) buffer Materials { WaveFrontMaterial m[]; };
+layout(buffer_reference, scalar) buffer MatIndices { int i[]; };
+// clang-format on
+
+// Instance of the scene, 64 bytes so an instance never straddles two cache lines
 struct sceneDesc
 {
+  vec4 transfo[3];  // Rows of the 3x4 object to world matrix
   int  objId;
-  int  txtOffset;
-  mat4 transfo;
-  mat4 transfoIT;
+  int  index16;  // 1 if the indices of the object are 16-bit
+  int  padding0;
+  int  padding1;
 };
 
+// Object to world transformation of a position
+vec3 sceneTransformPoint(vec4 transfo[3], vec3 pos)
+{
+  vec4 p = vec4(pos, 1.0);
+  return vec3(dot(transfo[0], p), dot(transfo[1], p), dot(transfo[2], p));
+}
+
+// Object to world transformation of a normal, the result is not normalized
+// The cofactor matrix of the 3x3 part replaces the inverse transpose: they only differ by the
+// determinant, which only matters through its sign once the normal is normalized.
+vec3 sceneTransformNormal(vec4 transfo[3], vec3 nrm)
+{
+  vec3 c0  = vec3(transfo[0].x, transfo[1].x, transfo[2].x);
+  vec3 c1  = vec3(transfo[0].y, transfo[1].y, transfo[2].y);
+  vec3 c2  = vec3(transfo[0].z, transfo[1].z, transfo[2].z);
+  vec3 c12 = cross(c1, c2);
+  vec3 n   = nrm.x * c12 + nrm.y * cross(c2, c0) + nrm.z * cross(c0, c1);
+  return dot(c0, c12) < 0.0 ? -n : n;
+}
+
 
 vec3 computeDiffuse(WaveFrontMaterial mat, vec3 lightDir, vec3 normal)
 {
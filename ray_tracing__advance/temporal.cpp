@@ -0,0 +1,198 @@
+/* Copyright (c) 2014-2018, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "temporal.hpp"
+#include "nvh/fileoperations.hpp"
+#include "nvvk/commands_vk.hpp"
+#include "nvvk/images_vk.hpp"
+#include "nvvk/shaders_vk.hpp"
+
+extern std::vector<std::string> defaultSearchPaths;
+
+//////////////////////////////////////////////////////////////////////////
+// Temporal accumulation
+//////////////////////////////////////////////////////////////////////////
+
+void TemporalAccumulator::setup(const vk::Device& device,
+                                nvvk::Allocator*  allocator,
+                                uint32_t          queueFamily,
+                                PipelineCache*    pipelineCache,
+                                RetiredResources* retired)
+{
+  m_device             = device;
+  m_alloc              = allocator;
+  m_graphicsQueueIndex = queueFamily;
+  m_pipelineCache      = pipelineCache;
+  m_retired            = retired;
+  m_debug.setup(m_device);
+}
+
+void TemporalAccumulator::destroy()
+{
+  m_device.destroy(m_pipeline);
+  m_device.destroy(m_pipelineLayout);
+  m_device.destroy(m_descPool);
+  m_device.destroy(m_dsetLayout);
+  m_alloc->destroy(m_motionTexture);
+  for(auto& t : m_historyTextures)
+    m_alloc->destroy(t);
+  for(auto& t : m_depthTextures)
+    m_alloc->destroy(t);
+}
+
+nvvk::Texture TemporalAccumulator::createStorageImage(vk::Format format, const char* name)
+{
+  auto createInfo = nvvk::makeImage2DCreateInfo(m_size, format, vk::ImageUsageFlagBits::eStorage);
+  nvvk::Image             image   = m_alloc->createImage(createInfo);
+  vk::ImageViewCreateInfo ivInfo  = nvvk::makeImageViewCreateInfo(image.image, createInfo);
+  nvvk::Texture           texture = m_alloc->createTexture(image, ivInfo);
+  texture.descriptor.imageLayout  = VK_IMAGE_LAYOUT_GENERAL;
+  m_debug.setObjectName(texture.image, name);
+  return texture;
+}
+
+//--------------------------------------------------------------------------------------------------
+// Motion image, and the two history and depth images, of the size of the rendering
+//
+void TemporalAccumulator::createResources(const vk::Extent2D& size, const vk::CommandBuffer& cmdBuf)
+{
+  m_retired->destroy(m_alloc, m_motionTexture);
+  for(auto& t : m_historyTextures)
+    m_retired->destroy(m_alloc, t);
+  for(auto& t : m_depthTextures)
+    m_retired->destroy(m_alloc, t);
+  m_size = size;
+
+  m_motionTexture      = createStorageImage(vk::Format::eR32G32B32A32Sfloat, "TemporalMotion");
+  m_historyTextures[0] = createStorageImage(vk::Format::eR32G32B32A32Sfloat, "TemporalHistory0");
+  m_historyTextures[1] = createStorageImage(vk::Format::eR32G32B32A32Sfloat, "TemporalHistory1");
+  m_depthTextures[0]   = createStorageImage(vk::Format::eR32Sfloat, "TemporalDepth0");
+  m_depthTextures[1]   = createStorageImage(vk::Format::eR32Sfloat, "TemporalDepth1");
+
+  for(auto* t : {&m_motionTexture, &m_historyTextures[0], &m_historyTextures[1],
+                 &m_depthTextures[0], &m_depthTextures[1]})
+    nvvk::cmdBarrierImageLayout(cmdBuf, t->image, vk::ImageLayout::eUndefined,
+                                vk::ImageLayout::eGeneral);
+}
+
+//--------------------------------------------------------------------------------------------------
+// Compute pipeline reprojecting the history and blending the frame in it
+//
+void TemporalAccumulator::createPipeline(bool separateAccum)
+{
+  using vkDS = vk::DescriptorSetLayoutBinding;
+  using vkDT = vk::DescriptorType;
+  using vkSS = vk::ShaderStageFlagBits;
+
+  // Frame (0), motion (1), histories (2), depths (3) and reduced precision output (4)
+  m_dsetLayoutBinding.addBinding(vkDS(0, vkDT::eStorageImage, 1, vkSS::eCompute));
+  m_dsetLayoutBinding.addBinding(vkDS(1, vkDT::eStorageImage, 1, vkSS::eCompute));
+  m_dsetLayoutBinding.addBinding(vkDS(2, vkDT::eStorageImage, 2, vkSS::eCompute));
+  m_dsetLayoutBinding.addBinding(vkDS(3, vkDT::eStorageImage, 2, vkSS::eCompute));
+  m_dsetLayoutBinding.addBinding(vkDS(4, vkDT::eStorageImage, 1, vkSS::eCompute));
+  m_dsetLayout = m_dsetLayoutBinding.createLayout(m_device);
+  m_descPool   = m_retired->createPool(m_dsetLayoutBinding, m_device);
+
+  vk::PushConstantRange        pushConstant{vkSS::eCompute, 0, sizeof(PushConstant)};
+  vk::PipelineLayoutCreateInfo layoutInfo{{}, 1, &m_dsetLayout, 1, &pushConstant};
+  m_pipelineLayout = m_device.createPipelineLayout(layoutInfo);
+
+  // SEPARATE_ACCUM: the result is also written to the reduced precision output image
+  int                        separate = separateAccum ? 1 : 0;
+  vk::SpecializationMapEntry specEntry{0, 0, sizeof(int)};
+  vk::SpecializationInfo     specInfo{1, &specEntry, sizeof(int), &separate};
+
+  vk::ComputePipelineCreateInfo computePipelineCreateInfo{{}, {}, m_pipelineLayout};
+  computePipelineCreateInfo.stage = nvvk::createShaderStageInfo(
+      m_device, nvh::loadFile("shaders/temporal.comp.spv", true, defaultSearchPaths),
+      VK_SHADER_STAGE_COMPUTE_BIT);
+  computePipelineCreateInfo.stage.setPSpecializationInfo(&specInfo);
+  {
+    PipelineCache::Timer timer(*m_pipelineCache, "temporal accumulation");
+    m_pipeline =
+        m_device.createComputePipeline(m_pipelineCache->get(), computePipelineCreateInfo, nullptr);
+  }
+  m_device.destroy(computePipelineCreateInfo.stage.module);
+  m_debug.setObjectName(m_pipeline, "TemporalAccumulation");
+}
+
+//--------------------------------------------------------------------------------------------------
+// Writes the images to a new descriptor set
+// - Required when changing resolution
+//
+void TemporalAccumulator::updateDescriptorSet(const vk::ImageView& outputImage,
+                                              const vk::ImageView& accumImage)
+{
+  m_retired->replaceSet(m_device, m_descPool, m_dsetLayout, m_dset);
+  vk::DescriptorImageInfo                accumInfo{{}, accumImage, vk::ImageLayout::eGeneral};
+  vk::DescriptorImageInfo                imageInfo{{}, outputImage, vk::ImageLayout::eGeneral};
+  std::array<vk::DescriptorImageInfo, 2> historyInfos{m_historyTextures[0].descriptor,
+                                                      m_historyTextures[1].descriptor};
+  std::array<vk::DescriptorImageInfo, 2> depthInfos{m_depthTextures[0].descriptor,
+                                                    m_depthTextures[1].descriptor};
+
+  std::vector<vk::WriteDescriptorSet> writes;
+  writes.emplace_back(m_dsetLayoutBinding.makeWrite(m_dset, 0, &accumInfo));
+  writes.emplace_back(m_dsetLayoutBinding.makeWrite(m_dset, 1, &m_motionTexture.descriptor));
+  writes.emplace_back(m_dsetLayoutBinding.makeWriteArray(m_dset, 2, historyInfos.data()));
+  writes.emplace_back(m_dsetLayoutBinding.makeWriteArray(m_dset, 3, depthInfos.data()));
+  writes.emplace_back(m_dsetLayoutBinding.makeWrite(m_dset, 4, &imageInfo));
+  m_device.updateDescriptorSets(static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
+}
+
+//--------------------------------------------------------------------------------------------------
+// Blending the samples traced by this frame in the reprojected history
+//
+void TemporalAccumulator::cmdAccumulate(const vk::CommandBuffer& cmdBuf, int frame, int maxFrames)
+{
+  using vkAF = vk::AccessFlagBits;
+  using vkPS = vk::PipelineStageFlagBits;
+
+  m_debug.beginLabel(cmdBuf, "Temporal accumulation");
+
+  // The ray tracing wrote the frame and the motion
+  vk::MemoryBarrier rtToTemporal{vkAF::eShaderWrite, vkAF::eShaderRead | vkAF::eShaderWrite};
+  cmdBuf.pipelineBarrier(vkPS::eRayTracingShaderKHR, vkPS::eComputeShader, {}, rtToTemporal, {},
+                         {});
+
+  m_current = 1 - m_current;
+  PushConstant pushC{m_current, frame, maxFrames, m_depthTolerance, static_cast<int>(m_size.width),
+                     static_cast<int>(m_size.height)};
+  cmdBuf.bindPipeline(vk::PipelineBindPoint::eCompute, m_pipeline);
+  cmdBuf.bindDescriptorSets(vk::PipelineBindPoint::eCompute, m_pipelineLayout, 0, m_dset, {});
+  cmdBuf.pushConstants<PushConstant>(m_pipelineLayout, vk::ShaderStageFlagBits::eCompute, 0,
+                                     pushC);
+  cmdBuf.dispatch((m_size.width + 15) / 16, (m_size.height + 15) / 16, 1);
+
+  // The result is displayed by the post pass, and the images are written again by the next frame
+  vk::MemoryBarrier temporalToNext{vkAF::eShaderWrite, vkAF::eShaderRead | vkAF::eShaderWrite};
+  cmdBuf.pipelineBarrier(vkPS::eComputeShader,
+                         vkPS::eFragmentShader | vkPS::eRayTracingShaderKHR | vkPS::eTransfer,
+                         {}, temporalToNext, {}, {});
+
+  m_debug.endLabel(cmdBuf);
+}
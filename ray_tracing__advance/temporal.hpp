@@ -0,0 +1,110 @@
+/* Copyright (c) 2014-2018, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <array>
+#include <vulkan/vulkan.hpp>
+
+#include "nvvk/debug_util_vk.hpp"
+#include "nvvk/descriptorsets_vk.hpp"
+#include "pipeline_cache.hpp"
+#include "retired_resources.hpp"
+#include "vkalloc.hpp"
+
+//--------------------------------------------------------------------------------------------------
+// Temporal accumulation, surviving camera motion
+// - The ray generation shader (TEMPORAL) writes the samples of the frame in the accumulation image,
+//   and in the motion image the offset of each pixel to its position in the previous frame, its
+//   depth, and the depth it had in the previous view
+// - cmdAccumulate() reprojects the history of the previous frame, rejects it where the previous
+//   frame saw another surface (disocclusion) or nothing, and blends the new samples in it. Each
+//   pixel keeps its own history length, capped at maxFrames.
+// - The history and the depth are in two images each, alternately read and written
+//
+class TemporalAccumulator
+{
+public:
+  void setup(const vk::Device& device,
+             nvvk::Allocator*  allocator,
+             uint32_t          queueFamily,
+             PipelineCache*    pipelineCache,
+             RetiredResources* retired);
+  void destroy();
+
+  // The layouts of the images are set in `cmdBuf`, before their first use. The frames in flight
+  // may still use the previous images, they are retired.
+  void createResources(const vk::Extent2D& size, const vk::CommandBuffer& cmdBuf);
+  void createPipeline(bool separateAccum);
+  // Part of the histories accumulated by the next frames, at most the size of createResources
+  void setRenderSize(const vk::Extent2D& size) { m_size = size; }
+  // The accumulation image has the samples of the frame, and gets the result as well as the
+  // output image when it has a reduced precision. The descriptor set is replaced.
+  void updateDescriptorSet(const vk::ImageView& outputImage, const vk::ImageView& accumImage);
+
+  // Relative difference of depth above which the history of a pixel is rejected
+  void setDepthTolerance(float tolerance) { m_depthTolerance = tolerance; }
+
+  // `frame` 0 drops the histories
+  void cmdAccumulate(const vk::CommandBuffer& cmdBuf, int frame, int maxFrames);
+
+  const nvvk::Texture& motionTexture() const { return m_motionTexture; }
+
+private:
+  struct PushConstant
+  {
+    int   current;  // History and depth images written by this frame
+    int   frame;
+    int   maxFrames;
+    float depthTolerance;
+    int   width;
+    int   height;
+  };
+
+  nvvk::Texture createStorageImage(vk::Format format, const char* name);
+
+  nvvk::DescriptorSetBindings m_dsetLayoutBinding;
+  vk::DescriptorPool          m_descPool;
+  vk::DescriptorSetLayout     m_dsetLayout;
+  vk::DescriptorSet           m_dset;
+  vk::Pipeline                m_pipeline;
+  vk::PipelineLayout          m_pipelineLayout;
+
+  nvvk::Texture                m_motionTexture;    // Motion in pixels, depth, previous depth
+  std::array<nvvk::Texture, 2> m_historyTextures;  // Color, number of frames
+  std::array<nvvk::Texture, 2> m_depthTextures;    // Depth of the history
+  vk::Extent2D                 m_size;
+  int                          m_current{0};
+  float                        m_depthTolerance{0.05f};
+
+  nvvk::Allocator*  m_alloc{nullptr};  // Allocator for buffer, images, acceleration structures
+  PipelineCache*    m_pipelineCache{nullptr};
+  RetiredResources* m_retired{nullptr};
+  vk::Device        m_device;
+  int               m_graphicsQueueIndex{0};
+  nvvk::DebugUtil   m_debug;  // Utility to name objects
+};
@@ -0,0 +1,692 @@
+/* Copyright (c) 2014-2018, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <cstring>
+
+#include "fileformats/stb_image.h"
+#include "nvh/fileoperations.hpp"
+#include "nvh/nvprint.hpp"
+#include "nvvk/commands_vk.hpp"
+#include "nvvk/images_vk.hpp"
+#include "nvvk/shaders_vk.hpp"
+#include "texture_streamer.hpp"
+#include "threadpool.hpp"
+
+extern std::vector<std::string> defaultSearchPaths;
+
+// Offsets of the levels in the staging buffer are multiples of the texel block size and of 4, as
+// required by vkCmdCopyBufferToImage: the least common multiple, for blocks of 3, 6 or 12 bytes too
+static vk::DeviceSize alignLevel(vk::DeviceSize offset, uint32_t blockBytes)
+{
+  vk::DeviceSize alignment = blockBytes * (blockBytes % 4 == 0 ? 1 : (blockBytes % 2 == 0 ? 2 : 4));
+  return (offset + alignment - 1) / alignment * alignment;
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Texture streaming
+//////////////////////////////////////////////////////////////////////////
+
+void TextureStreamer::setup(const vk::Device&         device,
+                            const vk::PhysicalDevice& physicalDevice,
+                            nvvk::Allocator*          allocator,
+                            uint32_t                  queueFamily,
+                            PipelineCache*            pipelineCache)
+{
+  m_device         = device;
+  m_physicalDevice = physicalDevice;
+  m_alloc          = allocator;
+  m_pipelineCache  = pipelineCache;
+  m_queue          = m_device.getQueue(queueFamily, 0);
+  m_cmdPool = m_device.createCommandPool({vk::CommandPoolCreateFlagBits::eTransient, queueFamily});
+  m_debug.setup(m_device);
+  createCompressPipeline();
+
+  // 1x1 white texture, bound in place of the textures not yet resident
+  TextureData tex;
+  tex.name   = "placeholder";
+  tex.format = vk::Format::eR8G8B8A8Srgb;
+  tex.extent = vk::Extent2D(1, 1);
+  tex.data   = {255u, 255u, 255u, 255u};
+  tex.levelOffsets.push_back(0);
+
+  nvvk::Buffer staging =
+      m_alloc->createBuffer(tex.data.size(), vk::BufferUsageFlagBits::eTransferSrc,
+                            vk::MemoryPropertyFlagBits::eHostVisible
+                                | vk::MemoryPropertyFlagBits::eHostCoherent);
+  memcpy(m_alloc->map(staging), tex.data.data(), tex.data.size());
+  m_alloc->unmap(staging);
+
+  nvvk::CommandPool cmdGen(m_device, queueFamily);
+  vk::CommandBuffer cmdBuf = cmdGen.createCommandBuffer();
+  m_placeholder            = createTexture(cmdBuf, tex, staging.buffer, 0);
+  cmdGen.submitAndWait(cmdBuf);
+  m_alloc->destroy(staging);
+  MemoryStats::shared().add(MemoryCategory::eTexture,
+                            MemoryStats::sizeOf(m_device, m_placeholder.image));
+}
+
+void TextureStreamer::destroy()
+{
+  // Decoding jobs only touch their own data
+  for(auto& d : m_decoding)
+    d.data.wait();
+  m_decoding.clear();
+
+  if(m_batch.fence)
+  {
+    m_device.waitForFences(m_batch.fence, VK_TRUE, UINT64_MAX);
+    for(auto& r : m_batch.textures)
+      destroyTexture(r.texture);
+    m_device.destroy(m_batch.fence);
+    destroyStaging();
+    m_batch = Batch();
+  }
+
+  destroyTexture(m_placeholder);
+  m_device.destroy(m_cmdPool);
+  m_device.destroy(m_compressPipeline);
+  m_device.destroy(m_compressLayout);
+  m_device.destroy(m_compressDescLayout);
+}
+
+//--------------------------------------------------------------------------------------------------
+// Compute pipeline encoding the blocks of a level, if the device can sample the BC formats
+//
+void TextureStreamer::createCompressPipeline()
+{
+  using vkDS = vk::DescriptorSetLayoutBinding;
+  using vkDT = vk::DescriptorType;
+  using vkSS = vk::ShaderStageFlagBits;
+
+  auto sampled = [&](vk::Format format) {
+    return bool(m_physicalDevice.getFormatProperties(format).optimalTilingFeatures
+                & vk::FormatFeatureFlagBits::eSampledImage);
+  };
+  if(!m_physicalDevice.getFeatures().textureCompressionBC
+     || !sampled(vk::Format::eBc1RgbaSrgbBlock) || !sampled(vk::Format::eBc3SrgbBlock))
+  {
+    LOGI("Texture streaming: BC1 and BC3 are not supported, the textures stay uncompressed\n");
+    return;
+  }
+
+  m_compressBind.addBinding(vkDS(0, vkDT::eCombinedImageSampler, 1, vkSS::eCompute));
+  m_compressBind.addBinding(vkDS(1, vkDT::eStorageBuffer, 1, vkSS::eCompute));
+  m_compressDescLayout = m_compressBind.createLayout(m_device);
+
+  vk::PushConstantRange        pushConstant{vkSS::eCompute, 0, sizeof(CompressPushConstant)};
+  vk::PipelineLayoutCreateInfo layoutInfo{{}, 1, &m_compressDescLayout, 1, &pushConstant};
+  m_compressLayout = m_device.createPipelineLayout(layoutInfo);
+
+  vk::ComputePipelineCreateInfo computePipelineCreateInfo{{}, {}, m_compressLayout};
+  computePipelineCreateInfo.stage = nvvk::createShaderStageInfo(
+      m_device, nvh::loadFile("shaders/bc_compress.comp.spv", true, defaultSearchPaths),
+      VK_SHADER_STAGE_COMPUTE_BIT);
+  {
+    PipelineCache::Timer timer(*m_pipelineCache, "block compression");
+    m_compressPipeline =
+        m_device.createComputePipeline(m_pipelineCache->get(), computePipelineCreateInfo, nullptr);
+  }
+  m_device.destroy(computePipelineCreateInfo.stage.module);
+  m_debug.setObjectName(m_compressPipeline, "BlockCompression");
+  m_compress = true;
+}
+
+// 8-bit textures whose mips are generated, the stored formats are uploaded as they are
+bool TextureStreamer::compressible(const TextureData& tex) const
+{
+  return m_compress && tex.generateMips && tex.format == vk::Format::eR8G8B8A8Srgb;
+}
+
+//--------------------------------------------------------------------------------------------------
+// Decoding the file in the background, the texture is returned by update() once uploaded
+//
+void TextureStreamer::request(uint32_t slot, const std::string& filename)
+{
+  Decoding decoding;
+  decoding.slot = slot;
+  decoding.data = ThreadPool::shared().push([filename] { return decode(filename); });
+  m_decoding.emplace_back(std::move(decoding));
+}
+
+//--------------------------------------------------------------------------------------------------
+// Returning the textures of the finished batch, and submitting the next one
+// - Only one batch is in flight, so decoded data waits on the host rather than in staging memory
+//
+std::vector<TextureStreamer::Resident> TextureStreamer::update()
+{
+  std::vector<Resident> resident;
+  if(m_batch.fence && m_device.getFenceStatus(m_batch.fence) == vk::Result::eSuccess)
+  {
+    resident = std::move(m_batch.textures);
+    m_device.destroy(m_batch.fence);
+    m_device.freeCommandBuffers(m_cmdPool, m_batch.cmdBuf);
+    destroyStaging();
+    m_batch = Batch();
+  }
+
+  if(!m_batch.fence)
+  {
+    std::vector<std::pair<uint32_t, TextureData>> ready;
+    vk::DeviceSize                                 bytes = 0;
+    for(auto it = m_decoding.begin(); it != m_decoding.end() && bytes < kBatchBytes;)
+    {
+      if(it->data.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+      {
+        ++it;
+        continue;
+      }
+      ready.emplace_back(it->slot, it->data.get());
+      bytes += ready.back().second.data.size();
+      it = m_decoding.erase(it);
+    }
+    if(!ready.empty())
+      submitBatch(ready);
+  }
+  return resident;
+}
+
+void TextureStreamer::submitBatch(std::vector<std::pair<uint32_t, TextureData>>& ready)
+{
+  vk::DeviceSize stagingSize  = 0;
+  uint32_t       nbCompressed = 0;
+  for(auto& r : ready)
+  {
+    vk::FormatFeatureFlags features =
+        m_physicalDevice.getFormatProperties(r.second.format).optimalTilingFeatures;
+    if(!(features & vk::FormatFeatureFlagBits::eSampledImage))
+    {
+      LOGW("Texture %s: format %s is not supported\n", r.second.name.c_str(),
+           vk::to_string(r.second.format).c_str());
+      makeFallback(r.second);
+    }
+    stagingSize = alignLevel(stagingSize, r.second.blockBytes) + r.second.data.size();
+    nbCompressed += compressible(r.second) ? 1 : 0;
+  }
+  if(nbCompressed > 0)
+    m_batch.descPool = m_compressBind.createPool(m_device, nbCompressed);
+
+  m_batch.staging = m_alloc->createBuffer(stagingSize, vk::BufferUsageFlagBits::eTransferSrc,
+                                          vk::MemoryPropertyFlagBits::eHostVisible
+                                              | vk::MemoryPropertyFlagBits::eHostCoherent);
+  MemoryStats::shared().add(MemoryCategory::eStaging,
+                            MemoryStats::sizeOf(m_device, m_batch.staging.buffer));
+  uint8_t* mapped = reinterpret_cast<uint8_t*>(m_alloc->map(m_batch.staging));
+
+  m_batch.cmdBuf =
+      m_device.allocateCommandBuffers({m_cmdPool, vk::CommandBufferLevel::ePrimary, 1})[0];
+  m_batch.cmdBuf.begin({vk::CommandBufferUsageFlagBits::eOneTimeSubmit});
+  vk::DeviceSize offset = 0;
+  for(auto& r : ready)
+  {
+    offset = alignLevel(offset, r.second.blockBytes);
+    memcpy(mapped + offset, r.second.data.data(), r.second.data.size());
+    nvvk::Texture texture = createTexture(m_batch.cmdBuf, r.second, m_batch.staging.buffer, offset);
+    m_debug.setObjectName(texture.image, r.second.name.c_str());
+    MemoryStats::shared().add(MemoryCategory::eTexture,
+                              MemoryStats::sizeOf(m_device, texture.image));
+    m_batch.textures.push_back({r.first, texture});
+    offset += r.second.data.size();
+  }
+  m_batch.cmdBuf.end();
+  m_alloc->unmap(m_batch.staging);
+
+  m_batch.fence = m_device.createFence({});
+  vk::SubmitInfo submitInfo;
+  submitInfo.setCommandBufferCount(1);
+  submitInfo.setPCommandBuffers(&m_batch.cmdBuf);
+  m_queue.submit(submitInfo, m_batch.fence);
+}
+
+//--------------------------------------------------------------------------------------------------
+// Recording the copy of the stored levels, and the generation of the others if needed
+//
+nvvk::Texture TextureStreamer::createTexture(const vk::CommandBuffer& cmdBuf,
+                                             const TextureData&       tex,
+                                             vk::Buffer               staging,
+                                             vk::DeviceSize           stagingOffset)
+{
+  using vkIU = vk::ImageUsageFlagBits;
+  using vkFF = vk::FormatFeatureFlagBits;
+
+  vk::FormatFeatureFlags features =
+      m_physicalDevice.getFormatProperties(tex.format).optimalTilingFeatures;
+  bool generateMips =
+      tex.generateMips && (features & vkFF::eBlitSrc) && (features & vkFF::eBlitDst);
+
+  bool compress = compressible(tex);
+
+  auto imageCreateInfo =
+      nvvk::makeImage2DCreateInfo(tex.extent, tex.format, vkIU::eSampled, generateMips);
+  imageCreateInfo.setUsage(vkIU::eSampled | vkIU::eTransferDst | vkIU::eTransferSrc);
+  if(compress)
+    imageCreateInfo.setFlags(vk::ImageCreateFlagBits::eMutableFormat);
+  if(!generateMips)
+    imageCreateInfo.setMipLevels(tex.generateMips ? 1 : tex.mipLevels);
+  nvvk::Image image = m_alloc->createImage(imageCreateInfo);
+
+  uint32_t                         nbStored = tex.generateMips ? 1 : tex.mipLevels;
+  std::vector<vk::BufferImageCopy> regions(nbStored);
+  for(uint32_t level = 0; level < nbStored; level++)
+  {
+    regions[level].setBufferOffset(stagingOffset + tex.levelOffsets[level]);
+    regions[level].setImageSubresource({vk::ImageAspectFlagBits::eColor, level, 0, 1});
+    regions[level].setImageExtent({std::max(tex.extent.width >> level, 1u),
+                                   std::max(tex.extent.height >> level, 1u), 1});
+  }
+
+  nvvk::cmdBarrierImageLayout(cmdBuf, image.image, vk::ImageLayout::eUndefined,
+                              vk::ImageLayout::eTransferDstOptimal);
+  cmdBuf.copyBufferToImage(staging, image.image, vk::ImageLayout::eTransferDstOptimal, regions);
+  nvvk::cmdBarrierImageLayout(cmdBuf, image.image, vk::ImageLayout::eTransferDstOptimal,
+                              vk::ImageLayout::eShaderReadOnlyOptimal);
+  if(generateMips)
+    nvvk::cmdGenerateMipmaps(cmdBuf, image.image, tex.format, tex.extent,
+                             imageCreateInfo.mipLevels);
+
+  vk::SamplerCreateInfo samplerCreateInfo{
+      {}, vk::Filter::eLinear, vk::Filter::eLinear, vk::SamplerMipmapMode::eLinear};
+  samplerCreateInfo.setMaxLod(FLT_MAX);
+  vk::ImageViewCreateInfo ivInfo = nvvk::makeImageViewCreateInfo(image.image, imageCreateInfo);
+  if(compress)
+  {
+    // The 8-bit texture only lives until the batch is done
+    ivInfo.setFormat(vk::Format::eR8G8B8A8Unorm);
+    nvvk::Texture source = m_alloc->createTexture(image, ivInfo, samplerCreateInfo);
+    MemoryStats::shared().add(MemoryCategory::eStaging,
+                              MemoryStats::sizeOf(m_device, source.image));
+    m_batch.sources.push_back(source);
+    return compressTexture(cmdBuf, tex, source, imageCreateInfo);
+  }
+  return m_alloc->createTexture(image, ivInfo, samplerCreateInfo);
+}
+
+//--------------------------------------------------------------------------------------------------
+// Recording the compression of all levels of `source` to BC1, or BC3 if it has alpha, in a buffer
+// and their copy to the returned texture
+//
+nvvk::Texture TextureStreamer::compressTexture(const vk::CommandBuffer&   cmdBuf,
+                                               const TextureData&         tex,
+                                               const nvvk::Texture&       source,
+                                               const vk::ImageCreateInfo& sourceInfo)
+{
+  using vkAF = vk::AccessFlagBits;
+  using vkDT = vk::DescriptorType;
+  using vkIU = vk::ImageUsageFlagBits;
+  using vkPS = vk::PipelineStageFlagBits;
+
+  vk::Format format     = tex.opaque ? vk::Format::eBc1RgbaSrgbBlock : vk::Format::eBc3SrgbBlock;
+  uint32_t   blockWords = tex.opaque ? 2 : 4;
+  uint32_t   mipLevels  = sourceInfo.mipLevels;
+
+  // Blocks of each level, one after the other
+  std::vector<vk::BufferImageCopy>  regions(mipLevels);
+  std::vector<CompressPushConstant> levels(mipLevels);
+  uint32_t                          nbWords = 0;
+  for(uint32_t level = 0; level < mipLevels; level++)
+  {
+    uint32_t width  = std::max(tex.extent.width >> level, 1u);
+    uint32_t height = std::max(tex.extent.height >> level, 1u);
+    levels[level]   = {int(level), int(width), int(height), nbWords, tex.opaque ? 0 : 1};
+    regions[level].setBufferOffset(nbWords * sizeof(uint32_t));
+    regions[level].setImageSubresource({vk::ImageAspectFlagBits::eColor, level, 0, 1});
+    regions[level].setImageExtent({width, height, 1});
+    nbWords += ((width + 3) / 4) * ((height + 3) / 4) * blockWords;
+  }
+
+  nvvk::Buffer blocks = m_alloc->createBuffer(
+      nbWords * sizeof(uint32_t),
+      vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferSrc,
+      vk::MemoryPropertyFlagBits::eDeviceLocal);
+  MemoryStats::shared().add(MemoryCategory::eStaging, MemoryStats::sizeOf(m_device, blocks.buffer));
+  m_batch.blocks.push_back(blocks);
+
+  vk::DescriptorSet descSet =
+      m_device.allocateDescriptorSets({m_batch.descPool, 1, &m_compressDescLayout})[0];
+  vk::DescriptorImageInfo  imageInfo{source.descriptor.sampler, source.descriptor.imageView,
+                                    vk::ImageLayout::eShaderReadOnlyOptimal};
+  vk::DescriptorBufferInfo bufferInfo{blocks.buffer, 0, VK_WHOLE_SIZE};
+  std::vector<vk::WriteDescriptorSet> writes;
+  writes.push_back({descSet, 0, 0, 1, vkDT::eCombinedImageSampler, &imageInfo});
+  writes.push_back({descSet, 1, 0, 1, vkDT::eStorageBuffer, nullptr, &bufferInfo});
+  m_device.updateDescriptorSets(writes, nullptr);
+
+  // The levels were written by the copy and the blits of createTexture
+  vk::MemoryBarrier toCompress{vkAF::eTransferWrite, vkAF::eShaderRead};
+  cmdBuf.pipelineBarrier(vkPS::eAllCommands, vkPS::eComputeShader, {}, toCompress, {}, {});
+
+  cmdBuf.bindPipeline(vk::PipelineBindPoint::eCompute, m_compressPipeline);
+  cmdBuf.bindDescriptorSets(vk::PipelineBindPoint::eCompute, m_compressLayout, 0, descSet, {});
+  for(const CompressPushConstant& pushC : levels)
+  {
+    cmdBuf.pushConstants<CompressPushConstant>(m_compressLayout, vk::ShaderStageFlagBits::eCompute,
+                                               0, pushC);
+    uint32_t nbBlocksX = (pushC.width + 3) / 4;
+    uint32_t nbBlocksY = (pushC.height + 3) / 4;
+    cmdBuf.dispatch((nbBlocksX + 7) / 8, (nbBlocksY + 7) / 8, 1);
+  }
+
+  auto imageCreateInfo = nvvk::makeImage2DCreateInfo(tex.extent, format, vkIU::eSampled);
+  imageCreateInfo.setUsage(vkIU::eSampled | vkIU::eTransferDst);
+  imageCreateInfo.setMipLevels(mipLevels);
+  nvvk::Image image = m_alloc->createImage(imageCreateInfo);
+
+  vk::MemoryBarrier toCopy{vkAF::eShaderWrite, vkAF::eTransferRead};
+  cmdBuf.pipelineBarrier(vkPS::eComputeShader, vkPS::eTransfer, {}, toCopy, {}, {});
+  nvvk::cmdBarrierImageLayout(cmdBuf, image.image, vk::ImageLayout::eUndefined,
+                              vk::ImageLayout::eTransferDstOptimal);
+  cmdBuf.copyBufferToImage(blocks.buffer, image.image, vk::ImageLayout::eTransferDstOptimal,
+                           regions);
+  nvvk::cmdBarrierImageLayout(cmdBuf, image.image, vk::ImageLayout::eTransferDstOptimal,
+                              vk::ImageLayout::eShaderReadOnlyOptimal);
+
+  vk::SamplerCreateInfo samplerCreateInfo{
+      {}, vk::Filter::eLinear, vk::Filter::eLinear, vk::SamplerMipmapMode::eLinear};
+  samplerCreateInfo.setMaxLod(FLT_MAX);
+  vk::ImageViewCreateInfo ivInfo = nvvk::makeImageViewCreateInfo(image.image, imageCreateInfo);
+  return m_alloc->createTexture(image, ivInfo, samplerCreateInfo);
+}
+
+//--------------------------------------------------------------------------------------------------
+// Decoding, called from the worker threads
+//
+TextureStreamer::TextureData TextureStreamer::decode(const std::string& filename)
+{
+  TextureData tex;
+  tex.name = filename.substr(filename.find_last_of("/\\") + 1);
+
+  std::string ext = filename.substr(std::min(filename.find_last_of('.'), filename.size()));
+  std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+
+  bool loaded = false;
+  if(ext == ".ktx2")
+    loaded = loadKtx2(nvh::loadFile(filename, true), tex);
+  else if(ext == ".dds")
+    loaded = loadDds(nvh::loadFile(filename, true), tex);
+  else
+    loaded = loadStb(filename, tex);
+
+  if(!loaded)
+  {
+    LOGW("Texture %s: could not be loaded\n", filename.c_str());
+    makeFallback(tex);
+  }
+  return tex;
+}
+
+// Magenta 1x1 texture, for the files which could not be used
+void TextureStreamer::makeFallback(TextureData& tex)
+{
+  tex.format       = vk::Format::eR8G8B8A8Srgb;
+  tex.extent       = vk::Extent2D(1, 1);
+  tex.mipLevels    = 1;
+  tex.blockBytes   = 4;
+  tex.generateMips = false;
+  tex.data         = {255u, 0u, 255u, 255u};
+  tex.levelOffsets = {0};
+}
+
+bool TextureStreamer::loadStb(const std::string& filename, TextureData& tex)
+{
+  int      texWidth, texHeight, texChannels;
+  stbi_uc* pixels =
+      stbi_load(filename.c_str(), &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
+  if(!pixels)
+    return false;
+
+  tex.format       = vk::Format::eR8G8B8A8Srgb;
+  tex.extent       = vk::Extent2D(texWidth, texHeight);
+  tex.generateMips = true;
+  tex.data.assign(pixels, pixels + static_cast<size_t>(texWidth) * texHeight * 4);
+  tex.levelOffsets = {0};
+  stbi_image_free(pixels);
+
+  // Textures with alpha are compressed to BC3
+  tex.opaque = true;
+  for(size_t i = 3; texChannels == 4 && tex.opaque && i < tex.data.size(); i += 4)
+    tex.opaque = tex.data[i] == 255u;
+  return true;
+}
+
+//--------------------------------------------------------------------------------------------------
+// KTX2: the Vulkan format is stored as is, only files without supercompression are supported.
+// For arrays and cube maps, only the first layer or face is used.
+//
+bool TextureStreamer::loadKtx2(const std::string& file, TextureData& tex)
+{
+  struct Header
+  {
+    uint8_t  identifier[12];
+    uint32_t vkFormat;
+    uint32_t typeSize;
+    uint32_t pixelWidth;
+    uint32_t pixelHeight;
+    uint32_t pixelDepth;
+    uint32_t layerCount;
+    uint32_t faceCount;
+    uint32_t levelCount;
+    uint32_t supercompressionScheme;
+    uint32_t dfdByteOffset;
+    uint32_t dfdByteLength;
+    uint32_t kvdByteOffset;
+    uint32_t kvdByteLength;
+    uint64_t sgdByteOffset;
+    uint64_t sgdByteLength;
+  };
+  struct Level
+  {
+    uint64_t byteOffset;
+    uint64_t byteLength;
+    uint64_t uncompressedByteLength;
+  };
+  static_assert(sizeof(Header) == 80, "KTX2 header");
+  static const uint8_t kIdentifier[12] = {0xAB, 0x4B, 0x54, 0x58, 0x20, 0x32,
+                                          0x30, 0xBB, 0x0D, 0x0A, 0x1A, 0x0A};
+
+  Header header;
+  if(file.size() < sizeof(Header))
+    return false;
+  memcpy(&header, file.data(), sizeof(Header));
+  if(memcmp(header.identifier, kIdentifier, sizeof(kIdentifier)) != 0 || header.vkFormat == 0
+     || header.supercompressionScheme != 0 || header.pixelHeight == 0 || header.pixelDepth > 1)
+    return false;
+
+  uint32_t nbLevels = std::max(header.levelCount, 1u);
+  uint32_t nbImages = std::max(header.layerCount, 1u) * std::max(header.faceCount, 1u);
+  if(file.size() < sizeof(Header) + nbLevels * sizeof(Level))
+    return false;
+
+  // Size of a texel block: bytesPlane0 of the basic descriptor block, after the total size and 4
+  // words of the data format descriptor
+  const size_t kBytesPlane0 = 20;
+  if(header.dfdByteLength <= kBytesPlane0 || header.dfdByteOffset + kBytesPlane0 >= file.size())
+    return false;
+
+  tex.format       = static_cast<vk::Format>(header.vkFormat);
+  tex.extent       = vk::Extent2D(header.pixelWidth, header.pixelHeight);
+  tex.mipLevels    = nbLevels;
+  tex.blockBytes   = std::max<uint32_t>(uint8_t(file[header.dfdByteOffset + kBytesPlane0]), 1u);
+  tex.generateMips = header.levelCount == 0;
+  for(uint32_t l = 0; l < nbLevels; l++)
+  {
+    Level level;
+    memcpy(&level, file.data() + sizeof(Header) + l * sizeof(Level), sizeof(Level));
+    uint64_t size = level.byteLength / nbImages;
+    if(level.byteOffset + size > file.size())
+      return false;
+    tex.levelOffsets.push_back(alignLevel(tex.data.size(), tex.blockBytes));
+    tex.data.resize(tex.levelOffsets.back() + size);
+    memcpy(tex.data.data() + tex.levelOffsets.back(), file.data() + level.byteOffset, size);
+  }
+  return true;
+}
+
+//--------------------------------------------------------------------------------------------------
+// DDS: BC1 to BC7, with the legacy FourCC codes or the DX10 header, and RGBA8
+// Legacy BC1-3 files are considered sRGB, as the textures decoded by stb_image.
+//
+bool TextureStreamer::loadDds(const std::string& file, TextureData& tex)
+{
+  struct PixelFormat
+  {
+    uint32_t size;
+    uint32_t flags;
+    uint32_t fourCC;
+    uint32_t rgbBitCount;
+    uint32_t masks[4];
+  };
+  struct Header
+  {
+    uint32_t    size;
+    uint32_t    flags;
+    uint32_t    height;
+    uint32_t    width;
+    uint32_t    pitchOrLinearSize;
+    uint32_t    depth;
+    uint32_t    mipMapCount;
+    uint32_t    reserved1[11];
+    PixelFormat pixelFormat;
+    uint32_t    caps[4];
+    uint32_t    reserved2;
+  };
+  struct HeaderDx10
+  {
+    uint32_t dxgiFormat;
+    uint32_t resourceDimension;
+    uint32_t miscFlag;
+    uint32_t arraySize;
+    uint32_t miscFlags2;
+  };
+  struct FormatInfo
+  {
+    uint32_t   code;  // DXGI format or FourCC
+    vk::Format format;
+    uint32_t   blockDim;  // Texels per side of a block
+    uint32_t   blockBytes;
+  };
+  auto fourCC = [](const char* c) {
+    return uint32_t(c[0]) | (uint32_t(c[1]) << 8) | (uint32_t(c[2]) << 16) | (uint32_t(c[3]) << 24);
+  };
+  const FormatInfo kDxgiFormats[] = {
+      {28, vk::Format::eR8G8B8A8Unorm, 1, 4},     {29, vk::Format::eR8G8B8A8Srgb, 1, 4},
+      {71, vk::Format::eBc1RgbaUnormBlock, 4, 8}, {72, vk::Format::eBc1RgbaSrgbBlock, 4, 8},
+      {74, vk::Format::eBc2UnormBlock, 4, 16},    {75, vk::Format::eBc2SrgbBlock, 4, 16},
+      {77, vk::Format::eBc3UnormBlock, 4, 16},    {78, vk::Format::eBc3SrgbBlock, 4, 16},
+      {80, vk::Format::eBc4UnormBlock, 4, 8},     {81, vk::Format::eBc4SnormBlock, 4, 8},
+      {83, vk::Format::eBc5UnormBlock, 4, 16},    {84, vk::Format::eBc5SnormBlock, 4, 16},
+      {95, vk::Format::eBc6HUfloatBlock, 4, 16},  {96, vk::Format::eBc6HSfloatBlock, 4, 16},
+      {98, vk::Format::eBc7UnormBlock, 4, 16},    {99, vk::Format::eBc7SrgbBlock, 4, 16}};
+  const FormatInfo kFourCCFormats[] = {
+      {fourCC("DXT1"), vk::Format::eBc1RgbaSrgbBlock, 4, 8},
+      {fourCC("DXT3"), vk::Format::eBc2SrgbBlock, 4, 16},
+      {fourCC("DXT5"), vk::Format::eBc3SrgbBlock, 4, 16},
+      {fourCC("ATI1"), vk::Format::eBc4UnormBlock, 4, 8},
+      {fourCC("BC4U"), vk::Format::eBc4UnormBlock, 4, 8},
+      {fourCC("ATI2"), vk::Format::eBc5UnormBlock, 4, 16},
+      {fourCC("BC5U"), vk::Format::eBc5UnormBlock, 4, 16}};
+  const uint32_t kMagic       = fourCC("DDS ");
+  const uint32_t kFlagMipMaps = 0x20000;  // DDSD_MIPMAPCOUNT
+  const uint32_t kFlagFourCC  = 0x4;      // DDPF_FOURCC
+
+  Header   header;
+  uint32_t magic;
+  size_t   offset = sizeof(magic) + sizeof(Header);
+  if(file.size() < offset)
+    return false;
+  memcpy(&magic, file.data(), sizeof(magic));
+  memcpy(&header, file.data() + sizeof(magic), sizeof(Header));
+  if(magic != kMagic || !(header.pixelFormat.flags & kFlagFourCC))
+    return false;
+
+  const FormatInfo* info = nullptr;
+  if(header.pixelFormat.fourCC == fourCC("DX10"))
+  {
+    HeaderDx10 dx10;
+    if(file.size() < offset + sizeof(HeaderDx10))
+      return false;
+    memcpy(&dx10, file.data() + offset, sizeof(HeaderDx10));
+    offset += sizeof(HeaderDx10);
+    for(const auto& f : kDxgiFormats)
+      info = f.code == dx10.dxgiFormat ? &f : info;
+  }
+  else
+  {
+    for(const auto& f : kFourCCFormats)
+      info = f.code == header.pixelFormat.fourCC ? &f : info;
+  }
+  if(info == nullptr || header.width == 0 || header.height == 0)
+    return false;
+
+  tex.format     = info->format;
+  tex.extent     = vk::Extent2D(header.width, header.height);
+  tex.mipLevels  = (header.flags & kFlagMipMaps) ? std::max(header.mipMapCount, 1u) : 1;
+  tex.blockBytes = info->blockBytes;
+  for(uint32_t l = 0; l < tex.mipLevels; l++)
+  {
+    uint32_t width  = std::max(header.width >> l, 1u);
+    uint32_t height = std::max(header.height >> l, 1u);
+    size_t   size   = size_t((width + info->blockDim - 1) / info->blockDim)
+                  * ((height + info->blockDim - 1) / info->blockDim) * info->blockBytes;
+    if(offset + size > file.size())
+      return false;
+    tex.levelOffsets.push_back(alignLevel(tex.data.size(), tex.blockBytes));
+    tex.data.resize(tex.levelOffsets.back() + size);
+    memcpy(tex.data.data() + tex.levelOffsets.back(), file.data() + offset, size);
+    offset += size;
+  }
+  return true;
+}
+
+void TextureStreamer::destroyTexture(nvvk::Texture& texture)
+{
+  MemoryStats::shared().remove(MemoryCategory::eTexture,
+                               MemoryStats::sizeOf(m_device, texture.image));
+  m_alloc->destroy(texture);
+}
+
+// Staging buffer of the batch, and the resources of its block compression
+void TextureStreamer::destroyStaging()
+{
+  MemoryStats::shared().remove(MemoryCategory::eStaging,
+                               MemoryStats::sizeOf(m_device, m_batch.staging.buffer));
+  m_alloc->destroy(m_batch.staging);
+  for(auto& source : m_batch.sources)
+  {
+    MemoryStats::shared().remove(MemoryCategory::eStaging,
+                                 MemoryStats::sizeOf(m_device, source.image));
+    m_alloc->destroy(source);
+  }
+  for(auto& blocks : m_batch.blocks)
+  {
+    MemoryStats::shared().remove(MemoryCategory::eStaging,
+                                 MemoryStats::sizeOf(m_device, blocks.buffer));
+    m_alloc->destroy(blocks);
+  }
+  m_device.destroy(m_batch.descPool);
+}
@@ -0,0 +1,163 @@
+/* Copyright (c) 2014-2018, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+
+#include <future>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "memory_stats.hpp"
+#include "nvvk/debug_util_vk.hpp"
+#include "nvvk/descriptorsets_vk.hpp"
+#include "pipeline_cache.hpp"
+#include "vkalloc.hpp"
+
+//--------------------------------------------------------------------------------------------------
+// Streaming of the textures
+// - request() decodes the file on the shared thread pool: KTX2 and DDS files are uploaded as
+//   stored (BCn, ASTC, ... with their mip chain), other files are decoded to RGBA8 by stb_image
+//   and their mip chain is generated on the GPU, then compressed to BC1 or BC3 by bc_compress.comp
+// - update() uploads the decoded textures in batches, each batch being submitted with its own
+//   fence, and returns the textures of the batches the GPU has finished
+// - Until then, the slot of a texture is meant to hold placeholder()
+//
+class TextureStreamer
+{
+public:
+  // Texture now resident, to be bound at `slot`
+  struct Resident
+  {
+    uint32_t      slot;
+    nvvk::Texture texture;
+  };
+
+  void setup(const vk::Device&         device,
+             const vk::PhysicalDevice& physicalDevice,
+             nvvk::Allocator*          allocator,
+             uint32_t                  queueFamily,
+             PipelineCache*            pipelineCache);
+  void destroy();
+
+  // Compressing the textures decoded by stb_image, if the device samples BC1 and BC3. To set before
+  // the first request.
+  void setBlockCompression(bool compress) { m_compress = compress && m_compressPipeline; }
+
+  void                  request(uint32_t slot, const std::string& filename);
+  std::vector<Resident> update();
+  // True while some requested textures are not returned by update() yet
+  bool busy() const { return !m_decoding.empty() || m_batch.fence; }
+
+  // 1x1 white texture, owned by the streamer
+  const nvvk::Texture& placeholder() const { return m_placeholder; }
+
+private:
+  // Content of a texture file, all levels are tightly packed one after the other
+  struct TextureData
+  {
+    std::string                 name;
+    vk::Format                  format{vk::Format::eUndefined};
+    vk::Extent2D                extent;
+    uint32_t                    mipLevels{1};
+    uint32_t                    blockBytes{4};        // Size of a texel block
+    bool                        generateMips{false};  // Only level 0 is in `data`
+    bool                        opaque{true};         // Compressed to BC1 rather than BC3
+    std::vector<uint8_t>        data;
+    std::vector<vk::DeviceSize> levelOffsets;
+  };
+
+  struct Decoding
+  {
+    uint32_t                 slot;
+    std::future<TextureData> data;
+  };
+
+  // Textures being copied by the GPU
+  struct Batch
+  {
+    vk::Fence             fence;
+    vk::CommandBuffer     cmdBuf;
+    nvvk::Buffer          staging;
+    std::vector<Resident> textures;
+
+    // Read and written by the block compression
+    std::vector<nvvk::Texture> sources;
+    std::vector<nvvk::Buffer>  blocks;
+    vk::DescriptorPool         descPool;
+  };
+
+  struct CompressPushConstant
+  {
+    int      level;
+    int      width;
+    int      height;
+    uint32_t offset;  // In words
+    int      alpha;
+  };
+
+  static TextureData decode(const std::string& filename);
+  static bool        loadKtx2(const std::string& file, TextureData& tex);
+  static bool        loadDds(const std::string& file, TextureData& tex);
+  static bool        loadStb(const std::string& filename, TextureData& tex);
+  static void        makeFallback(TextureData& tex);
+
+  void          createCompressPipeline();
+  bool          compressible(const TextureData& tex) const;
+  void          submitBatch(std::vector<std::pair<uint32_t, TextureData>>& ready);
+  nvvk::Texture createTexture(const vk::CommandBuffer& cmdBuf,
+                              const TextureData&       tex,
+                              vk::Buffer               staging,
+                              vk::DeviceSize           stagingOffset);
+  nvvk::Texture compressTexture(const vk::CommandBuffer&   cmdBuf,
+                                const TextureData&         tex,
+                                const nvvk::Texture&       source,
+                                const vk::ImageCreateInfo& sourceInfo);
+  void          destroyTexture(nvvk::Texture& texture);
+  void          destroyStaging();
+
+  // Upper bound of the data uploaded by a batch, unless a single texture is larger
+  static const vk::DeviceSize kBatchBytes = 64 * 1024 * 1024;
+
+  vk::Device                  m_device;
+  vk::PhysicalDevice          m_physicalDevice;
+  nvvk::Allocator*            m_alloc{nullptr};
+  PipelineCache*              m_pipelineCache{nullptr};
+  vk::Queue                   m_queue;
+  vk::CommandPool             m_cmdPool;
+  nvvk::DebugUtil             m_debug;
+  nvvk::Texture               m_placeholder;
+  std::vector<Decoding>       m_decoding;
+  Batch                       m_batch;
+  bool                        m_compress{false};
+  nvvk::DescriptorSetBindings m_compressBind;
+  vk::DescriptorSetLayout     m_compressDescLayout;
+  vk::PipelineLayout          m_compressLayout;
+  vk::Pipeline                m_compressPipeline;
+};
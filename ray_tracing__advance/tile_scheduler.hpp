@@ -0,0 +1,135 @@
+/* Copyright (c) 2014-2018, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <deque>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+
+//--------------------------------------------------------------------------------------------------
+// Splitting the ray tracing launches of a frame in tiles, for very large images
+// - A pass traces every tile once, which accumulates one frame in all pixels
+// - With a time budget, a pass is spread over several frames: each frame traces the tiles which
+//   fit in the budget, from the GPU time per pixel measured by the previous frames. Each frame is
+//   a submission, the UI stays responsive and no submission runs long enough to trigger a device
+//   timeout.
+// - Without time budget, all tiles of a pass are traced in the same frame
+//
+// Usage, once per frame:
+//   if(tiles.passDone())
+//     tiles.beginPass(size);  // and begin the next accumulation frame
+//   for(const vk::Rect2D& tile : tiles.nextTiles(lastRayTraceMs))
+//     ...
+//
+class TileScheduler
+{
+public:
+  // tileSize: width and height of the tiles in pixels, 0 for a single launch over the image
+  // budgetMs: GPU time of the tiles of one frame, 0 to trace a whole pass in each frame
+  // latency: frames between a launch and its GPU time, see GpuProfiler
+  void setup(uint32_t tileSize, float budgetMs, uint32_t latency)
+  {
+    m_tileSize = tileSize;
+    m_budgetMs = budgetMs;
+    m_latency  = std::max(latency, 1u);
+    m_pixels.clear();
+    m_msPerPixel = 0;
+    restart();
+  }
+
+  bool     enabled() const { return m_tileSize > 0; }
+  uint32_t tileSize() const { return m_tileSize; }
+  float    budgetMs() const { return m_budgetMs; }
+
+  // Dropping the tiles left in the pass, the next one starts from the first tile
+  void restart() { m_next = m_count; }
+  bool passDone() const { return m_next >= m_count; }
+  void beginPass(const vk::Extent2D& size)
+  {
+    m_size   = size;
+    m_tilesX = enabled() ? (size.width + m_tileSize - 1) / m_tileSize : 1;
+    m_tilesY = enabled() ? (size.height + m_tileSize - 1) / m_tileSize : 1;
+    m_count  = m_tilesX * m_tilesY;
+    m_next   = 0;
+  }
+  uint32_t tilesLeft() const { return m_count - std::min(m_next, m_count); }
+  uint32_t tileCount() const { return m_count; }
+
+  // Tiles to trace in this frame, `lastMs` being the GPU time of the launches `latency` frames ago
+  std::vector<vk::Rect2D> nextTiles(double lastMs)
+  {
+    if(m_pixels.size() == m_latency)
+    {
+      if(lastMs > 0 && m_pixels.front() > 0)
+        m_msPerPixel = lastMs / double(m_pixels.front());
+      m_pixels.pop_front();
+    }
+
+    uint32_t nbTiles = tilesLeft();
+    if(enabled() && m_budgetMs > 0)
+    {
+      // A single tile until the cost of a pixel is known
+      double   tileMs = m_msPerPixel * double(m_tileSize) * double(m_tileSize);
+      uint32_t fit    = tileMs > 0 ? static_cast<uint32_t>(m_budgetMs / tileMs) : 1;
+      nbTiles         = std::min(nbTiles, std::max(fit, 1u));
+    }
+
+    std::vector<vk::Rect2D> tiles;
+    uint64_t                pixels = 0;
+    for(uint32_t i = 0; i < nbTiles; i++, m_next++)
+    {
+      vk::Rect2D tile;
+      if(enabled())
+      {
+        tile.offset.x      = int32_t((m_next % m_tilesX) * m_tileSize);
+        tile.offset.y      = int32_t((m_next / m_tilesX) * m_tileSize);
+        tile.extent.width  = std::min(m_tileSize, m_size.width - uint32_t(tile.offset.x));
+        tile.extent.height = std::min(m_tileSize, m_size.height - uint32_t(tile.offset.y));
+      }
+      else
+        tile.extent = m_size;
+      pixels += uint64_t(tile.extent.width) * tile.extent.height;
+      tiles.push_back(tile);
+    }
+    m_pixels.push_back(pixels);
+    return tiles;
+  }
+
+private:
+  uint32_t             m_tileSize{0};
+  float                m_budgetMs{0};
+  uint32_t             m_latency{1};
+  vk::Extent2D         m_size;
+  uint32_t             m_tilesX{0};
+  uint32_t             m_tilesY{0};
+  uint32_t             m_count{0};
+  uint32_t             m_next{0};
+  std::deque<uint64_t> m_pixels;  // Pixels traced by the last frames, oldest first
+  double               m_msPerPixel{0};
+};
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "nvmath/nvmath.h"
+#include "obj_loader.h"
+
+//--------------------------------------------------------------------------------------------------
+// Packed vertex streams
+// - Positions keep full precision in their own buffer, tightly packed for the BLAS build
+// - Normal, texture coordinates and color are quantized in a second stream of 12 bytes, decoded
+//   by the shaders when fetching the vertices (24 bytes per vertex instead of 44)
+//
+struct VertexAttribPacked
+{
+  uint32_t normal;    // Octahedral encoding, 2x snorm16
+  uint32_t color;     // RGBA, 4x unorm8
+  uint32_t texCoord;  // 2x half float
+};
+static_assert(sizeof(VertexAttribPacked) == 12, "Must match VertexAttrib in wavefront.glsl");
+
+// Float to half float, rounding to the nearest even
+inline uint16_t packHalf(float value)
+{
+  uint32_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  uint32_t sign     = (bits >> 16) & 0x8000u;
+  uint32_t mantissa = bits & 0x7fffffu;
+  int32_t  exponent = int32_t((bits >> 23) & 0xffu) - 127 + 15;
+
+  if(((bits >> 23) & 0xffu) == 0xffu)  // Inf and NaN
+    return uint16_t(sign | 0x7c00u | (mantissa != 0 ? 0x200u : 0u));
+  if(exponent >= 31)  // Overflow
+    return uint16_t(sign | 0x7c00u);
+
+  uint32_t shift = 13;
+  uint32_t half  = sign | (uint32_t(std::max(exponent, 0)) << 10);
+  if(exponent <= 0)  // Subnormal
+  {
+    if(exponent < -10)
+      return uint16_t(sign);
+    mantissa |= 0x800000u;
+    shift = uint32_t(14 - exponent);
+  }
+  half |= mantissa >> shift;
+  // A carry out of the mantissa correctly increments the exponent
+  uint32_t remainder = mantissa & ((1u << shift) - 1);
+  uint32_t halfway   = 1u << (shift - 1);
+  if(remainder > halfway || (remainder == halfway && (half & 1u)))
+    half++;
+  return uint16_t(half);
+}
+
+inline uint32_t packSnorm2x16(float x, float y)
+{
+  auto snorm = [](float v) {
+    return uint32_t(uint16_t(int16_t(std::round(std::min(std::max(v, -1.f), 1.f) * 32767.f))));
+  };
+  return snorm(x) | (snorm(y) << 16);
+}
+
+inline uint32_t packUnorm4x8(const nvmath::vec3f& rgb)
+{
+  auto unorm = [](float v) {
+    return uint32_t(std::round(std::min(std::max(v, 0.f), 1.f) * 255.f));
+  };
+  return unorm(rgb.x) | (unorm(rgb.y) << 8) | (unorm(rgb.z) << 16) | (255u << 24);
+}
+
+// Projecting the unit vector on the octahedron, the lower half being folded over the upper one
+inline uint32_t packOctahedral(const nvmath::vec3f& n)
+{
+  float l1 = std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+  if(l1 == 0.f)
+    return 0;
+  float u = n.x / l1;
+  float v = n.y / l1;
+  if(n.z < 0.f)
+  {
+    float fu = (1.f - std::abs(v)) * (u >= 0.f ? 1.f : -1.f);
+    float fv = (1.f - std::abs(u)) * (v >= 0.f ? 1.f : -1.f);
+    u        = fu;
+    v        = fv;
+  }
+  return packSnorm2x16(u, v);
+}
+
+inline void packVertices(const VertexObj*                 vertices,
+                         size_t                           count,
+                         std::vector<nvmath::vec3f>&      positions,
+                         std::vector<VertexAttribPacked>& attributes)
+{
+  positions.resize(count);
+  attributes.resize(count);
+  for(size_t i = 0; i < count; i++)
+  {
+    const VertexObj& v   = vertices[i];
+    positions[i]         = v.pos;
+    attributes[i].normal = packOctahedral(v.nrm);
+    attributes[i].color  = packUnorm4x8(v.color);
+    attributes[i].texCoord =
+        uint32_t(packHalf(v.texCoord.x)) | (uint32_t(packHalf(v.texCoord.y)) << 16);
+  }
+}
@@ -1,6 +1,16 @@
-
-//#define NVVK_ALLOC_DEDICATED
+// Memory allocator backend, selected by the VKALLOC_BACKEND CMake option: DEDICATED, DMA or VMA
+// The resource types (nvvk::Buffer, nvvk::Image, nvvk::AccelKHR, ...) depend on the backend, so
+// it is chosen when building rather than at run time
+#if !defined(NVVK_ALLOC_DEDICATED) && !defined(NVVK_ALLOC_DMA) && !defined(NVVK_ALLOC_VMA)
 #define NVVK_ALLOC_DMA
-//#define NVVK_ALLOC_VMA
+#endif
 
 #include <nvvk/allocator_vk.hpp>
+
+#if defined(NVVK_ALLOC_DEDICATED)
+#define VKALLOC_BACKEND_NAME "Dedicated"
+#elif defined(NVVK_ALLOC_DMA)
+#define VKALLOC_BACKEND_NAME "DMA"
+#elif defined(NVVK_ALLOC_VMA)
+#define VKALLOC_BACKEND_NAME "VMA"
+#endif
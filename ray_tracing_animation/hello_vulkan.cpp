@@ -25,6 +25,7 @@
  * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <array>
 #include <sstream>
 #include <vulkan/vulkan.hpp>
 
@@ -67,6 +68,9 @@ void HelloVulkan::setup(const vk::Instance&       instance,
   AppBase::setup(instance, device, physicalDevice, queueFamily);
   m_alloc.init(device, physicalDevice);
   m_debug.setup(m_device);
+
+  // Pipelines compiled in a previous run are taken from the cache
+  m_pipelineCache.init(device, physicalDevice, std::string(PROJECT_NAME) + ".pipelinecache");
 }
 
 //--------------------------------------------------------------------------------------------------
@@ -123,8 +127,9 @@ void HelloVulkan::createDescriptorSetLayout()
       vkDS(6, vkDT::eStorageBuffer, nbObj, vkSS::eClosestHitKHR));
 
 
+  // With async compute, the second animation set has its own set (see createAsyncComputeResources)
   m_descSetLayout = m_descSetLayoutBind.createLayout(m_device);
-  m_descPool      = m_descSetLayoutBind.createPool(m_device, 1);
+  m_descPool      = m_descSetLayoutBind.createPool(m_device, m_asyncCompute ? 2 : 1);
   m_descSet       = nvvk::allocateDescriptorSet(m_device, m_descPool, m_descSetLayout);
 }
 
@@ -201,7 +206,10 @@ void HelloVulkan::createGraphicsPipeline()
                                 {2, 0, vk::Format::eR32G32B32Sfloat, offsetof(VertexObj, color)},
                                 {3, 0, vk::Format::eR32G32Sfloat, offsetof(VertexObj, texCoord)}});
 
-  m_graphicsPipeline = gpb.createPipeline();
+  {
+    PipelineCache::Timer timer(m_pipelineCache, "graphics");
+    m_graphicsPipeline = gpb.createPipeline(m_pipelineCache.get());
+  }
   m_debug.setObjectName(m_graphicsPipeline, "Graphics");
 }
 
@@ -237,10 +245,12 @@ void HelloVulkan::loadModel(const std::string& filename, nvmath::mat4f transform
   nvvk::CommandPool cmdBufGet(m_device, m_graphicsQueueIndex);
   vk::CommandBuffer cmdBuf = cmdBufGet.createCommandBuffer();
   model.vertexBuffer =
-      m_alloc.createBuffer(cmdBuf, loader.m_vertices,
+      createGeometryBuffer(cmdBuf, loader.m_vertices.size() * sizeof(VertexObj),
+                           loader.m_vertices.data(),
                            vkBU::eVertexBuffer | vkBU::eStorageBuffer | vkBU::eShaderDeviceAddress);
   model.indexBuffer =
-      m_alloc.createBuffer(cmdBuf, loader.m_indices,
+      createGeometryBuffer(cmdBuf, loader.m_indices.size() * sizeof(uint32_t),
+                           loader.m_indices.data(),
                            vkBU::eIndexBuffer | vkBU::eStorageBuffer | vkBU::eShaderDeviceAddress);
   model.matColorBuffer = m_alloc.createBuffer(cmdBuf, loader.m_materials, vkBU::eStorageBuffer);
   model.matIndexBuffer = m_alloc.createBuffer(cmdBuf, loader.m_matIndx, vkBU::eStorageBuffer);
@@ -248,6 +258,9 @@ void HelloVulkan::loadModel(const std::string& filename, nvmath::mat4f transform
   createTextureImages(cmdBuf, loader.m_textures);
   cmdBufGet.submitAndWait(cmdBuf);
   m_alloc.finalizeAndReleaseStaging();
+  for(auto& b : m_sharedUploads)
+    m_alloc.destroy(b);
+  m_sharedUploads.clear();
 
   std::string objNb = std::to_string(instance.objIndex);
   m_debug.setObjectName(model.vertexBuffer.buffer, (std::string("vertex_" + objNb).c_str()));
@@ -259,6 +272,54 @@ void HelloVulkan::loadModel(const std::string& filename, nvmath::mat4f transform
   m_objInstance.emplace_back(instance);
 }
 
+//--------------------------------------------------------------------------------------------------
+// Buffers used by both queues when the animation and the acceleration structure updates run on a
+// compute queue of another family: the geometry, the deformation table, the TLAS instances and
+// the scratch memory. They are created with concurrent sharing, which needs no ownership transfer.
+//
+nvvk::Buffer HelloVulkan::createSharedBuffer(vk::DeviceSize          size,
+                                             vk::BufferUsageFlags    usage,
+                                             vk::MemoryPropertyFlags memProps)
+{
+  std::array<uint32_t, 2> families{m_graphicsQueueIndex, m_computeQueueIndex};
+  vk::BufferCreateInfo    info;
+  info.setSize(size);
+  info.setUsage(usage);
+  if(m_asyncCompute && m_computeQueueIndex != m_graphicsQueueIndex)
+  {
+    info.setSharingMode(vk::SharingMode::eConcurrent);
+    info.setQueueFamilyIndexCount(static_cast<uint32_t>(families.size()));
+    info.setPQueueFamilyIndices(families.data());
+  }
+  return m_alloc.createBuffer(info, memProps);
+}
+
+//--------------------------------------------------------------------------------------------------
+// Vertex and index buffers are read by the BLAS refit and written by the animation. The shared
+// buffers are uploaded through host visible buffers which are destroyed once the upload is done.
+//
+nvvk::Buffer HelloVulkan::createGeometryBuffer(const vk::CommandBuffer& cmdBuf,
+                                               vk::DeviceSize           size,
+                                               const void*              data,
+                                               vk::BufferUsageFlags     usage)
+{
+  using vkBU = vk::BufferUsageFlagBits;
+  using vkMP = vk::MemoryPropertyFlagBits;
+
+  if(!m_asyncCompute || m_computeQueueIndex == m_graphicsQueueIndex)
+    return m_alloc.createBuffer(cmdBuf, size, data, usage);
+
+  nvvk::Buffer buffer = createSharedBuffer(size, usage | vkBU::eTransferDst, vkMP::eDeviceLocal);
+
+  nvvk::Buffer upload =
+      m_alloc.createBuffer(size, vkBU::eTransferSrc, vkMP::eHostVisible | vkMP::eHostCoherent);
+  memcpy(m_alloc.map(upload), data, size);
+  m_alloc.unmap(upload);
+  cmdBuf.copyBuffer(upload.buffer, buffer.buffer, vk::BufferCopy(0, 0, size));
+  m_sharedUploads.push_back(upload);
+  return buffer;
+}
+
 //--------------------------------------------------------------------------------------------------
 // Creating the uniform buffer holding the camera matrices
 // - Buffer is host visible
@@ -289,6 +350,22 @@ void HelloVulkan::createSceneDescriptionBuffer()
   cmdGen.submitAndWait(cmdBuf);
   m_alloc.finalizeAndReleaseStaging();
   m_debug.setObjectName(m_sceneDesc.buffer, "sceneDesc");
+
+  // #VK_animation
+  // Persistently mapped staging ring, one slot per frame in flight, for the per-frame updates
+  // of the scene description. A slot is rewritten only after prepareFrame() has waited on the
+  // fence of the frame which last used it.
+  uint32_t nbFrames     = static_cast<uint32_t>(getCommandBuffers().size());
+  m_instStagingSlotSize = m_objInstance.size() * sizeof(ObjInstance);
+  m_instStaging = m_alloc.createBuffer(m_instStagingSlotSize * nbFrames, vkBU::eTransferSrc,
+                                       vk::MemoryPropertyFlagBits::eHostVisible
+                                           | vk::MemoryPropertyFlagBits::eHostCoherent);
+  m_instStagingMapped   = reinterpret_cast<uint8_t*>(m_alloc.map(m_instStaging));
+  m_debug.setObjectName(m_instStaging.buffer, "instStaging");
+  // Only the matrices of the animated instances are written in the slots afterwards
+  for(uint32_t i = 0; i < nbFrames; i++)
+    memcpy(m_instStagingMapped + i * m_instStagingSlotSize, m_objInstance.data(),
+           m_instStagingSlotSize);
 }
 
 //--------------------------------------------------------------------------------------------------
@@ -375,6 +452,8 @@ void HelloVulkan::destroyResources()
   m_device.destroy(m_descSetLayout);
   m_alloc.destroy(m_cameraMat);
   m_alloc.destroy(m_sceneDesc);
+  m_alloc.unmap(m_instStaging);
+  m_alloc.destroy(m_instStaging);
 
   for(auto& m : m_objModel)
   {
@@ -412,6 +491,16 @@ void HelloVulkan::destroyResources()
   m_device.destroy(m_compDescSetLayout);
   m_device.destroy(m_compPipeline);
   m_device.destroy(m_compPipelineLayout);
+  m_alloc.destroy(m_compTargets);
+  m_alloc.destroy(m_asScratch);
+
+  // #VK_async_compute
+  if(m_asyncCompute)
+    destroyAsyncComputeResources();
+
+  m_profiler.destroy();
+  m_pipelineCache.save();
+  m_pipelineCache.destroy();
 }
 
 
@@ -432,11 +521,11 @@ void HelloVulkan::rasterize(const vk::CommandBuffer& cmdBuf)
 
   // Drawing all triangles
   cmdBuf.bindPipeline(vkPBP::eGraphics, m_graphicsPipeline);
-  cmdBuf.bindDescriptorSets(vkPBP::eGraphics, m_pipelineLayout, 0, {m_descSet}, {});
+  cmdBuf.bindDescriptorSets(vkPBP::eGraphics, m_pipelineLayout, 0, {frameDescSet()}, {});
   for(int i = 0; i < m_objInstance.size(); ++i)
   {
     auto& inst                = m_objInstance[i];
-    auto& model               = m_objModel[inst.objIndex];
+    auto& model               = frameModels()[inst.objIndex];
     m_pushConstant.instanceId = i;  // Telling which instance is drawn
     cmdBuf.pushConstants<ObjPushConstant>(m_pipelineLayout, vkSS::eVertex | vkSS::eFragment, 0,
                                           m_pushConstant);
@@ -562,7 +651,10 @@ void HelloVulkan::createPostPipeline()
   pipelineGenerator.addShader(nvh::loadFile("shaders/post.frag.spv", true, paths),
                               vk::ShaderStageFlagBits::eFragment);
   pipelineGenerator.rasterizationState.setCullMode(vk::CullModeFlagBits::eNone);
-  m_postPipeline = pipelineGenerator.createPipeline();
+  {
+    PipelineCache::Timer timer(m_pipelineCache, "post");
+    m_postPipeline = pipelineGenerator.createPipeline(m_pipelineCache.get());
+  }
   m_debug.setObjectName(m_postPipeline, "post");
 }
 
@@ -627,6 +719,8 @@ void HelloVulkan::initRayTracing()
                                                     vk::PhysicalDeviceRayTracingPropertiesKHR>();
   m_rtProperties  = properties.get<vk::PhysicalDeviceRayTracingPropertiesKHR>();
   m_rtBuilder.setup(m_device, &m_alloc, m_graphicsQueueIndex);
+  if(m_asyncCompute)
+    m_rtBuilder.setQueueFamilies({m_graphicsQueueIndex, m_computeQueueIndex});
 }
 
 //--------------------------------------------------------------------------------------------------
@@ -670,19 +764,44 @@ nvvk::RaytracingBuilderKHR::Blas HelloVulkan::objectToVkGeometryKHR(const ObjMod
   return blas;
 }
 
-void HelloVulkan::createBottomLevelAS()
+//--------------------------------------------------------------------------------------------------
+// The BLAS of `models`, the ones of m_objModel or of the second animation set
+//
+std::vector<nvvk::RaytracingBuilderKHR::Blas> HelloVulkan::blasGeometries(
+    const std::vector<ObjModel>& models)
 {
+  using vkBF = vk::BuildAccelerationStructureFlagBitsKHR;
+
   // BLAS - Storing each primitive in a geometry
-  m_blas.reserve(m_objModel.size());
-  for(const auto& obj : m_objModel)
+  std::vector<nvvk::RaytracingBuilderKHR::Blas> allBlas;
+  allBlas.reserve(models.size());
+  for(uint32_t i = 0; i < static_cast<uint32_t>(models.size()); i++)
   {
-    auto blas = objectToVkGeometryKHR(obj);
+    auto blas = objectToVkGeometryKHR(models[i]);
+
+    // Only the deformed models are refit, the others are built for tracing speed
+    bool animated = std::find(m_animatedModels.begin(), m_animatedModels.end(), i)
+                    != m_animatedModels.end();
+    blas.flags = animated ? vkBF::eAllowUpdate | vkBF::ePreferFastBuild : vkBF::ePreferFastTrace;
 
     // We could add more geometry in each BLAS, but we add only one for now
-    m_blas.push_back(blas);
+    allBlas.push_back(blas);
   }
-  m_rtBuilder.buildBlas(m_blas, vk::BuildAccelerationStructureFlagBitsKHR::eAllowUpdate
-                                    | vk::BuildAccelerationStructureFlagBitsKHR::ePreferFastBuild);
+  return allBlas;
+}
+
+void HelloVulkan::createBottomLevelAS()
+{
+  m_blas = blasGeometries(m_objModel);
+  m_rtBuilder.buildBlas(m_blas, {});
+}
+
+// The TLAS is updated every frame, as instances move and the BLAS they reference are refit. It
+// always allows updates: the compute queue refits it without checking the flags of the frame.
+vk::BuildAccelerationStructureFlagsKHR HelloVulkan::tlasFlags() const
+{
+  return vk::BuildAccelerationStructureFlagBitsKHR::ePreferFastTrace
+         | vk::BuildAccelerationStructureFlagBitsKHR::eAllowUpdate;
 }
 
 void HelloVulkan::createTopLevelAS()
@@ -698,8 +817,10 @@ void HelloVulkan::createTopLevelAS()
     rayInst.flags      = VK_GEOMETRY_INSTANCE_TRIANGLE_FACING_CULL_DISABLE_BIT_KHR;
     m_tlas.emplace_back(rayInst);
   }
-  m_rtBuilder.buildTlas(m_tlas, vk::BuildAccelerationStructureFlagBitsKHR::ePreferFastTrace
-                                    | vk::BuildAccelerationStructureFlagBitsKHR::eAllowUpdate);
+  m_rtBuilder.buildTlas(m_tlas, tlasFlags());
+  // Sized for the initial builds, the refits need less: the scratch is allocated again by the
+  // first update and then reused by all the following ones
+  m_rtBuilder.releaseScratch();
 }
 
 //--------------------------------------------------------------------------------------------------
@@ -716,7 +837,7 @@ void HelloVulkan::createRtDescriptorSet()
   m_rtDescSetLayoutBind.addBinding(
       vkDSLB(1, vkDT::eStorageImage, 1, vkSS::eRaygenKHR));  // Output image
 
-  m_rtDescPool      = m_rtDescSetLayoutBind.createPool(m_device);
+  m_rtDescPool      = m_rtDescSetLayoutBind.createPool(m_device, m_asyncCompute ? 2 : 1);
   m_rtDescSetLayout = m_rtDescSetLayoutBind.createLayout(m_device);
   m_rtDescSet       = m_device.allocateDescriptorSets({m_rtDescPool, 1, &m_rtDescSetLayout})[0];
 
@@ -747,6 +868,11 @@ void HelloVulkan::updateRtDescriptorSet()
       {}, m_offscreenColor.descriptor.imageView, vk::ImageLayout::eGeneral};
   vk::WriteDescriptorSet wds{m_rtDescSet, 1, 0, 1, vkDT::eStorageImage, &imageInfo};
   m_device.updateDescriptorSets(wds, nullptr);
+  if(m_animSet.rtDescSet)
+  {
+    wds.setDstSet(m_animSet.rtDescSet);
+    m_device.updateDescriptorSets(wds, nullptr);
+  }
 }
 
 
@@ -832,7 +958,11 @@ void HelloVulkan::createRtPipeline()
 
   rayPipelineInfo.setMaxRecursionDepth(2);  // Ray depth
   rayPipelineInfo.setLayout(m_rtPipelineLayout);
-  m_rtPipeline = m_device.createRayTracingPipelineKHR({}, rayPipelineInfo).value;
+  {
+    PipelineCache::Timer timer(m_pipelineCache, "ray tracing");
+    m_rtPipeline =
+        m_device.createRayTracingPipelineKHR(m_pipelineCache.get(), rayPipelineInfo).value;
+  }
 
   m_device.destroy(raygenSM);
   m_device.destroy(missSM);
@@ -886,7 +1016,7 @@ void HelloVulkan::raytrace(const vk::CommandBuffer& cmdBuf, const nvmath::vec4f&
 
   cmdBuf.bindPipeline(vk::PipelineBindPoint::eRayTracingKHR, m_rtPipeline);
   cmdBuf.bindDescriptorSets(vk::PipelineBindPoint::eRayTracingKHR, m_rtPipelineLayout, 0,
-                            {m_rtDescSet, m_descSet}, {});
+                            {frameRtDescSet(), frameDescSet()}, {});
   cmdBuf.pushConstants<RtPushConstant>(m_rtPipelineLayout,
                                        vk::ShaderStageFlagBits::eRaygenKHR
                                            | vk::ShaderStageFlagBits::eClosestHitKHR
@@ -917,96 +1047,524 @@ void HelloVulkan::raytrace(const vk::CommandBuffer& cmdBuf, const nvmath::vec4f&
 //////////////////////////////////////////////////////////////////////////
 // #VK_animation
 
-void HelloVulkan::animationInstances(float time)
+void HelloVulkan::animationInstances(float time, const vk::CommandBuffer& cmdBuf)
 {
-  const int32_t nbWuson     = static_cast<int32_t>(m_objInstance.size() - 2);
-  const float   deltaAngle  = 6.28318530718f / static_cast<float>(nbWuson);
-  const float   wusonLength = 3.f;
-  const float   radius      = wusonLength / (2.f * sin(deltaAngle / 2.0f));
-  const float   offset      = time * 0.5f;
-
-  for(int i = 0; i < nbWuson; i++)
+  std::vector<RaytracingBuilder::InstanceRange> dirty;
+  if(m_animateInstances)
   {
-    int          wusonIdx = i + 1;
-    ObjInstance& inst     = m_objInstance[wusonIdx];
-    inst.transform        = nvmath::rotation_mat4_y(i * deltaAngle + offset)
-                     * nvmath::translation_mat4(radius, 0.f, 0.f);
-    inst.transformIT = nvmath::transpose(nvmath::invert(inst.transform));
-
-    nvvk::RaytracingBuilderKHR::Instance& tinst = m_tlas[wusonIdx];
-    tinst.transform                             = inst.transform;
+    const int32_t nbWuson     = static_cast<int32_t>(m_objInstance.size() - 2);
+    const float   deltaAngle  = 6.28318530718f / static_cast<float>(nbWuson);
+    const float   wusonLength = 3.f;
+    const float   radius      = wusonLength / (2.f * sin(deltaAngle / 2.0f));
+    const float   offset      = time * 0.5f;
+
+    // Writing the matrices in the slots of this frame, and copying the scene description slot in
+    // the frame command buffer. The Wuson instances start at 1.
+    vk::DeviceSize                        bufferSize = m_objInstance.size() * sizeof(ObjInstance);
+    vk::DeviceSize                        slotOffset = getCurFrame() * m_instStagingSlotSize;
+    uint8_t*                              sceneSlot  = m_instStagingMapped + slotOffset;
+    vk::AccelerationStructureInstanceKHR* tlasSlot   = nullptr;
+    if(m_asyncCompute)
+      tlasSlot = m_tlasStagingMapped + (getCurFrame() * 2 + m_frameSet) * m_tlas.size() + 1;
+    ObjInstance* sceneInst = reinterpret_cast<ObjInstance*>(sceneSlot) + 1;
+
+    m_wusonTransforms.resize(nbWuson);
+    m_wusonTransforms.compute(
+        [&](size_t i) {
+          float angle = static_cast<float>(i) * deltaAngle + offset;
+          m_wusonTransforms.setWorld(
+              i, nvmath::rotation_mat4_y(angle) * nvmath::translation_mat4(radius, 0.f, 0.f));
+        },
+        [&](size_t begin, size_t end) {
+          m_wusonTransforms.writeWorld(begin, end, sceneInst, &ObjInstance::transform);
+          m_wusonTransforms.writeNormal(begin, end, sceneInst, &ObjInstance::transformIT);
+          m_wusonTransforms.writeWorld(begin, end, &m_tlas[1],
+                                       &RaytracingBuilder::Instance::transform);
+          if(tlasSlot)
+            m_wusonTransforms.writeTlasTransforms(begin, end, tlasSlot);
+        });
+    m_tlasSlotWritten = tlasSlot != nullptr;
+
+    // The previous frame may still be reading the scene description
+    cmdBuf.pipelineBarrier(vk::PipelineStageFlagBits::eVertexShader
+                               | vk::PipelineStageFlagBits::eFragmentShader
+                               | vk::PipelineStageFlagBits::eRayTracingShaderKHR,
+                           vk::PipelineStageFlagBits::eTransfer, {}, {}, {}, {});
+    cmdBuf.copyBuffer(m_instStaging.buffer, m_sceneDesc.buffer,
+                      vk::BufferCopy(slotOffset, 0, bufferSize));
+    vk::BufferMemoryBarrier barrier(vk::AccessFlagBits::eTransferWrite,
+                                    vk::AccessFlagBits::eShaderRead, VK_QUEUE_FAMILY_IGNORED,
+                                    VK_QUEUE_FAMILY_IGNORED, m_sceneDesc.buffer, 0, bufferSize);
+    cmdBuf.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer,
+                           vk::PipelineStageFlagBits::eVertexShader
+                               | vk::PipelineStageFlagBits::eFragmentShader
+                               | vk::PipelineStageFlagBits::eRayTracingShaderKHR,
+                           {}, {}, {barrier}, {});
+    dirty.push_back({1, static_cast<uint32_t>(nbWuson)});
   }
 
-  // Update the buffer
-  vk::DeviceSize bufferSize = m_objInstance.size() * sizeof(ObjInstance);
-  nvvk::Buffer stagingBuffer = m_alloc.createBuffer(bufferSize, vk::BufferUsageFlagBits::eTransferSrc,
-                                                  vk::MemoryPropertyFlagBits::eHostVisible);
-  // Copy data to staging buffer
-  auto* gInst = m_alloc.map(stagingBuffer);
-  memcpy(gInst, m_objInstance.data(), bufferSize);
-  m_alloc.unmap(stagingBuffer);
-  // Copy staging buffer to the Scene Description buffer
-  nvvk::CommandPool genCmdBuf(m_device, m_graphicsQueueIndex);
-  vk::CommandBuffer cmdBuf = genCmdBuf.createCommandBuffer();
-  cmdBuf.copyBuffer(stagingBuffer.buffer, m_sceneDesc.buffer, vk::BufferCopy(0, 0, bufferSize));
-  m_debug.endLabel(cmdBuf);
-  genCmdBuf.submitAndWait(cmdBuf);
-  m_alloc.destroy(stagingBuffer);
+  // Only the moving instances are written. Those referencing a refit BLAS are also marked,
+  // as their bounds changed.
+  for(uint32_t i = 0; i < static_cast<uint32_t>(m_tlas.size()); i++)
+  {
+    if(std::find(m_animatedModels.begin(), m_animatedModels.end(), m_tlas[i].blasId)
+       != m_animatedModels.end())
+      dirty.push_back({i, 1});
+  }
 
-  m_rtBuilder.updateTlasMatrices(m_tlas);
-  m_rtBuilder.updateBlas(2);
+  // The TLAS depends on the bounds of the BLAS, refit before the frame by animationObject(). With
+  // async compute, both are updated in animationCompute(), from the same ranges.
+  if(m_asyncCompute)
+  {
+    m_tlasDirty = std::move(dirty);
+    return;
+  }
+  GpuProfiler::Section section(m_profiler, cmdBuf, "TLAS update");
+  m_rtBuilder.cmdUpdateTlas(cmdBuf, getCurFrame(), m_tlas, std::move(dirty));
 }
 
+//--------------------------------------------------------------------------------------------------
+// Animating the vertices and refitting their BLAS, timed in the same command buffer
+//
 void HelloVulkan::animationObject(float time)
 {
-  ObjModel& model = m_objModel[2];
-
-  updateCompDescriptors(model.vertexBuffer);
-
   nvvk::CommandPool genCmdBuf(m_device, m_graphicsQueueIndex);
   vk::CommandBuffer cmdBuf = genCmdBuf.createCommandBuffer();
+  {
+    GpuProfiler::Section section(m_profiler, cmdBuf, "Animation");
+    cmdAnimateObjects(cmdBuf, time);
+  }
 
-  cmdBuf.bindPipeline(vk::PipelineBindPoint::eCompute, m_compPipeline);
-  cmdBuf.bindDescriptorSets(vk::PipelineBindPoint::eCompute, m_compPipelineLayout, 0,
-                            {m_compDescSet}, {});
-  cmdBuf.pushConstants(m_compPipelineLayout, vk::ShaderStageFlagBits::eCompute, 0, sizeof(float),
-                       &time);
-  cmdBuf.dispatch(model.nbVertices, 1, 1);
+  vk::MemoryBarrier vertexBarrier(vk::AccessFlagBits::eShaderWrite,
+                                  vk::AccessFlagBits::eAccelerationStructureReadKHR);
+  cmdBuf.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader,
+                         vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR, {},
+                         {vertexBarrier}, {}, {});
+  {
+    GpuProfiler::Section section(m_profiler, cmdBuf, "BLAS refit");
+    vk::DeviceAddress    scratchAddress = m_device.getBufferAddress({m_asScratch.buffer});
+    vk::DeviceSize       scratchOffset{0};
+    for(auto objIndex : m_animatedModels)
+    {
+      m_rtBuilder.cmdUpdateBlas(cmdBuf, objIndex, scratchAddress + scratchOffset);
+      scratchOffset += m_rtBuilder.getBlasUpdateScratchSize(objIndex);
+    }
+  }
   genCmdBuf.submitAndWait(cmdBuf);
 }
 
+//--------------------------------------------------------------------------------------------------
+// The BLAS are refit together, each in its own region of the scratch buffer. The asynchronous
+// TLAS update comes after them and reuses the beginning of the buffer: the synchronous one uses
+// the scratch of the builder. Both animation sets have the same sizes, and their updates are
+// serialized on the compute queue.
+//
+void HelloVulkan::createAsUpdateScratch()
+{
+  using vkBU = vk::BufferUsageFlagBits;
+
+  vk::DeviceSize blasScratchSize{0};
+  for(auto objIndex : m_animatedModels)
+    blasScratchSize += m_rtBuilder.getBlasUpdateScratchSize(objIndex);
+  vk::DeviceSize scratchSize = std::max(blasScratchSize, m_rtBuilder.getTlasUpdateScratchSize());
+  m_asScratch = createSharedBuffer(scratchSize, vkBU::eRayTracingKHR | vkBU::eShaderDeviceAddress,
+                                   vk::MemoryPropertyFlagBits::eDeviceLocal);
+  m_debug.setObjectName(m_asScratch.buffer, "asUpdateScratch");
+}
+
 //////////////////////////////////////////////////////////////////////////
 // #VK_compute
+
+// Entry of the table read by anim.comp, pointing to the vertices of an animated model
+struct DeformTarget
+{
+  vk::DeviceAddress vertexAddress;
+  uint32_t          nbVertices;
+  uint32_t          pad;
+};
+
+//--------------------------------------------------------------------------------------------------
+// The compute shader reads the table of the animated models (m_animatedModels), and accesses the
+// vertices through their device address. The table is static: the descriptor set is written once.
+//
 void HelloVulkan::createCompDescriptors()
 {
+  using vkBU = vk::BufferUsageFlagBits;
+
   m_compDescSetLayoutBind.addBinding(vk::DescriptorSetLayoutBinding(
       0, vk::DescriptorType::eStorageBuffer, 1, vk::ShaderStageFlagBits::eCompute));
 
   m_compDescSetLayout = m_compDescSetLayoutBind.createLayout(m_device);
-  m_compDescPool      = m_compDescSetLayoutBind.createPool(m_device, 1);
+  m_compDescPool      = m_compDescSetLayoutBind.createPool(m_device, m_asyncCompute ? 2 : 1);
   m_compDescSet       = nvvk::allocateDescriptorSet(m_device, m_compDescPool, m_compDescSetLayout);
+  writeCompDescriptorSet(m_compDescSet, m_objModel, m_compTargets);
 }
 
-void HelloVulkan::updateCompDescriptors(nvvk::Buffer& vertex)
+// Table of the vertices of the animated `models` in `targets`, read through `descSet`
+void HelloVulkan::writeCompDescriptorSet(vk::DescriptorSet            descSet,
+                                         const std::vector<ObjModel>& models,
+                                         nvvk::Buffer&                targets)
 {
+  using vkBU = vk::BufferUsageFlagBits;
+
+  std::vector<DeformTarget> table;
+  m_compMaxVertices = 0;
+  for(auto objIndex : m_animatedModels)
+  {
+    const ObjModel& model = models[objIndex];
+    vk::DeviceAddress vertexAddress = m_device.getBufferAddress({model.vertexBuffer.buffer});
+    table.push_back({vertexAddress, model.nbVertices, 0});
+    m_compMaxVertices = std::max(m_compMaxVertices, model.nbVertices);
+  }
+
+  // Read by the compute queue
+  nvvk::CommandPool cmdGen(m_device, m_graphicsQueueIndex);
+  auto              cmdBuf = cmdGen.createCommandBuffer();
+  targets = createGeometryBuffer(cmdBuf, table.size() * sizeof(DeformTarget), table.data(),
+                                 vkBU::eStorageBuffer);
+  cmdGen.submitAndWait(cmdBuf);
+  m_alloc.finalizeAndReleaseStaging();
+  for(auto& b : m_sharedUploads)
+    m_alloc.destroy(b);
+  m_sharedUploads.clear();
+  m_debug.setObjectName(targets.buffer, "deformTargets");
+
   std::vector<vk::WriteDescriptorSet> writes;
-  vk::DescriptorBufferInfo            dbiUnif{vertex.buffer, 0, VK_WHOLE_SIZE};
-  writes.emplace_back(m_compDescSetLayoutBind.makeWrite(m_compDescSet, 0, &dbiUnif));
+  vk::DescriptorBufferInfo            dbiTargets{targets.buffer, 0, VK_WHOLE_SIZE};
+  writes.emplace_back(m_compDescSetLayoutBind.makeWrite(descSet, 0, &dbiTargets));
   m_device.updateDescriptorSets(static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
 }
 
+//--------------------------------------------------------------------------------------------------
+// The workgroup size is a specialization constant, the largest power of two up to 256 the
+// device supports
+//
 void HelloVulkan::createCompPipelines()
 {
+  vk::PhysicalDeviceLimits limits = m_physicalDevice.getProperties().limits;
+  m_compWorkgroupSize             = 256;
+  while(m_compWorkgroupSize > limits.maxComputeWorkGroupSize[0]
+        || m_compWorkgroupSize > limits.maxComputeWorkGroupInvocations)
+    m_compWorkgroupSize /= 2;
+
   // pushing time
   vk::PushConstantRange push_constants = {vk::ShaderStageFlagBits::eCompute, 0, sizeof(float)};
   vk::PipelineLayoutCreateInfo layout_info{{}, 1, &m_compDescSetLayout, 1, &push_constants};
   m_compPipelineLayout = m_device.createPipelineLayout(layout_info);
   vk::ComputePipelineCreateInfo computePipelineCreateInfo{{}, {}, m_compPipelineLayout};
 
+  vk::SpecializationMapEntry specEntry{0, 0, sizeof(uint32_t)};
+  vk::SpecializationInfo     specInfo{1, &specEntry, sizeof(uint32_t), &m_compWorkgroupSize};
+
   computePipelineCreateInfo.stage =
       nvvk::createShaderStageInfo(m_device,
                                   nvh::loadFile("shaders/anim.comp.spv", true, defaultSearchPaths),
                                   VK_SHADER_STAGE_COMPUTE_BIT);
-  m_compPipeline = m_device.createComputePipeline({}, computePipelineCreateInfo, nullptr);
+  computePipelineCreateInfo.stage.setPSpecializationInfo(&specInfo);
+  {
+    PipelineCache::Timer timer(m_pipelineCache, "compute");
+    m_compPipeline =
+        m_device.createComputePipeline(m_pipelineCache.get(), computePipelineCreateInfo, nullptr);
+  }
   m_device.destroy(computePipelineCreateInfo.stage.module);
 }
+
+//--------------------------------------------------------------------------------------------------
+// Animating all models of m_animatedModels in one dispatch: X covers the vertices of the largest
+// model, Y selects the model
+//
+void HelloVulkan::cmdAnimateObjects(const vk::CommandBuffer& cmdBuf, float time)
+{
+  uint32_t nbGroups = (m_compMaxVertices + m_compWorkgroupSize - 1) / m_compWorkgroupSize;
+
+  cmdBuf.bindPipeline(vk::PipelineBindPoint::eCompute, m_compPipeline);
+  cmdBuf.bindDescriptorSets(vk::PipelineBindPoint::eCompute, m_compPipelineLayout, 0,
+                            {frameCompDescSet()}, {});
+  cmdBuf.pushConstants(m_compPipelineLayout, vk::ShaderStageFlagBits::eCompute, 0, sizeof(float),
+                       &time);
+  cmdBuf.dispatch(nbGroups, static_cast<uint32_t>(m_animatedModels.size()), 1);
+}
+
+//////////////////////////////////////////////////////////////////////////
+// #VK_async_compute
+
+//--------------------------------------------------------------------------------------------------
+// Using `computeQueue` for the animation and the acceleration structure updates.
+// Must be called before loading the models, as the geometry buffers may need to be shared.
+//
+void HelloVulkan::setupAsyncCompute(vk::Queue computeQueue, uint32_t computeQueueFamily)
+{
+  m_asyncCompute      = true;
+  m_computeQueue      = computeQueue;
+  m_computeQueueIndex = computeQueueFamily;
+}
+
+const std::vector<HelloVulkan::ObjModel>& HelloVulkan::frameModels() const
+{
+  return m_frameSet == 0 ? m_objModel : m_animSet.objModel;
+}
+RaytracingBuilder& HelloVulkan::frameRtBuilder()
+{
+  return m_frameSet == 0 ? m_rtBuilder : m_animSet.rtBuilder;
+}
+vk::DescriptorSet HelloVulkan::frameDescSet() const
+{
+  return m_frameSet == 0 ? m_descSet : m_animSet.descSet;
+}
+vk::DescriptorSet HelloVulkan::frameRtDescSet() const
+{
+  return m_frameSet == 0 ? m_rtDescSet : m_animSet.rtDescSet;
+}
+vk::DescriptorSet HelloVulkan::frameCompDescSet() const
+{
+  return m_frameSet == 0 ? m_compDescSet : m_animSet.compDescSet;
+}
+
+//--------------------------------------------------------------------------------------------------
+// Command buffers, semaphores and buffers used by animationCompute(), one per frame in flight
+// when they are rewritten each frame, and the second animation set. Called after the acceleration
+// structures, the descriptor sets and the compute pipeline are created.
+//
+void HelloVulkan::createAsyncComputeResources()
+{
+  using vkBU = vk::BufferUsageFlagBits;
+  using vkMP = vk::MemoryPropertyFlagBits;
+
+  uint32_t nbFrames = static_cast<uint32_t>(getCommandBuffers().size());
+
+  m_computeCmdPool = m_device.createCommandPool(
+      {vk::CommandPoolCreateFlagBits::eResetCommandBuffer, m_computeQueueIndex});
+  m_computeCmdBufs = m_device.allocateCommandBuffers(
+      {m_computeCmdPool, vk::CommandBufferLevel::ePrimary, nbFrames});
+  for(uint32_t i = 0; i < nbFrames; i++)
+    m_computeDone.push_back(m_device.createSemaphore({}));
+  for(auto& s : m_setReleased)
+    s = m_device.createSemaphore({});
+
+  // Second animation set: copies of the animated vertices, and acceleration structures built on
+  // them. anim.comp computes the positions from their initial x and z, so both sets animate the
+  // same way.
+  m_animSet.objModel = m_objModel;
+  nvvk::CommandPool cmdGen(m_device, m_graphicsQueueIndex);
+  vk::CommandBuffer cmdBuf = cmdGen.createCommandBuffer();
+  for(auto objIndex : m_animatedModels)
+  {
+    ObjModel&      model = m_animSet.objModel[objIndex];
+    vk::DeviceSize size  = model.nbVertices * sizeof(VertexObj);
+    model.vertexBuffer =
+        createSharedBuffer(size,
+                           vkBU::eVertexBuffer | vkBU::eStorageBuffer | vkBU::eShaderDeviceAddress
+                               | vkBU::eTransferDst,
+                           vkMP::eDeviceLocal);
+    cmdBuf.copyBuffer(m_objModel[objIndex].vertexBuffer.buffer, model.vertexBuffer.buffer,
+                      vk::BufferCopy(0, 0, size));
+    m_debug.setObjectName(model.vertexBuffer.buffer,
+                          (std::string("vertex_" + std::to_string(objIndex) + "_set1").c_str()));
+  }
+  vk::MemoryBarrier copyBarrier(vk::AccessFlagBits::eTransferWrite,
+                                vk::AccessFlagBits::eAccelerationStructureReadKHR);
+  cmdBuf.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer,
+                         vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR, {},
+                         {copyBarrier}, {}, {});
+  cmdGen.submitAndWait(cmdBuf);
+
+  m_animSet.rtBuilder.setup(m_device, &m_alloc, m_graphicsQueueIndex);
+  m_animSet.rtBuilder.setQueueFamilies({m_graphicsQueueIndex, m_computeQueueIndex});
+  m_animSet.rtBuilder.buildBlas(blasGeometries(m_animSet.objModel), {});
+  m_animSet.rtBuilder.buildTlas(m_tlas, tlasFlags());
+  m_animSet.rtBuilder.releaseScratch();
+
+  // Descriptor sets of the second set: the same as the first one, but the vertices and the TLAS
+  m_animSet.descSet = nvvk::allocateDescriptorSet(m_device, m_descPool, m_descSetLayout);
+  m_animSet.rtDescSet =
+      m_device.allocateDescriptorSets({m_rtDescPool, 1, &m_rtDescSetLayout})[0];
+  m_animSet.compDescSet =
+      nvvk::allocateDescriptorSet(m_device, m_compDescPool, m_compDescSetLayout);
+
+  std::vector<vk::CopyDescriptorSet> copies;
+  for(uint32_t binding = 0; binding <= 6; binding++)
+  {
+    uint32_t count = binding == 0 || binding == 2 ? 1 : static_cast<uint32_t>(m_objModel.size());
+    if(binding == 3)
+      count = static_cast<uint32_t>(m_textures.size());
+    if(binding != 5 && count > 0)
+      copies.emplace_back(m_descSet, binding, 0, m_animSet.descSet, binding, 0, count);
+  }
+  std::vector<vk::DescriptorBufferInfo> dbiVert;
+  for(auto& obj : m_animSet.objModel)
+    dbiVert.emplace_back(obj.vertexBuffer.buffer, 0, VK_WHOLE_SIZE);
+
+  vk::AccelerationStructureKHR tlas = m_animSet.rtBuilder.getAccelerationStructure();
+  vk::WriteDescriptorSetAccelerationStructureKHR descASInfo;
+  descASInfo.setAccelerationStructureCount(1);
+  descASInfo.setPAccelerationStructures(&tlas);
+  vk::DescriptorImageInfo imageInfo{
+      {}, m_offscreenColor.descriptor.imageView, vk::ImageLayout::eGeneral};
+
+  std::vector<vk::WriteDescriptorSet> writes;
+  writes.emplace_back(m_descSetLayoutBind.makeWriteArray(m_animSet.descSet, 5, dbiVert.data()));
+  writes.emplace_back(m_rtDescSetLayoutBind.makeWrite(m_animSet.rtDescSet, 0, &descASInfo));
+  writes.emplace_back(m_rtDescSetLayoutBind.makeWrite(m_animSet.rtDescSet, 1, &imageInfo));
+  m_device.updateDescriptorSets(writes, copies);
+  writeCompDescriptorSet(m_animSet.compDescSet, m_animSet.objModel, m_animSet.compTargets);
+
+  // TLAS instances written by the CPU in the slot of the frame and of its set, then copied by the
+  // compute queue. The records reference the BLAS of their set.
+  vk::DeviceSize slotSize = m_tlas.size() * sizeof(vk::AccelerationStructureInstanceKHR);
+  m_tlasStaging           = createSharedBuffer(slotSize * nbFrames * 2, vkBU::eTransferSrc,
+                                     vkMP::eHostVisible | vkMP::eHostCoherent);
+  m_tlasStagingMapped =
+      reinterpret_cast<vk::AccelerationStructureInstanceKHR*>(m_alloc.map(m_tlasStaging));
+  m_debug.setObjectName(m_tlasStaging.buffer, "tlasStaging");
+  // The records are complete in every slot, animationInstances then only writes the transforms
+  for(uint32_t i = 0; i < nbFrames; i++)
+  {
+    m_rtBuilder.writeInstances(m_tlas, m_tlasStagingMapped + (i * 2 + 0) * m_tlas.size());
+    m_animSet.rtBuilder.writeInstances(m_tlas, m_tlasStagingMapped + (i * 2 + 1) * m_tlas.size());
+  }
+}
+
+void HelloVulkan::destroyAsyncComputeResources()
+{
+  for(auto& s : m_computeDone)
+    m_device.destroy(s);
+  for(auto& s : m_setReleased)
+    m_device.destroy(s);
+  m_computeDone.clear();
+  m_device.destroy(m_computeCmdPool);
+  m_alloc.unmap(m_tlasStaging);
+  m_alloc.destroy(m_tlasStaging);
+
+  // The descriptor sets are freed with their pools
+  for(auto objIndex : m_animatedModels)
+    m_alloc.destroy(m_animSet.objModel[objIndex].vertexBuffer);
+  m_animSet.rtBuilder.destroy();
+  m_alloc.destroy(m_animSet.compTargets);
+}
+
+//--------------------------------------------------------------------------------------------------
+// Animating the vertices, refitting the BLAS and updating the TLAS of the set of the frame on the
+// compute queue. Must be called after prepareFrame() and animationInstances(), which updates the
+// instances. The graphics submission of this frame waits on it (see submitFrame), and it waits on
+// the graphics submission which last read the set, two frames before: the tracing of the previous
+// frame, on the other set, can run at the same time.
+//
+void HelloVulkan::animationCompute(float time)
+{
+  uint32_t                 frame     = getCurFrame();
+  const vk::CommandBuffer& cmdBuf    = m_computeCmdBufs[frame];
+  RaytracingBuilder&       rtBuilder = frameRtBuilder();
+
+  cmdBuf.begin({vk::CommandBufferUsageFlagBits::eOneTimeSubmit});
+
+  // Vertex animation
+  {
+    GpuProfiler::Section section(m_profiler, cmdBuf, "Animation");
+    cmdAnimateObjects(cmdBuf, time);
+  }
+
+  vk::MemoryBarrier vertexBarrier(vk::AccessFlagBits::eShaderWrite,
+                                  vk::AccessFlagBits::eAccelerationStructureReadKHR);
+  cmdBuf.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader,
+                         vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR, {},
+                         {vertexBarrier}, {}, {});
+
+  // BLAS refits, the TLAS update reads their bounds and reuses the scratch buffer
+  uint32_t          asSection = m_profiler.cmdBegin(cmdBuf, "AS update");
+  vk::DeviceAddress scratchAddress = m_device.getBufferAddress({m_asScratch.buffer});
+  vk::DeviceSize    scratchOffset{0};
+  for(auto objIndex : m_animatedModels)
+  {
+    rtBuilder.cmdUpdateBlas(cmdBuf, objIndex, scratchAddress + scratchOffset);
+    scratchOffset += rtBuilder.getBlasUpdateScratchSize(objIndex);
+  }
+
+  vk::MemoryBarrier blasBarrier(vk::AccessFlagBits::eAccelerationStructureWriteKHR,
+                                vk::AccessFlagBits::eAccelerationStructureReadKHR
+                                    | vk::AccessFlagBits::eAccelerationStructureWriteKHR);
+  cmdBuf.pipelineBarrier(vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR,
+                         vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR
+                             | vk::PipelineStageFlagBits::eTransfer,
+                         {}, {blasBarrier}, {}, {});
+
+  // TLAS update from the instances written in the slot of this frame. The other records of the
+  // slot are the ones of the last update of the set: only the dirty ranges are copied.
+  vk::DeviceSize slotOffset = (frame * 2 + m_frameSet) * m_tlas.size();
+  if(!m_tlasSlotWritten)
+  {
+    rtBuilder.writeInstances(m_tlas, m_tlasStagingMapped + slotOffset);
+    m_tlasDirty = {{0, static_cast<uint32_t>(m_tlas.size())}};
+  }
+  m_tlasSlotWritten = false;
+  rtBuilder.cmdUpdateTlas(cmdBuf, m_tlasStaging.buffer,
+                          slotOffset * sizeof(vk::AccelerationStructureInstanceKHR), m_tlas,
+                          std::move(m_tlasDirty), scratchAddress);
+  m_tlasDirty.clear();
+  m_profiler.cmdEnd(cmdBuf, asSection);
+
+  // The next update, of the other set, reuses the scratch buffer
+  vk::MemoryBarrier scratchBarrier(vk::AccessFlagBits::eAccelerationStructureWriteKHR,
+                                   vk::AccessFlagBits::eAccelerationStructureReadKHR
+                                       | vk::AccessFlagBits::eAccelerationStructureWriteKHR);
+  cmdBuf.pipelineBarrier(vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR,
+                         vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR, {},
+                         {scratchBarrier}, {}, {});
+
+  cmdBuf.end();
+
+  vk::PipelineStageFlags waitStage = vk::PipelineStageFlagBits::eComputeShader
+                                     | vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR
+                                     | vk::PipelineStageFlagBits::eTransfer;
+  vk::SubmitInfo submitInfo;
+  if(m_setPending[m_frameSet])
+  {
+    submitInfo.setWaitSemaphoreCount(1);
+    submitInfo.setPWaitSemaphores(&m_setReleased[m_frameSet]);
+    submitInfo.setPWaitDstStageMask(&waitStage);
+    m_setPending[m_frameSet] = false;
+  }
+  submitInfo.setCommandBufferCount(1);
+  submitInfo.setPCommandBuffers(&cmdBuf);
+  submitInfo.setSignalSemaphoreCount(1);
+  submitInfo.setPSignalSemaphores(&m_computeDone[frame]);
+  m_computeQueue.submit(submitInfo, {});
+}
+
+//--------------------------------------------------------------------------------------------------
+// Same as AppBase::submitFrame(), but also waiting on the compute submission of the frame, and
+// signaling the next compute submission updating the same set. The next frame uses the other set.
+//
+void HelloVulkan::submitFrame()
+{
+  if(!m_asyncCompute)
+  {
+    AppBase::submitFrame();
+    return;
+  }
+
+  uint32_t frame = m_swapChain.getActiveImageIndex();
+  m_device.resetFences(m_waitFences[frame]);
+
+  std::array<vk::Semaphore, 2> waitSemaphores{m_swapChain.getActiveReadSemaphore(),
+                                              m_computeDone[frame]};
+  std::array<vk::PipelineStageFlags, 2> waitStages{
+      vk::PipelineStageFlagBits::eColorAttachmentOutput,
+      vk::PipelineStageFlagBits::eVertexInput | vk::PipelineStageFlagBits::eVertexShader
+          | vk::PipelineStageFlagBits::eRayTracingShaderKHR};
+  std::array<vk::Semaphore, 2> signalSemaphores{m_swapChain.getActiveWrittenSemaphore(),
+                                                m_setReleased[m_frameSet]};
+
+  vk::SubmitInfo submitInfo;
+  submitInfo.setWaitSemaphoreCount(static_cast<uint32_t>(waitSemaphores.size()));
+  submitInfo.setPWaitSemaphores(waitSemaphores.data());
+  submitInfo.setPWaitDstStageMask(waitStages.data());
+  submitInfo.setCommandBufferCount(1);
+  submitInfo.setPCommandBuffers(&m_commandBuffers[frame]);
+  submitInfo.setSignalSemaphoreCount(static_cast<uint32_t>(signalSemaphores.size()));
+  submitInfo.setPSignalSemaphores(signalSemaphores.data());
+  m_queue.submit(submitInfo, m_waitFences[frame]);
+  m_setPending[m_frameSet] = true;
+  m_frameSet               = 1 - m_frameSet;
+
+  m_swapChain.present(m_queue);
+}
@@ -33,7 +33,11 @@
 #include "nvvk/descriptorsets_vk.hpp"
 
 // #VKRay
+#include "gpu_profiler.hpp"
+#include "instance_transforms.hpp"
 #include "nvvk/raytraceKHR_vk.hpp"
+#include "pipeline_cache.hpp"
+#include "raytrace_builder.hpp"
 
 //--------------------------------------------------------------------------------------------------
 // Simple rasterizer of OBJ objects
@@ -109,7 +113,9 @@ public:
   std::vector<nvvk::Texture> m_textures;   // vector of all textures of the scene
 
   nvvk::AllocatorDedicated m_alloc;  // Allocator for buffer, images, acceleration structures
-  nvvk::DebugUtil          m_debug;  // Utility to name objects
+  nvvk::DebugUtil          m_debug;     // Utility to name objects
+  PipelineCache            m_pipelineCache;
+  GpuProfiler              m_profiler;  // GPU time of the passes of the frames
 
   // #Post
   void createOffscreenRender();
@@ -134,8 +140,10 @@ public:
   // #VKRay
   void                             initRayTracing();
   nvvk::RaytracingBuilderKHR::Blas objectToVkGeometryKHR(const ObjModel& model);
-  void                             createBottomLevelAS();
-  void                             createTopLevelAS();
+  std::vector<nvvk::RaytracingBuilderKHR::Blas> blasGeometries(const std::vector<ObjModel>& models);
+  vk::BuildAccelerationStructureFlagsKHR        tlasFlags() const;
+  void                                          createBottomLevelAS();
+  void                                          createTopLevelAS();
   void                             createRtDescriptorSet();
   void                             updateRtDescriptorSet();
   void                             createRtPipeline();
@@ -144,7 +152,7 @@ public:
 
 
   vk::PhysicalDeviceRayTracingPropertiesKHR           m_rtProperties;
-  nvvk::RaytracingBuilderKHR                          m_rtBuilder;
+  RaytracingBuilder                                   m_rtBuilder;
   nvvk::DescriptorSetBindings                         m_rtDescSetLayoutBind;
   vk::DescriptorPool                                  m_rtDescPool;
   vk::DescriptorSetLayout                             m_rtDescSetLayout;
@@ -166,13 +174,91 @@ public:
   } m_rtPushConstants;
 
   // #VK_animation
-  void animationInstances(float time);
+  void animationInstances(float time, const vk::CommandBuffer& cmdBuf);
   void animationObject(float time);
+  void createAsUpdateScratch();
+
+  bool m_animateInstances{true};  // The Wuson instances turn around the sphere
+
+  nvvk::Buffer   m_instStaging;  // Host visible ring of scene descriptions, one slot per frame
+  uint8_t*       m_instStagingMapped{nullptr};
+  vk::DeviceSize m_instStagingSlotSize{0};
+
+  // Matrices of the Wuson instances, written in the slots of the frame and in m_tlas. The
+  // matrices of m_objInstance stay the initial ones.
+  InstanceTransforms m_wusonTransforms;
+
+  nvvk::Buffer m_asScratch;  // Scratch of the BLAS refits and of the asynchronous TLAS update
+
+  // #VK_async_compute
+  // The vertex animation, the BLAS refit and the TLAS update are recorded in a command buffer
+  // submitted to the compute queue, and the frame submission waits on it. The animated vertices,
+  // their BLAS and the TLAS exist twice (animation sets), used by every other frame: the compute
+  // work of a frame only waits on the graphics work of the frame before the previous one, which
+  // used the same set, so it overlaps the tracing of the previous frame.
+  void setupAsyncCompute(vk::Queue computeQueue, uint32_t computeQueueFamily);
+  void createAsyncComputeResources();
+  void destroyAsyncComputeResources();
+  void animationCompute(float time);
+  void submitFrame();
+  nvvk::Buffer createSharedBuffer(vk::DeviceSize          size,
+                                  vk::BufferUsageFlags    usage,
+                                  vk::MemoryPropertyFlags memProps);
+  nvvk::Buffer createGeometryBuffer(const vk::CommandBuffer& cmdBuf,
+                                    vk::DeviceSize           size,
+                                    const void*              data,
+                                    vk::BufferUsageFlags     usage);
+
+  // Resources of the animation set of the current frame
+  const std::vector<ObjModel>& frameModels() const;
+  RaytracingBuilder&           frameRtBuilder();
+  vk::DescriptorSet            frameDescSet() const;
+  vk::DescriptorSet            frameRtDescSet() const;
+  vk::DescriptorSet            frameCompDescSet() const;
+
+  // Second animation set, the first one being m_objModel, m_rtBuilder and their descriptor sets.
+  // Only the animated models have their own vertex buffers, the other buffers are the ones of
+  // m_objModel. The BLAS of the static models are built again, keeping the builders independent.
+  struct AnimationSet
+  {
+    std::vector<ObjModel> objModel;
+    RaytracingBuilder     rtBuilder;
+    nvvk::Buffer          compTargets;
+    vk::DescriptorSet     descSet;
+    vk::DescriptorSet     rtDescSet;
+    vk::DescriptorSet     compDescSet;
+  };
+
+  bool                           m_asyncCompute{false};
+  vk::Queue                      m_computeQueue;
+  uint32_t                       m_computeQueueIndex{0};
+  vk::CommandPool                m_computeCmdPool;
+  std::vector<vk::CommandBuffer> m_computeCmdBufs;  // One per frame in flight
+  std::vector<vk::Semaphore>     m_computeDone;     // Compute -> graphics, one per frame
+  AnimationSet                   m_animSet;
+  uint32_t                       m_frameSet{0};  // Animation set of the current frame
+  std::array<vk::Semaphore, 2>   m_setReleased;  // Graphics -> compute, when the set is read
+  std::array<bool, 2>            m_setPending{};  // m_setReleased is signaled and not waited yet
+  nvvk::Buffer                   m_tlasStaging;  // TLAS instances, one slot per frame and set
+  vk::AccelerationStructureInstanceKHR* m_tlasStagingMapped{nullptr};
+  std::vector<nvvk::Buffer>             m_sharedUploads;  // Pending uploads of shared buffers
+
+  // Set when animationInstances wrote the transforms of the frame in its TLAS slot, and the ranges
+  // of instances to update in animationCompute
+  bool                                          m_tlasSlotWritten{false};
+  std::vector<RaytracingBuilder::InstanceRange> m_tlasDirty;
 
   // #VK_compute
   void createCompDescriptors();
-  void updateCompDescriptors(nvvk::Buffer& vertex);
   void createCompPipelines();
+  void cmdAnimateObjects(const vk::CommandBuffer& cmdBuf, float time);
+  void writeCompDescriptorSet(vk::DescriptorSet descSet, const std::vector<ObjModel>& models,
+                              nvvk::Buffer& targets);
+
+  std::vector<uint32_t> m_animatedModels{2};  // Models deformed by anim.comp and refit each frame
+  nvvk::Buffer          m_compTargets;        // Vertex address and count of each animated model
+  uint32_t              m_compMaxVertices{0};
+  uint32_t              m_compWorkgroupSize{256};
 
   nvvk::DescriptorSetBindings m_compDescSetLayoutBind;
   vk::DescriptorPool          m_compDescPool;
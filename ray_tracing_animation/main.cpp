@@ -35,6 +35,8 @@
 #include "imgui.h"
 #include "imgui_impl_glfw.h"
 
+#include "benchmark_run.hpp"
+#include "gpu_profiler_ui.hpp"
 #include "hello_vulkan.h"
 #include "nvh/cameramanipulator.hpp"
 #include "nvh/fileoperations.hpp"
@@ -88,7 +90,8 @@ static int const SAMPLE_HEIGHT = 720;
 //
 int main(int argc, char** argv)
 {
-  UNUSED(argc);
+  // Benchmark runs, see benchmark_run.hpp: -headless -width w -height h -frames n -report file
+  BenchmarkRun bench(argc, argv, SAMPLE_WIDTH, SAMPLE_HEIGHT);
 
   // Setup GLFW window
   glfwSetErrorCallback(onErrorCallback);
@@ -97,11 +100,13 @@ int main(int argc, char** argv)
     return 1;
   }
   glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
-  GLFWwindow* window = glfwCreateWindow(SAMPLE_WIDTH, SAMPLE_HEIGHT,
+  if(bench.headless())
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+  GLFWwindow* window = glfwCreateWindow(bench.width(), bench.height(),
                                         "NVIDIA Vulkan Raytracing Tutorial", nullptr, nullptr);
 
   // Setup camera
-  CameraManip.setWindowSize(SAMPLE_WIDTH, SAMPLE_HEIGHT);
+  CameraManip.setWindowSize(bench.width(), bench.height());
   CameraManip.setLookat(nvmath::vec3f(4, 4, 4), nvmath::vec3f(0, 1, 0), nvmath::vec3f(0, 1, 0));
 
   // Setup Vulkan
@@ -167,7 +172,9 @@ int main(int argc, char** argv)
 
   helloVk.setup(vkctx.m_instance, vkctx.m_device, vkctx.m_physicalDevice,
                 vkctx.m_queueGCT.familyIndex);
-  helloVk.createSurface(surface, SAMPLE_WIDTH, SAMPLE_HEIGHT);
+  helloVk.createSurface(surface, bench.width(), bench.height());
+  helloVk.m_profiler.setup(vkctx.m_device, vkctx.m_physicalDevice,
+                           static_cast<uint32_t>(helloVk.getCommandBuffers().size()));
   helloVk.createDepthBuffer();
   helloVk.createRenderPass();
   helloVk.createFrameBuffers();
@@ -175,6 +182,11 @@ int main(int argc, char** argv)
   // Setup Imgui
   helloVk.initGUI(0);  // Using sub-pass 0
 
+  // #VK_async_compute: the animation and the acceleration structure updates go to the compute
+  // queue when the device has one. This must be known before loading the models.
+  if(vkctx.m_queueC.queue)
+    helloVk.setupAsyncCompute(vkctx.m_queueC.queue, vkctx.m_queueC.familyIndex);
+
   // Creation of the example
   helloVk.loadModel(nvh::findFile("media/scenes/plane.obj", defaultSearchPaths),
                     nvmath::scale_mat4(nvmath::vec3f(2.f, 1.f, 2.f)));
@@ -207,6 +219,9 @@ int main(int argc, char** argv)
   // #VK_compute
   helloVk.createCompDescriptors();
   helloVk.createCompPipelines();
+  helloVk.createAsUpdateScratch();
+  if(helloVk.m_asyncCompute)
+    helloVk.createAsyncComputeResources();
 
 
   nvmath::vec4f clearColor   = nvmath::vec4f(1, 1, 1, 1.00f);
@@ -218,7 +233,7 @@ int main(int argc, char** argv)
   ImGui_ImplGlfw_InitForVulkan(window, true);
 
   // Main loop
-  while(!glfwWindowShouldClose(window))
+  while(!glfwWindowShouldClose(window) && !bench.done())
   {
     glfwPollEvents();
     if(helloVk.isMinimized())
@@ -238,6 +253,8 @@ int main(int argc, char** argv)
       ImGui::Checkbox("Ray Tracer mode", &useRaytracer);  // Switch between raster and ray tracing
 
       renderUI(helloVk);
+      ImGui::Text("Animation on the %s queue", helloVk.m_asyncCompute ? "compute" : "graphics");
+      renderGpuProfilerUI(helloVk.m_profiler);
       ImGui::Text("Application average %.3f ms/frame (%.1f FPS)",
                   1000.0f / ImGui::GetIO().Framerate, ImGui::GetIO().Framerate);
       ImGui::Render();
@@ -245,8 +262,10 @@ int main(int argc, char** argv)
 
     // #VK_animation
     std::chrono::duration<float> diff = std::chrono::system_clock::now() - start;
-    helloVk.animationInstances(diff.count());
-    helloVk.animationObject(diff.count());
+    // Before the synchronous animation, which is timed in its own command buffer
+    helloVk.m_profiler.beginFrame();
+    if(!helloVk.m_asyncCompute)
+      helloVk.animationObject(diff.count());
 
     // Start rendering the scene
     helloVk.prepareFrame();
@@ -257,6 +276,11 @@ int main(int argc, char** argv)
 
     cmdBuff.begin({vk::CommandBufferUsageFlagBits::eOneTimeSubmit});
 
+    // #VK_animation: the instance updates are recorded in the frame command buffer
+    helloVk.animationInstances(diff.count(), cmdBuff);
+    if(helloVk.m_asyncCompute)
+      helloVk.animationCompute(diff.count());
+
     // Clearing screen
     vk::ClearValue clearValues[2];
     clearValues[0].setColor(
@@ -275,10 +299,12 @@ int main(int argc, char** argv)
       // Rendering Scene
       if(useRaytracer)
       {
+        GpuProfiler::Section section(helloVk.m_profiler, cmdBuff, "Ray trace");
         helloVk.raytrace(cmdBuff, clearColor);
       }
       else
       {
+        GpuProfiler::Section section(helloVk.m_profiler, cmdBuff, "Rasterize");
         cmdBuff.beginRenderPass(offscreenRenderPassBeginInfo, vk::SubpassContents::eInline);
         helloVk.rasterize(cmdBuff);
         cmdBuff.endRenderPass();
@@ -294,6 +320,7 @@ int main(int argc, char** argv)
       postRenderPassBeginInfo.setFramebuffer(helloVk.getFramebuffers()[curFrame]);
       postRenderPassBeginInfo.setRenderArea({{}, helloVk.getSize()});
 
+      GpuProfiler::Section section(helloVk.m_profiler, cmdBuff, "Post and UI");
       cmdBuff.beginRenderPass(postRenderPassBeginInfo, vk::SubpassContents::eInline);
       // Rendering tonemapper
       helloVk.drawPost(cmdBuff);
@@ -305,10 +332,12 @@ int main(int argc, char** argv)
     // Submit for display
     cmdBuff.end();
     helloVk.submitFrame();
+    bench.endFrame();
   }
 
   // Cleanup
   helloVk.getDevice().waitIdle();
+  int exitCode = bench.finish(vkctx.m_physicalDevice, helloVk.m_profiler);
   helloVk.destroyResources();
   helloVk.destroy();
 
@@ -317,5 +346,5 @@ int main(int argc, char** argv)
   glfwDestroyWindow(window);
   glfwTerminate();
 
-  return 0;
+  return exitCode;
 }
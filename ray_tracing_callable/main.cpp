@@ -36,6 +36,7 @@ VULKAN_HPP_DEFAULT_DISPATCH_LOADER_DYNAMIC_STORAGE
 #include "imgui.h"
 #include "imgui_impl_glfw.h"
 
+#include "benchmark_run.hpp"
 #include "hello_vulkan.h"
 #include "nvh/cameramanipulator.hpp"
 #include "nvh/fileoperations.hpp"
@@ -104,7 +105,8 @@ static int const SAMPLE_HEIGHT = 720;
 //
 int main(int argc, char** argv)
 {
-  UNUSED(argc);
+  // Benchmark runs, see benchmark_run.hpp: -headless -width w -height h -frames n -report file
+  BenchmarkRun bench(argc, argv, SAMPLE_WIDTH, SAMPLE_HEIGHT);
 
   // Setup GLFW window
   glfwSetErrorCallback(onErrorCallback);
@@ -113,11 +115,13 @@ int main(int argc, char** argv)
     return 1;
   }
   glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
-  GLFWwindow* window = glfwCreateWindow(SAMPLE_WIDTH, SAMPLE_HEIGHT,
+  if(bench.headless())
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+  GLFWwindow* window = glfwCreateWindow(bench.width(), bench.height(),
                                         "NVIDIA Vulkan Raytracing Tutorial", nullptr, nullptr);
 
   // Setup camera
-  CameraManip.setWindowSize(SAMPLE_WIDTH, SAMPLE_HEIGHT);
+  CameraManip.setWindowSize(bench.width(), bench.height());
   CameraManip.setLookat(nvmath::vec3f(5, 4, -4), nvmath::vec3f(0, 1, 0), nvmath::vec3f(0, 1, 0));
 
   // Setup Vulkan
@@ -176,6 +180,7 @@ int main(int argc, char** argv)
 
   // Create example
   HelloVulkan helloVk;
+  GpuProfiler profiler;  // GPU time of the passes, for the benchmark report
 
   // Window need to be opened to get the surface on which to draw
   const vk::SurfaceKHR surface = helloVk.getVkSurface(vkctx.m_instance, window);
@@ -183,7 +188,9 @@ int main(int argc, char** argv)
 
   helloVk.setup(vkctx.m_instance, vkctx.m_device, vkctx.m_physicalDevice,
                 vkctx.m_queueGCT.familyIndex);
-  helloVk.createSurface(surface, SAMPLE_WIDTH, SAMPLE_HEIGHT);
+  helloVk.createSurface(surface, bench.width(), bench.height());
+  profiler.setup(vkctx.m_device, vkctx.m_physicalDevice,
+                 static_cast<uint32_t>(helloVk.getCommandBuffers().size()));
   helloVk.createDepthBuffer();
   helloVk.createRenderPass();
   helloVk.createFrameBuffers();
@@ -224,7 +231,7 @@ int main(int argc, char** argv)
   ImGui_ImplGlfw_InitForVulkan(window, true);
 
   // Main loop
-  while(!glfwWindowShouldClose(window))
+  while(!glfwWindowShouldClose(window) && !bench.done())
   {
     glfwPollEvents();
     if(helloVk.isMinimized())
@@ -250,6 +257,7 @@ int main(int argc, char** argv)
     }
 
     // Start rendering the scene
+    profiler.beginFrame();
     helloVk.prepareFrame();
 
     // Start command buffer of this frame
@@ -276,10 +284,12 @@ int main(int argc, char** argv)
       // Rendering Scene
       if(useRaytracer)
       {
+        GpuProfiler::Section section(profiler, cmdBuff, "Ray trace");
         helloVk.raytrace(cmdBuff, clearColor);
       }
       else
       {
+        GpuProfiler::Section section(profiler, cmdBuff, "Rasterize");
         cmdBuff.beginRenderPass(offscreenRenderPassBeginInfo, vk::SubpassContents::eInline);
         helloVk.rasterize(cmdBuff);
         cmdBuff.endRenderPass();
@@ -306,10 +316,13 @@ int main(int argc, char** argv)
     // Submit for display
     cmdBuff.end();
     helloVk.submitFrame();
+    bench.endFrame();
   }
 
   // Cleanup
   helloVk.getDevice().waitIdle();
+  int exitCode = bench.finish(vkctx.m_physicalDevice, profiler);
+  profiler.destroy();
   helloVk.destroyResources();
   helloVk.destroy();
 
@@ -318,5 +331,5 @@ int main(int argc, char** argv)
   glfwDestroyWindow(window);
   glfwTerminate();
 
-  return 0;
+  return exitCode;
 }
@@ -37,6 +37,8 @@ extern std::vector<std::string> defaultSearchPaths;
 #define VMA_IMPLEMENTATION
 
 #include "hello_vulkan.h"
+#include "instance_transforms.hpp"
+#include "threadpool.hpp"
 #include "nvh//cameramanipulator.hpp"
 #include "nvvk/descriptorsets_vk.hpp"
 #include "nvvk/pipeline_vk.hpp"
@@ -137,6 +139,9 @@ void HelloVulkan::createDescriptorSetLayout()
   // Storing indices (binding = 6)
   m_descSetLayoutBind.addBinding(  //
       vkDS(6, vkDT::eStorageBuffer, nbObj, vkSS::eClosestHitKHR));
+  // Instances of the indirect draws (binding = 7)
+  m_descSetLayoutBind.addBinding(  //
+      vkDS(7, vkDT::eStorageBuffer, 1, vkSS::eVertex));
 
 
   m_descSetLayout = m_descSetLayoutBind.createLayout(m_device);
@@ -156,6 +161,8 @@ void HelloVulkan::updateDescriptorSet()
   writes.emplace_back(m_descSetLayoutBind.makeWrite(m_descSet, 0, &dbiUnif));
   vk::DescriptorBufferInfo dbiSceneDesc{m_sceneDesc.buffer, 0, VK_WHOLE_SIZE};
   writes.emplace_back(m_descSetLayoutBind.makeWrite(m_descSet, 2, &dbiSceneDesc));
+  vk::DescriptorBufferInfo dbiDrawInst{m_drawInstances.buffer, 0, VK_WHOLE_SIZE};
+  writes.emplace_back(m_descSetLayoutBind.makeWrite(m_descSet, 7, &dbiDrawInst));
 
   // All material buffers, 1 buffer per OBJ
   std::vector<vk::DescriptorBufferInfo> dbiMat;
@@ -228,6 +235,19 @@ void HelloVulkan::loadModel(const std::string& filename, nvmath::mat4f transform
 {
   using vkBU = vk::BufferUsageFlagBits;
 
+  // The model was already loaded: only adding an instance of it
+  auto cached = m_modelCache.find(filename);
+  if(cached != m_modelCache.end())
+  {
+    ObjInstance instance;
+    instance.objIndex    = cached->second.objIndex;
+    instance.txtOffset   = cached->second.txtOffset;
+    instance.transform   = transform;
+    instance.transformIT = instanceNormalMatrix(transform);
+    m_objInstance.emplace_back(instance);
+    return;
+  }
+
   ObjLoader loader;
   loader.loadModel(filename);
 
@@ -242,7 +262,7 @@ void HelloVulkan::loadModel(const std::string& filename, nvmath::mat4f transform
   ObjInstance instance;
   instance.objIndex    = static_cast<uint32_t>(m_objModel.size());
   instance.transform   = transform;
-  instance.transformIT = nvmath::transpose(nvmath::invert(transform));
+  instance.transformIT = instanceNormalMatrix(transform);
   instance.txtOffset   = static_cast<uint32_t>(m_textures.size());
 
   ObjModel model;
@@ -250,20 +270,46 @@ void HelloVulkan::loadModel(const std::string& filename, nvmath::mat4f transform
   model.nbVertices = static_cast<uint32_t>(loader.m_vertices.size());
 
   // Create the buffers on Device and copy vertices, indices and materials
-  nvvk::CommandPool cmdBufGet(m_device, m_graphicsQueueIndex);
-  vk::CommandBuffer cmdBuf = cmdBufGet.createCommandBuffer();
+  // When batching, the upload is recorded in the current batch command buffer
+  const bool        batched = m_modelBatch.active;
+  nvvk::CommandPool cmdBufGet;
+  vk::CommandBuffer cmdBuf;
+  if(batched)
+  {
+    cmdBuf = batchCommandBuffer();
+  }
+  else
+  {
+    cmdBufGet.init(m_device, m_graphicsQueueIndex);
+    cmdBuf = cmdBufGet.createCommandBuffer();
+  }
+  // Transfer source: the geometry is also packed in the buffers of the indirect draws
   model.vertexBuffer =
       m_alloc.createBuffer(cmdBuf, loader.m_vertices,
-                           vkBU::eVertexBuffer | vkBU::eStorageBuffer | vkBU::eShaderDeviceAddress);
+                           vkBU::eVertexBuffer | vkBU::eStorageBuffer | vkBU::eShaderDeviceAddress
+                               | vkBU::eTransferSrc);
   model.indexBuffer =
       m_alloc.createBuffer(cmdBuf, loader.m_indices,
-                           vkBU::eIndexBuffer | vkBU::eStorageBuffer | vkBU::eShaderDeviceAddress);
+                           vkBU::eIndexBuffer | vkBU::eStorageBuffer | vkBU::eShaderDeviceAddress
+                               | vkBU::eTransferSrc);
   model.matColorBuffer = m_alloc.createBuffer(cmdBuf, loader.m_materials, vkBU::eStorageBuffer);
   model.matIndexBuffer = m_alloc.createBuffer(cmdBuf, loader.m_matIndx, vkBU::eStorageBuffer);
   // Creates all textures found
   createTextureImages(cmdBuf, loader.m_textures);
-  cmdBufGet.submitAndWait(cmdBuf);
-  m_alloc.finalizeAndReleaseStaging();
+  if(batched)
+  {
+    m_modelBatch.recordedBytes += loader.m_vertices.size() * sizeof(VertexObj)
+                                  + loader.m_indices.size() * sizeof(uint32_t)
+                                  + loader.m_materials.size() * sizeof(MaterialObj)
+                                  + loader.m_matIndx.size() * sizeof(uint32_t);
+    if(m_modelBatch.recordedBytes >= m_modelBatch.stagingBudget)
+      flushModelBatch();
+  }
+  else
+  {
+    cmdBufGet.submitAndWait(cmdBuf);
+    m_alloc.finalizeAndReleaseStaging();
+  }
 
   std::string objNb = std::to_string(instance.objIndex);
   m_debug.setObjectName(model.vertexBuffer.buffer, (std::string("vertex_" + objNb).c_str()));
@@ -271,10 +317,99 @@ void HelloVulkan::loadModel(const std::string& filename, nvmath::mat4f transform
   m_debug.setObjectName(model.matColorBuffer.buffer, (std::string("mat_" + objNb).c_str()));
   m_debug.setObjectName(model.matIndexBuffer.buffer, (std::string("matIdx_" + objNb).c_str()));
 
+  m_modelCache[filename] = {instance.objIndex, instance.txtOffset};
   m_objModel.emplace_back(model);
   m_objInstance.emplace_back(instance);
 }
 
+//--------------------------------------------------------------------------------------------------
+// Starting a batch of model loading: see ModelBatch
+//
+void HelloVulkan::beginModelBatch(vk::DeviceSize stagingBudget)
+{
+  assert(!m_modelBatch.active);
+  m_modelBatch.active        = true;
+  m_modelBatch.stagingBudget = stagingBudget;
+  m_modelBatch.recordedBytes = 0;
+  m_modelBatch.current       = 0;
+  m_modelBatch.cmdPool       = m_device.createCommandPool(
+      {vk::CommandPoolCreateFlagBits::eResetCommandBuffer, m_graphicsQueueIndex});
+
+  vk::CommandBufferAllocateInfo allocInfo{m_modelBatch.cmdPool, vk::CommandBufferLevel::ePrimary,
+                                          ModelBatch::kRingSize};
+  auto cmdBufs = m_device.allocateCommandBuffers(allocInfo);
+  for(uint32_t i = 0; i < ModelBatch::kRingSize; i++)
+  {
+    m_modelBatch.cmdBufs[i]   = cmdBufs[i];
+    m_modelBatch.fences[i]    = m_device.createFence({});
+    m_modelBatch.submitted[i] = false;
+  }
+  m_modelBatch.cmdBufs[0].begin({vk::CommandBufferUsageFlagBits::eOneTimeSubmit});
+}
+
+//--------------------------------------------------------------------------------------------------
+// Command buffer currently recording uploads
+//
+vk::CommandBuffer HelloVulkan::batchCommandBuffer()
+{
+  return m_modelBatch.cmdBufs[m_modelBatch.current];
+}
+
+//--------------------------------------------------------------------------------------------------
+// Submitting the current command buffer, without waiting, and starting the next one of the ring.
+// The staging memory used by the submitted command buffer is tied to its fence and is recycled
+// by releaseStaging() once the fence is signaled.
+//
+void HelloVulkan::flushModelBatch()
+{
+  ModelBatch& b   = m_modelBatch;
+  auto        cur = b.current;
+
+  b.cmdBufs[cur].end();
+  vk::SubmitInfo submit;
+  submit.setCommandBufferCount(1);
+  submit.setPCommandBuffers(&b.cmdBufs[cur]);
+  m_queue.submit(submit, b.fences[cur]);
+  m_alloc.finalizeStaging(b.fences[cur]);
+  b.submitted[cur] = true;
+  b.recordedBytes  = 0;
+
+  // Next slot of the ring, waiting for it if it is still in flight
+  b.current = (cur + 1) % ModelBatch::kRingSize;
+  if(b.submitted[b.current])
+  {
+    m_device.waitForFences(b.fences[b.current], VK_TRUE, UINT64_MAX);
+    m_device.resetFences(b.fences[b.current]);
+    b.submitted[b.current] = false;
+  }
+  m_alloc.releaseStaging();
+
+  b.cmdBufs[b.current].reset({});
+  b.cmdBufs[b.current].begin({vk::CommandBufferUsageFlagBits::eOneTimeSubmit});
+}
+
+//--------------------------------------------------------------------------------------------------
+// Submitting what remains and waiting for all uploads of the batch
+//
+void HelloVulkan::endModelBatch()
+{
+  assert(m_modelBatch.active);
+  ModelBatch& b = m_modelBatch;
+
+  flushModelBatch();
+  b.cmdBufs[b.current].end();  // Started by flush, but unused
+
+  for(uint32_t i = 0; i < ModelBatch::kRingSize; i++)
+  {
+    if(b.submitted[i])
+      m_device.waitForFences(b.fences[i], VK_TRUE, UINT64_MAX);
+    m_device.destroy(b.fences[i]);
+  }
+  m_alloc.releaseStaging();
+  m_device.destroy(b.cmdPool);
+  b = ModelBatch();
+}
+
 //--------------------------------------------------------------------------------------------------
 // Creating the uniform buffer holding the camera matrices
 // - Buffer is host visible
@@ -307,6 +442,83 @@ void HelloVulkan::createSceneDescriptionBuffer()
   m_debug.setObjectName(m_sceneDesc.buffer, "sceneDesc");
 }
 
+//--------------------------------------------------------------------------------------------------
+// Buffers for drawing all instances with one indirect draw (see rasterize)
+// - All vertices and indices are packed in shared buffers, each model being a draw command
+//   with its vertex offset and first index
+// - The instances are grouped by model in `m_drawInstances`, the draw commands of a model
+//   cover its range with firstInstance and instanceCount. The vertex shader finds the scene
+//   description of the instance with drawInstances[gl_InstanceIndex].
+// - A model has one draw command per `kInstancesPerDraw` instances, so the recording jobs can
+//   split the commands between them (see recordParallel)
+//
+void HelloVulkan::createIndirectDrawBuffers()
+{
+  using vkBU                       = vk::BufferUsageFlagBits;
+  const uint32_t kInstancesPerDraw = 256;
+
+  std::vector<std::vector<uint32_t>> instancesOfModel(m_objModel.size());
+  for(uint32_t i = 0; i < static_cast<uint32_t>(m_objInstance.size()); i++)
+    instancesOfModel[m_objInstance[i].objIndex].push_back(i);
+
+  std::vector<uint32_t>                       drawInstances;
+  std::vector<vk::DrawIndexedIndirectCommand> drawCommands;
+  std::vector<vk::BufferCopy>                 vertexCopies(m_objModel.size());
+  std::vector<vk::BufferCopy>                 indexCopies(m_objModel.size());
+  uint32_t                                    nbVertices{0};
+  uint32_t                                    nbIndices{0};
+  drawInstances.reserve(m_objInstance.size());
+  for(size_t m = 0; m < m_objModel.size(); m++)
+  {
+    const ObjModel& model   = m_objModel[m];
+    uint32_t        nbModel = static_cast<uint32_t>(instancesOfModel[m].size());
+    for(uint32_t first = 0; first < nbModel; first += kInstancesPerDraw)
+    {
+      drawCommands.emplace_back(model.nbIndices, std::min(kInstancesPerDraw, nbModel - first),
+                                nbIndices, static_cast<int32_t>(nbVertices),
+                                static_cast<uint32_t>(drawInstances.size()) + first);
+    }
+    drawInstances.insert(drawInstances.end(), instancesOfModel[m].begin(),
+                         instancesOfModel[m].end());
+    vertexCopies[m] = vk::BufferCopy(0, nbVertices * sizeof(VertexObj),
+                                     model.nbVertices * sizeof(VertexObj));
+    indexCopies[m] =
+        vk::BufferCopy(0, nbIndices * sizeof(uint32_t), model.nbIndices * sizeof(uint32_t));
+    nbVertices += model.nbVertices;
+    nbIndices += model.nbIndices;
+  }
+
+  nvvk::CommandPool cmdGen(m_device, m_graphicsQueueIndex);
+  auto              cmdBuf = cmdGen.createCommandBuffer();
+
+  m_drawVertices = m_alloc.createBuffer(nbVertices * sizeof(VertexObj),
+                                        vkBU::eVertexBuffer | vkBU::eTransferDst);
+  m_drawIndices  = m_alloc.createBuffer(nbIndices * sizeof(uint32_t),
+                                       vkBU::eIndexBuffer | vkBU::eTransferDst);
+  for(size_t m = 0; m < m_objModel.size(); m++)
+  {
+    cmdBuf.copyBuffer(m_objModel[m].vertexBuffer.buffer, m_drawVertices.buffer, vertexCopies[m]);
+    cmdBuf.copyBuffer(m_objModel[m].indexBuffer.buffer, m_drawIndices.buffer, indexCopies[m]);
+  }
+  m_drawInstances = m_alloc.createBuffer(cmdBuf, drawInstances, vkBU::eStorageBuffer);
+  m_drawCommands  = m_alloc.createBuffer(cmdBuf, drawCommands, vkBU::eIndirectBuffer);
+  cmdGen.submitAndWait(cmdBuf);
+  m_alloc.finalizeAndReleaseStaging();
+
+  // Without drawIndirectFirstInstance, the commands must start at instance 0: rasterize then
+  // draws the instances one by one
+  vk::PhysicalDeviceFeatures features = m_physicalDevice.getFeatures();
+  m_nbDrawCommands                    = static_cast<uint32_t>(drawCommands.size());
+  m_multiDrawIndirect                 = features.multiDrawIndirect == VK_TRUE;
+  m_indirectDrawSupported             = features.drawIndirectFirstInstance == VK_TRUE;
+  m_useIndirectDraw                   = m_useIndirectDraw && m_indirectDrawSupported;
+
+  m_debug.setObjectName(m_drawVertices.buffer, "drawVertices");
+  m_debug.setObjectName(m_drawIndices.buffer, "drawIndices");
+  m_debug.setObjectName(m_drawInstances.buffer, "drawInstances");
+  m_debug.setObjectName(m_drawCommands.buffer, "drawCommands");
+}
+
 //--------------------------------------------------------------------------------------------------
 // Creating all textures and samplers
 //
@@ -390,6 +602,10 @@ void HelloVulkan::destroyResources()
   m_device.destroy(m_descSetLayout);
   m_alloc.destroy(m_cameraMat);
   m_alloc.destroy(m_sceneDesc);
+  m_alloc.destroy(m_drawVertices);
+  m_alloc.destroy(m_drawIndices);
+  m_alloc.destroy(m_drawInstances);
+  m_alloc.destroy(m_drawCommands);
 
   for(auto& m : m_objModel)
   {
@@ -422,6 +638,9 @@ void HelloVulkan::destroyResources()
   m_device.destroy(m_rtPipelineLayout);
   m_alloc.destroy(m_rtSBTBuffer);
 
+  // #VK_threads
+  destroyParallelRecording();
+
   m_alloc.deinit();
 #if defined(NVVK_ALLOC_DMA)
   m_memAllocator.deinit();
@@ -434,12 +653,33 @@ void HelloVulkan::destroyResources()
 // Drawing the scene in raster mode
 //
 void HelloVulkan::rasterize(const vk::CommandBuffer& cmdBuf)
+{
+  m_debug.beginLabel(cmdBuf, "Rasterize");
+  rasterizeRange(cmdBuf, 0, nbRasterItems());
+  m_debug.endLabel(cmdBuf);
+}
+
+// Indirect draws need drawIndirectFirstInstance, see createIndirectDrawBuffers
+bool HelloVulkan::indirectDraw() const
+{
+  return m_useIndirectDraw && m_indirectDrawSupported;
+}
+uint32_t HelloVulkan::nbRasterItems() const
+{
+  return indirectDraw() ? m_nbDrawCommands : static_cast<uint32_t>(m_objInstance.size());
+}
+
+//--------------------------------------------------------------------------------------------------
+// Drawing the instances [first, first + count), or the indirect draw commands of this range when
+// indirectDraw(). All the state is set, the command buffer can be a secondary recorded on another
+// thread: the push constant is a local copy.
+//
+void HelloVulkan::rasterizeRange(const vk::CommandBuffer& cmdBuf, uint32_t first, uint32_t count)
 {
   using vkPBP = vk::PipelineBindPoint;
   using vkSS  = vk::ShaderStageFlagBits;
-  vk::DeviceSize offset{0};
-
-  m_debug.beginLabel(cmdBuf, "Rasterize");
+  vk::DeviceSize  offset{0};
+  ObjPushConstant pushConstant = m_pushConstant;
 
   // Dynamic Viewport
   cmdBuf.setViewport(0, {vk::Viewport(0, 0, (float)m_size.width, (float)m_size.height, 0, 1)});
@@ -448,19 +688,38 @@ void HelloVulkan::rasterize(const vk::CommandBuffer& cmdBuf)
   // Drawing all triangles
   cmdBuf.bindPipeline(vkPBP::eGraphics, m_graphicsPipeline);
   cmdBuf.bindDescriptorSets(vkPBP::eGraphics, m_pipelineLayout, 0, {m_descSet}, {});
-  for(int i = 0; i < m_objInstance.size(); ++i)
+
+  // All instances of the commands at once, see createIndirectDrawBuffers
+  if(indirectDraw())
+  {
+    const uint32_t stride   = sizeof(vk::DrawIndexedIndirectCommand);
+    pushConstant.instanceId = -1;  // Instance from gl_InstanceIndex
+    cmdBuf.pushConstants<ObjPushConstant>(m_pipelineLayout, vkSS::eVertex | vkSS::eFragment, 0,
+                                          pushConstant);
+    cmdBuf.bindVertexBuffers(0, {m_drawVertices.buffer}, {offset});
+    cmdBuf.bindIndexBuffer(m_drawIndices.buffer, 0, vk::IndexType::eUint32);
+    if(m_multiDrawIndirect)
+      cmdBuf.drawIndexedIndirect(m_drawCommands.buffer, first * stride, count, stride);
+    else
+    {
+      for(uint32_t i = first; i < first + count; i++)
+        cmdBuf.drawIndexedIndirect(m_drawCommands.buffer, i * stride, 1, stride);
+    }
+    return;
+  }
+
+  for(uint32_t i = first; i < first + count; ++i)
   {
-    auto& inst                = m_objInstance[i];
-    auto& model               = m_objModel[inst.objIndex];
-    m_pushConstant.instanceId = i;  // Telling which instance is drawn
+    auto& inst              = m_objInstance[i];
+    auto& model             = m_objModel[inst.objIndex];
+    pushConstant.instanceId = i;  // Telling which instance is drawn
     cmdBuf.pushConstants<ObjPushConstant>(m_pipelineLayout, vkSS::eVertex | vkSS::eFragment, 0,
-                                          m_pushConstant);
+                                          pushConstant);
 
     cmdBuf.bindVertexBuffers(0, {model.vertexBuffer.buffer}, {offset});
     cmdBuf.bindIndexBuffer(model.indexBuffer.buffer, 0, vk::IndexType::eUint32);
     cmdBuf.drawIndexed(model.nbIndices, 1, 0, 0, 0);
   }
-  m_debug.endLabel(cmdBuf);
 }
 
 //--------------------------------------------------------------------------------------------------
@@ -927,3 +1186,102 @@ void HelloVulkan::raytrace(const vk::CommandBuffer& cmdBuf, const nvmath::vec4f&
 
   m_debug.endLabel(cmdBuf);
 }
+
+//////////////////////////////////////////////////////////////////////////
+// #VK_threads
+
+//--------------------------------------------------------------------------------------------------
+// One command pool per recording job and per frame in flight: a pool is only used by the job
+// recording in it, and reset when the frame using its command buffer is done.
+//
+void HelloVulkan::createParallelRecording()
+{
+  uint32_t nbFrames = static_cast<uint32_t>(getCommandBuffers().size());
+  m_nbRasterJobs    = std::min<uint32_t>(ThreadPool::shared().size(), 16);
+
+  m_frameRecording.resize(nbFrames);
+  for(auto& frame : m_frameRecording)
+  {
+    // Raster jobs, then the post-process job
+    for(uint32_t j = 0; j < m_nbRasterJobs + 1; j++)
+    {
+      vk::CommandPool pool = m_device.createCommandPool({{}, m_graphicsQueueIndex});
+      vk::CommandBuffer cmdBuf =
+          m_device.allocateCommandBuffers({pool, vk::CommandBufferLevel::eSecondary, 1})[0];
+      frame.pools.push_back(pool);
+      frame.cmdBufs.push_back(cmdBuf);
+    }
+  }
+}
+
+void HelloVulkan::destroyParallelRecording()
+{
+  for(auto& frame : m_frameRecording)
+  {
+    for(auto& pool : frame.pools)
+      m_device.destroy(pool);
+  }
+  m_frameRecording.clear();
+}
+
+//--------------------------------------------------------------------------------------------------
+// Recording the secondary command buffers of the current frame on the worker threads:
+// - if `raster`, the instances (or the indirect draw commands) are split in ranges, each recorded
+//   by a job in the offscreen pass
+// - `post` records the post-process pass, in parallel with the raster jobs
+// Must be called after prepareFrame(). The primary command buffer then calls executeRaster()
+// and executePost() in render passes begun with eSecondaryCommandBuffers.
+//
+void HelloVulkan::recordParallel(bool                                                 raster,
+                                 const std::function<void(const vk::CommandBuffer&)>& post)
+{
+  FrameRecording& frame = m_frameRecording[getCurFrame()];
+
+  uint32_t nbItems = nbRasterItems();
+  uint32_t nbJobs  = std::min(m_nbRasterJobs, std::max(nbItems, 1u));
+  frame.nbRaster   = raster ? nbJobs : 0;
+
+  auto record = [this, &frame](uint32_t job, vk::RenderPass renderPass,
+                               vk::Framebuffer framebuffer,
+                               const std::function<void(const vk::CommandBuffer&)>& fn) {
+    m_device.resetCommandPool(frame.pools[job], {});
+    const vk::CommandBuffer&         cmdBuf = frame.cmdBufs[job];
+    vk::CommandBufferInheritanceInfo inheritance{renderPass, 0, framebuffer};
+    cmdBuf.begin({vk::CommandBufferUsageFlagBits::eOneTimeSubmit
+                      | vk::CommandBufferUsageFlagBits::eRenderPassContinue,
+                  &inheritance});
+    fn(cmdBuf);
+    cmdBuf.end();
+  };
+
+  std::vector<std::future<void>> jobs;
+  for(uint32_t j = 0; j < frame.nbRaster; j++)
+  {
+    uint32_t first = static_cast<uint32_t>(uint64_t(nbItems) * j / nbJobs);
+    uint32_t last  = static_cast<uint32_t>(uint64_t(nbItems) * (j + 1) / nbJobs);
+    jobs.push_back(ThreadPool::shared().push([this, j, first, last, &record] {
+      record(j, m_offscreenRenderPass, m_offscreenFramebuffer,
+             [this, first, last](const vk::CommandBuffer& cmdBuf) {
+               rasterizeRange(cmdBuf, first, last - first);
+             });
+    }));
+  }
+  jobs.push_back(ThreadPool::shared().push([this, &record, &post] {
+    record(m_nbRasterJobs, getRenderPass(), getFramebuffers()[getCurFrame()], post);
+  }));
+
+  for(auto& j : jobs)
+    j.get();
+}
+
+void HelloVulkan::executeRaster(const vk::CommandBuffer& cmdBuf)
+{
+  FrameRecording& frame = m_frameRecording[getCurFrame()];
+  cmdBuf.executeCommands(frame.nbRaster, frame.cmdBufs.data());
+}
+
+void HelloVulkan::executePost(const vk::CommandBuffer& cmdBuf)
+{
+  FrameRecording& frame = m_frameRecording[getCurFrame()];
+  cmdBuf.executeCommands(1, &frame.cmdBufs[m_nbRasterJobs]);
+}
@@ -25,6 +25,9 @@
  * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 #pragma once
+#include <array>
+#include <functional>
+#include <unordered_map>
 
 // #VKRay
 //#define NVVK_ALLOC_DEDICATED
@@ -56,15 +59,23 @@ public:
   void createDescriptorSetLayout();
   void createGraphicsPipeline();
   void loadModel(const std::string& filename, nvmath::mat4f transform = nvmath::mat4f(1));
+  void beginModelBatch(vk::DeviceSize stagingBudget = 64ull * 1024 * 1024);
+  void endModelBatch();
   void updateDescriptorSet();
   void createUniformBuffer();
   void createSceneDescriptionBuffer();
+  void createIndirectDrawBuffers();
   void createTextureImages(const vk::CommandBuffer&        cmdBuf,
                            const std::vector<std::string>& textures);
   void updateUniformBuffer();
   void onResize(int /*w*/, int /*h*/) override;
   void destroyResources();
   void rasterize(const vk::CommandBuffer& cmdBuff);
+  void rasterizeRange(const vk::CommandBuffer& cmdBuf, uint32_t first, uint32_t count);
+
+  // Items of rasterizeRange: the instances, or the indirect draw commands
+  bool     indirectDraw() const;
+  uint32_t nbRasterItems() const;
 
   // The OBJ model
   struct ObjModel
@@ -90,7 +101,7 @@ public:
   struct ObjPushConstant
   {
     nvmath::vec3f lightPosition{10.f, 15.f, 8.f};
-    int           instanceId{0};  // To retrieve the transformation matrix
+    int           instanceId{0};  // To retrieve the transformation matrix, -1: indirect draw
     float         lightIntensity{100.f};
     int           lightType{0};  // 0: point, 1: infinite
   };
@@ -100,6 +111,15 @@ public:
   std::vector<ObjModel>    m_objModel;
   std::vector<ObjInstance> m_objInstance;
 
+  // Models already loaded, by file name. Loading the same file again only adds an instance
+  // referencing the existing model (same objIndex and txtOffset).
+  struct ModelCacheEntry
+  {
+    uint32_t objIndex{0};
+    uint32_t txtOffset{0};
+  };
+  std::unordered_map<std::string, ModelCacheEntry> m_modelCache;
+
   // Graphic pipeline
   vk::PipelineLayout          m_pipelineLayout;
   vk::Pipeline                m_graphicsPipeline;
@@ -112,6 +132,16 @@ public:
   nvvk::Buffer               m_sceneDesc;  // Device buffer of the OBJ instances
   std::vector<nvvk::Texture> m_textures;   // vector of all textures of the scene
 
+  // Indirect rasterization: one draw command per model, drawing all its instances
+  bool         m_useIndirectDraw{true};
+  bool         m_indirectDrawSupported{false};  // drawIndirectFirstInstance
+  bool         m_multiDrawIndirect{false};      // All draw commands in a single call
+  uint32_t     m_nbDrawCommands{0};
+  nvvk::Buffer m_drawVertices;   // Vertices of all models
+  nvvk::Buffer m_drawIndices;    // Indices of all models, relative to the model
+  nvvk::Buffer m_drawInstances;  // Instance index, grouped by model
+  nvvk::Buffer m_drawCommands;   // vk::DrawIndexedIndirectCommand per model
+
 #if defined(NVVK_ALLOC_DEDICATED)
   nvvk::AllocatorDedicated m_alloc;  // Allocator for buffer, images, acceleration structures
 #elif defined(NVVK_ALLOC_DMA)
@@ -124,6 +154,45 @@ public:
 
   nvvk::DebugUtil m_debug;  // Utility to name objects
 
+  // Batched loading: all loadModel between beginModelBatch() and endModelBatch() are
+  // recorded in a small ring of command buffers. A command buffer is submitted once the data
+  // recorded in it exceeds the staging budget, and its staging memory is recycled when its
+  // fence is signaled. The CPU only waits when the ring wraps around.
+  struct ModelBatch
+  {
+    static const uint32_t                    kRingSize = 3;
+    bool                                     active{false};
+    vk::CommandPool                          cmdPool;
+    std::array<vk::CommandBuffer, kRingSize> cmdBufs;
+    std::array<vk::Fence, kRingSize>         fences;
+    std::array<bool, kRingSize>              submitted{};
+    uint32_t                                 current{0};
+    vk::DeviceSize                           recordedBytes{0};
+    vk::DeviceSize                           stagingBudget{0};
+  } m_modelBatch;
+
+  vk::CommandBuffer batchCommandBuffer();
+  void              flushModelBatch();
+
+  // #VK_threads
+  // Recording of the raster and post-process passes in secondary command buffers, on the
+  // worker threads of ThreadPool::shared(). See recordParallel().
+  void createParallelRecording();
+  void destroyParallelRecording();
+  void recordParallel(bool raster, const std::function<void(const vk::CommandBuffer&)>& post);
+  void executeRaster(const vk::CommandBuffer& cmdBuf);
+  void executePost(const vk::CommandBuffer& cmdBuf);
+
+  struct FrameRecording
+  {
+    std::vector<vk::CommandPool>   pools;    // One per job: the raster jobs, then the post job
+    std::vector<vk::CommandBuffer> cmdBufs;  // Secondary command buffer of each job
+    uint32_t                       nbRaster{0};
+  };
+  bool                        m_parallelRecording{true};
+  uint32_t                    m_nbRasterJobs{0};
+  std::vector<FrameRecording> m_frameRecording;  // One per frame in flight
+
   // #Post
   void createOffscreenRender();
   void createPostPipeline();
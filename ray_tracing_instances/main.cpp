@@ -37,7 +37,9 @@ VULKAN_HPP_DEFAULT_DISPATCH_LOADER_DYNAMIC_STORAGE
 #include "imgui.h"
 #include "imgui_impl_glfw.h"
 
+#include "benchmark_run.hpp"
 #include "hello_vulkan.h"
+#include "instance_transforms.hpp"
 #include "nvh/cameramanipulator.hpp"
 #include "nvh/fileoperations.hpp"
 #include "nvpsystem.hpp"
@@ -75,6 +77,9 @@ void renderUI(HelloVulkan& helloVk)
   ImGui::RadioButton("Point", &helloVk.m_pushConstant.lightType, 0);
   ImGui::SameLine();
   ImGui::RadioButton("Infinite", &helloVk.m_pushConstant.lightType, 1);
+  if(helloVk.m_indirectDrawSupported)
+    ImGui::Checkbox("Indirect raster", &helloVk.m_useIndirectDraw);
+  ImGui::Checkbox("Multithreaded recording", &helloVk.m_parallelRecording);
 }
 
 //////////////////////////////////////////////////////////////////////////
@@ -88,7 +93,8 @@ static int const SAMPLE_HEIGHT = 720;
 //
 int main(int argc, char** argv)
 {
-  UNUSED(argc);
+  // Benchmark runs, see benchmark_run.hpp: -headless -width w -height h -frames n -report file
+  BenchmarkRun bench(argc, argv, SAMPLE_WIDTH, SAMPLE_HEIGHT);
 
   // Setup GLFW window
   glfwSetErrorCallback(onErrorCallback);
@@ -97,11 +103,13 @@ int main(int argc, char** argv)
     return 1;
   }
   glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
-  GLFWwindow* window = glfwCreateWindow(SAMPLE_WIDTH, SAMPLE_HEIGHT,
+  if(bench.headless())
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+  GLFWwindow* window = glfwCreateWindow(bench.width(), bench.height(),
                                         "NVIDIA Vulkan Raytracing Tutorial", nullptr, nullptr);
 
   // Setup camera
-  CameraManip.setWindowSize(SAMPLE_WIDTH, SAMPLE_HEIGHT);
+  CameraManip.setWindowSize(bench.width(), bench.height());
   CameraManip.setLookat(nvmath::vec3f(5, 4, -4), nvmath::vec3f(0, 1, 0), nvmath::vec3f(0, 1, 0));
 
   // Setup Vulkan
@@ -160,6 +168,7 @@ int main(int argc, char** argv)
 
   // Create example
   HelloVulkan helloVk;
+  GpuProfiler profiler;  // GPU time of the passes, for the benchmark report
 
   // Window need to be opened to get the surface on which to draw
   const vk::SurfaceKHR surface = helloVk.getVkSurface(vkctx.m_instance, window);
@@ -167,7 +176,9 @@ int main(int argc, char** argv)
 
   helloVk.setup(vkctx.m_instance, vkctx.m_device, vkctx.m_physicalDevice,
                 vkctx.m_queueGCT.familyIndex);
-  helloVk.createSurface(surface, SAMPLE_WIDTH, SAMPLE_HEIGHT);
+  helloVk.createSurface(surface, bench.width(), bench.height());
+  profiler.setup(vkctx.m_device, vkctx.m_physicalDevice,
+                 static_cast<uint32_t>(helloVk.getCommandBuffers().size()));
   helloVk.createDepthBuffer();
   helloVk.createRenderPass();
   helloVk.createFrameBuffers();
@@ -180,6 +191,8 @@ int main(int argc, char** argv)
   std::mt19937                    gen(rd());  //Standard mersenne_twister_engine seeded with rd()
   std::normal_distribution<float> dis(1.0f, 1.0f);
   std::normal_distribution<float> disn(0.05f, 0.05f);
+  // Uploads of all models are batched instead of waiting on each of them
+  helloVk.beginModelBatch();
   for(int n = 0; n < 2000; ++n)
   {
     helloVk.loadModel(nvh::findFile("media/scenes/cube_multi.obj", defaultSearchPaths));
@@ -188,19 +201,30 @@ int main(int argc, char** argv)
     float         scale = fabsf(disn(gen));
     nvmath::mat4f mat =
         nvmath::translation_mat4(nvmath::vec3f{dis(gen), 2.0f + dis(gen), dis(gen)});
-    mat              = mat * nvmath::rotation_mat4_x(dis(gen));
-    mat              = mat * nvmath::scale_mat4(nvmath::vec3f(scale));
-    inst.transform   = mat;
-    inst.transformIT = nvmath::transpose(nvmath::invert((inst.transform)));
+    mat            = mat * nvmath::rotation_mat4_x(dis(gen));
+    mat            = mat * nvmath::scale_mat4(nvmath::vec3f(scale));
+    inst.transform = mat;
   }
 
   helloVk.loadModel(nvh::findFile("media/scenes/plane.obj", defaultSearchPaths));
+  helloVk.endModelBatch();
+
+  // Normal matrices of all instances, in blocks on the thread pool
+  auto&              instances = helloVk.m_objInstance;
+  InstanceTransforms transforms;
+  transforms.resize(instances.size());
+  transforms.compute([&](size_t i) { transforms.setWorld(i, instances[i].transform); },
+                     [&](size_t begin, size_t end) {
+                       transforms.writeNormal(begin, end, instances.data(),
+                                              &HelloVulkan::ObjInstance::transformIT);
+                     });
 
   helloVk.createOffscreenRender();
   helloVk.createDescriptorSetLayout();
   helloVk.createGraphicsPipeline();
   helloVk.createUniformBuffer();
   helloVk.createSceneDescriptionBuffer();
+  helloVk.createIndirectDrawBuffers();
   helloVk.updateDescriptorSet();
 
   // #VKRay
@@ -214,6 +238,7 @@ int main(int argc, char** argv)
   helloVk.createPostDescriptor();
   helloVk.createPostPipeline();
   helloVk.updatePostDescriptorSet();
+  helloVk.createParallelRecording();
 
 
   nvmath::vec4f clearColor   = nvmath::vec4f(1, 1, 1, 1.00f);
@@ -224,7 +249,7 @@ int main(int argc, char** argv)
   ImGui_ImplGlfw_InitForVulkan(window, true);
 
   // Main loop
-  while(!glfwWindowShouldClose(window))
+  while(!glfwWindowShouldClose(window) && !bench.done())
   {
     glfwPollEvents();
     if(helloVk.isMinimized())
@@ -250,6 +275,7 @@ int main(int argc, char** argv)
     }
 
     // Start rendering the scene
+    profiler.beginFrame();
     helloVk.prepareFrame();
 
     // Start command buffer of this frame
@@ -258,6 +284,19 @@ int main(int argc, char** argv)
 
     cmdBuff.begin({vk::CommandBufferUsageFlagBits::eOneTimeSubmit});
 
+    // #VK_threads: the raster and post passes are recorded in secondary command buffers by the
+    // worker threads, and executed in the render passes below
+    const bool parallel = helloVk.m_parallelRecording;
+    if(parallel)
+    {
+      helloVk.recordParallel(!useRaytracer, [&helloVk](const vk::CommandBuffer& cmdBuf) {
+        helloVk.drawPost(cmdBuf);
+        ImGui::RenderDrawDataVK(cmdBuf, ImGui::GetDrawData());
+      });
+    }
+    const vk::SubpassContents contents =
+        parallel ? vk::SubpassContents::eSecondaryCommandBuffers : vk::SubpassContents::eInline;
+
     // Clearing screen
     vk::ClearValue clearValues[2];
     clearValues[0].setColor(
@@ -276,12 +315,17 @@ int main(int argc, char** argv)
       // Rendering Scene
       if(useRaytracer)
       {
+        GpuProfiler::Section section(profiler, cmdBuff, "Ray trace");
         helloVk.raytrace(cmdBuff, clearColor);
       }
       else
       {
-        cmdBuff.beginRenderPass(offscreenRenderPassBeginInfo, vk::SubpassContents::eInline);
-        helloVk.rasterize(cmdBuff);
+        GpuProfiler::Section section(profiler, cmdBuff, "Rasterize");
+        cmdBuff.beginRenderPass(offscreenRenderPassBeginInfo, contents);
+        if(parallel)
+          helloVk.executeRaster(cmdBuff);
+        else
+          helloVk.rasterize(cmdBuff);
         cmdBuff.endRenderPass();
       }
     }
@@ -295,21 +339,31 @@ int main(int argc, char** argv)
       postRenderPassBeginInfo.setFramebuffer(helloVk.getFramebuffers()[curFrame]);
       postRenderPassBeginInfo.setRenderArea({{}, helloVk.getSize()});
 
-      cmdBuff.beginRenderPass(postRenderPassBeginInfo, vk::SubpassContents::eInline);
-      // Rendering tonemapper
-      helloVk.drawPost(cmdBuff);
-      // Rendering UI
-      ImGui::RenderDrawDataVK(cmdBuff, ImGui::GetDrawData());
+      cmdBuff.beginRenderPass(postRenderPassBeginInfo, contents);
+      if(parallel)
+      {
+        helloVk.executePost(cmdBuff);
+      }
+      else
+      {
+        // Rendering tonemapper
+        helloVk.drawPost(cmdBuff);
+        // Rendering UI
+        ImGui::RenderDrawDataVK(cmdBuff, ImGui::GetDrawData());
+      }
       cmdBuff.endRenderPass();
     }
 
     // Submit for display
     cmdBuff.end();
     helloVk.submitFrame();
+    bench.endFrame();
   }
 
   // Cleanup
   helloVk.getDevice().waitIdle();
+  int exitCode = bench.finish(vkctx.m_physicalDevice, profiler);
+  profiler.destroy();
   helloVk.destroyResources();
   helloVk.destroy();
 
@@ -318,5 +372,5 @@ int main(int argc, char** argv)
   glfwDestroyWindow(window);
   glfwTerminate();
 
-  return 0;
+  return exitCode;
 }
@@ -10,7 +10,7 @@
 layout(push_constant) uniform shaderInformation
 {
   vec3  lightPosition;
-  uint  instanceId;
+  int   instanceId;
   float lightIntensity;
   int   lightType;
 }
@@ -23,6 +23,7 @@ layout(location = 1) in vec2 fragTexCoord;
 layout(location = 2) in vec3 fragNormal;
 layout(location = 3) in vec3 viewDir;
 layout(location = 4) in vec3 worldPos;
+layout(location = 5) flat in uint fragInstanceId;
 // Outgoing
 layout(location = 0) out vec4 outColor;
 // Buffers
@@ -37,7 +38,7 @@ layout(binding = 4, scalar) buffer MatIndex { int i[]; } matIdx[];
 void main()
 {
   // Object of this instance
-  int objId = scnDesc.i[pushC.instanceId].objId;
+  int objId = scnDesc.i[fragInstanceId].objId;
 
   // Material of the object
   int               matIndex = matIdx[objId].i[gl_PrimitiveID];
@@ -65,7 +66,7 @@ void main()
   vec3 diffuse = computeDiffuse(mat, L, N);
   if(mat.textureId >= 0)
   {
-    int  txtOffset  = scnDesc.i[pushC.instanceId].txtOffset;
+    int  txtOffset  = scnDesc.i[fragInstanceId].txtOffset;
     uint txtId      = txtOffset + mat.textureId;
     vec3 diffuseTxt = texture(textureSamplers[txtId], fragTexCoord).xyz;
     diffuse *= diffuseTxt;
@@ -7,6 +7,7 @@
 
 // clang-format off
 layout(binding = 2, set = 0, scalar) buffer ScnDesc { sceneDesc i[]; } scnDesc;
+layout(binding = 7, set = 0, scalar) buffer DrawInstances { uint i[]; } drawInstances;
 // clang-format on
 
 layout(binding = 0) uniform UniformBufferObject
@@ -20,7 +21,7 @@ ubo;
 layout(push_constant) uniform shaderInformation
 {
   vec3  lightPosition;
-  uint  instanceId;
+  int   instanceId;  // -1: indirect draw, the instance is given by gl_InstanceIndex
   float lightIntensity;
   int   lightType;
 }
@@ -37,6 +38,7 @@ layout(location = 1) out vec2 fragTexCoord;
 layout(location = 2) out vec3 fragNormal;
 layout(location = 3) out vec3 viewDir;
 layout(location = 4) out vec3 worldPos;
+layout(location = 5) flat out uint fragInstanceId;
 
 out gl_PerVertex
 {
@@ -46,15 +48,22 @@ out gl_PerVertex
 
 void main()
 {
-  mat4 objMatrix   = scnDesc.i[pushC.instanceId].transfo;
-  mat4 objMatrixIT = scnDesc.i[pushC.instanceId].transfoIT;
+  // With indirect draws, each model is drawn with its instances in a contiguous range of
+  // drawInstances, starting at the firstInstance of the draw command
+  uint instanceId = uint(pushC.instanceId);
+  if(pushC.instanceId < 0)
+    instanceId = drawInstances.i[gl_InstanceIndex];
+
+  mat4 objMatrix   = scnDesc.i[instanceId].transfo;
+  mat4 objMatrixIT = scnDesc.i[instanceId].transfoIT;
 
   vec3 origin = vec3(ubo.viewI * vec4(0, 0, 0, 1));
 
-  worldPos     = vec3(objMatrix * vec4(inPosition, 1.0));
-  viewDir      = vec3(worldPos - origin);
-  fragTexCoord = inTexCoord;
-  fragNormal   = vec3(objMatrixIT * vec4(inNormal, 0.0));
+  worldPos       = vec3(objMatrix * vec4(inPosition, 1.0));
+  viewDir        = vec3(worldPos - origin);
+  fragTexCoord   = inTexCoord;
+  fragNormal     = vec3(objMatrixIT * vec4(inNormal, 0.0));
+  fragInstanceId = instanceId;
   //  matIndex     = inMatID;
 
   gl_Position = ubo.proj * ubo.view * vec4(worldPos, 1.0);
@@ -25,6 +25,7 @@
  * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <algorithm>
 #include <sstream>
 #include <vulkan/vulkan.hpp>
 
@@ -406,6 +407,17 @@ void HelloVulkan::destroyResources()
   m_device.destroy(m_rtPipeline);
   m_device.destroy(m_rtPipelineLayout);
   m_alloc.destroy(m_rtSBTBuffer);
+
+  // #VK_adaptive
+  m_device.destroy(m_adaptivePipeline);
+  m_device.destroy(m_adaptivePipelineLayout);
+  m_device.destroy(m_adaptiveDescPool);
+  m_device.destroy(m_adaptiveDescSetLayout);
+  m_alloc.destroy(m_adaptiveStats);
+  m_alloc.destroy(m_adaptivePixels);
+  if(m_adaptiveReadbackMapped)
+    m_alloc.unmap(m_adaptiveReadback);
+  m_alloc.destroy(m_adaptiveReadback);
 }
 
 //--------------------------------------------------------------------------------------------------
@@ -447,8 +459,10 @@ void HelloVulkan::rasterize(const vk::CommandBuffer& cmdBuf)
 void HelloVulkan::onResize(int /*w*/, int /*h*/)
 {
   createOffscreenRender();
+  createAdaptiveResources();
   updatePostDescriptorSet();
   updateRtDescriptorSet();
+  resetFrame();
 }
 
 //////////////////////////////////////////////////////////////////////////
@@ -620,6 +634,12 @@ void HelloVulkan::initRayTracing()
                                                     vk::PhysicalDeviceRayTracingPropertiesKHR>();
   m_rtProperties  = properties.get<vk::PhysicalDeviceRayTracingPropertiesKHR>();
   m_rtBuilder.setup(m_device, &m_alloc, m_graphicsQueueIndex);
+
+  // The context enables the ray tracing features which are supported
+  auto features = m_physicalDevice.getFeatures2<vk::PhysicalDeviceFeatures2,
+                                                vk::PhysicalDeviceRayTracingFeaturesKHR>();
+  const auto& rtFeatures = features.get<vk::PhysicalDeviceRayTracingFeaturesKHR>();
+  m_indirectTraceRays    = rtFeatures.rayTracingIndirectTraceRays == VK_TRUE;
 }
 
 //--------------------------------------------------------------------------------------------------
@@ -694,7 +714,8 @@ void HelloVulkan::createTopLevelAS()
 }
 
 //--------------------------------------------------------------------------------------------------
-// This descriptor set holds the Acceleration structure and the output image
+// This descriptor set holds the Acceleration structure, the output image and the adaptive sampling
+// statistics and pixel list
 //
 void HelloVulkan::createRtDescriptorSet()
 {
@@ -706,6 +727,10 @@ void HelloVulkan::createRtDescriptorSet()
                                           vkSS::eRaygenKHR | vkSS::eClosestHitKHR));  // TLAS
   m_rtDescSetLayoutBind.addBinding(
       vkDSLB(1, vkDT::eStorageImage, 1, vkSS::eRaygenKHR));  // Output image
+  m_rtDescSetLayoutBind.addBinding(
+      vkDSLB(2, vkDT::eStorageImage, 1, vkSS::eRaygenKHR));  // Adaptive statistics
+  m_rtDescSetLayoutBind.addBinding(
+      vkDSLB(3, vkDT::eStorageBuffer, 1, vkSS::eRaygenKHR));  // Adaptive pixel list
 
   m_rtDescPool      = m_rtDescSetLayoutBind.createPool(m_device);
   m_rtDescSetLayout = m_rtDescSetLayoutBind.createLayout(m_device);
@@ -717,16 +742,19 @@ void HelloVulkan::createRtDescriptorSet()
   descASInfo.setPAccelerationStructures(&tlas);
   vk::DescriptorImageInfo imageInfo{
       {}, m_offscreenColor.descriptor.imageView, vk::ImageLayout::eGeneral};
+  vk::DescriptorBufferInfo pixelInfo{m_adaptivePixels.buffer, 0, VK_WHOLE_SIZE};
 
   std::vector<vk::WriteDescriptorSet> writes;
   writes.emplace_back(m_rtDescSetLayoutBind.makeWrite(m_rtDescSet, 0, &descASInfo));
   writes.emplace_back(m_rtDescSetLayoutBind.makeWrite(m_rtDescSet, 1, &imageInfo));
+  writes.emplace_back(m_rtDescSetLayoutBind.makeWrite(m_rtDescSet, 2, &m_adaptiveStats.descriptor));
+  writes.emplace_back(m_rtDescSetLayoutBind.makeWrite(m_rtDescSet, 3, &pixelInfo));
   m_device.updateDescriptorSets(static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
 }
 
 
 //--------------------------------------------------------------------------------------------------
-// Writes the output image to the descriptor set
+// Writes the output image and the adaptive sampling resources to the descriptor set
 // - Required when changing resolution
 //
 void HelloVulkan::updateRtDescriptorSet()
@@ -736,8 +764,16 @@ void HelloVulkan::updateRtDescriptorSet()
   // (1) Output buffer
   vk::DescriptorImageInfo imageInfo{
       {}, m_offscreenColor.descriptor.imageView, vk::ImageLayout::eGeneral};
-  vk::WriteDescriptorSet wds{m_rtDescSet, 1, 0, 1, vkDT::eStorageImage, &imageInfo};
-  m_device.updateDescriptorSets(wds, nullptr);
+  // (2, 3) Statistics and pixel list, recreated with the size
+  vk::DescriptorImageInfo statsInfo{
+      {}, m_adaptiveStats.descriptor.imageView, vk::ImageLayout::eGeneral};
+  vk::DescriptorBufferInfo pixelInfo{m_adaptivePixels.buffer, 0, VK_WHOLE_SIZE};
+
+  std::vector<vk::WriteDescriptorSet> writes;
+  writes.push_back({m_rtDescSet, 1, 0, 1, vkDT::eStorageImage, &imageInfo});
+  writes.push_back({m_rtDescSet, 2, 0, 1, vkDT::eStorageImage, &statsInfo});
+  writes.push_back({m_rtDescSet, 3, 0, 1, vkDT::eStorageBuffer, nullptr, &pixelInfo});
+  m_device.updateDescriptorSets(static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
 }
 
 
@@ -768,7 +804,10 @@ void HelloVulkan::createRtPipeline()
   vk::RayTracingShaderGroupCreateInfoKHR rg{vk::RayTracingShaderGroupTypeKHR::eGeneral,
                                             VK_SHADER_UNUSED_KHR, VK_SHADER_UNUSED_KHR,
                                             VK_SHADER_UNUSED_KHR, VK_SHADER_UNUSED_KHR};
-  stages.push_back({{}, vk::ShaderStageFlagBits::eRaygenKHR, raygenSM, "main"});
+  // Samples per frame are a constant of the raygen shader, so the loop can be unrolled
+  vk::SpecializationMapEntry specEntry{0, 0, sizeof(int)};
+  vk::SpecializationInfo     specInfo{1, &specEntry, sizeof(int), &m_nbSamples};
+  stages.push_back({{}, vk::ShaderStageFlagBits::eRaygenKHR, raygenSM, "main", &specInfo});
   rg.setGeneralShader(static_cast<uint32_t>(stages.size() - 1));
   m_rtShaderGroups.push_back(rg);
   // Miss
@@ -872,6 +911,18 @@ void HelloVulkan::raytrace(const vk::CommandBuffer& cmdBuf, const nvmath::vec4f&
   if(m_rtPushConstants.frame >= m_maxFrames)
     return;
 
+  // #VK_adaptive: the first frames are accumulated everywhere, to get a first estimate of the
+  // variance, then only the pixels of the list are traced
+  m_rtPushConstants.adaptive = 0;
+  if(m_adaptiveSampling)
+  {
+    if(adaptiveConverged())
+      return;
+    m_rtPushConstants.adaptive = m_rtPushConstants.frame < m_adaptiveMinFrames ? 1 : 2;
+    if(m_rtPushConstants.adaptive == 2)
+      cmdBuildPixelList(cmdBuf);
+  }
+
   m_debug.beginLabel(cmdBuf, "Ray trace");
   // Initializing push constant values
   m_rtPushConstants.clearColor     = clearColor;
@@ -902,9 +953,27 @@ void HelloVulkan::raytrace(const vk::CommandBuffer& cmdBuf, const nvmath::vec4f&
   const vk::StridedBufferRegionKHR hitShaderBindingTable    = {m_rtSBTBuffer.buffer, hitGroupOffset,
                                                             progSize, sbtSize};
   const vk::StridedBufferRegionKHR callableShaderBindingTable;
-  cmdBuf.traceRaysKHR(&raygenShaderBindingTable, &missShaderBindingTable, &hitShaderBindingTable,
-                      &callableShaderBindingTable,      //
-                      m_size.width, m_size.height, 1);  //
+  if(m_rtPushConstants.adaptive == 2 && m_indirectTraceRays)
+  {
+    // One launch per pixel of the list, its size is written by cmdBuildPixelList
+    cmdBuf.traceRaysIndirectKHR(&raygenShaderBindingTable, &missShaderBindingTable,
+                                &hitShaderBindingTable, &callableShaderBindingTable,
+                                m_adaptivePixels.buffer, 0);
+  }
+  else if(m_rtPushConstants.adaptive == 2)
+  {
+    // Without indirect launches, as many launches as the list can hold, the ray generation shader
+    // returns past its size
+    cmdBuf.traceRaysKHR(&raygenShaderBindingTable, &missShaderBindingTable,
+                        &hitShaderBindingTable, &callableShaderBindingTable,  //
+                        m_size.width * m_size.height, 1, 1);                  //
+  }
+  else
+  {
+    cmdBuf.traceRaysKHR(&raygenShaderBindingTable, &missShaderBindingTable,
+                        &hitShaderBindingTable, &callableShaderBindingTable,  //
+                        m_size.width, m_size.height, 1);                      //
+  }
 
 
   m_debug.endLabel(cmdBuf);
@@ -932,3 +1001,178 @@ void HelloVulkan::resetFrame()
 {
   m_rtPushConstants.frame = -1;
 }
+
+//////////////////////////////////////////////////////////////////////////
+// #VK_adaptive: adaptive sampling
+// Once a pixel has converged, it is not traced anymore. After m_adaptiveMinFrames frames,
+// adaptive.comp lists the pixels whose estimated error is still above the threshold and only them
+// are traced.
+//////////////////////////////////////////////////////////////////////////
+
+//--------------------------------------------------------------------------------------------------
+// Statistics image and pixel list of the size of the rendering, and one read back slot for each
+// frame in flight
+// - Required when changing resolution
+//
+void HelloVulkan::createAdaptiveResources()
+{
+  using vkBU = vk::BufferUsageFlagBits;
+  using vkMP = vk::MemoryPropertyFlagBits;
+
+  m_alloc.destroy(m_adaptiveStats);
+  m_alloc.destroy(m_adaptivePixels);
+  if(m_adaptiveReadbackMapped)
+    m_alloc.unmap(m_adaptiveReadback);
+  m_alloc.destroy(m_adaptiveReadback);
+
+  // Luminance mean, squared mean and number of frames of each pixel, written by raytrace.rgen
+  auto statsCreateInfo = nvvk::makeImage2DCreateInfo(m_size, vk::Format::eR32G32B32A32Sfloat,
+                                                     vk::ImageUsageFlagBits::eStorage);
+  {
+    nvvk::Image             image  = m_alloc.createImage(statsCreateInfo);
+    vk::ImageViewCreateInfo ivInfo = nvvk::makeImageViewCreateInfo(image.image, statsCreateInfo);
+    m_adaptiveStats                = m_alloc.createTexture(image, ivInfo);
+    m_adaptiveStats.descriptor.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+  }
+  m_debug.setObjectName(m_adaptiveStats.image, "AdaptiveStats");
+
+  // Launch size of traceRaysIndirectKHR, followed by the pixels to trace
+  vk::DeviceSize listSize =
+      sizeof(PixelListHeader) + sizeof(uint32_t) * m_size.width * m_size.height;
+  m_adaptivePixels = m_alloc.createBuffer(listSize, vkBU::eStorageBuffer | vkBU::eIndirectBuffer
+                                                        | vkBU::eTransferSrc | vkBU::eTransferDst);
+  m_debug.setObjectName(m_adaptivePixels.buffer, "AdaptivePixels");
+
+  // Number of pixels left, read by the host once the fence of the frame was waited
+  auto nbFrames      = static_cast<uint32_t>(getFramebuffers().size());
+  m_adaptiveReadback = m_alloc.createBuffer(nbFrames * sizeof(PixelListHeader), vkBU::eTransferDst,
+                                            vkMP::eHostVisible | vkMP::eHostCoherent);
+
+  void* mapped             = m_alloc.map(m_adaptiveReadback);
+  m_adaptiveReadbackMapped = reinterpret_cast<const PixelListHeader*>(mapped);
+  m_adaptiveReadbackFrame.assign(nbFrames, -1);
+  m_adaptiveConverged = false;
+  m_adaptiveRemaining = m_size.width * m_size.height;
+
+  {
+    nvvk::CommandPool genCmdBuf(m_device, m_graphicsQueueIndex);
+    auto              cmdBuf = genCmdBuf.createCommandBuffer();
+    nvvk::cmdBarrierImageLayout(cmdBuf, m_adaptiveStats.image, vk::ImageLayout::eUndefined,
+                                vk::ImageLayout::eGeneral);
+    genCmdBuf.submitAndWait(cmdBuf);
+  }
+
+  if(m_adaptiveDescSet)
+    updateAdaptiveDescriptorSet();
+}
+
+//--------------------------------------------------------------------------------------------------
+// Compute pipeline compacting the pixels which did not converge
+//
+void HelloVulkan::createAdaptivePipeline()
+{
+  using vkDT   = vk::DescriptorType;
+  using vkSS   = vk::ShaderStageFlagBits;
+  using vkDSLB = vk::DescriptorSetLayoutBinding;
+
+  m_adaptiveDescSetLayoutBind.addBinding(vkDSLB(0, vkDT::eStorageImage, 1, vkSS::eCompute));
+  m_adaptiveDescSetLayoutBind.addBinding(vkDSLB(1, vkDT::eStorageBuffer, 1, vkSS::eCompute));
+  m_adaptiveDescPool      = m_adaptiveDescSetLayoutBind.createPool(m_device);
+  m_adaptiveDescSetLayout = m_adaptiveDescSetLayoutBind.createLayout(m_device);
+  m_adaptiveDescSet =
+      m_device.allocateDescriptorSets({m_adaptiveDescPool, 1, &m_adaptiveDescSetLayout})[0];
+  updateAdaptiveDescriptorSet();
+
+  vk::PushConstantRange        pushConstant{vkSS::eCompute, 0, sizeof(AdaptivePushConstant)};
+  vk::PipelineLayoutCreateInfo layoutInfo{{}, 1, &m_adaptiveDescSetLayout, 1, &pushConstant};
+  m_adaptivePipelineLayout = m_device.createPipelineLayout(layoutInfo);
+
+  vk::ComputePipelineCreateInfo computePipelineCreateInfo{{}, {}, m_adaptivePipelineLayout};
+  computePipelineCreateInfo.stage = nvvk::createShaderStageInfo(
+      m_device, nvh::loadFile("shaders/adaptive.comp.spv", true, defaultSearchPaths),
+      VK_SHADER_STAGE_COMPUTE_BIT);
+  m_adaptivePipeline = m_device.createComputePipeline({}, computePipelineCreateInfo, nullptr);
+  m_device.destroy(computePipelineCreateInfo.stage.module);
+  m_debug.setObjectName(m_adaptivePipeline, "AdaptiveSampling");
+}
+
+void HelloVulkan::updateAdaptiveDescriptorSet()
+{
+  vk::DescriptorBufferInfo            pixelInfo{m_adaptivePixels.buffer, 0, VK_WHOLE_SIZE};
+  std::vector<vk::WriteDescriptorSet> writes;
+  writes.emplace_back(
+      m_adaptiveDescSetLayoutBind.makeWrite(m_adaptiveDescSet, 0, &m_adaptiveStats.descriptor));
+  writes.emplace_back(m_adaptiveDescSetLayoutBind.makeWrite(m_adaptiveDescSet, 1, &pixelInfo));
+  m_device.updateDescriptorSets(static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
+}
+
+//--------------------------------------------------------------------------------------------------
+// Reading the number of pixels left by a previous frame of the same accumulation
+// - The fence of the current frame was waited by prepareFrame
+//
+bool HelloVulkan::adaptiveConverged()
+{
+  uint32_t curFrame = getCurFrame();
+  if(m_rtPushConstants.frame == 0)
+  {
+    // The slots hold counts of the previous accumulation
+    std::fill(m_adaptiveReadbackFrame.begin(), m_adaptiveReadbackFrame.end(), -1);
+    m_adaptiveConverged = false;
+    m_adaptiveRemaining = m_size.width * m_size.height;
+    return false;
+  }
+  if(!m_adaptiveConverged && m_adaptiveReadbackFrame[curFrame] >= 0)
+  {
+    m_adaptiveRemaining = m_adaptiveReadbackMapped[curFrame].width;
+    m_adaptiveConverged = m_adaptiveRemaining == 0;
+  }
+  return m_adaptiveConverged;
+}
+
+//--------------------------------------------------------------------------------------------------
+// Filling the pixel list with the pixels above the threshold, and sending their number to the
+// read back slot of the frame
+//
+void HelloVulkan::cmdBuildPixelList(const vk::CommandBuffer& cmdBuf)
+{
+  using vkAF = vk::AccessFlagBits;
+  using vkPS = vk::PipelineStageFlagBits;
+
+  uint32_t curFrame = getCurFrame();
+  m_debug.beginLabel(cmdBuf, "Adaptive pixel list");
+
+  // The previous ray tracing wrote the statistics and read the pixel list
+  vk::MemoryBarrier rtToList{vkAF::eShaderWrite | vkAF::eShaderRead | vkAF::eIndirectCommandRead,
+                             vkAF::eTransferWrite | vkAF::eShaderRead | vkAF::eShaderWrite};
+  cmdBuf.pipelineBarrier(vkPS::eRayTracingShaderKHR | vkPS::eDrawIndirect,
+                         vkPS::eTransfer | vkPS::eComputeShader, {}, rtToList, {}, {});
+
+  PixelListHeader header{0, 1, 1, 0};
+  cmdBuf.updateBuffer<PixelListHeader>(m_adaptivePixels.buffer, 0, header);
+  vk::MemoryBarrier resetToList{vkAF::eTransferWrite, vkAF::eShaderRead | vkAF::eShaderWrite};
+  cmdBuf.pipelineBarrier(vkPS::eTransfer, vkPS::eComputeShader, {}, resetToList, {}, {});
+
+  AdaptivePushConstant pushC{m_adaptiveThreshold, m_adaptiveMinFrames, m_maxFrames,
+                             static_cast<int>(m_size.width), static_cast<int>(m_size.height)};
+  cmdBuf.bindPipeline(vk::PipelineBindPoint::eCompute, m_adaptivePipeline);
+  cmdBuf.bindDescriptorSets(vk::PipelineBindPoint::eCompute, m_adaptivePipelineLayout, 0,
+                            m_adaptiveDescSet, {});
+  cmdBuf.pushConstants<AdaptivePushConstant>(m_adaptivePipelineLayout,
+                                             vk::ShaderStageFlagBits::eCompute, 0, pushC);
+  cmdBuf.dispatch((m_size.width + 15) / 16, (m_size.height + 15) / 16, 1);
+
+  // The list is used by the ray generation shader and as the launch size
+  vk::MemoryBarrier listToRt{vkAF::eShaderWrite, vkAF::eShaderRead | vkAF::eIndirectCommandRead
+                                                     | vkAF::eTransferRead};
+  cmdBuf.pipelineBarrier(vkPS::eComputeShader,
+                         vkPS::eRayTracingShaderKHR | vkPS::eDrawIndirect | vkPS::eTransfer, {},
+                         listToRt, {}, {});
+
+  vk::BufferCopy region{0, curFrame * sizeof(PixelListHeader), sizeof(PixelListHeader)};
+  cmdBuf.copyBuffer(m_adaptivePixels.buffer, m_adaptiveReadback.buffer, region);
+  vk::MemoryBarrier toHost{vkAF::eTransferWrite, vkAF::eHostRead};
+  cmdBuf.pipelineBarrier(vkPS::eTransfer, vkPS::eHost, {}, toHost, {}, {});
+  m_adaptiveReadbackFrame[curFrame] = m_rtPushConstants.frame;
+
+  m_debug.endLabel(cmdBuf);
+}
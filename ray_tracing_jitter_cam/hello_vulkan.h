@@ -155,6 +155,7 @@ public:
   vk::Pipeline                                        m_rtPipeline;
   nvvk::Buffer                                        m_rtSBTBuffer;
   int                                                 m_maxFrames{100};
+  int                                                 m_nbSamples{10};  // NBSAMPLES of raygen
 
   struct RtPushConstant
   {
@@ -163,5 +164,48 @@ public:
     float         lightIntensity;
     int           lightType;
     int           frame{0};
+    int           adaptive{0};  // 0: off, 1: full frame with statistics, 2: pixels of the list
   } m_rtPushConstants;
+
+  // #VK_adaptive
+  void createAdaptiveResources();
+  void createAdaptivePipeline();
+  void updateAdaptiveDescriptorSet();
+  bool adaptiveConverged();
+  void cmdBuildPixelList(const vk::CommandBuffer& cmdBuf);
+
+  // Launch size of traceRaysIndirectKHR, at the start of the pixel list
+  struct PixelListHeader
+  {
+    uint32_t width;
+    uint32_t height;
+    uint32_t depth;
+    uint32_t pad;
+  };
+  struct AdaptivePushConstant
+  {
+    float threshold;  // Relative standard error under which a pixel has converged
+    int   minFrames;  // Frames accumulated in all pixels before the first pixel list
+    int   maxFrames;
+    int   width;
+    int   height;
+  };
+
+  bool                        m_adaptiveSampling{false};
+  float                       m_adaptiveThreshold{0.02f};
+  int                         m_adaptiveMinFrames{4};
+  bool                        m_indirectTraceRays{false};  // rayTracingIndirectTraceRays feature
+  uint32_t                    m_adaptiveRemaining{0};      // Pixels left, read back from the GPU
+  bool                        m_adaptiveConverged{false};
+  nvvk::Texture               m_adaptiveStats;     // Luminance mean, squared mean, frames
+  nvvk::Buffer                m_adaptivePixels;    // PixelListHeader, then the pixels to trace
+  nvvk::Buffer                m_adaptiveReadback;  // One PixelListHeader per frame in flight
+  const PixelListHeader*      m_adaptiveReadbackMapped{nullptr};
+  std::vector<int>            m_adaptiveReadbackFrame;  // Frame of the copy in each slot, or -1
+  nvvk::DescriptorSetBindings m_adaptiveDescSetLayoutBind;
+  vk::DescriptorPool          m_adaptiveDescPool;
+  vk::DescriptorSetLayout     m_adaptiveDescSetLayout;
+  vk::DescriptorSet           m_adaptiveDescSet;
+  vk::PipelineLayout          m_adaptivePipelineLayout;
+  vk::Pipeline                m_adaptivePipeline;
 };